@@ -0,0 +1,21 @@
+/*
+ * AHCI SATA driver.
+ *
+ * Every SATA disk on an AHCI controller becomes a block device named
+ * sda, sdb, ...  A request thread per port issues block requests to
+ * free command slots without waiting for earlier ones to finish; with
+ * native command queuing (NCQ) the disk may have up to 32 of them
+ * outstanding and complete them in any order.
+ */
+
+#ifndef GEEKOS_AHCI_H
+#define GEEKOS_AHCI_H
+
+#ifdef GEEKOS
+
+void Init_AHCI(void);
+void Dump_AHCI_Stats(void);
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_AHCI_H */
@@ -53,6 +53,14 @@ static __inline__ int Atomic_Decrement(int *value) {
     return old_value - 1;     /* Return new value */
 }
 
+/**
+ * Atomically add delta (which may be negative) to an integer and
+ * return the NEW value.
+ */
+static __inline__ int Atomic_Add(int *value, int delta) {
+    return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+}
+
 /**
  * Atomically read a value with acquire semantics.
  * Ensures subsequent reads see values at least as recent as this load.
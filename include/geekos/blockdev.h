@@ -48,22 +48,75 @@ struct Block_Request;
 DEFINE_LIST(Block_Request_List, Block_Request);
 
 /*
- * An I/O request for a block device.
+ * One piece of memory in a scatter-gather transfer: numBlocks blocks
+ * at buf, taking the next numBlocks blocks on the device.
+ */
+struct Block_Segment {
+    void *buf;
+    int numBlocks;
+};
+
+/* Most segments one request may carry */
+#define BLOCK_MAX_SEGMENTS 16
+
+/*
+ * An I/O request for a block device.  It transfers numBlocks
+ * consecutive blocks, either to or from the single buffer buf or,
+ * if segments is not 0, through the numSegments pieces of memory
+ * there in turn.  Drivers see both through Get_Request_Segment().
  */
 struct Block_Request {
     struct Block_Device *dev;
     enum Request_Type type;
     int blockNum;
+    int numBlocks;
     void *buf;
+    const struct Block_Segment *segments;       /* caller's, not copied */
+    int numSegments;
     volatile enum Request_State state;
     volatile int errorCode;
     struct Condition satisfied;
 
+    /* set by the I/O scheduler */
+    ulong_t submitTime;         /* in ticks */
+    struct Block_Request *mergedNext;   /* merged behind this one */
+    int mergedBlocks;           /* of numBlocks, those merged in */
+
      DEFINE_LINK(Block_Request_List, Block_Request);
 };
 
 IMPLEMENT_LIST(Block_Request_List, Block_Request);
 
+/*
+ * A driver's queue of pending requests, with its own lock and a
+ * condition its request thread sleeps on, so submitting a request
+ * wakes only the driver that serves it.  Devices handled by the same
+ * driver thread share a queue.  The queue's I/O scheduler orders the
+ * requests and merges adjacent ones into transfers of up to
+ * maxBlocks blocks, which a driver may set before registering.  The
+ * block layer also splits larger transfers to that size, so a driver
+ * must take any request of maxBlocks blocks in BLOCK_MAX_SEGMENTS
+ * segments, however the memory is aligned.
+ */
+struct Block_Queue {
+    struct Mutex lock;
+    struct Condition cond;
+    struct Block_Request_List requests;
+    const struct Block_Scheduler *sched;
+    int maxBlocks;
+    int headPos;                /* block after the last one dispatched */
+
+    /* statistics, since the scheduler was chosen */
+    ulong_t dispatched, merged, expired;
+    ulong_t seekBlocks;         /* total distance between dispatches */
+};
+
+#define BLOCK_QUEUE_DEFAULT_MAX_BLOCKS 128
+
+#define BLOCK_QUEUE_INITIALIZER \
+    { MUTEX_INITIALIZER, CONDITION_INITIALIZER, LIST_INITIALIZER, \
+      0, 0, 0, 0, 0, 0, 0 }
+
 struct Block_Device;
 struct Block_Device_Ops;
 
@@ -76,8 +129,7 @@ struct Block_Device {
     int unit;
     bool inUse;
     void *driverData;
-    struct Thread_Queue *waitQueue;
-    struct Block_Request_List *requestQueue;
+    struct Block_Queue *queue;
 
     unsigned int reads, writes; /* statistics */
 
@@ -99,26 +151,74 @@ struct Block_Device_Ops {
  */
 int Register_Block_Device(const char *name, struct Block_Device_Ops *ops,
                           int unit, void *driverData,
-                          struct Thread_Queue *waitQueue,
-                          struct Block_Request_List *requestQueue);
+                          struct Block_Queue *queue);
 int Open_Block_Device(const char *name, struct Block_Device **pDev);
 int Close_Block_Device(struct Block_Device *dev);
 struct Block_Request *Create_Request(struct Block_Device *dev,
                                      enum Request_Type type, int blockNum,
-                                     void *buf);
+                                     int numBlocks, void *buf);
+struct Block_Request *Create_Vector_Request(struct Block_Device *dev,
+                                            enum Request_Type type,
+                                            int blockNum,
+                                            const struct Block_Segment
+                                            *segments, int numSegments);
+void Destroy_Request(struct Block_Request *request);
 void Post_Request_And_Wait(struct Block_Request *request);
-struct Block_Request *Dequeue_Request(struct Block_Request_List
-                                      *requestQueue);
+void Init_Block_Queue(struct Block_Queue *queue);
+struct Block_Request *Dequeue_Request(struct Block_Queue *queue);
+int Dequeue_Requests(struct Block_Queue *queue,
+                     struct Block_Request **batch, int max);
 void Notify_Request_Completion(struct Block_Request *request,
                                enum Request_State state, int errorCode);
+void *Get_Request_Block_Buffer(const struct Block_Request *request,
+                               int block);
+
+/*
+ * Number of memory segments in a request, and the index'th of them.
+ */
+static __inline__ int Get_Num_Request_Segments(const struct Block_Request
+                                               *request) {
+    return request->segments != 0 ? request->numSegments : 1;
+}
+
+static __inline__ struct Block_Segment Get_Request_Segment(const struct
+                                                           Block_Request
+                                                           *request,
+                                                           int index) {
+    struct Block_Segment seg;
+
+    if(request->segments != 0)
+        return request->segments[index];
+    seg.buf = request->buf;
+    seg.numBlocks = request->numBlocks;
+    return seg;
+}
 
 /*
  * High level block device API.
- * For use by filesystem and disk paging code.
+ * For use by filesystem and disk paging code.  Block_Read() and
+ * Block_Write() wait for the transfer, as do the range and vector
+ * forms, which move many consecutive blocks in as few requests as
+ * the driver allows.  Block_Submit() returns at once, so several
+ * requests can be in flight before Wait_For_Request() is called on
+ * each.
  */
 int Block_Read(struct Block_Device *dev, int blockNum, void *buf);
 int Block_Write(struct Block_Device *dev, int blockNum, void *buf);
+int Block_Read_Range(struct Block_Device *dev, int blockNum, int numBlocks,
+                     void *buf);
+int Block_Write_Range(struct Block_Device *dev, int blockNum,
+                      int numBlocks, void *buf);
+int Block_Read_Vector(struct Block_Device *dev, int blockNum,
+                      const struct Block_Segment *segments,
+                      int numSegments);
+int Block_Write_Vector(struct Block_Device *dev, int blockNum,
+                       const struct Block_Segment *segments,
+                       int numSegments);
 int Get_Num_Blocks(struct Block_Device *dev);
+void Block_Submit(struct Block_Request *request);
+void Wait_For_Request(struct Block_Request *request);
+int Set_Block_Scheduler(const char *devName, const char *schedName);
 
 /*
  * Misc. routines
@@ -20,6 +20,7 @@
 #ifdef GEEKOS
 
 void Init_IDE(void);
+void Dump_IDE_Stats(void);
 
 #endif /* GEEKOS */
 
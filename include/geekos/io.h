@@ -25,6 +25,12 @@ uchar_t In_Byte(ushort_t port);
 void Out_Word(ushort_t port, ushort_t value);
 ushort_t In_Word(ushort_t port);
 
+void Out_DWord(ushort_t port, ulong_t value);
+ulong_t In_DWord(ushort_t port);
+
+void Out_Words(ushort_t port, const void *buf, ulong_t count);
+void In_Words(ushort_t port, void *buf, ulong_t count);
+
 void IO_Delay(void);
 
 #endif /* GEEKOS_IO_H */
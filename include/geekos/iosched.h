@@ -0,0 +1,38 @@
+/*
+ * I/O schedulers for block request queues.
+ *
+ * A scheduler decides the order in which the requests on a
+ * Block_Queue reach the driver.  "fifo" keeps arrival order.  "clook"
+ * keeps the queue sorted by block number, merges requests for
+ * adjacent blocks (and adjacent memory) into one transfer, and serves
+ * them in one direction from the last block dispatched, jumping back
+ * to the lowest when it runs out.  "deadline" is clook, except that a
+ * request that has waited too long goes next; reads expire sooner
+ * than writes, since someone is usually waiting for them.
+ *
+ * Requests in a queue at the same time may be reordered against each
+ * other; a caller that needs one done before another waits for it.
+ */
+
+#ifndef GEEKOS_IOSCHED_H
+#define GEEKOS_IOSCHED_H
+
+#ifdef GEEKOS
+
+struct Block_Queue;
+struct Block_Request;
+
+struct Block_Scheduler {
+    const char *name;
+    /* queue a request; called with queue->lock held */
+    void (*Add) (struct Block_Queue * queue, struct Block_Request * request);
+    /* remove and return the request to dispatch next, 0 if none */
+    struct Block_Request *(*Next) (struct Block_Queue * queue);
+};
+
+const struct Block_Scheduler *Find_Block_Scheduler(const char *name);
+const struct Block_Scheduler *Default_Block_Scheduler(void);
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_IOSCHED_H */
@@ -20,6 +20,7 @@
 #include <geekos/int.h>
 
 void Install_IRQ(int irq, Interrupt_Handler handler);
+void Install_Shared_IRQ(int irq, Interrupt_Handler handler);
 ushort_t Get_IRQ_Mask(void);
 void Set_IRQ_Mask(ushort_t mask);
 void Enable_IRQ(int irq);
@@ -157,6 +157,19 @@ void Switch_To_Thread(struct Kernel_Thread *);
 void Wait(struct Thread_Queue *waitQueue);
 void Wake_Up(struct Thread_Queue *waitQueue);
 void Wake_Up_One(struct Thread_Queue *waitQueue);
+void Wait_And_Relock(struct Thread_Queue *waitQueue, Spin_Lock_t * lock);
+
+/*
+ * Sleep on waitQueue until cond holds.  lock, which guards cond, is
+ * held with interrupts disabled; it is dropped while asleep and
+ * cond is tested again under it, so a wakeup from another CPU
+ * between the test and the sleep is not lost.
+ */
+#define Wait_Until(waitQueue, lock, cond)               \
+    do {                                                \
+        while (!(cond))                                 \
+            Wait_And_Relock((waitQueue), (lock));       \
+    } while (0)
 
 /*
  * Pointer to currently executing thread.
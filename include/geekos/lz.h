@@ -0,0 +1,26 @@
+/*
+ * Small LZ77-family compressor (LZF format).
+ *
+ * The output is a sequence of literal runs and back references.
+ * A control byte below 32 introduces a run of (byte + 1) literal
+ * bytes.  Otherwise the top three bits give the match length minus
+ * two (7 meaning a length byte follows), and the low five bits with
+ * the next byte give the distance back minus one, up to 8 KB.
+ *
+ * LZ_Compress needs LZ_WORK_SIZE bytes of scratch memory from its
+ * caller, so it can run on a small kernel stack.
+ */
+
+#ifndef GEEKOS_LZ_H
+#define GEEKOS_LZ_H
+
+#include <geekos/ktypes.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_WORK_SIZE ((1 << LZ_HASH_BITS) * sizeof(ushort_t))
+
+int LZ_Compress(const void *src, int srcLen, void *dst, int dstMax,
+                void *work);
+int LZ_Decompress(const void *src, int srcLen, void *dst, int dstMax);
+
+#endif /* GEEKOS_LZ_H */
@@ -21,6 +21,8 @@
 #include <geekos/ktypes.h>
 
 void Init_Heap(ulong_t start, ulong_t size);
+void Init_Heap_Caches(void);
+void Dump_Heap_Stats(void);
            /*@only@*//*@null@ */
 void *Malloc(ulong_t size);
 void Free( /*@only@ *//*@out@ *//*@null@ */ void *buf);
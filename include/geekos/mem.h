@@ -36,6 +36,12 @@ struct Boot_Info;
 #define PAGE_HEAP      0x0010   /* page is in kernel heap */
 #define PAGE_PAGEABLE  0x0020   /* page can be paged out */
 #define PAGE_LOCKED    0x0040   /* page is taken should not be freed */
+#define PAGE_ZEROED    0x0080   /* free page is known to be all zero */
+#define PAGE_RUN       0x0100   /* page is part of a contiguous run */
+#define PAGE_RUN_START 0x0200   /* page is the first page of a run */
+#define PAGE_SPAN      0x0400   /* page holds small kernel heap objects */
+#define PAGE_READAHEAD 0x0800   /* paged in ahead of a fault, not yet seen used */
+#define PAGE_SHM       0x1000   /* page of a shared memory segment */
 
 /*
  * PC memory map
@@ -68,19 +74,37 @@ DEFINE_LIST(Page_List, Page);
 struct Page {
     unsigned flags;             /* Flags indicating state of page */
      DEFINE_LINK(Page_List, Page);      /* Link fields for Page_List */
-    int clock;
     ulong_t vaddr;              /* User virtual address where page is mapped */
     pte_t *entry;               /* Page table entry referring to the page */
     struct User_Context *context;       /* User context that maps the page */
+    int refCount;               /* Number of user mappings (copy-on-write) */
 };
 
 IMPLEMENT_LIST(Page_List, Page);
 
 void Init_Mem(struct Boot_Info *bootInfo);
 void Init_BSS(void);
+void Init_Page_Caches(void);
+void Dump_Page_Cache_Stats(void);
+bool Zero_Free_Page(void);
+void Age_Pageable_Pages(int count);
+void Init_Pageout_Daemon(void);
 void *Alloc_Page(void);
+void *Alloc_Page_Atomic(void);
+void *Alloc_Contiguous_Pages(int numPages);
+int Free_Contiguous_Pages(void *pageAddr);
 void *Alloc_Pageable_Page(pte_t * entry, ulong_t vaddr);
+void *Alloc_Unmapped_Page(void);
 void Free_Page(void *pageAddr);
+void Lock_Page(struct Page *page);
+void Unlock_Page(struct Page *page);
+bool Share_Page(struct Page *page);
+bool Pin_Page(struct Page *page);
+void Unpin_Page(struct Page *page);
+void Claim_Page(struct Page *page, pte_t * entry, ulong_t vaddr);
+void Adopt_Page(struct Page *page, struct User_Context *context,
+                pte_t * entry, ulong_t vaddr);
+void Drop_Page(void *paddr);
 
 /* debugging support */
 void Print_Struct_Page(const struct Page *p);
@@ -35,6 +35,16 @@ struct User_Context;
 #define PAGE_ALIGNED_ADDR(x)   (((unsigned int) (x)) >> 12)
 #define PAGE_ADDR(x)   (PAGE_ALIGNED_ADDR(x) << 12)
 
+/*
+ * User address spaces occupy the upper half of the linear address
+ * space, below the APIC mappings; user segments start at USER_VM_START.
+ */
+#define USER_VM_START	0x80000000
+#define USER_VM_END	0xf0000000
+
+/* user address above which Mmap() looks for room */
+#define USER_MMAP_START	0x40000000
+
 /*
  * Bits for flags field of pde_t and pte_t.
  */
@@ -94,11 +104,13 @@ typedef struct {
 typedef struct _mappedRegion *mappedRegion_ptr;
 
 typedef struct _mappedRegion {
-    struct File *file;          // the open file that is mapped
-    uint_t startAddr;           // start of mapping
+    struct File *file;          // the open file that is mapped (null: zero filled)
+    uint_t startAddr;           // start of mapping (user address)
     uint_t length;              // length of mapping
     int prot;                   // protection information
     int flags;                  // flags
+    uint_t fileOffset;          // offset in file of startAddr
+    uint_t fileLength;          // bytes read from the file; the rest are zero
     mappedRegion_ptr next;      // pointer to nex mapped region
 } mappedRegion_t;
 
@@ -106,9 +118,16 @@ typedef struct _mappedRegion {
  * Bits used in the kernelInfo field of the PTE's:
  */
 #define KINFO_PAGE_ON_DISK	0x4     /* Page not present; contents in paging file */
+#define KINFO_PAGE_COMPRESSED	0x2     /* Page not present; contents in compressed swap cache */
+#define KINFO_PAGE_COW		0x1     /* Page shared read-only after fork; copy on write */
+
+/* mappedRegion_t flags, besides MAP_SHARED and MAP_PRIVATE */
+#define MAP_SHM			0x100   /* a shared memory segment */
+#define MAP_HEAP		0x200   /* the Sbrk() heap */
 
 void Init_VM(struct Boot_Info *bootInfo);
 void Init_Paging(void);
+void Map_Device_Memory(ulong_t paddr, ulong_t size);
 
 extern void Flush_TLB(void);
 extern void Set_PDBR(const pde_t * pageDir);
@@ -126,12 +145,38 @@ static __inline__ ulong_t Get_Page_Fault_Address(void) {
 }
 
 int Find_Space_On_Paging_File(void);
+int Find_Space_Run_On_Paging_File(int *pCount);
 void Free_Space_On_Paging_File(int pagefileIndex);
 void Write_To_Paging_File(void *paddr, ulong_t vaddr, int pagefileIndex);
 void Read_From_Paging_File(void *paddr, ulong_t vaddr, int pagefileIndex);
-
+int Write_Pages_To_Paging_File(void **paddrs, int count, int pagefileIndex);
+int Read_Pages_From_Paging_File(void **paddrs, int count, int pagefileIndex);
+void Note_Readahead_Outcome(bool used);
+void Dump_Paging_Stats(void);
+pte_t *Find_User_PTE(struct User_Context *context, ulong_t vaddr);
+void Add_Paged_User_Context(struct User_Context *context);
+void Remove_Paged_User_Context(struct User_Context *context);
+void Requeue_Unshared_Page(void *paddr, ulong_t vaddr);
+pte_t *Find_Or_Create_User_PTE(struct User_Context *context, ulong_t vaddr);
+mappedRegion_t *Find_Mapped_Region(struct User_Context *context,
+                                   ulong_t userAddr);
+int Page_In_User_Page(struct User_Context *context, ulong_t vaddr);
+
+int Add_Mapped_Region(struct User_Context *context, struct File *file,
+                      ulong_t startAddr, ulong_t length, int prot,
+                      int flags, ulong_t fileOffset, ulong_t fileLength);
+int Sync_Mapped_Region(struct User_Context *context,
+                       mappedRegion_t * region);
+
+ulong_t Find_Mmap_Space(struct User_Context *context, ulong_t length);
+void Unmap_User_Pages(struct User_Context *context, ulong_t first,
+                      ulong_t end);
+int Mmap_Impl(ulong_t ptr, ulong_t length, int prot, int flags, int fd);
+int Msync_Impl(ulong_t ptr);
+int Munmap_Impl(ulong_t ptr);
 bool Is_Mmaped_Page(struct User_Context *context, ulong_t vaddr);
-void Write_Out_Mmaped_Page(struct User_Context *context, ulong_t vaddr);
+int Write_Out_Mmaped_Page(struct User_Context *context, ulong_t vaddr,
+                          void *paddr);
 
 extern const pde_t *Kernel_Page_Dir(void);
 
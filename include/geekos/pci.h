@@ -0,0 +1,77 @@
+/*
+ * PCI bus enumeration.
+ *
+ * Init_PCI() walks configuration space with configuration mechanism
+ * #1 (ports 0xCF8/0xCFC), starting at bus 0 and following PCI-to-PCI
+ * bridges, and records every function it finds in a fixed table
+ * with its IDs, class, interrupt line and the base and size of each
+ * BAR.  Drivers then look devices up by ID or by class.
+ */
+
+#ifndef GEEKOS_PCI_H
+#define GEEKOS_PCI_H
+
+#include <geekos/ktypes.h>
+
+#define PCI_MAX_DEVICES     64
+#define PCI_NUM_BARS        6
+
+/* Configuration space registers */
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_REVISION        0x08
+#define PCI_PROG_IF         0x09
+#define PCI_SUBCLASS        0x0a
+#define PCI_CLASS           0x0b
+#define PCI_HEADER_TYPE     0x0e
+#define PCI_BAR0            0x10
+#define PCI_SECONDARY_BUS   0x19        /* PCI-to-PCI bridges */
+#define PCI_INTERRUPT_LINE  0x3c
+
+/* Bits of the command register */
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004
+
+/* Classes */
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+#define PCI_SUBCLASS_SATA   0x06
+#define PCI_CLASS_BRIDGE    0x06
+#define PCI_SUBCLASS_PCI_BRIDGE 0x04
+
+#define PCI_NO_IRQ          0xff
+
+struct PCI_Device {
+    uchar_t bus, slot, func;
+    ushort_t vendorId, deviceId;
+    uchar_t classCode, subclass, progIf, revision;
+    uchar_t irq;                /* interrupt line, PCI_NO_IRQ if none */
+    ulong_t bar[PCI_NUM_BARS];  /* base address, type bits stripped */
+    ulong_t barSize[PCI_NUM_BARS];      /* 0 if not implemented */
+    bool barIsIO[PCI_NUM_BARS];
+};
+
+#ifdef GEEKOS
+
+void Init_PCI(void);
+
+ulong_t PCI_Read_Config(const struct PCI_Device *dev, int offset);
+ushort_t PCI_Read_Config_Word(const struct PCI_Device *dev, int offset);
+uchar_t PCI_Read_Config_Byte(const struct PCI_Device *dev, int offset);
+void PCI_Write_Config(const struct PCI_Device *dev, int offset,
+                      ulong_t value);
+
+struct PCI_Device *Find_PCI_Device(ushort_t vendorId, ushort_t deviceId,
+                                   int index);
+struct PCI_Device *Find_PCI_Class(uchar_t classCode, uchar_t subclass,
+                                  int index);
+void PCI_Enable_Device(struct PCI_Device *dev, bool busMaster);
+
+void Dump_PCI_Devices(void);
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_PCI_H */
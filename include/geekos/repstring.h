@@ -0,0 +1,197 @@
+/*
+ * Block memory operations built on the x86 string instructions.
+ *
+ * memcpy(), memmove(), memset() and memcmp() in src/common (kernel
+ * and user libc alike) are thin wrappers around these, and the
+ * tools/strbench host benchmark includes them directly.
+ *
+ * Copies and fills align the destination to 4 bytes with a byte
+ * head, move the bulk with rep movsl/stosl and finish with a byte
+ * tail.  On CPUs with enhanced rep movsb/stosb (CPUID leaf 7, EBX
+ * bit 9) large forward copies and fills use a single rep movsb or
+ * stosb instead, which the microcode does in cache-line chunks.
+ * Short operations move words in a plain loop, since a rep
+ * instruction has a fixed start-up cost.
+ *
+ * The SSE2 path was left out on purpose: the kernel neither sets
+ * CR4.OSFXSR nor saves XMM registers across context switches.
+ *
+ * The direction flag must be clear on entry, as the ABI requires;
+ * backward copies set it and clear it again.
+ */
+
+#ifndef GEEKOS_REPSTRING_H
+#define GEEKOS_REPSTRING_H
+
+#include <stddef.h>
+
+/* below this many bytes, word loops beat the rep start-up cost */
+#define REP_STRING_MIN      128
+
+/* the same for backward copies, where rep movsl is slower */
+#define REP_STRING_DOWN_MIN 1024
+
+/* at and above this many bytes, enhanced rep movsb/stosb is used */
+#define REP_STRING_ERMS_MIN 256
+
+/* a word that may overlay any other type */
+typedef unsigned int __attribute__ ((__may_alias__)) Rep_String_Word;
+
+static __inline__ void Rep_Movsb(void *dst, const void *src, size_t n) {
+    __asm__ __volatile__("rep movsb":"+D"(dst), "+S"(src), "+c"(n)
+                         ::"memory");
+}
+
+static __inline__ void Rep_Movsl(void *dst, const void *src, size_t words) {
+    __asm__ __volatile__("rep movsl":"+D"(dst), "+S"(src), "+c"(words)
+                         ::"memory");
+}
+
+static __inline__ void Rep_Stosb(void *dst, unsigned char c, size_t n) {
+    __asm__ __volatile__("rep stosb":"+D"(dst), "+c"(n):"a"(c):"memory");
+}
+
+static __inline__ void Rep_Stosl(void *dst, unsigned int v, size_t words) {
+    __asm__ __volatile__("rep stosl":"+D"(dst), "+c"(words):"a"(v):"memory");
+}
+
+/* copy downwards; dst and src point at the last unit to move */
+static __inline__ void Rep_Movsb_Down(void *dst, const void *src, size_t n) {
+    __asm__ __volatile__("std\n\trep movsb\n\tcld":"+D"(dst), "+S"(src),
+                         "+c"(n)::"memory");
+}
+
+static __inline__ void Rep_Movsl_Down(void *dst, const void *src,
+                                      size_t words) {
+    __asm__ __volatile__("std\n\trep movsl\n\tcld":"+D"(dst), "+S"(src),
+                         "+c"(words)::"memory");
+}
+
+/*
+ * Does the CPU have enhanced rep movsb/stosb?  Probed once.
+ */
+static __inline__ int Has_Fast_Rep_Movsb(void) {
+    static int fastRepMovsb = -1;
+
+    if(fastRepMovsb < 0) {
+        unsigned int eax, ebx, ecx, edx;
+
+        __asm__ __volatile__("cpuid":"=a"(eax), "=b"(ebx), "=c"(ecx),
+                             "=d"(edx):"a"(0));
+        fastRepMovsb = 0;
+        if(eax >= 7) {
+            __asm__ __volatile__("cpuid":"=a"(eax), "=b"(ebx), "=c"(ecx),
+                                 "=d"(edx):"a"(7), "c"(0));
+            fastRepMovsb = (ebx >> 9) & 1;
+        }
+    }
+    return fastRepMovsb;
+}
+
+static __inline__ void Copy_Forward(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    size_t head = -(unsigned long)d & 3;
+
+    if(n >= REP_STRING_ERMS_MIN && Has_Fast_Rep_Movsb()) {
+        Rep_Movsb(d, s, n);
+        return;
+    }
+    if(head > n)
+        head = n;
+    for(n -= head; head > 0; --head)
+        *d++ = *s++;
+    if(n >= REP_STRING_MIN) {
+        Rep_Movsl(d, s, n / 4);
+    } else {
+        Rep_String_Word *dw = (Rep_String_Word *) d;
+        const Rep_String_Word *sw = (const Rep_String_Word *)s;
+        size_t words;
+
+        for(words = n / 4; words > 0; --words)
+            *dw++ = *sw++;
+    }
+    d += n & ~3;
+    s += n & ~3;
+    for(n &= 3; n > 0; --n)
+        *d++ = *s++;
+}
+
+/* for overlapping buffers with dst above src */
+static __inline__ void Copy_Backward(void *dst, const void *src, size_t n) {
+    unsigned char *d = (unsigned char *)dst + n;
+    const unsigned char *s = (const unsigned char *)src + n;
+    size_t tail = (unsigned long)d & 3;
+
+    /* align the end of the destination, then move words down */
+    if(tail > n)
+        tail = n;
+    for(n -= tail; tail > 0; --tail)
+        *--d = *--s;
+    if(n >= REP_STRING_DOWN_MIN) {
+        Rep_Movsl_Down(d - 4, s - 4, n / 4);
+        d -= n & ~3;
+        s -= n & ~3;
+    } else {
+        Rep_String_Word *dw = (Rep_String_Word *) d;
+        const Rep_String_Word *sw = (const Rep_String_Word *)s;
+        size_t words;
+
+        for(words = n / 4; words > 0; --words)
+            *--dw = *--sw;
+        d = (unsigned char *)dw;
+        s = (const unsigned char *)sw;
+    }
+    for(n &= 3; n > 0; --n)
+        *--d = *--s;
+}
+
+static __inline__ void Fill_Bytes(void *dst, int c, size_t n) {
+    unsigned char *d = dst;
+    unsigned int v = (unsigned char)c;
+    size_t head = -(unsigned long)d & 3;
+
+    if(n >= REP_STRING_ERMS_MIN && Has_Fast_Rep_Movsb()) {
+        Rep_Stosb(d, (unsigned char)c, n);
+        return;
+    }
+    v |= v << 8;
+    v |= v << 16;
+    if(head > n)
+        head = n;
+    for(n -= head; head > 0; --head)
+        *d++ = (unsigned char)c;
+    if(n >= REP_STRING_MIN) {
+        Rep_Stosl(d, v, n / 4);
+    } else {
+        Rep_String_Word *dw = (Rep_String_Word *) d;
+        size_t words;
+
+        for(words = n / 4; words > 0; --words)
+            *dw++ = v;
+    }
+    d += n & ~3;
+    for(n &= 3; n > 0; --n)
+        *d++ = (unsigned char)c;
+}
+
+/*
+ * Compare a word at a time until a difference, then find the byte.
+ * Bytes compare as unsigned char, as the C standard requires.
+ */
+static __inline__ int Compare_Bytes(const void *a, const void *b, size_t n) {
+    const unsigned char *p = a, *q = b;
+
+    while (n >= 4
+           && *(const Rep_String_Word *)p == *(const Rep_String_Word *)q) {
+        p += 4;
+        q += 4;
+        n -= 4;
+    }
+    for(; n > 0; ++p, ++q, --n)
+        if(*p != *q)
+            return *p - *q;
+    return 0;
+}
+
+#endif /* GEEKOS_REPSTRING_H */
@@ -0,0 +1,29 @@
+/*
+ * Named shared memory segments.
+ *
+ * A segment is a set of physical pages with a name.  Attaching it
+ * maps the same pages into the calling process, so processes can
+ * exchange data without copying it through the kernel.  Each
+ * mapping holds a reference on every page of the segment, and the
+ * pages are freed when the segment has been removed and the last
+ * process has detached (or exited).  Mappings survive fork().
+ *
+ * Segments need the paged user memory model (uservm.c); with
+ * segmentation (userseg.c) attaching fails with EUNSUPPORTED.
+ */
+
+#ifndef GEEKOS_SHM_H
+#define GEEKOS_SHM_H
+
+#define SHM_MAX_NAME_LEN 31
+#define SHM_MAX_SIZE     (64 * 1024 * 1024)
+
+#ifdef GEEKOS
+int Sys_Shm_Create(struct Interrupt_State *state);
+int Sys_Shm_Attach(struct Interrupt_State *state);
+int Sys_Shm_Detach(struct Interrupt_State *state);
+int Sys_Shm_Remove(struct Interrupt_State *state);
+void Dump_Shm_Stats(void);
+#endif
+
+#endif /* GEEKOS_SHM_H */
@@ -0,0 +1,69 @@
+/*
+ * Object caches (slab allocator) for fixed-size kernel objects.
+ *
+ * Hot, fixed-size objects (block requests, packets, files, pipes,
+ * alarms) come from a per-type Object_Cache instead of Malloc().
+ * Each cache carves whole pages into equal-sized objects, keeps
+ * partially used and empty slabs on lists protected by a spin lock,
+ * and puts a small per-CPU magazine of free objects in front of
+ * those lists so most allocations and frees take no lock at all.
+ *
+ * Caches are declared statically with OBJECT_CACHE_INITIALIZER and
+ * set themselves up on first use; Alloc_Object() and Free_Object()
+ * may be called with interrupts disabled.
+ *
+ * An optional constructor runs once when an object is first carved
+ * out of a slab.  Objects must be returned to Free_Object() in their
+ * constructed state (e.g. a Condition with no waiters), so the
+ * constructor need not run again on every allocation.
+ */
+
+#ifndef GEEKOS_SLAB_H
+#define GEEKOS_SLAB_H
+
+#include <geekos/ktypes.h>
+#include <geekos/lock.h>
+#include <geekos/list.h>
+
+struct Slab;
+struct Object_Magazine;
+
+DEFINE_LIST(Slab_List, Slab);
+
+typedef void (*Object_Constructor) (void *obj);
+
+struct Object_Cache {
+    const char *name;
+    ulong_t objSize;
+    Object_Constructor ctor;
+
+    Spin_Lock_t lock;           /* protects everything below */
+    bool initialized;
+    ulong_t slotSize;           /* object plus free-list link */
+    int objsPerSlab;
+    struct Slab_List partialSlabs;      /* some objects free */
+    struct Slab_List fullSlabs;         /* no objects free */
+    struct Slab_List emptySlabs;        /* all objects free */
+    int numEmptySlabs;
+    struct Object_Magazine *magazines;  /* one per CPU */
+    int numMagazines;
+    struct Object_Cache *nextCache;     /* all caches, for statistics */
+
+    /* statistics */
+    ulong_t allocs;             /* objects taken from slabs */
+    ulong_t frees;              /* objects returned to slabs */
+    ulong_t slabsCreated;
+    ulong_t slabsDestroyed;
+    int inUse;
+};
+
+#define OBJECT_CACHE_INITIALIZER(name, size, ctor) \
+    { (name), (size), (ctor), SPIN_LOCK_INITIALIZER, false, 0, 0, \
+      LIST_INITIALIZER, LIST_INITIALIZER, LIST_INITIALIZER, 0, \
+      NULL, 0, NULL, 0, 0, 0, 0, 0 }
+
+void *Alloc_Object(struct Object_Cache *cache);
+void Free_Object(struct Object_Cache *cache, void *obj);
+void Dump_Object_Cache_Stats(void);
+
+#endif /* GEEKOS_SLAB_H */
@@ -31,7 +31,7 @@ extern volatile CPU_Info CPUs[];
 
 int Get_CPU_ID(void);
 
-void Map_IO_APIC_IRQ(int irq, void *handler);
+void Map_IO_APIC_IRQ(int irq, void *handler, int level);
 void Init_SMP();
 int Init_Local_APIC(int cpu);
 void Release_SMP();
@@ -13,10 +13,10 @@
  *   - pidLock      - PID allocation
  *   - printLock    - Screen output
  *   - intLock      - Interrupt handling
+ *   - IDE channel  - IDE disk driver, a lock per channel (ide.c)
  *
  * ALIASES (currently use globalLock):
  *   - kernelLock   - Generic kernel-wide locking
- *   - ideLock      - IDE disk driver
  *   - floppyLock   - Floppy disk driver
  *   - dmaLock      - DMA controller
  *   - netLock      - Networking subsystem
@@ -32,9 +32,9 @@
  * TWO LOCKING PATTERNS:
  * ---------------------
  * 1. ACQUIRE pattern (most code): Enter without lock, acquire for critical section
- *      bool iflag = Spin_Lock_Irq_Save(&ideLock);
+ *      bool iflag = Spin_Lock_Irq_Save(&alarmLock);
  *      // ... critical section ...
- *      Spin_Unlock_Irq_Restore(&ideLock, iflag);
+ *      Spin_Unlock_Irq_Restore(&alarmLock, iflag);
  *
  * 2. RELEASE-FOR-BLOCKING pattern (syscalls): Enter with lock, release for blocking
  *      // Entered with lock held, interrupts disabled (from trap handler)
@@ -60,6 +60,7 @@ extern Spin_Lock_t globalLock;
 extern Spin_Lock_t kthreadLock;   /* smp.c - thread/process management */
 extern Spin_Lock_t alarmLock;     /* alarm.c - alarm/timer management */
 extern Spin_Lock_t intLock;       /* int.c - interrupt handling */
+/* the IDE channel locks are private to ide.c */
 /* pidLock is static in kthread.c */
 /* printLock is static in screen.c */
 
@@ -72,9 +73,6 @@ extern Spin_Lock_t intLock;       /* int.c - interrupt handling */
 /* For code that legitimately needs kernel-wide mutual exclusion */
 #define kernelLock   globalLock
 
-/* IDE disk driver - protects IDE controller state and pending operations */
-#define ideLock      globalLock
-
 /* Floppy disk driver - protects floppy controller state */
 #define floppyLock   globalLock
 
@@ -117,12 +117,18 @@ enum {
     SYS_GET_AFFINITY,           /* get scheduler affinity */
     SYS_CLONE,                  /* LWP version of fork */
     SYS_MMAP,                   /* mmap a file into a process address space */
-    SYS_MUNMAP,                 /* unmap a file from a process address space */
+    SYS_MUNMAP,                 /* unmap a whole mapping, given its start; no partial unmaps */
     SYS_ALARM,                  /* set an alarm to happen seconds in the future */
     SYS_RENAME,                 /* Rename a file system call  */
     SYS_LINK,                   /* hard link two files */
     SYS_SYMLINK,                /* Symbolic link two files */
     SYS_SBRK,                   /* sbrk */
+    SYS_MSYNC,                  /* write back a shared file mapping */
+    SYS_SHM_CREATE,             /* create a named shared memory segment */
+    SYS_SHM_ATTACH,             /* map a shared memory segment */
+    SYS_SHM_DETACH,             /* unmap a shared memory segment */
+    SYS_SHM_REMOVE,             /* remove a shared memory segment */
+    SYS_SET_IO_SCHEDULER,       /* choose a block device's I/O scheduler */
 };
 
 /*
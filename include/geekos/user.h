@@ -70,6 +70,9 @@ struct User_Context {
     char *memory;
     ulong_t size;
 
+    /* Sbrk() heap: user addresses, growing from heapStart to heapLimit */
+    ulong_t heapStart, heapBreak, heapLimit;
+
     /* Selector for the LDT's descriptor in the GDT */
     ushort_t ldtSelector;
 
@@ -107,6 +110,9 @@ struct User_Context {
 
 
     mappedRegion_t *mappedRegions;
+
+    /* next in the list of paged address spaces (paging.c) */
+    struct User_Context *nextPaged;
 };
 
 
@@ -132,9 +138,15 @@ void Switch_To_User_Context(struct Kernel_Thread *kthread,
  */
 
 void Destroy_User_Context(struct User_Context *context);
+int Clone_User_Context(struct User_Context *parent,
+                       struct User_Context **pChild);
+int Resize_User_Heap(struct User_Context *context, int increment,
+                     ulong_t * pOldBreak);
 int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
                       struct Exe_Format *exeFormat, const char *command,
                       struct User_Context **pUserContext);
+int Load_User_Program_File(const char *program, const char *command,
+                           struct User_Context **pUserContext);
 bool Copy_From_User(void *destInKernel, ulong_t srcInUser,
                     ulong_t bufSize);
 bool Copy_To_User(ulong_t destInUser, const void *srcInKernel,
@@ -100,6 +100,7 @@ struct File {
     int mode;                   /* Mode (read vs. write). */
     struct Mount_Point *mountPoint;     /* Mounted filesystem file is part of. */
     int refCount;               /* # of kthreads holding this File; managed atomically */
+    struct Mutex posLock;       /* held by Read_At()/Write_At() while they move filePos */
 };
 
 /* Operations that can be performed on a File. */
@@ -110,6 +111,11 @@ struct File_Ops {
     int (*Seek) (struct File * file, ulong_t pos);
     int (*Close) (struct File * file);
     int (*Read_Entry) (struct File * dir, struct VFS_Dir_Entry * entry);        /* Read next directory entry. */
+    /* Read or write at a position, leaving filePos alone; optional */
+    int (*Read_At) (struct File * file, ulong_t pos, void *buf,
+                    ulong_t numBytes);
+    int (*Write_At) (struct File * file, ulong_t pos, void *buf,
+                     ulong_t numBytes);
 };
 
 /*
@@ -146,10 +152,13 @@ int Sync(void);
 struct File *Allocate_File(const struct File_Ops *ops, int filePos,
                            int endPos, void *fsData, int mode,
                            struct Mount_Point *mountPoint);
+void Free_File(struct File *file);
 int FStat(struct File *file, struct VFS_File_Stat *stat);
 int Read(struct File *file, void *buf, ulong_t len);
 int Write(struct File *file, void *buf, ulong_t len);
 int Seek(struct File *file, ulong_t len);
+int Read_At(struct File *file, ulong_t pos, void *buf, ulong_t len);
+int Write_At(struct File *file, ulong_t pos, void *buf, ulong_t len);
 int Read_Fully(const char *path, void **pBuffer, ulong_t * pLen);
 int Delete(const char *path, bool recursive);
 int Rename(const char *oldpath, const char *newpath);
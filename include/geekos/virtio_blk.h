@@ -0,0 +1,21 @@
+/*
+ * Virtio block device driver (legacy virtio-pci interface).
+ *
+ * Each virtio-blk PCI function becomes a block device named vda,
+ * vdb, ...  A request thread per device turns block requests into
+ * descriptor chains on the device's virtqueue without waiting for
+ * earlier ones to finish, so many requests can be in flight; the
+ * interrupt handler completes them as the device returns them.
+ */
+
+#ifndef GEEKOS_VIRTIO_BLK_H
+#define GEEKOS_VIRTIO_BLK_H
+
+#ifdef GEEKOS
+
+void Init_Virtio_Blk(void);
+void Dump_Virtio_Blk_Stats(void);
+
+#endif /* GEEKOS */
+
+#endif /* GEEKOS_VIRTIO_BLK_H */
@@ -0,0 +1,31 @@
+/*
+ * Compressed in-memory swap cache.
+ *
+ * Pages chosen for eviction are first compressed into a pool of
+ * kernel heap memory capped at zswapPercent of physical memory.
+ * Their page table entries are marked KINFO_PAGE_COMPRESSED and hold
+ * a handle for the compressed copy instead of a paging file slot.
+ * A fault on such a page decompresses it, which is far cheaper than
+ * reading the paging file.  When the pool is full the least recently
+ * stored copies are written to the paging file to make room, and
+ * their entries changed to KINFO_PAGE_ON_DISK.
+ */
+
+#ifndef GEEKOS_ZSWAP_H
+#define GEEKOS_ZSWAP_H
+
+#include <geekos/ktypes.h>
+#include <geekos/paging.h>
+
+/* pool size as a percentage of physical memory; 0 disables the pool */
+extern int zswapPercent;
+
+void Init_Zswap(void);
+int Zswap_Store(void *paddr, pte_t * entry);
+int Zswap_Load(pte_t * entry, int handle, void *paddr);
+void Zswap_Free(int handle);
+void Zswap_Free_PTE(pte_t * entry);
+void Zswap_Note_Disk_Fault(void);
+void Dump_Zswap_Stats(void);
+
+#endif /* GEEKOS_ZSWAP_H */
@@ -50,6 +50,7 @@ int Pipe(int *read_fd, int *write_fd);
 int Diagnostic(void);
 int Disk_Properties(const char *path, unsigned int *block_size,
                     unsigned int *blocks_on_disk);
+int Set_IO_Scheduler(const char *devname, const char *scheduler);
 
 int SetSetUid(const char *path, int setUid);
 int SetAcl(const char *path, int user, int permissions);
@@ -1,2 +1,5 @@
 void *Malloc(unsigned long size);
 void Free(void *);
+
+/* Move the heap break; returns the old break, or an error code (< 0) */
+void *Sbrk(int increment);
@@ -11,4 +11,6 @@
 
 extern void *Mmap(void *addr, unsigned int length, int prot, int flags,
                   int fd);
+/* addr must be the start of a mapping, which is removed whole */
 extern int Munmap(void *addr);
+extern int Msync(void *addr);
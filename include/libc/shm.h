@@ -0,0 +1,13 @@
+/*
+ * Named shared memory segments.
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+int Shm_Create(const char *name, unsigned int size);
+void *Shm_Attach(const char *name);
+int Shm_Detach(void *addr);
+int Shm_Remove(const char *name);
+
+#endif /* SHM_H */
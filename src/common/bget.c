@@ -452,6 +452,9 @@
 
 #if defined (GEEKOS)
 
+/* The kernel heap grows from, and returns blocks to, the page allocator. */
+#define BECtl       1
+
 #include <geekos/string.h>      // for memset()
 
 // Provide an assert() macro
@@ -728,7 +731,7 @@ bufsize requested_size;
     /* Don't give up yet -- look in the reserve supply. */
 
     if(acqfcn != NULL) {
-        if(size > exp_incr - sizeof(struct bhead)) {
+        if(size > exp_incr - (bufsize) sizeof(struct bhead)) {
 
             /* Request  is  too  large  to  fit in a single expansion
                block.  Try to satisy it by a direct buffer acquisition. */
@@ -741,7 +744,7 @@ bufsize requested_size;
                 /*  Mark the buffer special by setting the size field
                    of its header to zero.  */
 
-                ba->bh.sentinel = SENTINEL;
+                bdh->bh.sentinel = SENTINEL;
                 bdh->bh.bsize = 0;
                 bdh->bh.prevfree = 0;
                 bdh->tsize = size;
@@ -975,7 +978,7 @@ void *buf;
        pool blocks are the same size.   */
 
     if(relfcn != NULL &&
-       ((bufsize) b->bh.bsize) == (pool_len - sizeof(struct bhead))) {
+       ((bufsize) b->bh.bsize) == (pool_len - (bufsize) sizeof(struct bhead))) {
 
         assert(b->bh.prevfree == 0);
         assert(BH((char *)b + b->bh.bsize)->bsize == ESent);
@@ -1,24 +1,21 @@
 /*
- * Memmove implementation, taken from the web (had no license)
+ * Memmove implementation, using the x86 string instructions
+ * (see <geekos/repstring.h>).
  * 
  * This is free software.  You are permitted to use,
  * redistribute, and modify it as specified in the file "COPYING".
  */
 
 #include <string.h>
+#include <geekos/repstring.h>
 
-void *memmove(void *dest1, const void *source1, size_t length) {
-    char *dest = dest1;
-    const char *source = source1;
-    char *d0 = dest;
-    if(source < dest)
-        /* Moving from low mem to hi mem; start at end.  */
-        for(source += length, dest += length; length; --length)
-            *--dest = *--source;
-    else if(source != dest) {
-        /* Moving from hi mem to low mem; start at beginning.  */
-        for(; length; --length)
-            *dest++ = *source++;
-    }
-    return (void *)d0;
+void *memmove(void *dest, const void *source, size_t length) {
+    if((const char *)source < (char *)dest
+       && (char *)dest < (const char *)source + length)
+        /* Overlapping, moving from low mem to hi mem; start at end.  */
+        Copy_Backward(dest, source, length);
+    else if(source != dest)
+        /* Moving from hi mem to low mem, or not overlapping.  */
+        Copy_Forward(dest, source, length);
+    return dest;
 }
@@ -10,76 +10,30 @@
 /*
  * NOTE:
  * These are slow and simple implementations of a subset of
- * the standard C library string functions.
+ * the standard C library string functions, except for the block
+ * memory operations, which use the x86 string instructions
+ * (see <geekos/repstring.h>).
  * We also have an implementation of snprintf().
  */
 
 #include <fmtout.h>
 #include <string.h>
+#include <geekos/repstring.h>
 
 extern void *Malloc(size_t size);
 
 void *memset(void *s, int c, size_t n) {
-    if((((unsigned long)s) & 0x3) == 0 && ((unsigned long)n & 0x3) == 0) {
-        /* marginally optimized common case version -ns */
-        /* memset was implicated by poor man's profiling as being the top single function */
-        /* consult, e.g., https://github.com/ryanmcgrath/svgalib-1/blob/master/demos/memset.c */
-        /* for an assembly variant that uses i386 instructions if more performance is needed. */
-        unsigned int *pi = s;
-        n /= 4;
-        c |= c << 8;
-        c |= c << 16;
-        for(pi = s; n > 0; n--, pi++) {
-            *pi = c;
-        }
-        return s;
-    } else {
-        unsigned char *p = (unsigned char *)s;
-
-        while (n > 0) {
-            *p++ = (unsigned char)c;
-            --n;
-        }
-
-        return s;
-    }
+    Fill_Bytes(s, c, n);
+    return s;
 }
 
 void *memcpy(void *dst, const void *src, size_t n) {
-    unsigned char *d = (unsigned char *)dst;
-    const unsigned char *s = (const unsigned char *)src;
-
-    if((((unsigned long)d | (unsigned long)s | n) & 0x3) == 0) {
-        unsigned int *di = (unsigned int *)dst;
-        const unsigned int *si = (const unsigned int *)src;
-        n /= 4;
-        while (n > 0) {
-            *di++ = *si++;
-            --n;
-        }
-    } else {
-        while (n > 0) {
-            *d++ = *s++;
-            --n;
-        }
-    }
-
+    Copy_Forward(dst, src, n);
     return dst;
 }
 
-int memcmp(const void *s1_, const void *s2_, size_t n) {
-    const signed char *s1 = s1_, *s2 = s2_;
-
-    while (n > 0) {
-        int cmp = *s1 - *s2;
-        if(cmp != 0)
-            return cmp;
-        ++s1;
-        ++s2;
-        --n;
-    }
-
-    return 0;
+int memcmp(const void *s1, const void *s2, size_t n) {
+    return Compare_Bytes(s1, s2, n);
 }
 
 size_t strlen(const char *s) {
@@ -0,0 +1,767 @@
+/*
+ * AHCI SATA driver.
+ *
+ * An AHCI controller (HBA) is found by PCI class and programmed
+ * through the memory-mapped registers at BAR 5.  Each port has a
+ * command list of up to 32 command headers and a received-FIS area;
+ * each command header points to a command table holding the
+ * register FIS to send and a PRD table describing the data buffer,
+ * one entry per page.  A command is started by setting its slot's
+ * bit in PxCI (and, when queued, first in PxSACT).
+ *
+ * Disks that support native command queuing get READ/WRITE FPDMA
+ * QUEUED with the slot as the tag, so up to the disk's queue depth
+ * may be outstanding; other disks get READ/WRITE DMA EXT one at a
+ * time.  The interrupt handler completes every slot whose PxSACT and
+ * PxCI bits the HBA has cleared.
+ *
+ * Command lists, tables and buffers are kernel memory, which is
+ * identity mapped, so their addresses are also the physical
+ * addresses the HBA uses.  Completion uses the legacy (INTx)
+ * interrupt line.
+ */
+
+#include <geekos/ktypes.h>
+#include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/malloc.h>
+#include <geekos/mem.h>
+#include <geekos/string.h>
+#include <geekos/int.h>
+#include <geekos/irq.h>
+#include <geekos/idt.h>
+#include <geekos/lock.h>
+#include <geekos/screen.h>
+#include <geekos/kthread.h>
+#include <geekos/paging.h>
+#include <geekos/blockdev.h>
+#include <geekos/pci.h>
+#include <geekos/ahci.h>
+
+#define AHCI_PROG_IF            0x01
+#define AHCI_ABAR               5
+
+#define AHCI_MAX_CONTROLLERS    2
+#define AHCI_MAX_DISKS          8
+#define AHCI_MAX_PORTS          32
+#define AHCI_MAX_SLOTS          32
+#define AHCI_MAX_PRDS           56      /* command table fills 1 KB */
+#define AHCI_BATCH              AHCI_MAX_SLOTS  /* requests taken at a time */
+
+/* Iterations to wait for the HBA or disk in polled operations */
+#define AHCI_SPIN_LIMIT         1000000
+
+/* HBA registers, offsets from the ABAR */
+#define AHCI_CAP                0x00
+#define AHCI_GHC                0x04
+#define AHCI_IS                 0x08
+#define AHCI_PI                 0x0c
+#define AHCI_VS                 0x10
+
+#define AHCI_CAP_NCS(cap)       ((((cap) >> 8) & 0x1f) + 1)
+#define AHCI_CAP_SNCQ           0x40000000
+#define AHCI_GHC_IE             0x00000002
+#define AHCI_GHC_AE             0x80000000
+
+/* Port registers, offsets from the port's base */
+#define AHCI_PORT_BASE(n)       (0x100 + (n) * 0x80)
+#define AHCI_PX_CLB             0x00
+#define AHCI_PX_CLBU            0x04
+#define AHCI_PX_FB              0x08
+#define AHCI_PX_FBU             0x0c
+#define AHCI_PX_IS              0x10
+#define AHCI_PX_IE              0x14
+#define AHCI_PX_CMD             0x18
+#define AHCI_PX_TFD             0x20
+#define AHCI_PX_SIG             0x24
+#define AHCI_PX_SSTS            0x28
+#define AHCI_PX_SERR            0x30
+#define AHCI_PX_SACT            0x34
+#define AHCI_PX_CI              0x38
+
+#define AHCI_PX_CMD_ST          0x00000001
+#define AHCI_PX_CMD_FRE         0x00000010
+#define AHCI_PX_CMD_FR          0x00004000
+#define AHCI_PX_CMD_CR          0x00008000
+
+#define AHCI_PX_SSTS_DET_MASK   0x0f
+#define AHCI_PX_SSTS_DET_PRESENT 0x03   /* device present, link up */
+#define AHCI_SIG_ATA            0x00000101
+
+/* Port interrupt status/enable bits */
+#define AHCI_PX_IS_DHRS         0x00000001      /* D2H register FIS */
+#define AHCI_PX_IS_SDBS         0x00000008      /* set device bits FIS */
+#define AHCI_PX_IS_IFS          0x08000000      /* interface fatal */
+#define AHCI_PX_IS_HBDS         0x10000000      /* host bus data error */
+#define AHCI_PX_IS_HBFS         0x20000000      /* host bus fatal */
+#define AHCI_PX_IS_TFES         0x40000000      /* task file error */
+#define AHCI_PX_IS_ERRORS \
+    (AHCI_PX_IS_IFS | AHCI_PX_IS_HBDS | AHCI_PX_IS_HBFS | AHCI_PX_IS_TFES)
+
+/* Task file status (low byte of PxTFD) */
+#define ATA_STATUS_ERR          0x01
+#define ATA_STATUS_DRQ          0x08
+#define ATA_STATUS_BSY          0x80
+
+/* Command header flags */
+#define AHCI_CMD_FIS_DWORDS     5       /* register H2D FIS length */
+#define AHCI_CMD_WRITE          0x0040
+
+/* Register host-to-device FIS */
+#define FIS_TYPE_REG_H2D        0x27
+#define FIS_H2D_COMMAND         0x80    /* the FIS carries a command */
+#define ATA_DEVICE_LBA          0x40
+
+/* ATA commands */
+#define ATA_IDENTIFY            0xec
+#define ATA_READ_DMA_EXT        0x25
+#define ATA_WRITE_DMA_EXT       0x35
+#define ATA_READ_FPDMA_QUEUED   0x60
+#define ATA_WRITE_FPDMA_QUEUED  0x61
+
+/* IDENTIFY DEVICE words */
+#define ATA_ID_QUEUE_DEPTH      75
+#define ATA_ID_SATA_CAPS        76
+#define ATA_ID_COMMAND_SETS     83
+#define ATA_ID_LBA48_SECTORS    100
+
+#define ATA_ID_QUEUE_DEPTH_MASK 0x1f
+#define ATA_ID_SATA_NCQ         0x0100
+#define ATA_ID_LBA48            0x0400
+
+struct AHCI_Command_Header {
+    ushort_t flags;             /* FIS length, direction */
+    ushort_t prdtLength;
+    volatile ulong_t prdByteCount;
+    ulong_t tableAddr, tableAddrHigh;
+    ulong_t reserved[4];
+};
+
+struct AHCI_PRD {
+    ulong_t addr, addrHigh;
+    ulong_t reserved;
+    ulong_t count;              /* byte count - 1 */
+};
+
+struct AHCI_Command_Table {
+    uchar_t fis[64];
+    uchar_t atapiCommand[16];
+    uchar_t reserved[48];
+    struct AHCI_PRD prdt[AHCI_MAX_PRDS];
+};
+
+struct AHCI_Controller;
+
+struct AHCI_Port {
+    struct AHCI_Controller *hba;
+    int num;
+    volatile uchar_t *regs;
+    int capacity;               /* in sectors */
+    int depth;                  /* slots used: 1 without NCQ */
+    bool ncq;
+
+    Spin_Lock_t lock;           /* protects active, unissued and slots */
+    struct AHCI_Command_Header *cmdList;
+    struct AHCI_Command_Table *tables;
+    ulong_t active;             /* slots in use */
+    struct Block_Request *slots[AHCI_MAX_SLOTS];
+    struct Thread_Queue slotWaitQueue;  /* submit waits for a free slot */
+    ulong_t unissued;           /* built, not yet issued; 0 when unlocked */
+
+    struct Block_Queue queue;
+
+    /* statistics */
+    ulong_t submitted, completed, errors;
+    ulong_t inFlight, maxInFlight;
+};
+
+struct AHCI_Controller {
+    struct PCI_Device *pci;
+    volatile uchar_t *abar;
+    ulong_t cap;
+    struct AHCI_Port *ports[AHCI_MAX_PORTS];    /* 0: not ours */
+};
+
+static struct AHCI_Controller s_ahciControllers[AHCI_MAX_CONTROLLERS];
+static int s_numAhciControllers;
+static struct AHCI_Port s_ahciPorts[AHCI_MAX_DISKS];
+static int s_numAhciPorts;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static __inline__ ulong_t HBA_Read(struct AHCI_Controller *hba, int reg) {
+    return *(volatile ulong_t *)(hba->abar + reg);
+}
+
+static __inline__ void HBA_Write(struct AHCI_Controller *hba, int reg,
+                                 ulong_t value) {
+    *(volatile ulong_t *)(hba->abar + reg) = value;
+}
+
+static __inline__ ulong_t Port_Read(struct AHCI_Port *port, int reg) {
+    return *(volatile ulong_t *)(port->regs + reg);
+}
+
+static __inline__ void Port_Write(struct AHCI_Port *port, int reg,
+                                  ulong_t value) {
+    *(volatile ulong_t *)(port->regs + reg) = value;
+}
+
+/*
+ * Wait for bits of a port register to clear; false on timeout.
+ */
+static bool Wait_Port_Clear(struct AHCI_Port *port, int reg, ulong_t bits) {
+    int i;
+
+    for(i = 0; i < AHCI_SPIN_LIMIT; i++)
+        if(!(Port_Read(port, reg) & bits))
+            return true;
+    return false;
+}
+
+/*
+ * Stop command processing, and FIS reception too if fis is set.
+ * Clearing ST also clears PxCI and PxSACT.
+ */
+static void Stop_Port(struct AHCI_Port *port, bool fis) {
+    Port_Write(port, AHCI_PX_CMD,
+               Port_Read(port, AHCI_PX_CMD) & ~AHCI_PX_CMD_ST);
+    Wait_Port_Clear(port, AHCI_PX_CMD, AHCI_PX_CMD_CR);
+    if(fis) {
+        Port_Write(port, AHCI_PX_CMD,
+                   Port_Read(port, AHCI_PX_CMD) & ~AHCI_PX_CMD_FRE);
+        Wait_Port_Clear(port, AHCI_PX_CMD, AHCI_PX_CMD_FR);
+    }
+}
+
+/*
+ * Start command processing once the disk is no longer busy.
+ */
+static void Start_Port(struct AHCI_Port *port) {
+    Wait_Port_Clear(port, AHCI_PX_TFD, ATA_STATUS_BSY | ATA_STATUS_DRQ);
+    Port_Write(port, AHCI_PX_CMD,
+               Port_Read(port, AHCI_PX_CMD) | AHCI_PX_CMD_ST);
+}
+
+/*
+ * Number of PRD entries needed: one per page each memory segment of
+ * the request touches.
+ */
+static int Count_Data_Segments(const struct Block_Request *request) {
+    int i, n = 0;
+
+    for(i = 0; i < Get_Num_Request_Segments(request); i++) {
+        struct Block_Segment seg = Get_Request_Segment(request, i);
+        ulong_t addr = (ulong_t) seg.buf;
+
+        n += (Round_Up_To_Page(addr + seg.numBlocks * SECTOR_SIZE) -
+              (addr & ~(ulong_t) PAGE_MASK)) / PAGE_SIZE;
+    }
+    return n;
+}
+
+/*
+ * Fill in the command header and table of slot for an ATA command,
+ * with no data yet.  Queued commands carry the sector count in the
+ * features register and the tag in the count register.
+ */
+static void Build_Command(struct AHCI_Port *port, int slot, int command,
+                          int lba, int count, bool write) {
+    struct AHCI_Command_Header *header = &port->cmdList[slot];
+    struct AHCI_Command_Table *table = &port->tables[slot];
+    uchar_t *fis = table->fis;
+
+    memset(fis, '\0', AHCI_CMD_FIS_DWORDS * 4);
+    fis[0] = FIS_TYPE_REG_H2D;
+    fis[1] = FIS_H2D_COMMAND;
+    fis[2] = command;
+    if(command != ATA_IDENTIFY) {
+        fis[4] = lba & 0xff;
+        fis[5] = (lba >> 8) & 0xff;
+        fis[6] = (lba >> 16) & 0xff;
+        fis[7] = ATA_DEVICE_LBA;
+        fis[8] = (lba >> 24) & 0xff;
+    }
+    if(command == ATA_READ_FPDMA_QUEUED || command == ATA_WRITE_FPDMA_QUEUED) {
+        fis[3] = count & 0xff;
+        fis[11] = (count >> 8) & 0xff;
+        fis[12] = slot << 3;
+    } else {
+        fis[12] = count & 0xff;
+        fis[13] = (count >> 8) & 0xff;
+    }
+
+    header->flags = AHCI_CMD_FIS_DWORDS | (write ? AHCI_CMD_WRITE : 0);
+    header->prdtLength = 0;
+    header->prdByteCount = 0;
+    header->tableAddr = (ulong_t) table;
+    header->tableAddrHigh = 0;
+}
+
+/*
+ * Add bytes bytes at buf to the data of the command in slot, one PRD
+ * entry per page.
+ */
+static void Add_Command_Data(struct AHCI_Port *port, int slot, void *buf,
+                             ulong_t bytes) {
+    struct AHCI_Command_Header *header = &port->cmdList[slot];
+    struct AHCI_Command_Table *table = &port->tables[slot];
+    ulong_t addr = (ulong_t) buf;
+    int n = header->prdtLength;
+
+    while (bytes > 0) {
+        ulong_t chunk = PAGE_SIZE - (addr & PAGE_MASK);
+
+        if(chunk > bytes)
+            chunk = bytes;
+        KASSERT(n < AHCI_MAX_PRDS);
+        table->prdt[n].addr = addr;
+        table->prdt[n].addrHigh = 0;
+        table->prdt[n].reserved = 0;
+        table->prdt[n].count = chunk - 1;
+        ++n;
+        addr += chunk;
+        bytes -= chunk;
+    }
+    header->prdtLength = n;
+}
+
+/*
+ * Hand the slots in mask to the HBA with one write of each register.
+ * The tables and headers must be in memory before the HBA sees the
+ * slots' bits.
+ */
+static void Issue_Commands(struct AHCI_Port *port, ulong_t mask) {
+    __asm__ __volatile__("":::"memory");
+    if(port->ncq)
+        Port_Write(port, AHCI_PX_SACT, mask);
+    Port_Write(port, AHCI_PX_CI, mask);
+}
+
+/*
+ * Run a command in slot 0 and poll for it to finish; only used
+ * before the port's interrupts are enabled.
+ */
+static int Polled_Command(struct AHCI_Port *port, int command, void *buf,
+                          ulong_t bytes) {
+    int i;
+
+    Build_Command(port, 0, command, 0, 0, false);
+    Add_Command_Data(port, 0, buf, bytes);
+    Issue_Commands(port, 1);
+    for(i = 0; i < AHCI_SPIN_LIMIT; i++) {
+        if(Port_Read(port, AHCI_PX_IS) & AHCI_PX_IS_ERRORS)
+            break;
+        if(!(Port_Read(port, AHCI_PX_CI) & 1))
+            return (Port_Read(port, AHCI_PX_TFD) & ATA_STATUS_ERR) ? EIO : 0;
+    }
+    return EIO;
+}
+
+/*
+ * Complete the requests in the slots of mask.
+ * Called with port->lock held.
+ */
+static void Complete_Slots(struct AHCI_Port *port, ulong_t mask,
+                           enum Request_State state, int errorCode) {
+    int slot;
+
+    for(slot = 0; slot < port->depth; slot++) {
+        struct Block_Request *request = port->slots[slot];
+
+        if(!(mask & (1UL << slot)) || request == 0)
+            continue;
+        port->slots[slot] = 0;
+        port->active &= ~(1UL << slot);
+        ++port->completed;
+        --port->inFlight;
+        if(state == ERROR)
+            ++port->errors;
+        Notify_Request_Completion(request, state, errorCode);
+    }
+}
+
+/*
+ * Complete the slots the HBA has finished.  After an error the HBA
+ * stops processing the list; the commands still outstanding are
+ * failed and the port restarted.
+ */
+static void Handle_Port_Interrupt(struct AHCI_Port *port) {
+    ulong_t status = Port_Read(port, AHCI_PX_IS), done;
+
+    Port_Write(port, AHCI_PX_IS, status);
+    Spin_Lock(&port->lock);
+    done = port->active & ~(Port_Read(port, AHCI_PX_SACT) |
+                            Port_Read(port, AHCI_PX_CI));
+    Complete_Slots(port, done, COMPLETED, 0);
+    if(status & AHCI_PX_IS_ERRORS) {
+        Print("ahci: port %d error, status %lx, task file %lx\n",
+              port->num, status, Port_Read(port, AHCI_PX_TFD));
+        Complete_Slots(port, port->active, ERROR, EIO);
+        Stop_Port(port, false);
+        Port_Write(port, AHCI_PX_SERR, 0xffffffff);
+        Port_Write(port, AHCI_PX_IS, 0xffffffff);
+        Start_Port(port);
+    }
+    if(done != 0 || (status & AHCI_PX_IS_ERRORS))
+        Wake_Up(&port->slotWaitQueue);
+    Spin_Unlock(&port->lock);
+}
+
+/*
+ * The line is edge triggered, so keep going until the HBA has no
+ * interrupt pending; otherwise an event arriving while the handler
+ * runs would leave the line asserted with no new edge.  PCI lines
+ * are shared, so an HBA with nothing pending is left alone.
+ */
+static void AHCI_Interrupt_Handler(struct Interrupt_State *state) {
+    int c, p;
+
+    for(c = 0; c < s_numAhciControllers; c++) {
+        struct AHCI_Controller *hba = &s_ahciControllers[c];
+        ulong_t pending;
+
+        if(hba->pci->irq != state->intNum - FIRST_EXTERNAL_INT)
+            continue;
+        while ((pending = HBA_Read(hba, AHCI_IS)) != 0) {
+            for(p = 0; p < AHCI_MAX_PORTS; p++) {
+                volatile ulong_t *portIS;
+
+                if(!(pending & (1UL << p)))
+                    continue;
+                if(hba->ports[p] != 0) {
+                    Handle_Port_Interrupt(hba->ports[p]);
+                    continue;
+                }
+                portIS = (volatile ulong_t *)(hba->abar + AHCI_PORT_BASE(p) +
+                                              AHCI_PX_IS);
+                *portIS = *portIS;
+            }
+            HBA_Write(hba, AHCI_IS, pending);
+        }
+    }
+}
+
+static int Find_Free_Slot(struct AHCI_Port *port) {
+    int slot;
+
+    for(slot = 0; slot < port->depth; slot++)
+        if(!(port->active & (1UL << slot)))
+            return slot;
+    return -1;
+}
+
+/*
+ * Issue the commands built since the last call.
+ * Called with port->lock held.
+ */
+static void Issue_Pending(struct AHCI_Port *port) {
+    if(port->unissued == 0)
+        return;
+    Issue_Commands(port, port->unissued);
+    port->unissued = 0;
+}
+
+/*
+ * Build the command for request in slot; it is issued later by
+ * Issue_Pending().  Called with port->lock held.
+ */
+static void Submit_Request(struct AHCI_Port *port, int slot,
+                           struct Block_Request *request) {
+    bool write = request->type == BLOCK_WRITE;
+    int command, i;
+
+    if(port->ncq)
+        command = write ? ATA_WRITE_FPDMA_QUEUED : ATA_READ_FPDMA_QUEUED;
+    else
+        command = write ? ATA_WRITE_DMA_EXT : ATA_READ_DMA_EXT;
+
+    port->slots[slot] = request;
+    port->active |= 1UL << slot;
+    Build_Command(port, slot, command, request->blockNum,
+                  request->numBlocks, write);
+    for(i = 0; i < Get_Num_Request_Segments(request); i++) {
+        struct Block_Segment seg = Get_Request_Segment(request, i);
+
+        Add_Command_Data(port, slot, seg.buf, seg.numBlocks * SECTOR_SIZE);
+    }
+    port->unissued |= 1UL << slot;
+
+    ++port->submitted;
+    if(++port->inFlight > port->maxInFlight)
+        port->maxInFlight = port->inFlight;
+}
+
+/*
+ * Check a request against the disk; false if it cannot be done.
+ */
+static bool Valid_Request(struct AHCI_Port *port,
+                          struct Block_Request *request) {
+    int numData = Count_Data_Segments(request);
+
+    return request->blockNum >= 0 && request->numBlocks > 0
+        && request->numBlocks <= 0xffff
+        && request->numBlocks <= port->capacity - request->blockNum
+        && numData <= AHCI_MAX_PRDS;
+}
+
+/*
+ * Take the queued requests in batches, build a command for each in
+ * a free slot, and issue the batch at once.
+ */
+static void AHCI_Request_Thread(ulong_t arg) {
+    struct AHCI_Port *port = (struct AHCI_Port *)arg;
+    struct Block_Request *batch[AHCI_BATCH];
+
+    for(;;) {
+        int n = Dequeue_Requests(&port->queue, batch, AHCI_BATCH), i;
+        bool iflag = Spin_Lock_Irq_Save(&port->lock);
+
+        for(i = 0; i < n; i++) {
+            int slot;
+
+            if(!Valid_Request(port, batch[i])) {
+                Notify_Request_Completion(batch[i], ERROR, EINVALID);
+                continue;
+            }
+            if(Find_Free_Slot(port) < 0) {
+                /* all slots busy: wait for the interrupt handler */
+                Issue_Pending(port);
+                Wait_Until(&port->slotWaitQueue, &port->lock,
+                           Find_Free_Slot(port) >= 0);
+            }
+            slot = Find_Free_Slot(port);
+            Submit_Request(port, slot, batch[i]);
+        }
+        Issue_Pending(port);
+        Spin_Unlock_Irq_Restore(&port->lock, iflag);
+    }
+}
+
+static int AHCI_Open(struct Block_Device *dev) {
+    KASSERT(!dev->inUse);
+    return 0;
+}
+
+static int AHCI_Close(struct Block_Device *dev) {
+    KASSERT(dev->inUse);
+    return 0;
+}
+
+static int AHCI_Get_Num_Blocks(struct Block_Device *dev) {
+    return ((struct AHCI_Port *)dev->driverData)->capacity;
+}
+
+static struct Block_Device_Ops s_ahciDeviceOps = {
+    AHCI_Open,
+    AHCI_Close,
+    AHCI_Get_Num_Blocks,
+};
+
+/*
+ * Read the disk's size and queuing support.  Only LBA48 disks are
+ * used, since the DMA commands issued are the 48-bit ones.
+ */
+static int Identify_Disk(struct AHCI_Port *port) {
+    ushort_t *id = Malloc(SECTOR_SIZE);
+    int rc;
+
+    if(id == 0)
+        return ENOMEM;
+    rc = Polled_Command(port, ATA_IDENTIFY, id, SECTOR_SIZE);
+    if(rc == 0 && !(id[ATA_ID_COMMAND_SETS] & ATA_ID_LBA48))
+        rc = EUNSUPPORTED;
+    if(rc == 0) {
+        ulong_t sectors = id[ATA_ID_LBA48_SECTORS] |
+            ((ulong_t) id[ATA_ID_LBA48_SECTORS + 1] << 16);
+        bool huge = id[ATA_ID_LBA48_SECTORS + 2] != 0
+            || id[ATA_ID_LBA48_SECTORS + 3] != 0 || sectors > 0x7fffffff;
+
+        port->capacity = huge ? 0x7fffffff : (int)sectors;
+        port->ncq = (port->hba->cap & AHCI_CAP_SNCQ)
+            && (id[ATA_ID_SATA_CAPS] & ATA_ID_SATA_NCQ);
+        port->depth = 1;
+        if(port->ncq) {
+            port->depth = (id[ATA_ID_QUEUE_DEPTH] &
+                           ATA_ID_QUEUE_DEPTH_MASK) + 1;
+            if(port->depth > (int)AHCI_CAP_NCS(port->hba->cap))
+                port->depth = AHCI_CAP_NCS(port->hba->cap);
+        }
+    }
+    Free(id);
+    return rc;
+}
+
+/*
+ * Give the port its command list, FIS area and command tables, start
+ * it and identify the disk.  The port's interrupts stay off until
+ * the caller enables them.  On failure the port is left stopped and
+ * its memory freed.
+ */
+static int Setup_Port(struct AHCI_Port *port) {
+    int numSlots = AHCI_CAP_NCS(port->hba->cap);
+    ulong_t tableBytes =
+        Round_Up_To_Page(numSlots * sizeof(struct AHCI_Command_Table));
+    char *page;
+    int rc;
+
+    Stop_Port(port, true);
+
+    /* command list (1 KB aligned), then received FISes (256 aligned) */
+    page = Alloc_Page();
+    port->tables = Alloc_Contiguous_Pages(tableBytes / PAGE_SIZE);
+    if(page == 0 || port->tables == 0) {
+        rc = ENOMEM;
+        goto fail;
+    }
+    memset(page, '\0', PAGE_SIZE);
+    memset(port->tables, '\0', tableBytes);
+    port->cmdList = (struct AHCI_Command_Header *)page;
+
+    Port_Write(port, AHCI_PX_CLB, (ulong_t) page);
+    Port_Write(port, AHCI_PX_CLBU, 0);
+    Port_Write(port, AHCI_PX_FB,
+               (ulong_t) page + AHCI_MAX_SLOTS *
+               sizeof(struct AHCI_Command_Header));
+    Port_Write(port, AHCI_PX_FBU, 0);
+    Port_Write(port, AHCI_PX_IE, 0);
+    Port_Write(port, AHCI_PX_CMD,
+               Port_Read(port, AHCI_PX_CMD) | AHCI_PX_CMD_FRE);
+    Port_Write(port, AHCI_PX_SERR, 0xffffffff);
+    Port_Write(port, AHCI_PX_IS, 0xffffffff);
+    Start_Port(port);
+
+    rc = Identify_Disk(port);
+    if(rc == 0)
+        return 0;
+
+    Stop_Port(port, true);
+    Port_Write(port, AHCI_PX_CLB, 0);
+    Port_Write(port, AHCI_PX_FB, 0);
+  fail:
+    if(page != 0)
+        Free_Page(page);
+    if(port->tables != 0)
+        Free_Contiguous_Pages(port->tables);
+    port->cmdList = 0;
+    port->tables = 0;
+    return rc;
+}
+
+/*
+ * Set up every implemented port of hba that has an ATA disk.
+ */
+static void Probe_Ports(struct AHCI_Controller *hba) {
+    ulong_t implemented = HBA_Read(hba, AHCI_PI);
+    int p;
+
+    for(p = 0; p < AHCI_MAX_PORTS && s_numAhciPorts < AHCI_MAX_DISKS; p++) {
+        struct AHCI_Port *port = &s_ahciPorts[s_numAhciPorts];
+        int rc;
+
+        if(!(implemented & (1UL << p)))
+            continue;
+        port->hba = hba;
+        port->num = p;
+        port->regs = hba->abar + AHCI_PORT_BASE(p);
+        Init_Block_Queue(&port->queue);
+        /*
+         * Requests must fit the PRD table, an entry per page touched;
+         * each segment may touch two pages more than its size needs.
+         */
+        port->queue.maxBlocks = (AHCI_MAX_PRDS - 2 * BLOCK_MAX_SEGMENTS) *
+            (PAGE_SIZE / SECTOR_SIZE);
+        if((Port_Read(port, AHCI_PX_SSTS) & AHCI_PX_SSTS_DET_MASK) !=
+           AHCI_PX_SSTS_DET_PRESENT
+           || Port_Read(port, AHCI_PX_SIG) != AHCI_SIG_ATA)
+            continue;
+
+        rc = Setup_Port(port);
+        if(rc != 0) {
+            Print("ahci: port %d setup failed (%d)\n", p, rc);
+            continue;
+        }
+        Port_Write(port, AHCI_PX_IS, 0xffffffff);
+        Port_Write(port, AHCI_PX_IE, AHCI_PX_IS_DHRS | AHCI_PX_IS_SDBS |
+                   AHCI_PX_IS_ERRORS);
+        hba->ports[p] = port;
+        ++s_numAhciPorts;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+void Dump_AHCI_Stats(void) {
+    int i;
+
+    for(i = 0; i < s_numAhciPorts; i++) {
+        struct AHCI_Port *port = &s_ahciPorts[i];
+
+        Print("sd%c: %lu submitted, %lu completed, %lu errors, "
+              "max %lu in flight (depth %d%s)\n", 'a' + i, port->submitted,
+              port->completed, port->errors, port->maxInFlight,
+              port->depth, port->ncq ? ", NCQ" : "");
+    }
+}
+
+void Init_AHCI(void) {
+    struct PCI_Device *pci;
+    int index = 0, first = 0, i;
+
+    while (s_numAhciControllers < AHCI_MAX_CONTROLLERS
+           && (pci = Find_PCI_Class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA,
+                                    index++)) != 0) {
+        struct AHCI_Controller *hba = &s_ahciControllers[s_numAhciControllers];
+
+        if(pci->progIf != AHCI_PROG_IF)
+            continue;
+        if(pci->barSize[AHCI_ABAR] == 0 || pci->barIsIO[AHCI_ABAR]
+           || pci->irq == PCI_NO_IRQ) {
+            Print("ahci: controller without ABAR or irq ignored\n");
+            continue;
+        }
+        hba->pci = pci;
+        hba->abar = (volatile uchar_t *)pci->bar[AHCI_ABAR];
+        Map_Device_Memory(pci->bar[AHCI_ABAR], pci->barSize[AHCI_ABAR]);
+        PCI_Enable_Device(pci, true);
+        ++s_numAhciControllers;
+
+        HBA_Write(hba, AHCI_GHC, HBA_Read(hba, AHCI_GHC) | AHCI_GHC_AE);
+        hba->cap = HBA_Read(hba, AHCI_CAP);
+        Print("ahci: version %lx, %lu slots%s, irq %d\n",
+              HBA_Read(hba, AHCI_VS), AHCI_CAP_NCS(hba->cap),
+              (hba->cap & AHCI_CAP_SNCQ) ? ", NCQ" : "", pci->irq);
+
+        first = s_numAhciPorts;
+        Probe_Ports(hba);
+
+        HBA_Write(hba, AHCI_IS, 0xffffffff);
+        Install_Shared_IRQ(pci->irq, &AHCI_Interrupt_Handler);
+        Enable_IRQ(pci->irq);
+        HBA_Write(hba, AHCI_GHC, HBA_Read(hba, AHCI_GHC) | AHCI_GHC_IE);
+
+        for(i = first; i < s_numAhciPorts; i++) {
+            struct AHCI_Port *port = &s_ahciPorts[i];
+            char devname[BLOCKDEV_MAX_NAME_LEN];
+            int rc;
+
+            snprintf(devname, sizeof(devname), "sd%c", 'a' + i);
+            Print("    %s: port %d, %d sectors, queue depth %d%s\n",
+                  devname, port->num, port->capacity, port->depth,
+                  port->ncq ? " (NCQ)" : "");
+            rc = Register_Block_Device(devname, &s_ahciDeviceOps, 0, port,
+                                       &port->queue);
+            if(rc != 0) {
+                Print("  Error: could not create block device for %s\n",
+                      devname);
+                continue;
+            }
+            Start_Kernel_Thread(AHCI_Request_Thread, (ulong_t) port,
+                                PRIORITY_NORMAL, true, "{AHCI}");
+        }
+    }
+}
@@ -14,6 +14,7 @@
 #include <geekos/int.h>
 #include <geekos/kthread.h>
 #include <geekos/smp.h>
+#include <geekos/slab.h>
 
 #ifndef NULL
 #define NULL ((void *)0)
@@ -28,6 +29,10 @@ static struct Alarm_Handler_Queue s_alarmWaitingQueue;  /* not yet fired. */
 static struct Alarm_Handler_Queue s_alarmPendingQueue;  /* fired, not yet run */
 static struct Thread_Queue s_threadQueue;       /* queue for the alarm handler thread */
 
+/* Alarm_Event objects; freed with interrupts disabled, so not Malloc'd */
+static struct Object_Cache s_alarmCache =
+OBJECT_CACHE_INITIALIZER("alarm", sizeof(struct Alarm_Event), 0);
+
 static inline int Calc_Ticks_Per_MS(int milliseconds) {
     float ticks = TICKS_PER_MS * milliseconds;
     float trunc = (float)(unsigned int)ticks;
@@ -69,7 +74,7 @@ static void Alarm_Handler_Thread(ulong_t arg __attribute__ ((unused))) {
             }
             alarm->callback(alarm->data);
 
-            Free(alarm);
+            Free_Object(&s_alarmCache, alarm);
         } else {
             Disable_Interrupts();
             Wait(&s_threadQueue);
@@ -109,7 +114,7 @@ void Init_Alarm(void) {
 
 int Alarm_Create(Alarm_Callback callback, void *data,
                  unsigned int milliSeconds) {
-    struct Alarm_Event *alarmEvent = Malloc(sizeof(struct Alarm_Event));
+    struct Alarm_Event *alarmEvent = Alloc_Object(&s_alarmCache);
     if(alarmEvent == 0)
         return ENOMEM;
 
@@ -125,6 +130,7 @@ int Alarm_Create(Alarm_Callback callback, void *data,
                      System_Timer_Callback);
     if(id < 0) {
         Enable_Interrupts();
+        Free_Object(&s_alarmCache, alarmEvent);
         DEBUG_ALARM("In Alarm_Create, failed to Start_Timer\n");
         return -1;
     }
@@ -148,7 +154,7 @@ int Alarm_Cancel_For_Thread(struct Kernel_Thread *thread) {
         if(alarm->thread == thread) {
             Locked_Remove_From_Alarm_Handler_Queue(&s_alarmWaitingQueue,
                                                    alarm);
-            Free(alarm);
+            Free_Object(&s_alarmCache, alarm);
         }
     }
     Unlock_Alarm_Handler_Queue(&s_alarmWaitingQueue);
@@ -162,12 +168,12 @@ int Alarm_Destroy(int id) {
     if(alarm) {
         Remove_From_Alarm_Handler_Queue(&s_alarmWaitingQueue, alarm);
         Cancel_Timer(id);
-        Free(alarm);
+        Free_Object(&s_alarmCache, alarm);
     } else {
         alarm = Alarm_Find_In_Queue_By_ID(&s_alarmPendingQueue, id);
         if(alarm) {
             Remove_From_Alarm_Handler_Queue(&s_alarmPendingQueue, alarm);
-            Free(alarm);
+            Free_Object(&s_alarmCache, alarm);
         }
     }
     return 0;
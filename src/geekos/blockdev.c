@@ -16,6 +16,9 @@
 #include <geekos/synch.h>
 #include <geekos/blockdev.h>
 #include <geekos/kassert.h>
+#include <geekos/slab.h>
+#include <geekos/timer.h>
+#include <geekos/iosched.h>
 
 /* #define BLOCKDEV_DEBUG  */
 #ifdef BLOCKDEV_DEBUG
@@ -35,11 +38,11 @@ extern Spin_Lock_t kthreadLock;
  */
 static struct Mutex s_blockdevLock;
 
-/* One mutex and condition variable for all requests */
-/* Prior wait and request queues were per-device type rather
-   than per-device; or were based on the globalLock. */
-static struct Mutex s_blockdevRequestLock;
-static struct Condition s_blockdevRequestCond;
+/*
+ * Completion.  Drivers complete requests from interrupt handlers, so
+ * a spin lock orders a request's state change against its waiter.
+ */
+static Spin_Lock_t s_completionLock;
 
 /*
  * List datatype for list of block devices.
@@ -53,31 +56,102 @@ IMPLEMENT_LIST(Block_Device_List, Block_Device);
  */
 static struct Block_Device_List s_deviceList;
 
+/*
+ * Block requests come from an object cache; every transfer allocates
+ * at least one.
+ */
+static void Construct_Request(void *obj) {
+    Cond_Init(&((struct Block_Request *)obj)->satisfied);
+}
+
+static struct Object_Cache s_requestCache =
+OBJECT_CACHE_INITIALIZER("blockreq", sizeof(struct Block_Request),
+                         Construct_Request);
+
+
+/* Most requests one transfer has outstanding */
+#define BLOCK_PIECE_WINDOW 16
+
+/*
+ * Wait for a transfer's requests and release them.  Returns the
+ * first error code among them, or rc if that is an error already.
+ */
+static int Finish_Requests(struct Block_Request **pieces, int count,
+                           int rc) {
+    int i;
+
+    for(i = 0; i < count; i++) {
+        Wait_For_Request(pieces[i]);
+        if(rc == 0)
+            rc = pieces[i]->errorCode;
+        Destroy_Request(pieces[i]);
+    }
+    return rc;
+}
 
 /*
- * Perform a block IO request.
+ * Perform a block IO request for the consecutive blocks starting at
+ * blockNum, to or from the given memory segments.  The transfer is
+ * split where it exceeds what the driver takes in one request: at
+ * most queue->maxBlocks blocks in BLOCK_MAX_SEGMENTS segments.  Up to
+ * BLOCK_PIECE_WINDOW of the pieces are in flight at once.
  * Returns 0 if successful, error code on failure.
  */
 static int Do_Request(struct Block_Device *dev, enum Request_Type type,
-                      int blockNum, void *buf) {
-    struct Block_Request *request;
-    int rc;
+                      int blockNum, const struct Block_Segment *segments,
+                      int numSegments) {
+    struct Block_Request *pieces[BLOCK_PIECE_WINDOW];
+    int maxBlocks = dev->queue->maxBlocks;
+    int count = 0, rc = 0;
+    int seg = 0, offset = 0;    /* blocks already done of segments[seg] */
+
+    while (seg < numSegments && rc == 0) {
+        struct Block_Request *request;
+        int numBlocks;
+
+        KASSERT(segments[seg].numBlocks > 0);
+        if(offset == 0 && segments[seg].numBlocks <= maxBlocks) {
+            /* as many whole segments as fit */
+            int n = 0;
+
+            numBlocks = 0;
+            while (seg + n < numSegments && n < BLOCK_MAX_SEGMENTS
+                   && numBlocks + segments[seg + n].numBlocks <= maxBlocks)
+                numBlocks += segments[seg + n++].numBlocks;
+            request = n == 1
+                ? Create_Request(dev, type, blockNum, numBlocks,
+                                 segments[seg].buf)
+                : Create_Vector_Request(dev, type, blockNum, &segments[seg],
+                                        n);
+            seg += n;
+        } else {
+            /* part of a segment too large for one request */
+            numBlocks = segments[seg].numBlocks - offset;
+            if(numBlocks > maxBlocks)
+                numBlocks = maxBlocks;
+            request = Create_Request(dev, type, blockNum, numBlocks,
+                                     (char *)segments[seg].buf +
+                                     offset * SECTOR_SIZE);
+            offset += numBlocks;
+            if(offset == segments[seg].numBlocks) {
+                ++seg;
+                offset = 0;
+            }
+        }
+        if(request == 0) {
+            rc = ENOMEM;
+            break;
+        }
 
-    // Print("about to do_req\n");
-    Mutex_Lock(&s_blockdevLock);        /* not obviously the right mutex */
-    request = Create_Request(dev, type, blockNum, buf);
-    // Print("created req\n");
-    if(request == 0) {
-        // Print("req returned null\n");
-        Mutex_Unlock(&s_blockdevLock);
-        return ENOMEM;
+        Block_Submit(request);
+        pieces[count++] = request;
+        blockNum += numBlocks;
+        if(count == BLOCK_PIECE_WINDOW) {
+            rc = Finish_Requests(pieces, count, rc);
+            count = 0;
+        }
     }
-    // Print("about to post\n");
-    Post_Request_And_Wait(request);
-    rc = request->errorCode;
-    Mutex_Unlock(&s_blockdevLock);
-    Free(request);
-    return rc;
+    return Finish_Requests(pieces, count, rc);
 }
 
 /* ----------------------------------------------------------------------
@@ -92,13 +166,11 @@ static int Do_Request(struct Block_Device *dev, enum Request_Type type,
  */
 int Register_Block_Device(const char *name, struct Block_Device_Ops *ops,
                           int unit, void *driverData,
-                          struct Thread_Queue *waitQueue,
-                          struct Block_Request_List *requestQueue) {
+                          struct Block_Queue *queue) {
     struct Block_Device *dev;
 
     KASSERT(ops != 0);
-    KASSERT(waitQueue != 0);
-    KASSERT(requestQueue != 0);
+    KASSERT(queue != 0);
 
     dev = (struct Block_Device *)Malloc(sizeof(*dev));
     if(dev == 0)
@@ -109,10 +181,15 @@ int Register_Block_Device(const char *name, struct Block_Device_Ops *ops,
     dev->unit = unit;
     dev->inUse = false;
     dev->driverData = driverData;
-    dev->requestQueue = requestQueue;
     dev->reads = dev->writes = 0;
-    dev->waitQueue = waitQueue; /* can be shared */
-    dev->requestQueue = requestQueue;   /* can be shared */
+    dev->queue = queue;         /* can be shared */
+
+    Mutex_Lock(&queue->lock);
+    if(queue->sched == 0)
+        queue->sched = Default_Block_Scheduler();
+    if(queue->maxBlocks == 0)
+        queue->maxBlocks = BLOCK_QUEUE_DEFAULT_MAX_BLOCKS;
+    Mutex_Unlock(&queue->lock);
 
     Mutex_Lock(&s_blockdevLock);
     /* FIXME: handle name conflict with existing device */
@@ -177,94 +254,211 @@ int Close_Block_Device(struct Block_Device *dev) {
 }
 
 /*
- * Create a block device request to transfer a single block.
+ * Create a block device request to transfer numBlocks consecutive
+ * blocks starting at blockNum.
  */
 struct Block_Request *Create_Request(struct Block_Device *dev,
                                      enum Request_Type type, int blockNum,
-                                     void *buf) {
-    struct Block_Request *request = Malloc(sizeof(*request));
+                                     int numBlocks, void *buf) {
+    struct Block_Request *request = Alloc_Object(&s_requestCache);
     if(request != 0) {
-        memset(request, 0, sizeof(struct Block_Request));       /* must bzero waitQueue */
+        /* request->satisfied is initialized by Construct_Request */
         request->dev = dev;
         request->type = type;
         request->blockNum = blockNum;
+        request->numBlocks = numBlocks;
         request->buf = buf;
+        request->segments = 0;
+        request->numSegments = 0;
         request->state = PENDING;
-        //      Clear_Thread_Queue(&request->waitQueue);
-        Cond_Init(&request->satisfied);
+        request->errorCode = 0;
+        request->mergedNext = 0;
+        request->mergedBlocks = 0;
+        Set_Prev_In_Block_Request_List(request, 0);
+        Set_Next_In_Block_Request_List(request, 0);
+        request->inBlock_Request_List = 0;
     }
     return request;
 }
 
 /*
- * Send a block IO request to a device and wait for it to be handled.
- * Returns when the driver completes the requests or signals
- * an error.
- *
+ * Create a block device request to transfer consecutive blocks
+ * starting at blockNum through a list of memory segments, which must
+ * stay in place until the request completes.
  */
-void Post_Request_And_Wait(struct Block_Request *request) {
+struct Block_Request *Create_Vector_Request(struct Block_Device *dev,
+                                            enum Request_Type type,
+                                            int blockNum,
+                                            const struct Block_Segment
+                                            *segments, int numSegments) {
+    struct Block_Request *request;
+    int i, numBlocks = 0;
+
+    KASSERT(numSegments > 0 && numSegments <= BLOCK_MAX_SEGMENTS);
+    for(i = 0; i < numSegments; i++)
+        numBlocks += segments[i].numBlocks;
+    request = Create_Request(dev, type, blockNum, numBlocks,
+                             segments[0].buf);
+    if(request != 0) {
+        request->segments = segments;
+        request->numSegments = numSegments;
+    }
+    return request;
+}
+
+/*
+ * Release a request created by Create_Request() once it has
+ * completed and no thread waits on it.
+ */
+void Destroy_Request(struct Block_Request *request) {
+    KASSERT(Is_Thread_Queue_Empty(&request->satisfied.waitQueue));
+    Free_Object(&s_requestCache, request);
+}
+
+/*
+ * Send a request to its device's driver and return without waiting;
+ * Wait_For_Request() waits for it to complete.
+ */
+void Block_Submit(struct Block_Request *request) {
     struct Block_Device *dev;
 
     KASSERT(request != 0);
+    KASSERT(request->state == PENDING);
 
     dev = request->dev;
     KASSERT(dev != 0);
+    if(request->type == BLOCK_READ)
+        dev->reads += request->numBlocks;
+    else
+        dev->writes += request->numBlocks;
 
-    /* Send request to the driver */
     Debug("Posting block device request [@%p]...\n", request);
 
-    Mutex_Lock(&s_blockdevRequestLock);
-    Add_To_Back_Of_Block_Request_List(dev->requestQueue, request);
-    Cond_Broadcast(&s_blockdevRequestCond);     /* awakens Dequeue_Request below */
-
-    /* Wait for request to be processed */
-    while (request->state == PENDING) {
-        Debug("Waiting, state=%d\n", request->state);
-        // Disable_Interrupts();
-        // Wait(&request->waitQueue);
-        Cond_Wait(&request->satisfied, &s_blockdevRequestLock);
-        // Enable_Interrupts();
-    }
-    Mutex_Unlock(&s_blockdevRequestLock);
+    request->submitTime = g_numTicks;
+    Mutex_Lock(&dev->queue->lock);
+    dev->queue->sched->Add(dev->queue, request);
+    Cond_Signal(&dev->queue->cond);     /* awakens Dequeue_Requests below */
+    Mutex_Unlock(&dev->queue->lock);
+}
+
+/*
+ * Wait for a submitted request to complete.
+ */
+void Wait_For_Request(struct Block_Request *request) {
+    bool iflag = Spin_Lock_Irq_Save(&s_completionLock);
+
+    Wait_Until(&request->satisfied.waitQueue, &s_completionLock,
+               request->state != PENDING);
+    Spin_Unlock_Irq_Restore(&s_completionLock, iflag);
     Debug("Wait completed!\n");
 }
 
 /*
- * Wait for a block request to arrive.
+ * Send a block IO request to a device and wait for it to be handled.
+ * Returns when the driver completes the requests or signals
+ * an error.
  */
-struct Block_Request *Dequeue_Request(struct Block_Request_List
-                                      *requestQueue) {
-    struct Block_Request *request;
+void Post_Request_And_Wait(struct Block_Request *request) {
+    Block_Submit(request);
+    Wait_For_Request(request);
+}
 
-    Mutex_Lock(&s_blockdevRequestLock);
+/*
+ * Prepare a queue that is not statically initialized with
+ * BLOCK_QUEUE_INITIALIZER.
+ */
+void Init_Block_Queue(struct Block_Queue *queue) {
+    Mutex_Init(&queue->lock);
+    Cond_Init(&queue->cond);
+    Clear_Block_Request_List(&queue->requests);
+    Spin_Lock_Init(&queue->requests.lock);
+}
 
-    while (!
-           (request =
-            Remove_From_Front_Of_Block_Request_List(requestQueue))) {
-        /* could have something added here by Post_Request_And_Wait */
-        Cond_Wait(&s_blockdevRequestCond, &s_blockdevRequestLock);
+/*
+ * Wait for at least one request to arrive on queue, then take up to
+ * max of them, in the order the queue's scheduler picks.  Returns
+ * the number taken.
+ */
+int Dequeue_Requests(struct Block_Queue *queue,
+                     struct Block_Request **batch, int max) {
+    int n = 0;
+
+    KASSERT(max > 0);
+    Mutex_Lock(&queue->lock);
+    while (Is_Block_Request_List_Empty(&queue->requests))
+        Cond_Wait(&queue->cond, &queue->lock);
+    while (n < max && (batch[n] = queue->sched->Next(queue)) != 0) {
+        struct Block_Request *request = batch[n++];
+
+        queue->seekBlocks += request->blockNum >= queue->headPos
+            ? request->blockNum - queue->headPos
+            : queue->headPos - request->blockNum;
+        queue->headPos = request->blockNum + request->numBlocks;
+        ++queue->dispatched;
     }
+    Mutex_Unlock(&queue->lock);
+    return n;
+}
 
-    Mutex_Unlock(&s_blockdevRequestLock);
+/*
+ * Wait for a block request to arrive.
+ */
+struct Block_Request *Dequeue_Request(struct Block_Queue *queue) {
+    struct Block_Request *request;
 
+    Dequeue_Requests(queue, &request, 1);
     return request;
 }
 
 /*
- * Signal the completion of a block request.
+ * Record the outcome of one request and wake whoever waits for it.
+ */
+static void Complete_Request(struct Block_Request *request,
+                             enum Request_State state, int errorCode) {
+    bool iflag = Spin_Lock_Irq_Save(&s_completionLock);
+
+    request->errorCode = errorCode;
+    request->state = state;
+    Wake_Up(&request->satisfied.waitQueue);
+    Spin_Unlock_Irq_Restore(&s_completionLock, iflag);
+}
+
+/*
+ * Signal the completion of a block request, and of the requests the
+ * scheduler merged into it.  May be called from an interrupt handler.
  */
 void Notify_Request_Completion(struct Block_Request *request,
                                enum Request_State state, int errorCode) {
-    request->state = state;
-    request->errorCode = errorCode;
-    Cond_Signal(&request->satisfied);
-    // Print("+++ in Notify_Request_Completion: core %d\n", Get_CPU_ID()); 
-    // Disable_Interrupts();
-    // Wake_Up(&request->waitQueue);
-    // Print("--- in Notify_Request_Completion: core %d\n", Get_CPU_ID()); 
-    // Enable_Interrupts();
-    /* Ensure that Wake_Up did its job; this should never fail. */
-    // KASSERT(Is_Thread_Queue_Empty(&request->waitQueue));
+    struct Block_Request *merged = request->mergedNext;
+
+    request->mergedNext = 0;
+    request->numBlocks -= request->mergedBlocks;
+    request->mergedBlocks = 0;
+    Complete_Request(request, state, errorCode);
+    while (merged != 0) {
+        struct Block_Request *next = merged->mergedNext;
+
+        merged->mergedNext = 0;
+        Complete_Request(merged, state, errorCode);
+        merged = next;
+    }
+}
+
+/*
+ * Where the given block of a request's transfer goes in memory.
+ */
+void *Get_Request_Block_Buffer(const struct Block_Request *request,
+                               int block) {
+    int i;
+
+    KASSERT(block >= 0 && block < request->numBlocks);
+    for(i = 0;; i++) {
+        struct Block_Segment seg = Get_Request_Segment(request, i);
+
+        if(block < seg.numBlocks)
+            return (char *)seg.buf + block * SECTOR_SIZE;
+        block -= seg.numBlocks;
+    }
 }
 
 /*
@@ -272,10 +466,7 @@ void Notify_Request_Completion(struct Block_Request *request,
  * Return 0 if successful, error code on error.
  */
 int Block_Read(struct Block_Device *dev, int blockNum, void *buf) {
-    KASSERT(dev);
-    KASSERT(buf);
-    dev->reads++;
-    return Do_Request(dev, BLOCK_READ, blockNum, buf);
+    return Block_Read_Range(dev, blockNum, 1, buf);
 }
 
 /*
@@ -283,10 +474,98 @@ int Block_Read(struct Block_Device *dev, int blockNum, void *buf) {
  * Return 0 if successful, error code on error.
  */
 int Block_Write(struct Block_Device *dev, int blockNum, void *buf) {
+    return Block_Write_Range(dev, blockNum, 1, buf);
+}
+
+/*
+ * Read numBlocks consecutive blocks into buf.
+ * Return 0 if successful, error code on error.
+ */
+int Block_Read_Range(struct Block_Device *dev, int blockNum, int numBlocks,
+                     void *buf) {
+    struct Block_Segment seg;
+
+    KASSERT(dev);
+    KASSERT(buf);
+    seg.buf = buf;
+    seg.numBlocks = numBlocks;
+    return Do_Request(dev, BLOCK_READ, blockNum, &seg, 1);
+}
+
+/*
+ * Write numBlocks consecutive blocks from buf.
+ * Return 0 if successful, error code on error.
+ */
+int Block_Write_Range(struct Block_Device *dev, int blockNum,
+                      int numBlocks, void *buf) {
+    struct Block_Segment seg;
+
     KASSERT(dev);
     KASSERT(buf);
-    dev->writes++;
-    return Do_Request(dev, BLOCK_WRITE, blockNum, buf);
+    seg.buf = buf;
+    seg.numBlocks = numBlocks;
+    return Do_Request(dev, BLOCK_WRITE, blockNum, &seg, 1);
+}
+
+/*
+ * Read consecutive blocks starting at blockNum into the given memory
+ * segments, in turn.
+ * Return 0 if successful, error code on error.
+ */
+int Block_Read_Vector(struct Block_Device *dev, int blockNum,
+                      const struct Block_Segment *segments,
+                      int numSegments) {
+    KASSERT(dev);
+    KASSERT(segments);
+    return Do_Request(dev, BLOCK_READ, blockNum, segments, numSegments);
+}
+
+/*
+ * Write consecutive blocks starting at blockNum from the given memory
+ * segments, in turn.
+ * Return 0 if successful, error code on error.
+ */
+int Block_Write_Vector(struct Block_Device *dev, int blockNum,
+                       const struct Block_Segment *segments,
+                       int numSegments) {
+    KASSERT(dev);
+    KASSERT(segments);
+    return Do_Request(dev, BLOCK_WRITE, blockNum, segments, numSegments);
+}
+
+/*
+ * Switch the named device's queue (shared with any other devices on
+ * it) to the named I/O scheduler.  Queued requests move over.
+ */
+int Set_Block_Scheduler(const char *devName, const char *schedName) {
+    const struct Block_Scheduler *sched = Find_Block_Scheduler(schedName);
+    struct Block_Request_List pending = LIST_INITIALIZER;
+    struct Block_Request *request;
+    struct Block_Queue *queue;
+    struct Block_Device *dev;
+
+    if(sched == 0)
+        return EINVALID;
+
+    Mutex_Lock(&s_blockdevLock);
+    for(dev = Get_Front_Of_Block_Device_List(&s_deviceList);
+        dev != 0 && strcmp(dev->name, devName) != 0;
+        dev = Get_Next_In_Block_Device_List(dev)) ;
+    Mutex_Unlock(&s_blockdevLock);
+    if(dev == 0)
+        return ENODEV;
+
+    queue = dev->queue;
+    Mutex_Lock(&queue->lock);
+    while ((request = queue->sched->Next(queue)) != 0)
+        Unchecked_Add_To_Back_Of_Block_Request_List(&pending, request);
+    queue->sched = sched;
+    queue->dispatched = queue->merged = queue->expired = 0;
+    queue->seekBlocks = 0;
+    while ((request = Remove_From_Front_Of_Block_Request_List(&pending)) != 0)
+        sched->Add(queue, request);
+    Mutex_Unlock(&queue->lock);
+    return 0;
 }
 
 /*
@@ -307,8 +586,14 @@ void Dump_Blockdev_Stats(void) {
     for(dev = Get_Front_Of_Block_Device_List(&s_deviceList), i = 5;
         dev != 0 && i > 0;
         dev = Get_Next_In_Block_Device_List(dev), i -= 1) {
+        struct Block_Queue *queue = dev->queue;
+
         Print(" %s: read %u wrote %u\n", dev->name, dev->reads,
               dev->writes);
+        Print("   %s: %lu dispatched, %lu merged, %lu expired, "
+              "avg seek %lu blocks\n", queue->sched->name,
+              queue->dispatched, queue->merged, queue->expired,
+              queue->dispatched ? queue->seekBlocks / queue->dispatched : 0);
     }
     Mutex_Unlock(&s_blockdevLock);
 }
@@ -45,28 +45,17 @@ static uint_t Get_Num_Sectors_Per_FS_Block(struct FS_Buffer_Cache *cache) {
 }
 
 /*
- * Read or write a filesystem buffer.
+ * Read or write a filesystem buffer, as a single block transfer.
  */
 static int Do_Buffer_IO(struct FS_Buffer_Cache *cache,
                         struct FS_Buffer *buf,
                         int (*IO_Func) (struct Block_Device * dev,
-                                        int blockNum, void *buf)) {
-    uint_t offset;
-    unsigned int sectorCount = 0;
-    int blockNum = buf->fsBlockNum * Get_Num_Sectors_Per_FS_Block(cache);
-    char *ptr = (char *)buf->data;
-
-    for(offset = 0; offset < cache->fsBlockSize; offset += SECTOR_SIZE) {
-        int rc = IO_Func(cache->dev, blockNum, ptr + offset);
-        if(rc != 0)
-            return rc;
-        ++sectorCount;
-        ++blockNum;
-    }
-    KASSERT(offset == cache->fsBlockSize);
-    KASSERT(sectorCount == Get_Num_Sectors_Per_FS_Block(cache));
+                                        int blockNum, int numBlocks,
+                                        void *buf)) {
+    int numSectors = Get_Num_Sectors_Per_FS_Block(cache);
 
-    return 0;
+    return IO_Func(cache->dev, buf->fsBlockNum * numSectors, numSectors,
+                   buf->data);
 }
 
 /*
@@ -81,7 +70,7 @@ static int Sync_Buffer(struct FS_Buffer_Cache *cache,
     if(buf->flags & FS_BUFFER_DIRTY) {
         Debug("Sync %d block %lu\n", ++debugWriteCounter,
               buf->fsBlockNum);
-        if((rc = Do_Buffer_IO(cache, buf, Block_Write)) == 0)
+        if((rc = Do_Buffer_IO(cache, buf, Block_Write_Range)) == 0)
             buf->flags &= ~(FS_BUFFER_DIRTY);
     }
 
@@ -189,7 +178,7 @@ static int Get_Buffer(struct FS_Buffer_Cache *cache,
     Debug("READING %d block %lu\n", ++debugReadCounter, fsBlockNum);
 
     /* Read block data into buffer. */
-    if((rc = Do_Buffer_IO(cache, buf, Block_Read)) != 0)
+    if((rc = Do_Buffer_IO(cache, buf, Block_Read_Range)) != 0)
         return rc;
 
   done:
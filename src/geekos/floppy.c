@@ -188,15 +188,10 @@ static struct Thread_Queue s_floppyInterruptWaitQueue;
 static uchar_t *s_transferBuf;
 
 /*
- * Queue of floppy block I/O requests.
+ * Queue of floppy block I/O requests, where the request processing
+ * thread sleeps waiting for a request to arrive.
  */
-static struct Block_Request_List s_floppyRequestQueue;
-
-/*
- * Thread queue where request processing thread sleeps waiting for
- * a request to arrive.
- */
-static struct Thread_Queue s_floppyWaitQueue;
+static struct Block_Queue s_floppyQueue = BLOCK_QUEUE_INITIALIZER;
 
 /* ----------------------------------------------------------------------
  * Private functions
@@ -274,8 +269,7 @@ static void Setup_Drive_Parameters(int drive, unsigned int type) {
 
         /* Register the block device. */
         rc = Register_Block_Device(devname, &s_floppyDeviceOps, drive, 0,
-                                   &s_floppyWaitQueue,
-                                   &s_floppyRequestQueue);
+                                   &s_floppyQueue);
         if(rc != 0)
             Print("  Error: could not create block device for %s\n",
                   devname);
@@ -562,7 +556,7 @@ static int Floppy_Write(int driveNum, int blockNum, char *buffer) {
  * This is the thread that processes floppy I/O requests.
  */
 static void Floppy_Request_Thread(ulong_t arg __attribute__ ((unused))) {
-    int rc;
+    int rc, i;
 
     Debug("FRQ: Floppy request thread starting...\n");
 
@@ -571,18 +565,23 @@ static void Floppy_Request_Thread(ulong_t arg __attribute__ ((unused))) {
 
         /* Wait for an I/O request to arrive */
         Debug("FRQ: Request thread waiting for a request\n");
-        request = Dequeue_Request(&s_floppyRequestQueue);
+        request = Dequeue_Request(&s_floppyQueue);
         Debug("FRQ: Got a floppy request [@%x]\n", request);
         KASSERT(request->type == BLOCK_READ ||
                 request->type == BLOCK_WRITE);
 
-        /* Perform the I/O. */
-        if(request->type == BLOCK_READ)
-            rc = Floppy_Read(request->dev->unit, request->blockNum,
-                             request->buf);
-        else
-            rc = Floppy_Write(request->dev->unit, request->blockNum,
-                              request->buf);
+        /* Perform the I/O, one sector at a time. */
+        rc = 0;
+        for(i = 0; i < request->numBlocks && rc == 0; i++) {
+            char *buf = Get_Request_Block_Buffer(request, i);
+
+            if(request->type == BLOCK_READ)
+                rc = Floppy_Read(request->dev->unit, request->blockNum + i,
+                                 buf);
+            else
+                rc = Floppy_Write(request->dev->unit,
+                                  request->blockNum + i, buf);
+        }
 
         /* Notify the requesting thread of the outcome of the I/O. */
         Debug("FRQ: Notifying requesting thread...\n");
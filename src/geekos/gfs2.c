@@ -82,6 +82,8 @@ static int GFS2_Close(struct File *file) {
     &GFS2_Seek,
     &GFS2_Close,
     0,                          /* Read_Entry */
+    0,                          /* Read_At */
+    0,                          /* Write_At */
 };
 
 /*
@@ -117,6 +119,8 @@ static int GFS2_Read_Entry(struct File *dir, struct VFS_Dir_Entry *entry) {
     0,                          /* Seek */
     &GFS2_Close_Directory,
     &GFS2_Read_Entry,
+    0,                          /* Read_At */
+    0,                          /* Write_At */
 };
 
 
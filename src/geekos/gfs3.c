@@ -84,6 +84,8 @@ static int GFS3_Close(struct File *file) {
     &GFS3_Seek,
     &GFS3_Close,
     0,                          /* Read_Entry */
+    0,                          /* Read_At */
+    0,                          /* Write_At */
 };
 
 /*
@@ -119,6 +121,8 @@ static int GFS3_Read_Entry(struct File *dir, struct VFS_Dir_Entry *entry) {
     0,                          /* Seek */
     &GFS3_Close_Directory,
     &GFS3_Read_Entry,
+    0,                          /* Read_At */
+    0,                          /* Write_At */
 };
 
 
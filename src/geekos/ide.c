@@ -25,39 +25,59 @@
 #include <geekos/string.h>
 #include <geekos/io.h>
 #include <geekos/int.h>
+#include <geekos/irq.h>
+#include <geekos/idt.h>
 #include <geekos/screen.h>
 #include <geekos/subsystem_locks.h>
 #include <geekos/timer.h>
 #include <geekos/kthread.h>
 #include <geekos/blockdev.h>
+#include <geekos/mem.h>
+#include <geekos/pci.h>
 #include <geekos/ide.h>
 
-/* Registers */
-#define IDE_DATA_REGISTER		0x1f0
-#define IDE_ERROR_REGISTER		0x1f1
+/* Registers, at offsets from the channel's command block */
+#define IDE_DATA_REGISTER		0
+#define IDE_ERROR_REGISTER		1
 #define IDE_FEATURE_REG			IDE_ERROR_REGISTER
-#define IDE_SECTOR_COUNT_REGISTER	0x1f2
-#define IDE_SECTOR_NUMBER_REGISTER	0x1f3
-#define IDE_CYLINDER_LOW_REGISTER	0x1f4
-#define IDE_CYLINDER_HIGH_REGISTER	0x1f5
-#define IDE_DRIVE_HEAD_REGISTER		0x1f6
-#define IDE_STATUS_REGISTER		0x1f7
-#define IDE_COMMAND_REGISTER		0x1f7
-#define IDE_DEVICE_CONTROL_REGISTER	0x3F6
-
-/* Drives */
+#define IDE_SECTOR_COUNT_REGISTER	2
+#define IDE_SECTOR_NUMBER_REGISTER	3
+#define IDE_CYLINDER_LOW_REGISTER	4
+#define IDE_CYLINDER_HIGH_REGISTER	5
+#define IDE_DRIVE_HEAD_REGISTER		6
+#define IDE_STATUS_REGISTER		7
+#define IDE_COMMAND_REGISTER		7
+
+/* Channels: primary and secondary, at the legacy addresses */
+#define IDE_NUM_CHANNELS		2
+
+/*
+ * Drives: ide0 and ide1 are master and slave on the primary
+ * channel, ide2 and ide3 on the secondary.
+ */
 #define IDE_DRIVE_BASE			0xa0
-#define IDE_DRIVE(driveNum)		(IDE_DRIVE_BASE | (driveNum <<4))
-/* primary / secondary not supported yet.  2 drives maximum, else would re-detect 1 and 2 as 3 and 4. */
-#define IDE_MAX_DRIVES			2
+#define IDE_DRIVE(driveNum)		(IDE_DRIVE_BASE | (((driveNum) & 1) << 4))
+#define IDE_MAX_DRIVES			(2 * IDE_NUM_CHANNELS)
+#define IDE_CHANNEL(driveNum)		(&s_ideChannels[(driveNum) >> 1])
 
 
 /* Commands */
 #define IDE_COMMAND_IDENTIFY_DRIVE	0xEC
 #define IDE_COMMAND_SEEK		0x70
 #define IDE_COMMAND_READ_SECTORS	0x21
+#define IDE_COMMAND_READ_SECTORS_EXT	0x24
+#define IDE_COMMAND_READ_MULTIPLE	0xC4
+#define IDE_COMMAND_READ_MULTIPLE_EXT	0x29
 #define IDE_COMMAND_READ_BUFFER		0xE4
 #define IDE_COMMAND_WRITE_SECTORS	0x30
+#define IDE_COMMAND_WRITE_SECTORS_EXT	0x34
+#define IDE_COMMAND_WRITE_MULTIPLE	0xC5
+#define IDE_COMMAND_WRITE_MULTIPLE_EXT	0x39
+#define IDE_COMMAND_SET_MULTIPLE	0xC6
+#define IDE_COMMAND_READ_DMA		0xC8
+#define IDE_COMMAND_READ_DMA_EXT	0x25
+#define IDE_COMMAND_WRITE_DMA		0xCA
+#define IDE_COMMAND_WRITE_DMA_EXT	0x35
 #define IDE_COMMAND_WRITE_BUFFER	0xE8
 #define IDE_COMMAND_DIAGNOSTIC		0x90
 #define IDE_COMMAND_ATAPI_IDENT_DRIVE	0xA1
@@ -68,6 +88,15 @@
 #define	IDE_INDENTIFY_NUM_BYTES_TRACK	0x04
 #define	IDE_INDENTIFY_NUM_BYTES_SECTOR	0x05
 #define	IDE_INDENTIFY_NUM_SECTORS_TRACK	0x06
+#define	IDE_INDENTIFY_MAX_MULTIPLE	0x2F   /* low byte */
+#define	IDE_INDENTIFY_CAPABILITIES	0x31
+#define	IDE_INDENTIFY_LBA_SECTORS	0x3C   /* 2 words */
+#define	IDE_INDENTIFY_COMMAND_SETS	0x53
+#define	IDE_INDENTIFY_LBA48_SECTORS	0x64   /* 4 words */
+
+#define IDE_CAPABILITY_DMA		0x0100
+#define IDE_CAPABILITY_LBA		0x0200
+#define IDE_COMMAND_SET_LBA48		0x0400
 
 /* bits of Status Register */
 #define IDE_STATUS_DRIVE_BUSY		0x80
@@ -79,6 +108,9 @@
 #define IDE_STATUS_DRIVE_INDEX		0x02
 #define IDE_STATUS_DRIVE_ERROR		0x01
 
+/* Bits of Drive/Head Register */
+#define IDE_DRIVE_HEAD_LBA		0x40
+
 /* Bits of Device Control Register */
 #define IDE_DCR_NOINTERRUPT		0x02
 #define IDE_DCR_RESET			0x04
@@ -88,12 +120,57 @@
 #define	IDE_ERROR_BAD_DRIVE	-1
 #define	IDE_ERROR_INVALID_BLOCK	-2
 #define	IDE_ERROR_DRIVE_ERROR	-3
+#define	IDE_ERROR_TIMEOUT	-4
+
+/* Ticks a command may run before the channel is reset */
+#define IDE_COMMAND_TIMEOUT		(5 * TICKS_PER_SEC)
+/* Milliseconds to let the drives come out of a reset */
+#define IDE_RESET_TIMEOUT_MS		2000
+
+/* Sectors per command: a count register of 0 means 256 (65536 for LBA48) */
+#define IDE_MAX_SECTORS			256
+
+/* First sector that needs LBA48 addressing */
+#define IDE_LBA28_LIMIT			0x10000000
 
 /* Control register bits */
-#define IDE_CONTROL_REGISTER		0x3F6
 #define IDE_CONTROL_SOFTWARE_RESET	0x04
 #define IDE_CONTROL_INT_DISABLE		0x02
 
+/*
+ * Bus-master DMA registers (PIIX and compatibles), at offsets from
+ * BAR 4 of the IDE controller; the primary channel comes first, then
+ * the secondary IDE_BM_CHANNEL_SIZE bytes on.
+ */
+#define IDE_BM_COMMAND			0x0
+#define IDE_BM_STATUS			0x2
+#define IDE_BM_PRD_TABLE		0x4
+#define IDE_BM_CHANNEL_SIZE		0x8
+
+#define IDE_BM_COMMAND_START		0x01
+#define IDE_BM_COMMAND_READ		0x08    /* device to memory */
+
+#define IDE_BM_STATUS_ACTIVE		0x01
+#define IDE_BM_STATUS_ERROR		0x02
+#define IDE_BM_STATUS_INTERRUPT		0x04
+#define IDE_BM_STATUS_SIMPLEX		0x80    /* one channel at a time */
+
+#define IDE_PROG_IF_BUS_MASTER		0x80
+
+/*
+ * Physical Region Descriptor: one physically contiguous piece of a
+ * DMA buffer, which may not cross a 64 KB boundary.  A byte count
+ * of 0 means 64 KB.
+ */
+struct IDE_PRD {
+    ulong_t physAddr;
+    ushort_t byteCount;
+    ushort_t flags;
+};
+#define IDE_PRD_END_OF_TABLE		0x8000
+#define IDE_PRD_BOUNDARY		0x10000
+#define IDE_MAX_PRDS			(PAGE_SIZE / sizeof(struct IDE_PRD))
+
 #define LOW_BYTE(x)	(x & 0xff)
 #define HIGH_BYTE(x)	((x >> 8) & 0xff)
 
@@ -102,178 +179,506 @@ typedef struct {
     short num_Heads;
     short num_SectorsPerTrack;
     short num_BytesPerSector;
+    bool lba;                   /* LBA28 addressing supported */
+    bool lba48;                 /* LBA48 addressing supported */
+    int num_Sectors;            /* addressable sectors when lba */
+    int multipleSectors;        /* sectors per READ/WRITE MULTIPLE block, 0 if unset */
+    bool dma;                   /* READ/WRITE DMA supported */
+    bool present;
 } ideDisk;
 
+/*
+ * An ATA channel: two drive positions behind one set of registers,
+ * so one command at a time.  Each channel has its own lock, request
+ * queue and request thread, and runs independently of the other.
+ */
+struct IDE_Channel {
+    int num;
+    ushort_t ioBase;            /* command block registers */
+    ushort_t controlPort;       /* device control register */
+    int irq;
+    bool present;
+
+    /*
+     * Protects the channel registers and command; taken by the
+     * interrupt handler, so always with interrupts disabled.
+     */
+    Spin_Lock_t lock;
+
+    /*
+     * The command in progress.  The request thread issues it and sleeps
+     * on interruptWaitQueue; the interrupt handler moves each DRQ
+     * block of data and wakes the thread when the command is done.
+     */
+    struct {
+        bool active;
+        bool dma;               /* bus-master transfer, one interrupt */
+        enum Request_Type type;
+        char *buffer;           /* next sector to move */
+        int remaining;          /* sectors still to move */
+        int perDrq;             /* sectors per DRQ block */
+        int rc;
+        int timerId;            /* pending timeout, 0 once it is claimed */
+    } command;
+
+    struct Thread_Queue interruptWaitQueue;
+
+    /* Bus-master DMA: I/O base of the channel's registers (0 if no DMA) */
+    ushort_t busMaster;
+    struct IDE_PRD *prdTable;
+
+    struct Block_Queue queue;
+
+    /* statistics */
+    ulong_t dmaCommands, pioCommands, timeouts;
+};
+
+static const struct {
+    ushort_t ioBase, controlPort;
+    int irq;
+} s_ideLegacyChannels[IDE_NUM_CHANNELS] = {
+    {0x1f0, 0x3f6, 14},
+    {0x170, 0x376, 15},
+};
+
 int ideDebug = 0;
 static int numDrives;
 static ideDisk drives[IDE_MAX_DRIVES];
-
-/* can run much faster if it doesn't hold the global lock
-   during all reads/writes to the disk.  Since ide access is
-   managed by a thread, it doesn't seem like other processes
-   are in danger of accessing the drive.   #undef this symbol
-   if concerned about correctness. */
-#define NS_INTERRUPTABLE_NO_GLOBAL_LOCK
-
-struct Thread_Queue s_ideWaitQueue;
-struct Block_Request_List s_ideRequestQueue;
+static struct IDE_Channel s_ideChannels[IDE_NUM_CHANNELS];
 
 /*
  * return the number of logical blocks for a particular drive.
  *
  */
 static int IDE_getNumBlocks(int driveNum) {
-    if(driveNum < 0 || driveNum > IDE_MAX_DRIVES) {
+    if(driveNum < 0 || driveNum >= IDE_MAX_DRIVES) {
         return IDE_ERROR_BAD_DRIVE;
     }
 
+    if(drives[driveNum].lba)
+        return drives[driveNum].num_Sectors;
+
     return (drives[driveNum].num_Heads *
             drives[driveNum].num_SectorsPerTrack *
             drives[driveNum].num_Cylinders);
 }
 
 /*
- * Read a block at the logical block number indicated.
+ * Wait for the selected drive on a channel to finish whatever it is
+ * doing; return its status.
  */
-static int IDE_Read(int driveNum, int blockNum, char *buffer) {
-    int i;
-    int head;
-    int sector;
-    int cylinder;
-    short *bufferW;
-    bool reEnable;
+static int IDE_Wait(struct IDE_Channel *channel) {
+    int status;
 
-    if(driveNum < 0 || driveNum > (numDrives - 1)) {
-        if(ideDebug)
-            Print("ide: invalid drive %d\n", driveNum);
-        return IDE_ERROR_BAD_DRIVE;
-    }
+    while ((status = In_Byte(channel->ioBase + IDE_STATUS_REGISTER))
+           & IDE_STATUS_DRIVE_BUSY) ;
+    return status;
+}
 
-    if(blockNum < 0 || blockNum >= IDE_getNumBlocks(driveNum)) {
-        if(ideDebug)
-            Print("ide: invalid block %d\n", blockNum);
-        return IDE_ERROR_INVALID_BLOCK;
+/*
+ * Load the task file registers with the address and sector count of
+ * a transfer.  LBA48 (ext) writes each register twice, high byte
+ * first; otherwise LBA28 is used if the drive supports it, else CHS.
+ */
+static void IDE_Setup_Task_File(int driveNum, int blockNum, int count,
+                                bool ext) {
+    ideDisk *drive = &drives[driveNum];
+    ushort_t io = IDE_CHANNEL(driveNum)->ioBase;
+
+    if(ext) {
+        Out_Byte(io + IDE_DRIVE_HEAD_REGISTER,
+                 IDE_DRIVE(driveNum) | IDE_DRIVE_HEAD_LBA);
+        Out_Byte(io + IDE_SECTOR_COUNT_REGISTER, HIGH_BYTE(count));
+        Out_Byte(io + IDE_SECTOR_NUMBER_REGISTER, (blockNum >> 24) & 0xff);
+        Out_Byte(io + IDE_CYLINDER_LOW_REGISTER, 0);
+        Out_Byte(io + IDE_CYLINDER_HIGH_REGISTER, 0);
+        Out_Byte(io + IDE_SECTOR_COUNT_REGISTER, LOW_BYTE(count));
+        Out_Byte(io + IDE_SECTOR_NUMBER_REGISTER, LOW_BYTE(blockNum));
+        Out_Byte(io + IDE_CYLINDER_LOW_REGISTER, HIGH_BYTE(blockNum));
+        Out_Byte(io + IDE_CYLINDER_HIGH_REGISTER, (blockNum >> 16) & 0xff);
+    } else if(drive->lba) {
+        Out_Byte(io + IDE_SECTOR_COUNT_REGISTER, LOW_BYTE(count));
+        Out_Byte(io + IDE_SECTOR_NUMBER_REGISTER, LOW_BYTE(blockNum));
+        Out_Byte(io + IDE_CYLINDER_LOW_REGISTER, HIGH_BYTE(blockNum));
+        Out_Byte(io + IDE_CYLINDER_HIGH_REGISTER, (blockNum >> 16) & 0xff);
+        Out_Byte(io + IDE_DRIVE_HEAD_REGISTER,
+                 IDE_DRIVE(driveNum) | IDE_DRIVE_HEAD_LBA |
+                 ((blockNum >> 24) & 0x0f));
+    } else {
+        /* now compute the head, cylinder, and sector */
+        int sector = blockNum % drive->num_SectorsPerTrack + 1;
+        int cylinder = blockNum / (drive->num_Heads *
+                                   drive->num_SectorsPerTrack);
+        int head = (blockNum / drive->num_SectorsPerTrack) %
+            drive->num_Heads;
+
+        if(ideDebug >= 2)
+            Print("    head %d, cylinder %d, sector %d\n", head, cylinder,
+                  sector);
+
+        Out_Byte(io + IDE_SECTOR_COUNT_REGISTER, LOW_BYTE(count));
+        Out_Byte(io + IDE_SECTOR_NUMBER_REGISTER, sector);
+        Out_Byte(io + IDE_CYLINDER_LOW_REGISTER, LOW_BYTE(cylinder));
+        Out_Byte(io + IDE_CYLINDER_HIGH_REGISTER, HIGH_BYTE(cylinder));
+        Out_Byte(io + IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE(driveNum) | head);
     }
+}
 
-    /* now compute the head, cylinder, and sector */
-    sector = blockNum % drives[driveNum].num_SectorsPerTrack + 1;
-    cylinder = blockNum / (drives[driveNum].num_Heads *
-                           drives[driveNum].num_SectorsPerTrack);
-    head = (blockNum / drives[driveNum].num_SectorsPerTrack) %
-        drives[driveNum].num_Heads;
-
-    if(ideDebug >= 2) {
-        Print("request to read block %d\n", blockNum);
-        Print("    head %d, cylinder %d, sector %d\n", head, cylinder,
-              sector);
-        // Print ("    cylinder %d\n", cylinder);
-        // Print ("    sector %d\n", sector);
-    }
-    reEnable = Spin_Lock_Irq_Save(&ideLock);
+/*
+ * Move the next DRQ block of the current command through the data
+ * register.  Called with channel->lock held.
+ */
+static void IDE_Move_Data_Block(struct IDE_Channel *channel) {
+    int n = channel->command.remaining < channel->command.perDrq
+        ? channel->command.remaining : channel->command.perDrq;
+
+    if(channel->command.type == BLOCK_READ)
+        In_Words(channel->ioBase + IDE_DATA_REGISTER,
+                 channel->command.buffer, n * SECTOR_SIZE / 2);
+    else
+        Out_Words(channel->ioBase + IDE_DATA_REGISTER,
+                  channel->command.buffer, n * SECTOR_SIZE / 2);
+    channel->command.buffer += n * SECTOR_SIZE;
+    channel->command.remaining -= n;
+}
+
+/*
+ * Finish the current command and wake the request thread.
+ * Called with channel->lock held.
+ */
+static void IDE_Complete_Command(struct IDE_Channel *channel, int rc) {
+    channel->command.rc = rc;
+    channel->command.active = false;
+    Wake_Up(&channel->interruptWaitQueue);
+}
 
-    Out_Byte(IDE_SECTOR_COUNT_REGISTER, 1);
-    Out_Byte(IDE_SECTOR_NUMBER_REGISTER, sector);
-    Out_Byte(IDE_CYLINDER_LOW_REGISTER, LOW_BYTE(cylinder));
-    Out_Byte(IDE_CYLINDER_HIGH_REGISTER, HIGH_BYTE(cylinder));
-    Out_Byte(IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE(driveNum) | head);
+/*
+ * End a DMA command: the controller interrupts once, when the whole
+ * transfer is done or has failed.  Called with channel->lock held.
+ */
+static void IDE_Finish_DMA(struct IDE_Channel *channel) {
+    int bmStatus = In_Byte(channel->busMaster + IDE_BM_STATUS);
+    int status;
 
-    Out_Byte(IDE_COMMAND_REGISTER, IDE_COMMAND_READ_SECTORS);
+    if(!(bmStatus & IDE_BM_STATUS_INTERRUPT))
+        return;                 /* not from this channel */
 
-    if(ideDebug > 2)
-        Print("About to wait for Read \n");
+    Out_Byte(channel->busMaster + IDE_BM_COMMAND, 0);
+    Out_Byte(channel->busMaster + IDE_BM_STATUS,
+             IDE_BM_STATUS_INTERRUPT | IDE_BM_STATUS_ERROR);
+    status = In_Byte(channel->ioBase + IDE_STATUS_REGISTER);
 
-    /* wait for the drive */
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY) ;
-    if(In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_ERROR) {
-        Print("ERROR: Got Read %d\n", In_Byte(IDE_STATUS_REGISTER));
-        Spin_Unlock_Irq_Restore(&ideLock, reEnable);
-        return IDE_ERROR_DRIVE_ERROR;
+    if((bmStatus & IDE_BM_STATUS_ERROR)
+       || (status & (IDE_STATUS_DRIVE_ERROR | IDE_STATUS_DRIVE_WRITE_FAULT))) {
+        Print("ERROR: DMA %s failed, status %d, bus master status %d\n",
+              channel->command.type == BLOCK_READ ? "Read" : "Write",
+              status, bmStatus);
+        IDE_Complete_Command(channel, IDE_ERROR_DRIVE_ERROR);
+    } else {
+        IDE_Complete_Command(channel, IDE_ERROR_NO_ERROR);
     }
+}
 
-    if(ideDebug > 2)
-        Print("got buffer \n");
-
-    bufferW = (short *)buffer;
-    for(i = 0; i < 256; i++) {
-        bufferW[i] = In_Word(IDE_DATA_REGISTER);
+/*
+ * Advance a PIO command.  The drive interrupts when a DRQ block of
+ * read data is ready, after each DRQ block of write data has been
+ * written, and on error.  Called with channel->lock held.
+ */
+static void IDE_Continue_PIO(struct IDE_Channel *channel, int status) {
+    if(!channel->command.active || (status & IDE_STATUS_DRIVE_BUSY)) {
+        /* spurious */
+    } else if(status & (IDE_STATUS_DRIVE_ERROR | IDE_STATUS_DRIVE_WRITE_FAULT)) {
+        Print("ERROR: Got %s %d\n",
+              channel->command.type == BLOCK_READ ? "Read" : "Write",
+              status);
+        IDE_Complete_Command(channel, IDE_ERROR_DRIVE_ERROR);
+    } else if(channel->command.remaining == 0) {
+        /* the last write block is on the disk */
+        IDE_Complete_Command(channel, IDE_ERROR_NO_ERROR);
+    } else if(!(status & IDE_STATUS_DRIVE_DATA_REQUEST)) {
+        Print("ERROR: no data request, status %d\n", status);
+        IDE_Complete_Command(channel, IDE_ERROR_DRIVE_ERROR);
+    } else {
+        IDE_Move_Data_Block(channel);
+        if(channel->command.type == BLOCK_READ
+           && channel->command.remaining == 0)
+            IDE_Complete_Command(channel, IDE_ERROR_NO_ERROR);
     }
-    if(ideDebug > 2)
-        Print("read buffer \n");
+}
 
-    Spin_Unlock_Irq_Restore(&ideLock, reEnable);
+/*
+ * Each channel has its own IRQ line.  Reading the status register
+ * acknowledges the interrupt; a DMA command reads it in
+ * IDE_Finish_DMA().
+ */
+static void IDE_Interrupt_Handler(struct Interrupt_State *state) {
+    int c;
+
+    Begin_IRQ(state);
+    for(c = 0; c < IDE_NUM_CHANNELS; c++) {
+        struct IDE_Channel *channel = &s_ideChannels[c];
+
+        if(!channel->present
+           || channel->irq != (int)(state->intNum - FIRST_EXTERNAL_INT))
+            continue;
+        Spin_Lock(&channel->lock);
+        if(channel->command.active && channel->command.dma)
+            IDE_Finish_DMA(channel);
+        else
+            IDE_Continue_PIO(channel,
+                             In_Byte(channel->ioBase + IDE_STATUS_REGISTER));
+        Spin_Unlock(&channel->lock);
+    }
+    End_IRQ(state);
+}
 
-    return IDE_ERROR_NO_ERROR;
+/*
+ * Timer callback for a command that has not completed in
+ * IDE_COMMAND_TIMEOUT ticks: fail it and wake the request thread,
+ * which resets the channel.  Whichever of this and the request
+ * thread clears command.timerId cancels the timer.
+ */
+static void IDE_Command_Timeout(int id) {
+    int c;
+
+    for(c = 0; c < IDE_NUM_CHANNELS; c++) {
+        struct IDE_Channel *channel = &s_ideChannels[c];
+        bool claimed = false;
+
+        if(!channel->present)
+            continue;
+        Spin_Lock(&channel->lock);
+        if(channel->command.timerId == id) {
+            channel->command.timerId = 0;
+            claimed = true;
+            if(channel->command.active) {
+                Print("ide channel %d: command timed out\n", c);
+                IDE_Complete_Command(channel, IDE_ERROR_TIMEOUT);
+            }
+        }
+        Spin_Unlock(&channel->lock);
+        if(claimed) {
+            Cancel_Timer(id);
+            return;
+        }
+    }
 }
 
 /*
- * Write a block at the logical block number indicated.
+ * Reset a channel whose command timed out: stop any bus-master
+ * transfer and pulse SRST.  A soft reset may drop the drives'
+ * READ/WRITE MULTIPLE setting, so go back to a sector per DRQ.
+ * Called with channel->lock held.
  */
-static int IDE_Write(int driveNum, int blockNum, char *buffer) {
-    int i;
-    int head;
-    int sector;
-    int cylinder;
-    short *bufferW;
-    bool reEnable;
+static void IDE_Reset_Channel(struct IDE_Channel *channel) {
+    int d, ms;
 
-    if(driveNum < 0 || driveNum > (numDrives - 1)) {
-        return IDE_ERROR_BAD_DRIVE;
-    }
+    if(channel->busMaster != 0)
+        Out_Byte(channel->busMaster + IDE_BM_COMMAND, 0);
+    Out_Byte(channel->controlPort, IDE_DCR_RESET);
+    Micro_Delay(100);
+    Out_Byte(channel->controlPort, 0);
+    for(ms = 0; ms < IDE_RESET_TIMEOUT_MS
+        && (In_Byte(channel->ioBase + IDE_STATUS_REGISTER)
+            & IDE_STATUS_DRIVE_BUSY); ms++)
+        Micro_Delay(1000);
+
+    for(d = 0; d < IDE_MAX_DRIVES; d++)
+        if(IDE_CHANNEL(d) == channel)
+            drives[d].multipleSectors = 0;
+    ++channel->timeouts;
+}
 
-    if(blockNum < 0 || blockNum >= IDE_getNumBlocks(driveNum)) {
-        return IDE_ERROR_INVALID_BLOCK;
+/*
+ * Sleep until the interrupt handler completes the command in
+ * progress, or IDE_COMMAND_TIMEOUT ticks pass; then reset the
+ * channel and fail the command.
+ */
+static int IDE_Wait_For_Completion(struct IDE_Channel *channel) {
+    int timerId = Start_Timer(IDE_COMMAND_TIMEOUT, IDE_Command_Timeout);
+
+    channel->command.timerId = timerId > 0 ? timerId : 0;
+    Wait_Until(&channel->interruptWaitQueue, &channel->lock,
+               !channel->command.active);
+    if(channel->command.timerId != 0) {
+        channel->command.timerId = 0;
+        Cancel_Timer(timerId);
     }
+    if(channel->command.rc == IDE_ERROR_TIMEOUT)
+        IDE_Reset_Channel(channel);
+    return channel->command.rc;
+}
 
-    /* now compute the head, cylinder, and sector */
-    sector = blockNum % drives[driveNum].num_SectorsPerTrack + 1;
-    cylinder = blockNum / (drives[driveNum].num_Heads *
-                           drives[driveNum].num_SectorsPerTrack);
-    head = (blockNum / drives[driveNum].num_SectorsPerTrack) %
-        drives[driveNum].num_Heads;
-
-    if(ideDebug) {
-        Print("request to write block %d\n", blockNum);
-        Print("    head %d\n", head);
-        Print("    cylinder %d\n", cylinder);
-        Print("    sector %d\n", sector);
+/*
+ * Describe bytes bytes of buffer in the channel's PRD table,
+ * splitting at 64 KB boundaries.  Kernel memory is identity mapped,
+ * so a kernel address is also the physical address the controller
+ * needs.
+ */
+static void IDE_Build_PRD_Table(struct IDE_Channel *channel, char *buffer,
+                                ulong_t bytes) {
+    struct IDE_PRD *prdTable = channel->prdTable;
+    ulong_t addr = (ulong_t) buffer;
+    int n = 0;
+
+    while (bytes > 0) {
+        ulong_t chunk = IDE_PRD_BOUNDARY - (addr & (IDE_PRD_BOUNDARY - 1));
+
+        if(chunk > bytes)
+            chunk = bytes;
+        KASSERT(n < (int)IDE_MAX_PRDS);
+        prdTable[n].physAddr = addr;
+        prdTable[n].byteCount = chunk & 0xffff;
+        prdTable[n].flags = 0;
+        addr += chunk;
+        bytes -= chunk;
+        ++n;
     }
-    reEnable = Spin_Lock_Irq_Save(&ideLock);
+    prdTable[n - 1].flags = IDE_PRD_END_OF_TABLE;
+}
 
-    Out_Byte(IDE_SECTOR_COUNT_REGISTER, 1);
-    Out_Byte(IDE_SECTOR_NUMBER_REGISTER, sector);
-    Out_Byte(IDE_CYLINDER_LOW_REGISTER, LOW_BYTE(cylinder));
-    Out_Byte(IDE_CYLINDER_HIGH_REGISTER, HIGH_BYTE(cylinder));
-    Out_Byte(IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE(driveNum) | head);
+/*
+ * Transfer up to IDE_MAX_SECTORS sectors by bus-master DMA and sleep
+ * until the completion interrupt.
+ * Called with the channel's lock held and interrupts disabled.
+ */
+static int IDE_DMA_Command(int driveNum, enum Request_Type type,
+                           int blockNum, int count, char *buffer) {
+    struct IDE_Channel *channel = IDE_CHANNEL(driveNum);
+    bool ext = drives[driveNum].lba48 && blockNum + count > IDE_LBA28_LIMIT;
+    int direction = type == BLOCK_READ ? IDE_BM_COMMAND_READ : 0;
+    int command;
+
+    if(type == BLOCK_READ)
+        command = ext ? IDE_COMMAND_READ_DMA_EXT : IDE_COMMAND_READ_DMA;
+    else
+        command = ext ? IDE_COMMAND_WRITE_DMA_EXT : IDE_COMMAND_WRITE_DMA;
+
+    IDE_Build_PRD_Table(channel, buffer, count * SECTOR_SIZE);
+    Out_DWord(channel->busMaster + IDE_BM_PRD_TABLE,
+              (ulong_t) channel->prdTable);
+    Out_Byte(channel->busMaster + IDE_BM_COMMAND, direction);
+    Out_Byte(channel->busMaster + IDE_BM_STATUS,
+             IDE_BM_STATUS_INTERRUPT | IDE_BM_STATUS_ERROR);
+
+    channel->command.dma = true;
+    channel->command.type = type;
+    channel->command.rc = IDE_ERROR_NO_ERROR;
+    channel->command.active = true;
+    ++channel->dmaCommands;
+
+    IDE_Setup_Task_File(driveNum, blockNum, count, ext);
+    Out_Byte(channel->ioBase + IDE_COMMAND_REGISTER, command);
+    Out_Byte(channel->busMaster + IDE_BM_COMMAND,
+             direction | IDE_BM_COMMAND_START);
+
+    return IDE_Wait_For_Completion(channel);
+}
 
-    Out_Byte(IDE_COMMAND_REGISTER, IDE_COMMAND_WRITE_SECTORS);
+/*
+ * Issue one read or write command for up to IDE_MAX_SECTORS sectors
+ * and sleep until the interrupt handler has moved the data.  The
+ * drive raises DRQ once per sector, or once per multipleSectors
+ * sectors for READ/WRITE MULTIPLE.
+ * Called with the channel's lock held and interrupts disabled; the
+ * lock is released while waiting.
+ */
+static int IDE_Command(int driveNum, enum Request_Type type, int blockNum,
+                       int count, char *buffer) {
+    struct IDE_Channel *channel = IDE_CHANNEL(driveNum);
+    ideDisk *drive = &drives[driveNum];
+    bool ext = drive->lba48 && blockNum + count > IDE_LBA28_LIMIT;
+    bool multiple = drive->multipleSectors > 1 && count > 1;
+    int command, status;
+
+    KASSERT(count > 0 && count <= IDE_MAX_SECTORS);
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(!channel->command.active);
+
+    if(drive->dma && channel->busMaster != 0 && ((ulong_t) buffer & 1) == 0)
+        return IDE_DMA_Command(driveNum, type, blockNum, count, buffer);
+    ++channel->pioCommands;
+
+    if(type == BLOCK_READ)
+        command = multiple
+            ? (ext ? IDE_COMMAND_READ_MULTIPLE_EXT : IDE_COMMAND_READ_MULTIPLE)
+            : (ext ? IDE_COMMAND_READ_SECTORS_EXT : IDE_COMMAND_READ_SECTORS);
+    else
+        command = multiple
+            ? (ext ? IDE_COMMAND_WRITE_MULTIPLE_EXT :
+               IDE_COMMAND_WRITE_MULTIPLE)
+            : (ext ? IDE_COMMAND_WRITE_SECTORS_EXT :
+               IDE_COMMAND_WRITE_SECTORS);
+
+    channel->command.dma = false;
+    channel->command.type = type;
+    channel->command.buffer = buffer;
+    channel->command.remaining = count;
+    channel->command.perDrq = multiple ? drive->multipleSectors : 1;
+    channel->command.rc = IDE_ERROR_NO_ERROR;
+    channel->command.active = true;
+
+    IDE_Setup_Task_File(driveNum, blockNum, count, ext);
+    Out_Byte(channel->ioBase + IDE_COMMAND_REGISTER, command);
+
+    if(type == BLOCK_WRITE) {
+        /* the first block of write data is requested without an interrupt */
+        status = IDE_Wait(channel);
+        if((status & (IDE_STATUS_DRIVE_ERROR | IDE_STATUS_DRIVE_WRITE_FAULT))
+           || !(status & IDE_STATUS_DRIVE_DATA_REQUEST)) {
+            Print("ERROR: Got Write %d at block %d\n", status, blockNum);
+            channel->command.active = false;
+            return IDE_ERROR_DRIVE_ERROR;
+        }
+        IDE_Move_Data_Block(channel);
+    }
 
+    return IDE_Wait_For_Completion(channel);
+}
 
-    /* wait for the drive */
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY) ;
+/*
+ * Read or write numBlocks blocks starting at the logical block number
+ * indicated, IDE_MAX_SECTORS sectors per command.
+ */
+static int IDE_Transfer(int driveNum, enum Request_Type type, int blockNum,
+                        int numBlocks, char *buffer) {
+    int rc = IDE_ERROR_NO_ERROR;
+    struct IDE_Channel *channel;
+    bool reEnable;
 
-    bufferW = (short *)buffer;
-    for(i = 0; i < 256; i++) {
-        Out_Word(IDE_DATA_REGISTER, bufferW[i]);
+    if(driveNum < 0 || driveNum >= IDE_MAX_DRIVES
+       || !drives[driveNum].present) {
+        if(ideDebug)
+            Print("ide: invalid drive %d\n", driveNum);
+        return IDE_ERROR_BAD_DRIVE;
     }
 
-    if(ideDebug)
-        Print("About to wait for Write \n");
+    channel = IDE_CHANNEL(driveNum);
+    if(blockNum < 0 || numBlocks <= 0
+       || numBlocks > IDE_getNumBlocks(driveNum) - blockNum) {
+        if(ideDebug)
+            Print("ide: invalid block %d (+%d)\n", blockNum, numBlocks);
+        return IDE_ERROR_INVALID_BLOCK;
+    }
 
-    /* wait for the drive */
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY) ;
+    if(ideDebug >= 2)
+        Print("request to %s %d blocks at %d\n",
+              type == BLOCK_READ ? "read" : "write", numBlocks, blockNum);
 
-    if(In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_ERROR) {
-        Print("ERROR: Got Read %d\n", In_Byte(IDE_STATUS_REGISTER));
-        Spin_Unlock_Irq_Restore(&ideLock, reEnable);
-        return IDE_ERROR_DRIVE_ERROR;
-    }
+    while (numBlocks > 0 && rc == IDE_ERROR_NO_ERROR) {
+        int count =
+            numBlocks < IDE_MAX_SECTORS ? numBlocks : IDE_MAX_SECTORS;
 
-    if(ideDebug)
-        Print("write completed \n");
+        reEnable = Spin_Lock_Irq_Save(&channel->lock);
+        rc = IDE_Command(driveNum, type, blockNum, count, buffer);
+        Spin_Unlock_Irq_Restore(&channel->lock, reEnable);
 
-    Spin_Unlock_Irq_Restore(&ideLock, reEnable);
+        blockNum += count;
+        numBlocks -= count;
+        buffer += count * SECTOR_SIZE;
+    }
 
-    return IDE_ERROR_NO_ERROR;
+    return rc;
 }
 
 static int IDE_Open(struct Block_Device *dev) {
@@ -296,21 +701,28 @@ static struct Block_Device_Ops s_ideDeviceOps = {
     IDE_Get_Num_Blocks,
 };
 
-static void IDE_Request_Thread(ulong_t arg __attribute__ ((unused))) {
+/*
+ * Serve the requests for the drives on one channel.
+ */
+static void IDE_Request_Thread(ulong_t arg) {
+    struct IDE_Channel *channel = (struct IDE_Channel *)arg;
+
     for(;;) {
         struct Block_Request *request;
-        int rc;
+        int blockNum, i, rc = 0;
 
         /* Wait for a request to arrive */
-        request = Dequeue_Request(&s_ideRequestQueue);
+        request = Dequeue_Request(&channel->queue);
 
-        /* Do the I/O */
-        if(request->type == BLOCK_READ)
-            rc = IDE_Read(request->dev->unit, request->blockNum,
-                          request->buf);
-        else
-            rc = IDE_Write(request->dev->unit, request->blockNum,
-                           request->buf);
+        /* Do the I/O, a segment of memory at a time */
+        blockNum = request->blockNum;
+        for(i = 0; i < Get_Num_Request_Segments(request) && rc == 0; i++) {
+            struct Block_Segment seg = Get_Request_Segment(request, i);
+
+            rc = IDE_Transfer(request->dev->unit, request->type, blockNum,
+                              seg.numBlocks, seg.buf);
+            blockNum += seg.numBlocks;
+        }
 
         /* Notify requesting thread of final status */
         Notify_Request_Completion(request, rc == 0 ? COMPLETED : ERROR,
@@ -318,7 +730,59 @@ static void IDE_Request_Thread(ulong_t arg __attribute__ ((unused))) {
     }
 }
 
+/*
+ * Record the LBA capabilities from the identify data.  Sector counts
+ * are capped to fit the int block numbers of the block layer.
+ */
+static void Get_Drive_Addressing(int drive, const ushort_t * info) {
+    ulong_t sectors;
+
+    drives[drive].dma = (info[IDE_INDENTIFY_CAPABILITIES] &
+                         IDE_CAPABILITY_DMA) != 0;
+    drives[drive].lba = (info[IDE_INDENTIFY_CAPABILITIES] &
+                         IDE_CAPABILITY_LBA) != 0;
+    drives[drive].lba48 = drives[drive].lba &&
+        (info[IDE_INDENTIFY_COMMAND_SETS] & IDE_COMMAND_SET_LBA48) != 0;
+    if(!drives[drive].lba)
+        return;
+
+    sectors = info[IDE_INDENTIFY_LBA_SECTORS] |
+        ((ulong_t) info[IDE_INDENTIFY_LBA_SECTORS + 1] << 16);
+    if(drives[drive].lba48) {
+        ulong_t sectors48 = info[IDE_INDENTIFY_LBA48_SECTORS] |
+            ((ulong_t) info[IDE_INDENTIFY_LBA48_SECTORS + 1] << 16);
+
+        if(info[IDE_INDENTIFY_LBA48_SECTORS + 2] != 0
+           || info[IDE_INDENTIFY_LBA48_SECTORS + 3] != 0
+           || sectors48 > 0x7fffffff)
+            sectors48 = 0x7fffffff;
+        if(sectors48 > sectors)
+            sectors = sectors48;
+    }
+    drives[drive].num_Sectors = sectors;
+}
+
+/*
+ * Ask the drive to raise DRQ once per maxMultiple sectors for
+ * READ/WRITE MULTIPLE.  Leaves multipleSectors 0 if it refuses.
+ */
+static void Set_Multiple_Mode(int drive, int maxMultiple) {
+    struct IDE_Channel *channel = IDE_CHANNEL(drive);
+
+    drives[drive].multipleSectors = 0;
+    if(maxMultiple <= 1)
+        return;
+
+    Out_Byte(channel->ioBase + IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE(drive));
+    Out_Byte(channel->ioBase + IDE_SECTOR_COUNT_REGISTER, maxMultiple);
+    Out_Byte(channel->ioBase + IDE_COMMAND_REGISTER,
+             IDE_COMMAND_SET_MULTIPLE);
+    if(!(IDE_Wait(channel) & IDE_STATUS_DRIVE_ERROR))
+        drives[drive].multipleSectors = maxMultiple;
+}
+
 static int readDriveConfig(int drive) {
+    struct IDE_Channel *channel = IDE_CHANNEL(drive);
     int i;
     int status;
     short info[256];
@@ -328,11 +792,10 @@ static int readDriveConfig(int drive) {
     if(ideDebug > 1)
         Print("ide: about to read drive config for drive #%d\n", drive);
 
-    Out_Byte(IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE(drive));
-    Out_Byte(IDE_COMMAND_REGISTER, IDE_COMMAND_IDENTIFY_DRIVE);
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY) ;
-
-    status = In_Byte(IDE_STATUS_REGISTER);
+    Out_Byte(channel->ioBase + IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE(drive));
+    Out_Byte(channel->ioBase + IDE_COMMAND_REGISTER,
+             IDE_COMMAND_IDENTIFY_DRIVE);
+    status = IDE_Wait(channel);
     /*
      * simulate failure
      * status = 0x50;
@@ -341,7 +804,7 @@ static int readDriveConfig(int drive) {
         Print("ide: probe found ATA drive: ");
         /* drive responded to ATA probe */
         for(i = 0; i < 256; i++) {
-            info[i] = In_Word(IDE_DATA_REGISTER);
+            info[i] = In_Word(channel->ioBase + IDE_DATA_REGISTER);
         }
 
         drives[drive].num_Cylinders = info[IDE_INDENTIFY_NUM_CYLINDERS];
@@ -350,14 +813,19 @@ static int readDriveConfig(int drive) {
             info[IDE_INDENTIFY_NUM_SECTORS_TRACK];
         drives[drive].num_BytesPerSector =
             info[IDE_INDENTIFY_NUM_BYTES_SECTOR];
+
+        Get_Drive_Addressing(drive, (ushort_t *) info);
+        Set_Multiple_Mode(drive, info[IDE_INDENTIFY_MAX_MULTIPLE] & 0xff);
     } else {
         /* try for ATAPI */
-        Out_Byte(IDE_FEATURE_REG, 0);   /* disable dma & overlap */
-
-        Out_Byte(IDE_DRIVE_HEAD_REGISTER, IDE_DRIVE(drive));
-        Out_Byte(IDE_COMMAND_REGISTER, IDE_COMMAND_ATAPI_IDENT_DRIVE);
-        while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY) ;
-        status = In_Byte(IDE_STATUS_REGISTER);
+        /* disable dma & overlap */
+        Out_Byte(channel->ioBase + IDE_FEATURE_REG, 0);
+
+        Out_Byte(channel->ioBase + IDE_DRIVE_HEAD_REGISTER,
+                 IDE_DRIVE(drive));
+        Out_Byte(channel->ioBase + IDE_COMMAND_REGISTER,
+                 IDE_COMMAND_ATAPI_IDENT_DRIVE);
+        status = IDE_Wait(channel);
         // Print("status is %x\n",status);
         if((status & IDE_STATUS_DRIVE_DATA_REQUEST)) {
             Print("ide: found atapi drive\n");
@@ -367,14 +835,23 @@ static int readDriveConfig(int drive) {
         return -1;
     }
 
-    Print("    ide%d: cyl=%d, heads=%d, sectors=%d\n", drive,
+    Print("    ide%d: cyl=%d, heads=%d, sectors=%d", drive,
           drives[drive].num_Cylinders, drives[drive].num_Heads,
           drives[drive].num_SectorsPerTrack);
+    if(drives[drive].lba)
+        Print(", %s %d sectors", drives[drive].lba48 ? "lba48" : "lba",
+              drives[drive].num_Sectors);
+    if(drives[drive].multipleSectors > 0)
+        Print(", multiple %d", drives[drive].multipleSectors);
+    if(drives[drive].dma && channel->busMaster != 0)
+        Print(", dma");
+    Print("\n");
+    drives[drive].present = true;
 
     /* Register the drive as a block device */
     snprintf(devname, sizeof(devname), "ide%d", drive);
-    rc = Register_Block_Device(devname, &s_ideDeviceOps, drive, 0,
-                               &s_ideWaitQueue, &s_ideRequestQueue);
+    rc = Register_Block_Device(devname, &s_ideDeviceOps, drive, channel,
+                               &channel->queue);
     if(rc != 0)
         Print("  Error: could not create block device for %s\n", devname);
 
@@ -382,16 +859,73 @@ static int readDriveConfig(int drive) {
 }
 
 
-void Init_IDE(void) {
+void Dump_IDE_Stats(void) {
+    int c;
+
+    for(c = 0; c < IDE_NUM_CHANNELS; c++) {
+        struct IDE_Channel *channel = &s_ideChannels[c];
+
+        if(channel->present)
+            Print
+                ("ide channel %d: %lu dma commands, %lu pio commands, %lu timeouts\n",
+                 c, channel->dmaCommands, channel->pioCommands,
+                 channel->timeouts);
+    }
+}
+
+/*
+ * Find a PCI IDE controller that can bus master, enable it, and set
+ * up a PRD table for each channel.  Leaves busMaster 0 (PIO only) on
+ * a channel that cannot have one.  A simplex controller can only do
+ * DMA on one channel at a time, so it gets the primary only.
+ */
+static void Init_IDE_DMA(void) {
+    struct PCI_Device *dev;
+    ushort_t base;
+    int i, c;
+
+    for(i = 0; (dev = Find_PCI_Class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE,
+                                     i)) != 0; i++)
+        if((dev->progIf & IDE_PROG_IF_BUS_MASTER) && dev->barIsIO[4]
+           && dev->barSize[4] != 0)
+            break;
+    if(dev == 0)
+        return;
+
+    PCI_Enable_Device(dev, true);
+    base = dev->bar[4];
+    for(c = 0; c < IDE_NUM_CHANNELS; c++) {
+        struct IDE_Channel *channel = &s_ideChannels[c];
+
+        if(c > 0 && (In_Byte(base + IDE_BM_STATUS) & IDE_BM_STATUS_SIMPLEX))
+            break;
+        channel->prdTable = Alloc_Page();
+        if(channel->prdTable == 0)
+            break;
+        channel->busMaster = base + c * IDE_BM_CHANNEL_SIZE;
+        Out_Byte(channel->busMaster + IDE_BM_COMMAND, 0);
+    }
+    Print("ide: bus-master DMA at io %x (pci %04x:%04x)\n",
+          base, dev->vendorId, dev->deviceId);
+}
+
+/*
+ * Reset a channel and probe its two drive positions.  Returns the
+ * number of drives found.
+ */
+static int Init_IDE_Channel(struct IDE_Channel *channel) {
     int errorCode;
+    int found = 0;
+    int i;
 
-    Print("Initializing IDE controller...\n");
+    /* no controller answers at the address: the bus floats high */
+    if(In_Byte(channel->ioBase + IDE_STATUS_REGISTER) == 0xff)
+        return 0;
 
     /* Reset the controller and drives */
-    Out_Byte(IDE_DEVICE_CONTROL_REGISTER,
-             IDE_DCR_NOINTERRUPT | IDE_DCR_RESET);
+    Out_Byte(channel->controlPort, IDE_DCR_NOINTERRUPT | IDE_DCR_RESET);
     Micro_Delay(100);
-    Out_Byte(IDE_DEVICE_CONTROL_REGISTER, IDE_DCR_NOINTERRUPT);
+    Out_Byte(channel->controlPort, IDE_DCR_NOINTERRUPT);
 
 /*
  * FIXME: This code doesn't work on Bochs 2.0.
@@ -400,28 +934,59 @@ void Init_IDE(void) {
  */
 
     /* This code does work on Bochs 2.0. */
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY) ;
+    IDE_Wait(channel);
 
     if(ideDebug)
-        Print("About to run drive Diagnosis\n");
+        Print("About to run drive Diagnosis on channel %d\n", channel->num);
 
-    Out_Byte(IDE_COMMAND_REGISTER, IDE_COMMAND_DIAGNOSTIC);
-    while (In_Byte(IDE_STATUS_REGISTER) & IDE_STATUS_DRIVE_BUSY) ;
-    errorCode = In_Byte(IDE_ERROR_REGISTER);
+    Out_Byte(channel->ioBase + IDE_COMMAND_REGISTER, IDE_COMMAND_DIAGNOSTIC);
+    IDE_Wait(channel);
+    errorCode = In_Byte(channel->ioBase + IDE_ERROR_REGISTER);
     if(ideDebug > 1)
         Print("ide: ide error register = %x\n", errorCode);
 
     /* Probe and register drives */
-    int i;
-    for(i = 0; i < IDE_MAX_DRIVES; i++) {
-        if(readDriveConfig(i) == 0)
-            ++numDrives;
+    for(i = 0; i < 2; i++) {
+        if(readDriveConfig(2 * channel->num + i) == 0)
+            ++found;
+    }
+    return found;
+}
+
+void Init_IDE(void) {
+    int c;
+
+    Print("Initializing IDE controller...\n");
+
+    for(c = 0; c < IDE_NUM_CHANNELS; c++) {
+        struct IDE_Channel *channel = &s_ideChannels[c];
+
+        channel->num = c;
+        channel->ioBase = s_ideLegacyChannels[c].ioBase;
+        channel->controlPort = s_ideLegacyChannels[c].controlPort;
+        channel->irq = s_ideLegacyChannels[c].irq;
+        Spin_Lock_Init(&channel->lock);
+        Clear_Thread_Queue(&channel->interruptWaitQueue);
+        Init_Block_Queue(&channel->queue);
+    }
+    Init_IDE_DMA();
+
+    for(c = 0; c < IDE_NUM_CHANNELS; c++) {
+        struct IDE_Channel *channel = &s_ideChannels[c];
+        int found = Init_IDE_Channel(channel);
+
+        if(found == 0)
+            continue;
+        numDrives += found;
+
+        /* Start the channel's request thread, and let its drives interrupt */
+        channel->present = true;
+        Install_IRQ(channel->irq, &IDE_Interrupt_Handler);
+        Enable_IRQ(channel->irq);
+        Out_Byte(channel->controlPort, 0);
+        Start_Kernel_Thread(IDE_Request_Thread, (ulong_t) channel,
+                            PRIORITY_NORMAL, true, "{IDE}");
     }
     if(ideDebug)
         Print("Found %d IDE drives\n", numDrives);
-
-    /* Start request thread */
-    if(numDrives > 0)
-        Start_Kernel_Thread(IDE_Request_Thread, 0, PRIORITY_NORMAL, true,
-                            "{IDE}");
 }
@@ -51,6 +51,43 @@ ushort_t In_Word(ushort_t port) {
     return value;
 }
 
+/*
+ * Write a double word to an I/O port.
+ */
+void Out_DWord(ushort_t port, ulong_t value) {
+    __asm__ __volatile__("outl %0, %w1"::"a"(value), "Nd"(port)
+        );
+}
+
+/*
+ * Read a double word from an I/O port.
+ */
+ulong_t In_DWord(ushort_t port) {
+    ulong_t value;
+
+    __asm__ __volatile__("inl %w1, %0":"=a"(value)
+                         :"Nd"(port)
+        );
+
+    return value;
+}
+
+/*
+ * Write count words from buf to an I/O port.
+ */
+void Out_Words(ushort_t port, const void *buf, ulong_t count) {
+    __asm__ __volatile__("rep outsw":"+S"(buf), "+c"(count)
+                         :"d"(port):"memory");
+}
+
+/*
+ * Read count words from an I/O port into buf.
+ */
+void In_Words(ushort_t port, void *buf, ulong_t count) {
+    __asm__ __volatile__("rep insw":"+D"(buf), "+c"(count)
+                         :"d"(port):"memory");
+}
+
 /*
  * Short delay.  May be needed when talking to some
  * (slow) I/O devices.
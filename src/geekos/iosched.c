@@ -0,0 +1,176 @@
+/*
+ * I/O schedulers for block request queues.
+ *
+ * Every scheduler keeps its pending requests on queue->requests, so
+ * the block layer can tell an empty queue from a busy one; clook and
+ * deadline keep that list sorted by block number.  A merged request
+ * is the first of a chain of requests linked through mergedNext; the
+ * driver sees one transfer, and Notify_Request_Completion() completes
+ * every request in the chain.
+ */
+
+#include <geekos/ktypes.h>
+#include <geekos/kassert.h>
+#include <geekos/string.h>
+#include <geekos/timer.h>
+#include <geekos/blockdev.h>
+#include <geekos/iosched.h>
+
+/* How long a request may wait under the deadline scheduler */
+#define READ_EXPIRE_TICKS   (50 * TICKS_PER_SEC / 1000)
+#define WRITE_EXPIRE_TICKS  (500 * TICKS_PER_SEC / 1000)
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Can back be done in the same transfer as front, right after it?
+ * Only single-buffer requests merge.
+ */
+static bool Can_Merge(struct Block_Queue *queue,
+                      const struct Block_Request *front,
+                      const struct Block_Request *back) {
+    return front->dev == back->dev && front->type == back->type
+        && front->segments == 0 && back->segments == 0
+        && front->blockNum + front->numBlocks == back->blockNum
+        && (char *)front->buf + front->numBlocks * SECTOR_SIZE == back->buf
+        && front->numBlocks + back->numBlocks <= queue->maxBlocks;
+}
+
+/*
+ * Append back (with anything merged behind it) to front's chain.
+ */
+static void Merge_Requests(struct Block_Queue *queue,
+                           struct Block_Request *front,
+                           struct Block_Request *back) {
+    struct Block_Request *last = front;
+
+    while (last->mergedNext != 0)
+        last = last->mergedNext;
+    last->mergedNext = back;
+    front->numBlocks += back->numBlocks;
+    front->mergedBlocks += back->numBlocks;
+    back->numBlocks -= back->mergedBlocks;
+    back->mergedBlocks = 0;
+    if((long)(back->submitTime - front->submitTime) < 0)
+        front->submitTime = back->submitTime;
+    ++queue->merged;
+}
+
+static void Fifo_Add(struct Block_Queue *queue,
+                     struct Block_Request *request) {
+    Add_To_Back_Of_Block_Request_List(&queue->requests, request);
+}
+
+static struct Block_Request *Fifo_Next(struct Block_Queue *queue) {
+    return Remove_From_Front_Of_Block_Request_List(&queue->requests);
+}
+
+/*
+ * Insert request in block order, merging it with its neighbours
+ * where they are adjacent.
+ */
+static void Sorted_Add(struct Block_Queue *queue,
+                       struct Block_Request *request) {
+    struct Block_Request_List *list = &queue->requests;
+    struct Block_Request *prev = 0;
+    struct Block_Request *next = Get_Front_Of_Block_Request_List(list);
+
+    while (next != 0 && next->blockNum <= request->blockNum) {
+        prev = next;
+        next = Get_Next_In_Block_Request_List(next);
+    }
+
+    if(prev != 0 && Can_Merge(queue, prev, request)) {
+        Merge_Requests(queue, prev, request);
+        /* the gap to the next one may now be closed */
+        if(next != 0 && Can_Merge(queue, prev, next)) {
+            Remove_From_Block_Request_List(list, next);
+            Merge_Requests(queue, prev, next);
+        }
+        return;
+    }
+
+    if(prev != 0)
+        Insert_Into_Block_Request_List(list, prev, request);
+    else
+        Add_To_Front_Of_Block_Request_List(list, request);
+    if(next != 0 && Can_Merge(queue, request, next)) {
+        Remove_From_Block_Request_List(list, next);
+        Merge_Requests(queue, request, next);
+    }
+}
+
+/*
+ * C-LOOK: the first request at or beyond the head position, or the
+ * lowest one if there is none.
+ */
+static struct Block_Request *Clook_Next(struct Block_Queue *queue) {
+    struct Block_Request *request =
+        Get_Front_Of_Block_Request_List(&queue->requests);
+
+    while (request != 0 && request->blockNum < queue->headPos)
+        request = Get_Next_In_Block_Request_List(request);
+    if(request == 0)
+        request = Get_Front_Of_Block_Request_List(&queue->requests);
+    if(request != 0)
+        Remove_From_Block_Request_List(&queue->requests, request);
+    return request;
+}
+
+/*
+ * The oldest request of the given type that has waited at least
+ * limit ticks, or 0.
+ */
+static struct Block_Request *Oldest_Expired(struct Block_Queue *queue,
+                                            enum Request_Type type,
+                                            ulong_t limit) {
+    struct Block_Request *request, *oldest = 0;
+
+    for(request = Get_Front_Of_Block_Request_List(&queue->requests);
+        request != 0; request = Get_Next_In_Block_Request_List(request))
+        if(request->type == type
+           && (oldest == 0
+               || (long)(request->submitTime - oldest->submitTime) < 0))
+            oldest = request;
+    if(oldest != 0 && g_numTicks - oldest->submitTime >= limit)
+        return oldest;
+    return 0;
+}
+
+static struct Block_Request *Deadline_Next(struct Block_Queue *queue) {
+    struct Block_Request *request =
+        Oldest_Expired(queue, BLOCK_READ, READ_EXPIRE_TICKS);
+
+    if(request == 0)
+        request = Oldest_Expired(queue, BLOCK_WRITE, WRITE_EXPIRE_TICKS);
+    if(request == 0)
+        return Clook_Next(queue);
+    Remove_From_Block_Request_List(&queue->requests, request);
+    ++queue->expired;
+    return request;
+}
+
+static const struct Block_Scheduler s_schedulers[] = {
+    {"clook", Sorted_Add, Clook_Next},
+    {"deadline", Sorted_Add, Deadline_Next},
+    {"fifo", Fifo_Add, Fifo_Next},
+};
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+const struct Block_Scheduler *Find_Block_Scheduler(const char *name) {
+    unsigned i;
+
+    for(i = 0; i < sizeof(s_schedulers) / sizeof(s_schedulers[0]); i++)
+        if(strcmp(s_schedulers[i].name, name) == 0)
+            return &s_schedulers[i];
+    return 0;
+}
+
+const struct Block_Scheduler *Default_Block_Scheduler(void) {
+    return &s_schedulers[0];
+}
@@ -41,17 +41,72 @@ static ushort_t s_irqMask = 0xff7b;     /* ns: disable irq7 which qemu may gener
 #define MASTER(mask) ((mask) & 0xff)
 #define SLAVE(mask) (((mask)>>8) & 0xff)
 
+/*
+ * Handlers of IRQ lines that several devices share, such as PCI
+ * INTx lines, called in turn on every interrupt of the line.
+ */
+#define MAX_SHARED_IRQ_HANDLERS 4
+static Interrupt_Handler s_sharedHandlers[NUM_EXTERNAL_INTS]
+    [MAX_SHARED_IRQ_HANDLERS];
+static int s_numSharedHandlers[NUM_EXTERNAL_INTS];
+static ushort_t s_exclusiveIrqs;        /* lines taken by Install_IRQ() */
+
+static void Shared_IRQ_Handler(struct Interrupt_State *state) {
+    int irq = state->intNum - FIRST_EXTERNAL_INT, i;
+
+    Begin_IRQ(state);
+    for(i = 0; i < s_numSharedHandlers[irq]; i++)
+        s_sharedHandlers[irq][i] (state);
+    End_IRQ(state);
+}
+
 
 /* ----------------------------------------------------------------------
  * Public functions
  * ---------------------------------------------------------------------- */
 
 /*
- * Install a handler for given IRQ.
+ * Install a handler for given IRQ, which is delivered at interrupt
+ * FIRST_EXTERNAL_INT + irq.
  * Note that we don't unmask the IRQ.
  */
 void Install_IRQ(int irq, Interrupt_Handler handler) {
-    Map_IO_APIC_IRQ(irq, handler);
+    KASSERT(irq >= 0 && irq < NUM_EXTERNAL_INTS);
+    KASSERT0(s_numSharedHandlers[irq] == 0,
+             "Install_IRQ on a line with shared handlers");
+    s_exclusiveIrqs |= 1 << irq;
+    Map_IO_APIC_IRQ(irq, handler, false);
+}
+
+/*
+ * Add a handler for an IRQ line that other devices may be using too.
+ * Every handler of the line is called on each of its interrupts, and
+ * must check whether its own devices raised it.  The line is programmed
+ * level-triggered and active-low, as PCI INTx lines are, so a device
+ * that still asserts it after the handlers have run interrupts again
+ * rather than being lost.  Shared handlers are called between
+ * Begin_IRQ() and End_IRQ(), so do not call them.
+ * Adding a handler the line already has does nothing.
+ * Note that we don't unmask the IRQ.
+ */
+void Install_Shared_IRQ(int irq, Interrupt_Handler handler) {
+    bool iflag = Save_And_Disable_Interrupts();
+    int i;
+
+    KASSERT(irq >= 0 && irq < NUM_EXTERNAL_INTS);
+    KASSERT0(!(s_exclusiveIrqs & (1 << irq)),
+             "Install_Shared_IRQ on a line taken by Install_IRQ");
+    for(i = 0; i < s_numSharedHandlers[irq]; i++)
+        if(s_sharedHandlers[irq][i] == handler)
+            break;
+    if(i == s_numSharedHandlers[irq]) {
+        KASSERT(i < MAX_SHARED_IRQ_HANDLERS);
+        s_sharedHandlers[irq][i] = handler;
+        ++s_numSharedHandlers[irq];
+        if(i == 0)
+            Map_IO_APIC_IRQ(irq, &Shared_IRQ_Handler, true);
+    }
+    Restore_Interrupt_State(iflag);
 }
 
 /*
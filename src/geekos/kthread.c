@@ -441,6 +441,13 @@ static void Setup_Kernel_Thread(struct Kernel_Thread *kthread,
  */
 static void Idle(ulong_t arg __attribute__ ((unused))) {
     while (true) {
+        /*
+         * Spend idle time refilling the pool of pre-zeroed pages,
+         * one page at a time so no lock is held for long.
+         */
+        if(Zero_Free_Page())
+            continue;
+
         /* 
          * The hlt instruction tells the CPU to wait until an interrupt is called.
          * We call this in this loop so the Idle process does not eat up 100% cpu,
@@ -754,8 +761,6 @@ void Yield(void) {
  * Calling this function initiates a context switch.
  */
 void Exit(int exitCode) {
-    extern int Munmap_Impl(uint_t addr);
-
     bool iflag;
     struct Kernel_Thread *current = CURRENT_THREAD;
 
@@ -901,6 +906,23 @@ void Wait(struct Thread_Queue *waitQueue) {
     Schedule_And_Unlock(&waitQueue->lock);
 }
 
+/*
+ * Sleep on waitQueue, releasing lock, which the caller holds with
+ * interrupts disabled, and take it again on waking.  The thread is
+ * queued before the lock is dropped, so a Wake_Up() by whoever next
+ * takes the lock cannot be missed.  See Wait_Until().
+ */
+void Wait_And_Relock(struct Thread_Queue *waitQueue, Spin_Lock_t * lock) {
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(Is_Locked(lock));
+
+    Add_To_Back_Of_Thread_Queue(waitQueue, CURRENT_THREAD);
+    /* stay disabled on waking; the caller restores its own state */
+    lock->iflag = false;
+    Schedule_And_Unlock(lock);
+    Spin_Lock(lock);
+}
+
 void Wake_Up_Locked(struct Thread_Queue *waitQueue) {
     struct Kernel_Thread *kthread;
 
@@ -250,6 +250,8 @@ Load_LDTR:
 ; Start paging
 ;	load crt3 with the passed page directory pointer
 ;	enable paging bit in cr2
+;	and write protect (bit 16), so kernel writes to read-only
+;	user pages fault too, and copy-on-write pages get copied
 ;; nspring - ecx is caller save, ebx is callee save. 
 align 8
 Enable_Paging:
@@ -258,7 +260,7 @@ Enable_Paging:
     mov	eax, cr3                
     mov	cr3, eax
     mov	ecx, cr0
-    or	ecx, 0x80000000
+    or	ecx, 0x80010000
     mov	cr0, ecx
     ret
 
@@ -342,6 +344,10 @@ Handle_Interrupt:
     mov	ds, ax
     mov	es, ax
 
+    ; C code (memcpy's rep movs in particular) expects the direction
+    ; flag clear, whatever the interrupted code left it as.
+    cld
+
     ; Get the address of the C handler function from the
     ; table of handler functions.
     mov	eax, g_interruptTable	; get address of handler table
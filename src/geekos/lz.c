@@ -0,0 +1,143 @@
+/*
+ * Small LZ77-family compressor (LZF format).
+ *
+ * Compression looks up the next three input bytes in a hash table of
+ * recent positions and emits a back reference when the bytes there
+ * match; it does not search for the longest match, which keeps it
+ * fast enough to run on every page evicted.
+ */
+
+#include <geekos/lz.h>
+#include <geekos/kassert.h>
+#include <geekos/string.h>
+#include <geekos/errno.h>
+
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_MAX_LITERAL 32
+#define LZ_MAX_OFFSET  (1 << 13)
+#define LZ_MAX_MATCH   (7 + 255 + 2)
+
+#define LZ_HASH(p) \
+    ((uint_t) ((((uint_t) (p)[0] << 16) | ((p)[1] << 8) | (p)[2]) \
+               * 2654435761U) >> (32 - LZ_HASH_BITS))
+
+/*
+ * Compress srcLen bytes (at most 64 KB) from src into dst.
+ * Returns the compressed length, or 0 if it would not fit in dstMax
+ * bytes (i.e., the data does not compress).
+ */
+int LZ_Compress(const void *src, int srcLen, void *dst, int dstMax,
+                void *work) {
+    const uchar_t *in = src, *ip = in, *inEnd = in + srcLen;
+    uchar_t *out = dst, *op = out, *outEnd = out + dstMax;
+    uchar_t *literalCtl;
+    ushort_t *table = work;
+    int literals = 0;
+
+    KASSERT(srcLen <= 65536);
+    memset(table, '\0', LZ_WORK_SIZE);
+
+    if(op >= outEnd)
+        return 0;
+    literalCtl = op++;          /* control byte of the first literal run */
+
+    while (ip < inEnd) {
+        if(ip + 2 < inEnd) {
+            uint_t h = LZ_HASH(ip);
+            const uchar_t *ref = in + table[h];
+            ulong_t offset = ip - ref - 1;
+
+            table[h] = ip - in;
+            if(ref < ip && offset < LZ_MAX_OFFSET && ref[0] == ip[0]
+               && ref[1] == ip[1] && ref[2] == ip[2]) {
+                int len = 3, maxLen = inEnd - ip;
+
+                if(maxLen > LZ_MAX_MATCH)
+                    maxLen = LZ_MAX_MATCH;
+                while (len < maxLen && ref[len] == ip[len])
+                    len++;
+
+                /* close the literal run, or drop its unused control byte */
+                if(literals > 0)
+                    *literalCtl = literals - 1;
+                else
+                    op--;
+                literals = 0;
+
+                if(op + 3 >= outEnd)
+                    return 0;
+                ip += len;
+                len -= 2;
+                if(len < 7) {
+                    *op++ = (len << 5) | (offset >> 8);
+                } else {
+                    *op++ = (7 << 5) | (offset >> 8);
+                    *op++ = len - 7;
+                }
+                *op++ = offset;
+                literalCtl = op++;
+                continue;
+            }
+        }
+
+        if(op >= outEnd)
+            return 0;
+        *op++ = *ip++;
+        if(++literals == LZ_MAX_LITERAL) {
+            *literalCtl = literals - 1;
+            literals = 0;
+            if(op >= outEnd)
+                return 0;
+            literalCtl = op++;
+        }
+    }
+
+    if(literals > 0)
+        *literalCtl = literals - 1;
+    else
+        op--;
+    return op - out;
+}
+
+/*
+ * Decompress srcLen bytes from src into dst.
+ * Returns the decompressed length, or EINVALID if the input is
+ * corrupt or would overflow dstMax bytes.
+ */
+int LZ_Decompress(const void *src, int srcLen, void *dst, int dstMax) {
+    const uchar_t *ip = src, *inEnd = ip + srcLen;
+    uchar_t *out = dst, *op = out, *outEnd = out + dstMax;
+
+    while (ip < inEnd) {
+        uint_t ctl = *ip++;
+
+        if(ctl < LZ_MAX_LITERAL) {
+            uint_t len = ctl + 1;
+
+            if(ip + len > inEnd || op + len > outEnd)
+                return EINVALID;
+            memcpy(op, ip, len);
+            op += len;
+            ip += len;
+        } else {
+            uint_t len = ctl >> 5;
+            const uchar_t *ref;
+
+            if(len == 7) {
+                if(ip >= inEnd)
+                    return EINVALID;
+                len += *ip++;
+            }
+            if(ip >= inEnd)
+                return EINVALID;
+            ref = op - ((ctl & 0x1f) << 8) - *ip++ - 1;
+            len += 2;
+            if(ref < out || op + len > outEnd)
+                return EINVALID;
+            /* byte at a time: the source may overlap the destination */
+            while (len-- > 0)
+                *op++ = *ref++;
+        }
+    }
+    return op - out;
+}
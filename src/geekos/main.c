@@ -20,6 +20,7 @@
 #include <geekos/string.h>
 #include <geekos/screen.h>
 #include <geekos/mem.h>
+#include <geekos/malloc.h>
 #include <geekos/crc32.h>
 #include <geekos/tss.h>
 #include <geekos/int.h>
@@ -28,7 +29,10 @@
 #include <geekos/timer.h>
 #include <geekos/keyboard.h>
 #include <geekos/dma.h>
+#include <geekos/pci.h>
 #include <geekos/ide.h>
+#include <geekos/virtio_blk.h>
+#include <geekos/ahci.h>
 #include <geekos/floppy.h>
 #include <geekos/pfat.h>
 #include <geekos/vfs.h>
@@ -125,8 +129,10 @@ void Main(struct Boot_Info *bootInfo) {
     Print("Init_SMP\n");
     Init_SMP();
     Print("/Init_SMP\n");
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A,
-           "initialize virtual memory page tables.");
+    Init_Page_Caches();
+    Init_Heap_Caches();
+    if(PROJECT_VIRTUAL_MEMORY_A)
+        Init_VM(bootInfo);
     Init_Scheduler(0, (void *)KERN_STACK);
     Init_Traps();
     Init_Local_APIC(0);
@@ -135,7 +141,10 @@ void Main(struct Boot_Info *bootInfo) {
     Init_Keyboard();
     Init_DMA();
     /* Init_Floppy(); *//* floppy initialization hangs on virtualbox */
+    Init_PCI();
     Init_IDE();
+    Init_Virtio_Blk();
+    Init_AHCI();
     Init_PFAT();
     if(Init_GFS2)
         Init_GFS2();
@@ -168,8 +177,8 @@ void Main(struct Boot_Info *bootInfo) {
     /* End sound init */
 
     Mount_Root_Filesystem();
-
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A, "initialize page file.");
+    if(PROJECT_VIRTUAL_MEMORY_A)
+        Init_Paging();
 
     Set_Current_Attr(ATTRIB(BLACK, GREEN | BRIGHT));
     Print("Welcome to GeekOS!\n");
@@ -2,7 +2,7 @@
  * GeekOS memory allocation API
  * Copyright (c) 2001, David H. Hovemeyer <daveho@cs.umd.edu>
  * $Revision: 1.13 $
- * 
+ *
  * This is free software.  You are permitted to use,
  * redistribute, and modify it as specified in the file "COPYING".
  */
@@ -15,19 +15,359 @@
 #include <geekos/lock.h>
 #include <geekos/string.h>
 #include <geekos/synch.h>
+#include <geekos/list.h>
+#include <geekos/mem.h>
+#include <geekos/smp.h>
+#include <geekos/atomic.h>
+
+/*
+ * The kernel heap has two parts.
+ *
+ * Small requests (up to HEAP_MAX_SMALL bytes) are rounded up to a
+ * size class and served from per-CPU "spans": single pages carved
+ * into equal-sized objects.  A CPU allocates only from spans it owns
+ * and frees into them without a lock (interrupts disabled).  A CPU
+ * freeing an object of a span owned by another CPU pushes it onto the
+ * span's remoteFree stack with compare-and-swap; the owner collects
+ * those when it runs short.  Empty spans go back to the page allocator.
+ *
+ * Larger requests go to bget under mallocLock.  The heap starts with
+ * the KERNEL_HEAP_SIZE region reserved by Init_Mem() and grows by
+ * HEAP_GROW_SIZE blocks of contiguous pages; requests too big for a
+ * block get their own run of pages.  Blocks that become entirely free
+ * are returned to the page allocator.
+ */
 
 struct Mutex mallocLock;
 
+#define HEAP_GROW_SIZE  (256*1024)
+#define HEAP_MAX_SMALL  2048
+
+static const ulong_t s_sizeClasses[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536,
+    HEAP_MAX_SMALL
+};
+
+#define NUM_SIZE_CLASSES ((int)(sizeof(s_sizeClasses) / sizeof(s_sizeClasses[0])))
+
+struct Heap_Span;
+DEFINE_LIST(Heap_Span_List, Heap_Span);
+
+/* Header at the start of each span page. */
+struct Heap_Span {
+    DEFINE_LINK(Heap_Span_List, Heap_Span);
+    void *freeList;             /* touched only by the owning CPU */
+    void *volatile remoteFree;  /* objects freed by other CPUs */
+    short cpu;                  /* owning CPU */
+    short sizeClass;
+    short inUse;                /* not counting uncollected remote frees */
+    short capacity;
+};
+
+IMPLEMENT_LIST(Heap_Span_List, Heap_Span);
+
+#define HEAP_SPAN_HEADER_SIZE 32
+
+/* Per-CPU small-object heap. */
+struct Heap_CPU_Cache {
+    struct Heap_Span_List partial[NUM_SIZE_CLASSES];    /* have free objects */
+    struct Heap_Span_List full[NUM_SIZE_CLASSES];
+    ulong_t allocs;
+    ulong_t frees;
+    ulong_t remoteFrees;        /* frees this CPU pushed to other CPUs */
+    ulong_t spansCreated;
+    ulong_t spansReleased;
+};
+
+static struct Heap_CPU_Cache *s_heapCaches;
+static int s_numHeapCaches;
+
+/* Large-object heap statistics, protected by mallocLock. */
+static ulong_t s_blocksAcquired, s_blocksReleased, s_pagesInBlocks;
+
+/* ----------------------------------------------------------------------
+ * Large objects: bget pool expansion
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Called by bget when it needs a new block of memory, either a
+ * HEAP_GROW_SIZE pool or a direct block for one large request.
+ */
+static void *Acquire_Heap_Block(bufsize size) {
+    int numPages = Round_Up_To_Page(size) / PAGE_SIZE;
+    void *block = Alloc_Contiguous_Pages(numPages);
+
+    if(block) {
+        ++s_blocksAcquired;
+        s_pagesInBlocks += numPages;
+    }
+    return block;
+}
+
+/*
+ * Called by bget when a block it acquired is entirely free again.
+ */
+static void Release_Heap_Block(void *block) {
+    struct Page *page = Get_Page((ulong_t) block);
+
+    if(page->flags & PAGE_HEAP) {
+        /* part of the initial heap region; keep it */
+        bpool(block, HEAP_GROW_SIZE);
+        return;
+    }
+
+    ++s_blocksReleased;
+    s_pagesInBlocks -= Free_Contiguous_Pages(block);
+}
+
+/* ----------------------------------------------------------------------
+ * Small objects: per-CPU spans
+ * ---------------------------------------------------------------------- */
+
+static int Size_Class(ulong_t size) {
+    int i;
+
+    for(i = 0; size > s_sizeClasses[i]; i++) ;
+    return i;
+}
+
+/*
+ * Get the current CPU's small-object heap, or null if there is none.
+ * Must be called with interrupts disabled.
+ */
+static struct Heap_CPU_Cache *Get_Heap_Cache(int *pId) {
+    int id;
+
+    if(s_heapCaches == 0)
+        return 0;
+    id = Get_CPU_ID();
+    if(id < 0 || id >= s_numHeapCaches)
+        return 0;
+    *pId = id;
+    return &s_heapCaches[id];
+}
+
+static void Unlink_Span(struct Heap_Span *span) {
+    struct Heap_Span_List *list = span->inHeap_Span_List;
+
+    if(span->prevHeap_Span_List != 0)
+        span->prevHeap_Span_List->nextHeap_Span_List =
+            span->nextHeap_Span_List;
+    else
+        list->head = span->nextHeap_Span_List;
+    if(span->nextHeap_Span_List != 0)
+        span->nextHeap_Span_List->prevHeap_Span_List =
+            span->prevHeap_Span_List;
+    else
+        list->tail = span->prevHeap_Span_List;
+    span->inHeap_Span_List = 0;
+}
+
+static void Move_Span(struct Heap_Span *span, struct Heap_Span_List *to) {
+    Unlink_Span(span);
+    Locked_Unchecked_Add_To_Back_Of_Heap_Span_List(to, span);
+}
+
+/*
+ * Move objects other CPUs freed into a span back to its free list.
+ * Returns the number collected.
+ */
+static int Collect_Remote_Frees(struct Heap_Span *span) {
+    int old, count = 0;
+    void *obj, *next;
+
+    do {
+        old = Atomic_Load((int *)&span->remoteFree);
+    } while (old != 0
+             && !Atomic_Compare_And_Swap((int *)&span->remoteFree, &old,
+                                         0));
+
+    for(obj = (void *)old; obj != 0; obj = next) {
+        next = *(void **)obj;
+        *(void **)obj = span->freeList;
+        span->freeList = obj;
+        ++count;
+    }
+    span->inUse -= count;
+    return count;
+}
+
+static struct Heap_Span *Create_Span(struct Heap_CPU_Cache *cache, int id,
+                                     int sizeClass) {
+    struct Heap_Span *span;
+    ulong_t size = s_sizeClasses[sizeClass];
+    char *obj;
+    int i;
+
+    span = Alloc_Page_Atomic();
+    if(span == 0)
+        return 0;
+    Get_Page((ulong_t) span)->flags |= PAGE_SPAN;
+
+    span->freeList = 0;
+    span->remoteFree = 0;
+    span->cpu = id;
+    span->sizeClass = sizeClass;
+    span->inUse = 0;
+    span->capacity = (PAGE_SIZE - HEAP_SPAN_HEADER_SIZE) / size;
+    obj = (char *)span + HEAP_SPAN_HEADER_SIZE + (span->capacity - 1) * size;
+    for(i = 0; i < span->capacity; i++, obj -= size) {
+        *(void **)obj = span->freeList;
+        span->freeList = obj;
+    }
+
+    Locked_Unchecked_Add_To_Back_Of_Heap_Span_List(&cache->
+                                                   partial[sizeClass],
+                                                   span);
+    ++cache->spansCreated;
+    return span;
+}
+
+static void Release_Span(struct Heap_CPU_Cache *cache,
+                         struct Heap_Span *span) {
+    Unlink_Span(span);
+    Get_Page((ulong_t) span)->flags &= ~(PAGE_SPAN);
+    ++cache->spansReleased;
+    Free_Page(span);
+}
+
+/*
+ * Find a span with a free object when the partial list is empty:
+ * first a full span that other CPUs have freed into, else a new one.
+ */
+static struct Heap_Span *Refill_Partial(struct Heap_CPU_Cache *cache,
+                                        int id, int sizeClass) {
+    struct Heap_Span *span, *next;
+
+    for(span = Get_Front_Of_Heap_Span_List(&cache->full[sizeClass]);
+        span != 0; span = next) {
+        next = Get_Next_In_Heap_Span_List(span);
+        if(span->remoteFree != 0 && Collect_Remote_Frees(span) > 0) {
+            Move_Span(span, &cache->partial[sizeClass]);
+            return span;
+        }
+    }
+    return Create_Span(cache, id, sizeClass);
+}
+
+static void *Alloc_Small(ulong_t size) {
+    struct Heap_CPU_Cache *cache;
+    struct Heap_Span *span;
+    void *obj = 0;
+    int id, sizeClass = Size_Class(size);
+    bool iflag = Save_And_Disable_Interrupts();
+
+    cache = Get_Heap_Cache(&id);
+    if(cache == 0)
+        goto done;
+
+    span = Get_Front_Of_Heap_Span_List(&cache->partial[sizeClass]);
+    if(span == 0)
+        span = Refill_Partial(cache, id, sizeClass);
+    if(span == 0)
+        goto done;
+
+    obj = span->freeList;
+    KASSERT(obj);
+    span->freeList = *(void **)obj;
+    ++span->inUse;
+    if(span->freeList == 0 && Collect_Remote_Frees(span) == 0)
+        Move_Span(span, &cache->full[sizeClass]);
+    ++cache->allocs;
+
+  done:
+    Restore_Interrupt_State(iflag);
+    return obj;
+}
+
+static void Free_Small(void *obj) {
+    struct Heap_Span *span =
+        (struct Heap_Span *)Round_Down_To_Page((ulong_t) obj);
+    struct Heap_CPU_Cache *cache;
+    struct Heap_Span_List *partial;
+    int id = -1;
+    bool iflag = Save_And_Disable_Interrupts();
+
+    cache = Get_Heap_Cache(&id);
+
+    if(cache == 0 || span->cpu != id) {
+        /* owned by another CPU: hand it back without a lock */
+        int old;
+        do {
+            old = Atomic_Load((int *)&span->remoteFree);
+            *(void **)obj = (void *)old;
+        } while (!Atomic_Compare_And_Swap
+                 ((int *)&span->remoteFree, &old, (int)obj));
+        if(cache)
+            ++cache->remoteFrees;
+        Restore_Interrupt_State(iflag);
+        return;
+    }
+
+    partial = &cache->partial[span->sizeClass];
+    *(void **)obj = span->freeList;
+    span->freeList = obj;
+    --span->inUse;
+    ++cache->frees;
+    if(span->inHeap_Span_List != partial)
+        Move_Span(span, partial);
+
+    /* keep one span per size class, give back other empty ones */
+    if(span->inUse == 0 && span->remoteFree == 0
+       && (partial->head != span || span->nextHeap_Span_List != 0))
+        Release_Span(cache, span);
+
+    Restore_Interrupt_State(iflag);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
 /*
  * Initialize the heap starting at given address and occupying
  * specified number of bytes.
  */
 void Init_Heap(ulong_t start, ulong_t size) {
+    ulong_t offset;
+
     Print("Creating kernel heap: start=%lx, size=%ld\n", start, size);
-    bpool((void *)start, size);
+
+    /*
+     * Pool in HEAP_GROW_SIZE pieces: bget only returns a pool to
+     * Release_Heap_Block when all pools are the same size.
+     */
+    KASSERT(size % HEAP_GROW_SIZE == 0);
+    for(offset = 0; offset < size; offset += HEAP_GROW_SIZE)
+        bpool((void *)(start + offset), HEAP_GROW_SIZE);
+    bectl(NULL, Acquire_Heap_Block, Release_Heap_Block, HEAP_GROW_SIZE);
+
     Mutex_Init(&mallocLock);
 }
 
+/*
+ * Set up the per-CPU small-object heaps.  Must run after Init_SMP()
+ * has counted the CPUs; until then all requests go to bget.
+ */
+void Init_Heap_Caches(void) {
+    extern int CPU_Count;
+    int i, j, numCaches = CPU_Count > 0 ? CPU_Count : 1;
+    struct Heap_CPU_Cache *caches;
+
+    caches = Malloc(numCaches * sizeof(struct Heap_CPU_Cache));
+    KASSERT0(caches, "no memory for per-CPU heaps");
+    memset(caches, '\0', numCaches * sizeof(struct Heap_CPU_Cache));
+    for(i = 0; i < numCaches; i++) {
+        for(j = 0; j < NUM_SIZE_CLASSES; j++) {
+            Clear_Heap_Span_List(&caches[i].partial[j]);
+            Clear_Heap_Span_List(&caches[i].full[j]);
+        }
+    }
+
+    s_numHeapCaches = numCaches;
+    s_heapCaches = caches;
+}
+
 /*
  * Dynamically allocate a buffer of given size.
  * Returns null if there is not enough memory to satisfy the
@@ -38,6 +378,12 @@ void *Malloc(ulong_t size) {
 
     KASSERT(size > 0);
 
+    if(size <= HEAP_MAX_SMALL) {
+        result = Alloc_Small(size);
+        if(result)
+            return result;
+    }
+
     Mutex_Lock(&mallocLock);
     result = bget(size);
     Mutex_Unlock(&mallocLock);
@@ -52,7 +398,30 @@ void Free(void *buf) {
     KASSERT0((((unsigned int)buf) & 0x3) == 0,
              "attempt to free a corrupted pointer (wasn't four-byte aligned).");
 
+    if(buf != 0
+       && (Get_Page(Round_Down_To_Page((ulong_t) buf))->flags & PAGE_SPAN)) {
+        Free_Small(buf);
+        return;
+    }
+
     Mutex_Lock(&mallocLock);
     brel(buf);
     Mutex_Unlock(&mallocLock);
 }
+
+/*
+ * Print kernel heap statistics.
+ */
+void Dump_Heap_Stats(void) {
+    int i;
+
+    Print("heap: %lu blocks acquired, %lu released, %lu pages held\n",
+          s_blocksAcquired, s_blocksReleased, s_pagesInBlocks);
+    for(i = 0; i < s_numHeapCaches; i++) {
+        struct Heap_CPU_Cache *cache = &s_heapCaches[i];
+        Print
+            ("cpu%d heap: %lu allocs, %lu frees, %lu remote frees, %lu spans\n",
+             i, cache->allocs, cache->frees, cache->remoteFrees,
+             cache->spansCreated - cache->spansReleased);
+    }
+}
@@ -28,6 +28,9 @@
 #include <geekos/paging.h>
 #include <geekos/mem.h>
 #include <geekos/smp.h>
+#include <geekos/atomic.h>
+#include <geekos/synch.h>
+#include <geekos/zswap.h>
 #include <geekos/projects.h>
 
 /* ----------------------------------------------------------------------
@@ -56,15 +59,354 @@ extern int debugFaults;
 #define Debug(args...) if (debugFaults) Print(args)
 
 /*
- * List of pages available for allocation.
+ * Lists of pages available for allocation.  Free pages whose contents
+ * are unknown go on s_freeList; pages known to be all zero (flag
+ * PAGE_ZEROED) go on s_zeroedList.  Both are protected by the lock
+ * of s_freeList.
  */
 static struct Page_List s_freeList;
+static struct Page_List s_zeroedList;
+
+/*
+ * Number of pages on s_zeroedList, and the size of the pre-zeroed
+ * pool that the idle threads try to maintain.
+ */
+static int s_zeroedPageCount;
+#define ZEROED_POOL_TARGET 256
+
+/*
+ * Pageable pages in use, for page replacement.  Pages referenced
+ * recently are on s_activeList and eviction candidates on
+ * s_inactiveList; both are protected by the lock of s_activeList.
+ * A pageable page is never on a freelist, so these reuse the
+ * Page_List link.
+ */
+static struct Page_List s_activeList;
+static struct Page_List s_inactiveList;
+static int s_activeCount, s_inactiveCount;
+
+/* number of pages Age_Pageable_Pages and victim selection look at */
+#define PAGE_AGE_BATCH   32
+#define PAGE_SCAN_LIMIT  32
+
+static ulong_t s_pagesDeactivated, s_pagesReactivated, s_dirtyVictims;
+
+/* page-out statistics; passes also tells waiters the daemon ran */
+static volatile ulong_t s_pageoutPasses;
+static ulong_t s_pagesPagedOut, s_pageoutRuns, s_pageoutAborts,
+    s_mmapPagesDropped, s_allocStalls;
+
+/*
+ * Zero freed pages at Free_Page() time as well; useful to find
+ * use-after-free bugs, but costs a full page of stores on every free.
+ */
+bool debugZeroOnFree = false;
 
 /*
  * Total number of physical pages.
  */
 int unsigned g_numPages;
 
+/*
+ * Per-CPU caches ("magazines") of free pages in front of the freelists.
+ * A CPU allocates and frees only through its own cache, with
+ * interrupts disabled, so the cache lock it takes is uncontended on
+ * the common path.  The freelist lock is taken only to move a batch
+ * of pages into a cache or out of a cache that has grown past its
+ * high watermark.  When the freelists run dry, or a contiguous run
+ * is wanted, every cache is flushed back to them (cache lock before
+ * freelist lock).
+ */
+#define PAGE_CACHE_SIZE  64     /* capacity of each cache */
+#define PAGE_CACHE_HIGH  48     /* drain when a free pushes us past this */
+#define PAGE_CACHE_LOW   16     /* ...down to this many pages */
+#define PAGE_CACHE_BATCH 16     /* pages taken from the freelist per refill */
+
+struct Page_Cache {
+    Spin_Lock_t lock;           /* taken by other CPUs only to flush it */
+    int count;
+    int numZeroed;              /* entries with PAGE_ZEROED set */
+    struct Page *pages[PAGE_CACHE_SIZE];
+    ulong_t hits;               /* allocs satisfied from the cache */
+    ulong_t misses;             /* allocs that had to refill first */
+    ulong_t refills;            /* batches taken from the freelist */
+    ulong_t drains;             /* batches returned to the freelist */
+};
+
+static struct Page_Cache *s_pageCaches;
+static int s_numPageCaches;
+
+/*
+ * Free pages held in the caches.  They are still counted in
+ * g_freePageCount, but only their own CPU can allocate them until
+ * they are flushed.
+ */
+static int s_cachedPageCount;
+
+/*
+ * Free pages on the freelists, which any CPU can allocate; what the
+ * page-out watermarks are compared with.
+ */
+static uint_t Freelist_Page_Count(void) {
+    int count = (int)g_freePageCount - s_cachedPageCount;
+
+    return count > 0 ? (uint_t) count : 0;
+}
+
+/* allocations that got a dirty page and had to clear it themselves */
+static ulong_t s_allocZeroFills;
+
+/*
+ * Get the cache of the current CPU, or null if page caches are not
+ * set up yet.  Must be called with interrupts disabled.
+ */
+static struct Page_Cache *Get_Page_Cache(void) {
+    int id;
+
+    KASSERT(!Interrupts_Enabled());
+    if(s_pageCaches == 0)
+        return 0;
+    id = Get_CPU_ID();
+    if(id < 0 || id >= s_numPageCaches)
+        return 0;
+    return &s_pageCaches[id];
+}
+
+/*
+ * Unlink a page from the list it is on.  Caller holds the lock for
+ * that list.  (Locked_Remove_From_Page_List would walk the whole list
+ * to check membership.)
+ */
+static void Locked_Unlink_Page(struct Page *page) {
+    struct Page_List *list = page->inPage_List;
+
+    KASSERT(list != 0);
+    if(Get_Prev_In_Page_List(page) != 0)
+        Set_Next_In_Page_List(Get_Prev_In_Page_List(page),
+                              Get_Next_In_Page_List(page));
+    else
+        list->head = Get_Next_In_Page_List(page);
+    if(Get_Next_In_Page_List(page) != 0)
+        Set_Prev_In_Page_List(Get_Next_In_Page_List(page),
+                              Get_Prev_In_Page_List(page));
+    else
+        list->tail = Get_Prev_In_Page_List(page);
+    page->inPage_List = 0;
+    if(list == &s_zeroedList)
+        --s_zeroedPageCount;
+    else if(list == &s_activeList)
+        --s_activeCount;
+    else if(list == &s_inactiveList)
+        --s_inactiveCount;
+}
+
+/*
+ * Unlink a page from the freelist it is on.  Caller holds the freelist
+ * lock.
+ */
+static void Locked_Unlink_Free_Page(struct Page *page) {
+    KASSERT(page->inPage_List == &s_freeList
+            || page->inPage_List == &s_zeroedList);
+    Locked_Unlink_Page(page);
+}
+
+/*
+ * Unlink the first page of a freelist.  Caller holds the freelist lock.
+ */
+static struct Page *Locked_Take_Free_Page(struct Page_List *list) {
+    struct Page *page = Get_Front_Of_Page_List(list);
+
+    if(page != 0)
+        Locked_Unlink_Free_Page(page);
+    return page;
+}
+
+/*
+ * Put a free page on the freelist matching its PAGE_ZEROED state.
+ * Caller holds the freelist lock.
+ */
+static void Locked_Put_Free_Page(struct Page *page) {
+    struct Page_List *list =
+        (page->flags & PAGE_ZEROED) ? &s_zeroedList : &s_freeList;
+
+    if(debugFreeList)
+        KASSERT(!Locked_Is_Member_Of_Page_List(list, page));
+    Locked_Unchecked_Add_To_Back_Of_Page_List(list, page);
+    if(list == &s_zeroedList)
+        ++s_zeroedPageCount;
+}
+
+/*
+ * Move up to PAGE_CACHE_BATCH pages from the freelists into a cache,
+ * pre-zeroed pages first, taking the freelist lock once for the
+ * whole batch.
+ */
+static void Refill_Page_Cache(struct Page_Cache *cache) {
+    struct Page *page;
+    int want = cache->count + PAGE_CACHE_BATCH, had = cache->count;
+
+    if(want > PAGE_CACHE_SIZE)
+        want = PAGE_CACHE_SIZE;
+
+    Lock_Page_List(&s_freeList);
+    while(cache->count < want) {
+        page = Locked_Take_Free_Page(&s_zeroedList);
+        if(page == 0)
+            page = Locked_Take_Free_Page(&s_freeList);
+        if(page == 0)
+            break;
+        if(page->flags & PAGE_ZEROED)
+            cache->numZeroed++;
+        cache->pages[cache->count++] = page;
+    }
+    Unlock_Page_List(&s_freeList);
+    Atomic_Add(&s_cachedPageCount, cache->count - had);
+    cache->refills++;
+}
+
+/*
+ * Return pages from a cache to the freelists until only
+ * PAGE_CACHE_LOW remain.  The oldest (bottom) entries go back,
+ * leaving the most recently freed, cache-warm pages in the cache.
+ */
+static void Drain_Page_Cache(struct Page_Cache *cache) {
+    int i, n = cache->count - PAGE_CACHE_LOW;
+
+    if(n <= 0)
+        return;
+    Lock_Page_List(&s_freeList);
+    for(i = 0; i < n; i++) {
+        if(cache->pages[i]->flags & PAGE_ZEROED)
+            cache->numZeroed--;
+        Locked_Put_Free_Page(cache->pages[i]);
+    }
+    Unlock_Page_List(&s_freeList);
+    memmove(&cache->pages[0], &cache->pages[n],
+            PAGE_CACHE_LOW * sizeof(struct Page *));
+    cache->count = PAGE_CACHE_LOW;
+    Atomic_Add(&s_cachedPageCount, -n);
+    cache->drains++;
+}
+
+/*
+ * Return every page in every CPU's cache to the freelists.  Caller
+ * has interrupts disabled and holds no cache lock.
+ */
+static void Flush_Page_Caches(void) {
+    int i, j;
+
+    for(i = 0; i < s_numPageCaches; i++) {
+        struct Page_Cache *cache = &s_pageCaches[i];
+
+        Spin_Lock(&cache->lock);
+        if(cache->count > 0) {
+            Lock_Page_List(&s_freeList);
+            for(j = 0; j < cache->count; j++)
+                Locked_Put_Free_Page(cache->pages[j]);
+            Unlock_Page_List(&s_freeList);
+            Atomic_Add(&s_cachedPageCount, -cache->count);
+            cache->count = 0;
+            cache->numZeroed = 0;
+            cache->drains++;
+        }
+        Spin_Unlock(&cache->lock);
+    }
+}
+
+/*
+ * Remove entry i from a cache, filling the hole with the top entry.
+ */
+static struct Page *Take_Cached_Page(struct Page_Cache *cache, int i) {
+    struct Page *page = cache->pages[i];
+
+    cache->pages[i] = cache->pages[--cache->count];
+    if(page->flags & PAGE_ZEROED)
+        cache->numZeroed--;
+    Atomic_Decrement(&s_cachedPageCount);
+    return page;
+}
+
+/*
+ * Take a free page, preferring a pre-zeroed one and preferring the
+ * current CPU's cache.  If that and the freelists are empty, the
+ * other CPUs' caches are flushed and the freelists tried again.  The
+ * caller must clear the page if PAGE_ZEROED is not set.
+ */
+static struct Page *Get_Free_Page(void) {
+    struct Page *page = 0;
+    struct Page_Cache *cache;
+    int i;
+    bool iflag = Save_And_Disable_Interrupts();
+
+    cache = Get_Page_Cache();
+    if(cache) {
+        Spin_Lock(&cache->lock);
+        /*
+         * Freed (dirty) pages collect in the cache, so refill with
+         * pre-zeroed pages when the cache has none and the pool does.
+         */
+        if(cache->count == 0
+           || (cache->numZeroed == 0 && s_zeroedPageCount > 0)) {
+            cache->misses++;
+            Refill_Page_Cache(cache);
+        } else {
+            cache->hits++;
+        }
+        if(cache->numZeroed > 0) {
+            for(i = cache->count - 1; i >= 0; i--)
+                if(cache->pages[i]->flags & PAGE_ZEROED)
+                    break;
+            KASSERT(i >= 0);
+            page = Take_Cached_Page(cache, i);
+        } else if(cache->count > 0) {
+            page = Take_Cached_Page(cache, cache->count - 1);
+        }
+        Spin_Unlock(&cache->lock);
+        /* free pages may still be sitting in other CPUs' caches */
+        if(page == 0 && s_cachedPageCount > 0)
+            Flush_Page_Caches();
+    }
+    if(page == 0) {
+        Lock_Page_List(&s_freeList);
+        page = Locked_Take_Free_Page(&s_zeroedList);
+        if(page == 0)
+            page = Locked_Take_Free_Page(&s_freeList);
+        Unlock_Page_List(&s_freeList);
+    }
+    Restore_Interrupt_State(iflag);
+
+    if(page)
+        Atomic_Decrement((int *)&g_freePageCount);
+    return page;
+}
+
+/*
+ * Give a free page back, to the current CPU's cache if there is one.
+ */
+static void Put_Free_Page(struct Page *page) {
+    struct Page_Cache *cache;
+    bool iflag = Save_And_Disable_Interrupts();
+
+    cache = Get_Page_Cache();
+    if(cache) {
+        Spin_Lock(&cache->lock);
+        if(page->flags & PAGE_ZEROED)
+            cache->numZeroed++;
+        cache->pages[cache->count++] = page;
+        Atomic_Increment(&s_cachedPageCount);
+        if(cache->count > PAGE_CACHE_HIGH)
+            Drain_Page_Cache(cache);
+        Spin_Unlock(&cache->lock);
+    } else {
+        Lock_Page_List(&s_freeList);
+        Locked_Put_Free_Page(page);
+        Unlock_Page_List(&s_freeList);
+    }
+    Restore_Interrupt_State(iflag);
+
+    Atomic_Increment((int *)&g_freePageCount);
+}
+
 
 /*
  * Add a range of pages to the inventory of physical memory.
@@ -92,7 +434,6 @@ static void Add_Page_Range(ulong_t start, ulong_t end, int flags) {
             Set_Prev_In_Page_List(page, 0);
         }
 
-        page->clock = 0;
         page->vaddr = 0;
         page->context = NULL;
         page->entry = 0;
@@ -224,6 +565,86 @@ void Init_Mem(struct Boot_Info *bootInfo) {
          bootInfo->memSizeKB, g_freePageCount, KERNEL_HEAP_SIZE);
 }
 
+/*
+ * Set up one page cache per CPU.  Must run after Init_SMP() has
+ * counted the CPUs; until then pages come straight from the freelist.
+ */
+void Init_Page_Caches(void) {
+    extern int CPU_Count;
+    int numCaches = CPU_Count > 0 ? CPU_Count : 1, i;
+    struct Page_Cache *caches;
+
+    caches = Malloc(numCaches * sizeof(struct Page_Cache));
+    KASSERT0(caches, "no memory for per-CPU page caches");
+    memset(caches, '\0', numCaches * sizeof(struct Page_Cache));
+    for(i = 0; i < numCaches; i++)
+        Spin_Lock_Init(&caches[i].lock);
+
+    s_numPageCaches = numCaches;
+    s_pageCaches = caches;
+}
+
+/*
+ * Print per-CPU page cache statistics.
+ */
+void Dump_Page_Cache_Stats(void) {
+    int i;
+
+    Print
+        ("%u free pages (%d in per-CPU caches), %d pre-zeroed, %lu zeroed at allocation\n",
+         g_freePageCount, s_cachedPageCount, s_zeroedPageCount,
+         s_allocZeroFills);
+    Print
+        ("%d active, %d inactive pages; %lu deactivated, %lu reactivated, %lu dirty victims\n",
+         s_activeCount, s_inactiveCount, s_pagesDeactivated,
+         s_pagesReactivated, s_dirtyVictims);
+    Print
+        ("pageout: %lu pages in %lu runs, %lu aborted, %lu mapped file pages dropped, %lu passes, %lu allocation stalls\n",
+         s_pagesPagedOut, s_pageoutRuns, s_pageoutAborts,
+         s_mmapPagesDropped, s_pageoutPasses, s_allocStalls);
+    for(i = 0; i < s_numPageCaches; i++) {
+        struct Page_Cache *cache = &s_pageCaches[i];
+        Print
+            ("cpu%d page cache: %d cached, %lu hits, %lu misses, %lu refills, %lu drains\n",
+             i, cache->count, cache->hits, cache->misses, cache->refills,
+             cache->drains);
+    }
+}
+
+/*
+ * Clear one free page of unknown contents and move it to the
+ * pre-zeroed pool.  Called by the idle threads, so pages get cleared
+ * when a CPU has nothing better to do instead of on the alloc path.
+ * Returns false if there is nothing to do.
+ */
+bool Zero_Free_Page(void) {
+    struct Page *page;
+    bool iflag;
+
+    if(s_zeroedPageCount >= ZEROED_POOL_TARGET)
+        return false;
+
+    iflag = Save_And_Disable_Interrupts();
+    Lock_Page_List(&s_freeList);
+    page = Locked_Take_Free_Page(&s_freeList);
+    Unlock_Page_List(&s_freeList);
+    Restore_Interrupt_State(iflag);
+    if(page == 0)
+        return false;
+
+    /* The page is off the lists, so clear it with interrupts on. */
+    KASSERT(!(page->flags & (PAGE_ALLOCATED | PAGE_ZEROED)));
+    memset((void *)Get_Page_Address(page), '\0', PAGE_SIZE);
+    page->flags |= PAGE_ZEROED;
+
+    iflag = Save_And_Disable_Interrupts();
+    Lock_Page_List(&s_freeList);
+    Locked_Put_Free_Page(page);
+    Unlock_Page_List(&s_freeList);
+    Restore_Interrupt_State(iflag);
+    return true;
+}
+
 /*
  * Initialize the .bss section of the kernel executable image.
  */
@@ -250,45 +671,192 @@ static void *Alloc_Page_Frame(void) {
     void *result = 0;
 
     /* See if we have a free page */
-    /* Remove the first page on the freelist. */
-    page = Remove_From_Front_Of_Page_List(&s_freeList);
+    page = Get_Free_Page();
     if(page) {
         KASSERT((page->flags & PAGE_ALLOCATED) == 0);
         /* Mark page as having been allocated. */
         page->flags |= PAGE_ALLOCATED;
         KASSERT(!(page->flags & PAGE_PAGEABLE));
-        g_freePageCount--;
         result = (void *)Get_Page_Address(page);
+
+        /* Only pages not already cleared by the idle threads need it. */
+        if(page->flags & PAGE_ZEROED) {
+            page->flags &= ~(PAGE_ZEROED);
+        } else {
+            memset(result, '\0', 4096);
+            ++s_allocZeroFills;
+        }
     }
 
+    return result;
+}
 
-    if(result) {
-        memset(result, '\0', 4096);
+/*
+ * Read and clear the accessed bit in the PTE mapping a page.
+ */
+static bool Test_And_Clear_Accessed(struct Page *page) {
+    bool accessed = page->entry != 0 && page->entry->accessed;
+
+    /* first look at a page read ahead: tell the readahead code if it paid off */
+    if(page->flags & PAGE_READAHEAD) {
+        page->flags &= ~(PAGE_READAHEAD);
+        Note_Readahead_Outcome(accessed);
     }
-    return result;
+    if(!accessed)
+        return false;
+    page->entry->accessed = 0;
+    return true;
+}
+
+/*
+ * Move a page to the back of an LRU list.  Caller holds the LRU lock.
+ */
+static void Locked_Move_To_Lru(struct Page *page, struct Page_List *list) {
+    if(page->inPage_List != 0)
+        Locked_Unlink_Page(page);
+    Locked_Unchecked_Add_To_Back_Of_Page_List(list, page);
+    if(list == &s_activeList)
+        ++s_activeCount;
+    else
+        ++s_inactiveCount;
 }
 
 /*
- * Choose a page to evict.
+ * Look at up to count pages at the front of the active list.  Pages
+ * referenced since the last look get a second chance at the back of
+ * the active list; the others become inactive.  Caller holds the
+ * LRU lock.  Returns the number of accessed bits cleared.
+ */
+static int Locked_Age_Pages(int count) {
+    struct Page *page;
+    int cleared = 0;
+
+    while (count-- > 0 && (page = Get_Front_Of_Page_List(&s_activeList))) {
+        if(!(page->flags & PAGE_PAGEABLE)) {
+            /* pinned for now by a kernel copy; look again later */
+            Locked_Move_To_Lru(page, &s_activeList);
+        } else if(Test_And_Clear_Accessed(page)) {
+            Locked_Move_To_Lru(page, &s_activeList);
+            ++cleared;
+        } else {
+            Locked_Move_To_Lru(page, &s_inactiveList);
+            ++s_pagesDeactivated;
+        }
+    }
+    return cleared;
+}
+
+/*
+ * Sample and clear the accessed bits of some active pages, moving
+ * the unreferenced ones to the inactive list.  Meant to be called
+ * periodically; victim selection also ages pages on demand.
+ */
+void Age_Pageable_Pages(int count) {
+    int cleared;
+    bool iflag = Save_And_Disable_Interrupts();
+
+    Lock_Page_List(&s_activeList);
+    cleared = Locked_Age_Pages(count);
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+
+    /*
+     * The TLB caches the accessed bit; flush so this CPU's next
+     * reference sets it again.  (Other CPUs' TLBs are not shot down,
+     * which only makes aging less precise.)
+     */
+    if(cleared > 0)
+        Flush_TLB();
+}
+
+/*
+ * Choose a page to evict, take it off the LRU lists, and lock it
+ * (and make it unpageable) so it is neither chosen again nor shared
+ * nor freed while it is written out.
+ * Keeps the inactive list at least half the size of the active one,
+ * then takes the first inactive page not referenced since it was
+ * deactivated, preferring clean pages to dirty ones.  Looks at no
+ * more than PAGE_SCAN_LIMIT pages per call beyond the aging batch.
  * Returns null if no pages are available.
  */
-static struct Page *Find_Page_To_Page_Out() {
-    unsigned int i;
-    struct Page *curr, *best;
-    best = NULL;
-    for(i = 0; i < g_numPages; i++) {
-        if((g_pageList[i].flags & PAGE_PAGEABLE) &&
-           (g_pageList[i].flags & PAGE_ALLOCATED)) {
-            if(!best)
-                best = &g_pageList[i];
-            curr = &g_pageList[i];
-            if((curr->clock < best->clock) &&
-               (curr->flags & PAGE_PAGEABLE)) {
-                best = curr;
-            }
+static struct Page *Find_Page_To_Page_Out(void) {
+    struct Page *page, *dirty = 0, *victim = 0;
+    int scanned;
+    bool iflag = Save_And_Disable_Interrupts();
+
+    Lock_Page_List(&s_activeList);
+
+    if(s_inactiveCount < s_activeCount / 2 || s_inactiveCount == 0)
+        Locked_Age_Pages(PAGE_AGE_BATCH);
+    if(s_inactiveCount == 0)
+        Locked_Age_Pages(s_activeCount);        /* everything was referenced */
+
+    for(scanned = 0; scanned < PAGE_SCAN_LIMIT
+        && (page = Get_Front_Of_Page_List(&s_inactiveList)) != 0
+        && page != dirty; scanned++) {
+        if(!(page->flags & PAGE_PAGEABLE)) {
+            Locked_Move_To_Lru(page, &s_inactiveList);
+        } else if(Test_And_Clear_Accessed(page)) {
+            Locked_Move_To_Lru(page, &s_activeList);
+            ++s_pagesReactivated;
+        } else if(page->entry != 0 && page->entry->dirty) {
+            /* would need writing first; try for a clean one */
+            if(dirty == 0)
+                dirty = page;
+            Locked_Move_To_Lru(page, &s_inactiveList);
+        } else {
+            victim = page;
+            break;
         }
     }
-    return best;
+    if(victim == 0 && dirty != 0) {
+        victim = dirty;
+        ++s_dirtyVictims;
+    }
+    if(victim == 0) {
+        /* fall back to any pageable page, referenced or not */
+        for(page = Get_Front_Of_Page_List(&s_activeList); page != 0;
+            page = Get_Next_In_Page_List(page))
+            if(page->flags & PAGE_PAGEABLE)
+                break;
+        victim = page;
+    }
+    if(victim != 0) {
+        Locked_Unlink_Page(victim);
+        victim->flags &= ~(PAGE_PAGEABLE);
+        Lock_Page(victim);
+    }
+
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+    return victim;
+}
+
+/*
+ * Put a newly mapped pageable page on the active list.
+ */
+static void Add_To_Lru(struct Page *page) {
+    bool iflag = Save_And_Disable_Interrupts();
+
+    Lock_Page_List(&s_activeList);
+    KASSERT(page->inPage_List == 0);
+    Locked_Move_To_Lru(page, &s_activeList);
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+}
+
+/*
+ * Take a page off the LRU lists if it is on one.
+ */
+static void Remove_From_Lru(struct Page *page) {
+    bool iflag = Save_And_Disable_Interrupts();
+
+    Lock_Page_List(&s_activeList);
+    if(page->inPage_List == &s_activeList
+       || page->inPage_List == &s_inactiveList)
+        Locked_Unlink_Page(page);
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
 }
 
 
@@ -303,31 +871,351 @@ void Lock_Page(struct Page *page) {
    and at the end of free_page. Leaves the page in an unlocked state, but 
    can be called to release a page even when not locked. */
 void Unlock_Page(struct Page *page) {
+    bool freed;
+    bool iflag = Save_And_Disable_Interrupts();
 
     /* When a page is freed, the ALLOCATED bit is cleared.  If a locked page 
        is freed, the page is not returned to the free list, since some thread
-       is still busy evicting it. */
+       is still busy evicting it.  Free_Page() tests LOCKED under the LRU
+       lock, so test ALLOCATED and unlock under it too. */
+    Lock_Page_List(&s_activeList);
+    freed = !(page->flags & PAGE_ALLOCATED);
+    if(freed) {
+        /* a page freed while paged out may have been put back on the LRU */
+        if(page->inPage_List == &s_activeList
+           || page->inPage_List == &s_inactiveList)
+            Locked_Unlink_Page(page);
+        page->flags &= ~(PAGE_PAGEABLE);
+    }
+    /* Unlock the page */
+    page->flags &= ~(PAGE_LOCKED);
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
 
-    if(!(page->flags & PAGE_ALLOCATED)) {
+    if(freed) {
         /* clear the PTE this used to refer to */
         page->entry = 0;
 
         page->context = (void *)0xbad10000;
 
-        /* Put the page back on the freelist */
-        if(debugFreeList) {
-            Add_To_Back_Of_Page_List(&s_freeList, page);
-        } else {
-            Unchecked_Add_To_Back_Of_Page_List(&s_freeList, page);
+        /* contents are whatever the last owner left */
+        page->flags &= ~(PAGE_ZEROED | PAGE_READAHEAD | PAGE_SHM);
+
+        /* Put the page back on the freelist (or this CPU's cache) */
+        Put_Free_Page(page);
+    }
+}
+
+
+/*
+ * Page-out.  A daemon thread evicts batches of pages when the free
+ * page count falls below s_lowFreePages, until it is back above
+ * s_highFreePages, so faulting threads do not wait for the disk.
+ * Pageable allocations only block (for one pass of the daemon) once
+ * the count reaches the hard minimum s_minFreePages; the pages below
+ * it are left to pinned kernel allocations.
+ */
+#define PAGEOUT_CLUSTER  16     /* pages written per paging file I/O run */
+
+static struct Kernel_Thread *s_pageoutThread;
+static struct Mutex s_pageoutMutex;
+static struct Condition s_pageoutWanted;        /* daemon waits here */
+static struct Condition s_pageoutDone;  /* stalled allocators wait here */
+static volatile bool s_pageoutRequested;
+static uint_t s_minFreePages, s_lowFreePages, s_highFreePages;
+
+/*
+ * Give up on evicting a page: it was freed, redirtied, or there was
+ * no room in the paging file.
+ */
+static void Abort_Page_Out(struct Page *page) {
+    bool iflag = Save_And_Disable_Interrupts();
+
+    ++s_pageoutAborts;
+
+    /* unlock and requeue together, so the page is not chosen while locked */
+    Lock_Page_List(&s_activeList);
+    if(page->flags & PAGE_ALLOCATED) {
+        page->flags |= PAGE_PAGEABLE;
+        page->flags &= ~(PAGE_LOCKED);
+        Locked_Move_To_Lru(page, &s_activeList);
+        Unlock_Page_List(&s_activeList);
+        Restore_Interrupt_State(iflag);
+        return;
+    }
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+
+    /* its owner freed it meanwhile */
+    Unlock_Page(page);
+}
+
+/*
+ * A copy of a page has been made, in slot index of the paging file
+ * (kernelInfo KINFO_PAGE_ON_DISK), in the compressed swap cache
+ * (KINFO_PAGE_COMPRESSED) or in its mapped file (0): point its PTE,
+ * entry, there and free it.  entry is the page's PTE as taken when
+ * the page was locked; Free_Page() clears page->entry.
+ * Returns true if the page was freed.
+ */
+static bool Finish_Page_Out(struct Page *page, pte_t *entry,
+                            int kernelInfo, int index) {
+    if(!(page->flags & PAGE_ALLOCATED) || entry->dirty) {
+        /* freed or written to while on its way out */
+        if(kernelInfo == KINFO_PAGE_COMPRESSED)
+            Zswap_Free(index);
+        else if(kernelInfo == KINFO_PAGE_ON_DISK)
+            Free_Space_On_Paging_File(index);
+        Abort_Page_Out(page);
+        return false;
+    }
+
+    /* a copy-on-write page left with one mapping is simply writable */
+    if(entry->kernelInfo == KINFO_PAGE_COW)
+        entry->flags |= VM_WRITE;
+    entry->present = 0;
+    entry->kernelInfo = kernelInfo;
+    entry->pageBaseAddr = index;
+    page->entry = 0;
+
+    Unlock_Page(page);
+    Free_Page((void *)Get_Page_Address(page));
+    ++s_pagesPagedOut;
+    return true;
+}
+
+/*
+ * Order a batch of victims by address space and virtual address,
+ * so pages that are neighbours in memory get neighbouring slots
+ * and can be read back together.
+ */
+static void Sort_Page_Out_Batch(struct Page **pages, void **paddrs,
+                                pte_t **entries, int count) {
+    int i, j;
+
+    for(i = 1; i < count; i++) {
+        struct Page *page = pages[i];
+        void *paddr = paddrs[i];
+        pte_t *entry = entries[i];
+
+        for(j = i; j > 0 && (pages[j - 1]->context > page->context
+                             || (pages[j - 1]->context == page->context
+                                 && pages[j - 1]->vaddr > page->vaddr));
+            j--) {
+            pages[j] = pages[j - 1];
+            paddrs[j] = paddrs[j - 1];
+            entries[j] = entries[j - 1];
         }
-        g_freePageCount++;
+        pages[j] = page;
+        paddrs[j] = paddr;
+        entries[j] = entry;
+    }
+}
 
+/*
+ * Evict a page of a MAP_SHARED file mapping: write it back to the
+ * file if it is dirty, then drop it; the next touch reads it again.
+ * Returns true if the page was freed.
+ */
+static bool Page_Out_Mmaped_Page(struct Page *page, pte_t *entry) {
+    if(entry->dirty
+       && Write_Out_Mmaped_Page(page->context, page->vaddr,
+                                (void *)Get_Page_Address(page)) != 0) {
+        Abort_Page_Out(page);
+        return false;
     }
+    ++s_mmapPagesDropped;
+    return Finish_Page_Out(page, entry, 0, 0);
+}
 
-    /* Unlock the page */
-    page->flags &= ~(PAGE_LOCKED);
+/*
+ * Evict up to max pages, writing them to runs of consecutive
+ * paging file slots.  Returns the number of pages freed.
+ */
+static int Page_Out_Pages(int max) {
+    struct Page *pages[PAGEOUT_CLUSTER];
+    void *paddrs[PAGEOUT_CLUSTER];
+    pte_t *entries[PAGEOUT_CLUSTER];
+    int count = 0, kept, done, run, first, i, freed = 0;
+
+    if(max > PAGEOUT_CLUSTER)
+        max = PAGEOUT_CLUSTER;
+
+    for(i = 0; i < max; i++) {
+        struct Page *page = Find_Page_To_Page_Out();
+        pte_t *entry;
+
+        if(page == 0)
+            break;
+        /*
+         * The page is locked, so it stays allocated until we unlock
+         * it, but its owner may free it meanwhile, which clears
+         * page->entry; keep our own copy and check ALLOCATED first.
+         */
+        entry = page->entry;
+        if(!(page->flags & PAGE_ALLOCATED) || entry == 0) {
+            Abort_Page_Out(page);
+            continue;
+        }
+        if(page->context != 0 && Is_Mmaped_Page(page->context, page->vaddr)) {
+            if(Page_Out_Mmaped_Page(page, entry))
+                ++freed;
+            continue;
+        }
+        /* catch writes made while the copy is in flight */
+        entry->dirty = 0;
+        pages[count] = page;
+        entries[count] = entry;
+        paddrs[count++] = (void *)Get_Page_Address(page);
+    }
+    if(count == 0) {
+        if(freed > 0)
+            Flush_TLB();
+        return freed;
+    }
+    /* XXX - should only flush the victims, and on every CPU */
+    Flush_TLB();
+    Sort_Page_Out_Batch(pages, paddrs, entries, count);
+
+    /* the compressed swap cache takes what it can; the rest go to disk */
+    for(i = 0, kept = 0; i < count; i++) {
+        int handle;
+
+        if(!(pages[i]->flags & PAGE_ALLOCATED)) {
+            Abort_Page_Out(pages[i]);   /* freed while we slept */
+            continue;
+        }
+        handle = Zswap_Store(paddrs[i], entries[i]);
+        if(handle < 0) {
+            pages[kept] = pages[i];
+            entries[kept] = entries[i];
+            paddrs[kept++] = paddrs[i];
+        } else if(Finish_Page_Out(pages[i], entries[i],
+                                  KINFO_PAGE_COMPRESSED, handle))
+            ++freed;
+    }
+    count = kept;
+
+    for(done = 0; done < count; done += run) {
+        run = count - done;
+        first = Find_Space_Run_On_Paging_File(&run);
+        if(first < 0)
+            break;
+        ++s_pageoutRuns;
+        if(Write_Pages_To_Paging_File(&paddrs[done], run, first) != 0) {
+            for(i = 0; i < run; i++) {
+                Free_Space_On_Paging_File(first + i);
+                Abort_Page_Out(pages[done + i]);
+            }
+            continue;
+        }
+        for(i = 0; i < run; i++)
+            if(Finish_Page_Out(pages[done + i], entries[done + i],
+                               KINFO_PAGE_ON_DISK, first + i))
+                ++freed;
+    }
+    for(; done < count; done++)
+        Abort_Page_Out(pages[done]);    /* paging file is full */
+
+    if(freed > 0)
+        Flush_TLB();
+    return freed;
+}
+
+/*
+ * Ask the page-out daemon to run, if it is not already.
+ */
+static void Wake_Pageout_Daemon(void) {
+    if(s_pageoutThread == 0 || s_pageoutRequested)
+        return;
+    Mutex_Lock(&s_pageoutMutex);
+    s_pageoutRequested = true;
+    Cond_Signal(&s_pageoutWanted);
+    Mutex_Unlock(&s_pageoutMutex);
+}
+
+/*
+ * Wait for the page-out daemon to finish a pass.
+ */
+static void Wait_For_Pageout(void) {
+    ulong_t pass;
+
+    ++s_allocStalls;
+    Mutex_Lock(&s_pageoutMutex);
+    pass = s_pageoutPasses;
+    if(!s_pageoutRequested) {
+        s_pageoutRequested = true;
+        Cond_Signal(&s_pageoutWanted);
+    }
+    while (s_pageoutPasses == pass)
+        Cond_Wait(&s_pageoutDone, &s_pageoutMutex);
+    Mutex_Unlock(&s_pageoutMutex);
+}
+
+static void Pageout_Daemon(ulong_t arg) {
+    for(;;) {
+        Mutex_Lock(&s_pageoutMutex);
+        while (!s_pageoutRequested)
+            Cond_Wait(&s_pageoutWanted, &s_pageoutMutex);
+        Mutex_Unlock(&s_pageoutMutex);
+
+        while (Freelist_Page_Count() < s_highFreePages) {
+            Age_Pageable_Pages(PAGE_AGE_BATCH);
+            if(Page_Out_Pages(PAGEOUT_CLUSTER) == 0)
+                break;
+        }
+
+        Mutex_Lock(&s_pageoutMutex);
+        s_pageoutRequested = false;
+        ++s_pageoutPasses;
+        Cond_Broadcast(&s_pageoutDone);
+        Mutex_Unlock(&s_pageoutMutex);
+    }
+}
+
+/*
+ * Start the page-out daemon.  Called by Init_Paging() once the
+ * paging file is ready.
+ */
+void Init_Pageout_Daemon(void) {
+    s_minFreePages = g_numPages / 128;
+    if(s_minFreePages < 32)
+        s_minFreePages = 32;
+    s_lowFreePages = s_minFreePages * 2;
+    s_highFreePages = s_minFreePages * 3;
+
+    Mutex_Init(&s_pageoutMutex);
+    Cond_Init(&s_pageoutWanted);
+    Cond_Init(&s_pageoutDone);
+    s_pageoutThread =
+        Start_Kernel_Thread(Pageout_Daemon, 0, PRIORITY_HIGH, true,
+                            "{Pageout}");
 }
 
+/*
+ * Get a free page frame for Alloc_Or_Reclaim_Page(), waking the
+ * page-out daemon as memory runs low.  Pageable allocations wait
+ * for the daemon below the hard minimum; pinned ones only when no
+ * pages are free at all.  Returns null if the daemon could not
+ * free anything (or there is none).
+ */
+static void *Alloc_Frame_Or_Wait(bool pinnedPage) {
+    void *paddr;
+    bool daemon = s_pageoutThread != 0 && CURRENT_THREAD != s_pageoutThread;
+
+    if(Freelist_Page_Count() < s_lowFreePages)
+        Wake_Pageout_Daemon();
+
+    if(daemon && !pinnedPage && Freelist_Page_Count() <= s_minFreePages)
+        Wait_For_Pageout();
+
+    paddr = Alloc_Page_Frame();
+    if(paddr == 0 && daemon) {
+        Wait_For_Pageout();
+        paddr = Alloc_Page_Frame();
+    }
+    return paddr;
+}
 
 /**
  * Allocate a page of pageable physical memory, to be mapped
@@ -347,28 +1235,31 @@ static void *Alloc_Or_Reclaim_Page(pte_t * entry, ulong_t vaddr,
 
     /* Alloc_Page_Frame should be called before the atomics,
        since it acts over a locked list. */
-    paddr = Alloc_Page_Frame();
+    paddr = Alloc_Frame_Or_Wait(pinnedPage);
+
+    /* daemon not running, or could not keep up: evict a page ourselves */
+    if(paddr == 0 && s_pageoutThread != 0 && Page_Out_Pages(1) > 0)
+        paddr = Alloc_Page_Frame();
 
     KASSERT(Is_Page_Multiple(vaddr));
 
     if(paddr != 0) {
         page = Get_Page((ulong_t) paddr);
         KASSERT((page->flags & PAGE_PAGEABLE) == 0);
+    } else if(s_pageoutThread != 0) {
+        /* nothing left to page out */
+        return 0;
     } else {
         /* Select a page to steal from another process */
         Debug("About to hunt for a page to page out\n");
         page = Find_Page_To_Page_Out();
-        KASSERT(page->flags & PAGE_PAGEABLE);
+        KASSERT(page->flags & PAGE_LOCKED);
         paddr = (void *)Get_Page_Address(page);
-        Debug("Selected page at addr %p (age = %d)\n", paddr,
-              page->clock);
+        Debug("Selected page at addr %p (%s)\n", paddr,
+              page->entry && page->entry->dirty ? "dirty" : "clean");
 
-        /* Make the page temporarily unpageable (can't let another process steal it) */
-        page->flags &= ~(PAGE_PAGEABLE);
-
-        /* Lock the page so it cannot be freed while we're writing */
-        Debug("locking page at %p for writing\n", paddr);
-        Lock_Page(page);
+        /* (Find_Page_To_Page_Out locked the page, so it cannot be freed
+           while we're writing) */
         TODO_P(PROJECT_VIRTUAL_MEMORY_B,
                "write page out to backing storage");
         TODO_P(PROJECT_MMAP, "write page out to backing storage");
@@ -383,7 +1274,9 @@ static void *Alloc_Or_Reclaim_Page(pte_t * entry, ulong_t vaddr,
     }
 
     /* Fill in accounting information for page */
-    if(pinnedPage) {
+    page->refCount = 1;
+    if(entry == 0) {
+        /* pinned, or a user page not yet mapped (see Alloc_Unmapped_Page) */
         page->flags &= ~(PAGE_PAGEABLE);
         page->entry = NULL;     /* will not appear in a page table, since it's not a pageable page. */
         page->vaddr = 0;        /* has no virtual address */
@@ -396,6 +1289,7 @@ static void *Alloc_Or_Reclaim_Page(pte_t * entry, ulong_t vaddr,
         /* note that the page context here will not be correct while copying during a fork. */
         page->context = CURRENT_THREAD->userContext;
         KASSERT(page->flags & PAGE_ALLOCATED);
+        Add_To_Lru(page);
 
     }
 
@@ -426,6 +1320,123 @@ void *Alloc_Page(void) {
     return ret;
 }
 
+/*
+ * Allocate a pinned page only if one is free, without trying to
+ * reclaim one.  Unlike Alloc_Page(), may be called with interrupts
+ * disabled or spin locks held.
+ */
+void *Alloc_Page_Atomic(void) {
+    void *paddr = Alloc_Page_Frame();
+
+    if(paddr != 0) {
+        struct Page *page = Get_Page((ulong_t) paddr);
+        page->entry = NULL;
+        page->vaddr = 0;
+        page->context = NULL;
+    }
+    return paddr;
+}
+
+/* pages Alloc_Contiguous_Pages() looks at per hold of the freelist lock */
+#define CONTIG_SCAN_BATCH 256
+
+static bool Is_On_Free_List(const struct Page *page) {
+    return page->inPage_List == &s_freeList
+        || page->inPage_List == &s_zeroedList;
+}
+
+/*
+ * Allocate a run of physically contiguous pinned pages, for the
+ * kernel heap.  The per-CPU caches are flushed first, since only
+ * pages on the global freelists are considered, and finding a run scans the page list, so this is meant for
+ * infrequent, large allocations.  The scan drops the freelist lock
+ * every CONTIG_SCAN_BATCH pages, so other CPUs are not held up for
+ * the whole of it, and checks a run again before taking it.  Pages
+ * are not cleared.  May be called with interrupts disabled.
+ * Returns null if no run is free.
+ */
+void *Alloc_Contiguous_Pages(int numPages) {
+    unsigned int i = 0, j, first = 0, batchEnd, runLength = 0;
+    struct Page *page;
+    bool iflag;
+
+    KASSERT(numPages > 0);
+
+    iflag = Save_And_Disable_Interrupts();
+    Flush_Page_Caches();
+    Restore_Interrupt_State(iflag);
+
+    while (i < g_numPages) {
+        iflag = Save_And_Disable_Interrupts();
+        Lock_Page_List(&s_freeList);
+
+        batchEnd = i + CONTIG_SCAN_BATCH;
+        if(batchEnd > g_numPages)
+            batchEnd = g_numPages;
+        for(; i < batchEnd && runLength < (unsigned)numPages; i++) {
+            if(Is_On_Free_List(&g_pageList[i]))
+                ++runLength;
+            else
+                runLength = 0;
+        }
+
+        if(runLength == (unsigned)numPages) {
+            /* the start of the run may have been taken since we saw it */
+            first = i - numPages;
+            for(j = first; j < i && Is_On_Free_List(&g_pageList[j]); j++) ;
+            if(j == i)
+                break;
+            i = j + 1;
+            runLength = 0;
+        }
+
+        Unlock_Page_List(&s_freeList);
+        Restore_Interrupt_State(iflag);
+    }
+    if(runLength < (unsigned)numPages)
+        return 0;
+
+    /* still holding the freelist lock */
+    for(i = first; i < first + numPages; i++) {
+        page = &g_pageList[i];
+        Locked_Unlink_Free_Page(page);
+        KASSERT(!(page->flags & PAGE_ALLOCATED));
+        page->flags &= ~(PAGE_ZEROED);
+        page->flags |= PAGE_ALLOCATED | PAGE_RUN;
+        page->entry = NULL;
+        page->vaddr = 0;
+        page->context = NULL;
+        Atomic_Decrement((int *)&g_freePageCount);
+    }
+    g_pageList[first].flags |= PAGE_RUN_START;
+    Unlock_Page_List(&s_freeList);
+    Restore_Interrupt_State(iflag);
+
+    return (void *)Get_Page_Address(&g_pageList[first]);
+}
+
+/*
+ * Free a run of pages allocated by Alloc_Contiguous_Pages().
+ * Returns the number of pages freed.
+ */
+int Free_Contiguous_Pages(void *pageAddr) {
+    struct Page *page = Get_Page((ulong_t) pageAddr);
+    struct Page *end = g_pageList + g_numPages;
+    int numPages = 0;
+
+    KASSERT0(page->flags & PAGE_RUN_START,
+             "Free_Contiguous_Pages given a page that does not start a run");
+    page->flags &= ~(PAGE_RUN_START);
+    while (page < end && (page->flags & PAGE_RUN)
+           && !(page->flags & PAGE_RUN_START)) {
+        page->flags &= ~(PAGE_RUN);
+        Free_Page((void *)Get_Page_Address(page));
+        ++page;
+        ++numPages;
+    }
+    return numPages;
+}
+
 /**
  * Allocate a page of pageable physical memory, to be mapped
  * into a user address space.
@@ -441,6 +1452,141 @@ void *Alloc_Pageable_Page(pte_t * entry, ulong_t vaddr) {
     return ret;
 }
 
+/*
+ * Allocate a page for user memory whose PTE cannot point to it yet,
+ * because its contents are still being read or copied.  It is
+ * allocated like a pageable page but kept pinned, off the LRU lists,
+ * until Claim_Page() once the PTE is present.
+ */
+void *Alloc_Unmapped_Page(void) {
+    return Alloc_Or_Reclaim_Page(NULL, 0, false);
+}
+
+
+/*
+ * Add a mapping to a user page, for copy-on-write sharing after
+ * fork.  A shared page is kept out of page replacement, which can
+ * only update one page table entry.  Returns false if the page
+ * cannot be shared because it is being paged out.
+ */
+bool Share_Page(struct Page *page) {
+    bool shared = false;
+    bool iflag = Save_And_Disable_Interrupts();
+
+    Lock_Page_List(&s_activeList);
+    if(!(page->flags & PAGE_LOCKED)) {
+        if(page->inPage_List == &s_activeList
+           || page->inPage_List == &s_inactiveList)
+            Locked_Unlink_Page(page);
+        page->flags &= ~(PAGE_PAGEABLE);
+        Atomic_Increment(&page->refCount);
+        shared = true;
+    }
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+    return shared;
+}
+
+/*
+ * Keep a resident user page from being paged out or freed while the
+ * kernel reads it, as when writing it back to a mapped file: take it
+ * off the LRU and lock it.  Returns false if it is already locked,
+ * being paged out.
+ */
+bool Pin_Page(struct Page *page) {
+    bool pinned = false;
+    bool iflag = Save_And_Disable_Interrupts();
+
+    Lock_Page_List(&s_activeList);
+    if(!(page->flags & PAGE_LOCKED)) {
+        if(page->inPage_List == &s_activeList
+           || page->inPage_List == &s_inactiveList)
+            Locked_Unlink_Page(page);
+        page->flags |= PAGE_LOCKED;
+        pinned = true;
+    }
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+    return pinned;
+}
+
+/*
+ * Undo Pin_Page(), freeing the page if its owner freed it meanwhile.
+ */
+void Unpin_Page(struct Page *page) {
+    bool iflag = Save_And_Disable_Interrupts();
+
+    Lock_Page_List(&s_activeList);
+    if(page->flags & PAGE_ALLOCATED) {
+        page->flags &= ~(PAGE_LOCKED);
+        if(page->flags & PAGE_PAGEABLE)
+            Locked_Move_To_Lru(page, &s_activeList);
+        Unlock_Page_List(&s_activeList);
+        Restore_Interrupt_State(iflag);
+        return;
+    }
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+    Unlock_Page(page);
+}
+
+/*
+ * The last mapping of a formerly shared page, or the first of a page
+ * from Alloc_Unmapped_Page(), at vaddr in the current process through
+ * entry, becomes its owner; the page can be paged out again.
+ */
+void Claim_Page(struct Page *page, pte_t * entry, ulong_t vaddr) {
+    KASSERT(page->refCount == 1);
+    Adopt_Page(page, CURRENT_THREAD->userContext, entry, vaddr);
+}
+
+/*
+ * Make the only mapping of a page, through entry at vaddr in
+ * context, its owner, and put the page on the LRU lists if it is not
+ * already there.  The owner and the last other mapping's Drop_Page()
+ * may both get here; does nothing if the page has been shared again
+ * meanwhile.
+ */
+void Adopt_Page(struct Page *page, struct User_Context *context,
+                pte_t * entry, ulong_t vaddr) {
+    bool iflag = Save_And_Disable_Interrupts();
+
+    /* Share_Page() works under the LRU lock too */
+    Lock_Page_List(&s_activeList);
+    if(page->refCount != 1) {
+        Unlock_Page_List(&s_activeList);
+        Restore_Interrupt_State(iflag);
+        return;
+    }
+    page->entry = entry;
+    page->vaddr = vaddr;
+    page->context = context;
+    if(!(page->flags & PAGE_PAGEABLE)) {
+        page->flags |= PAGE_PAGEABLE;
+        /* a pinned page goes on the LRU when it is unpinned */
+        if(!(page->flags & PAGE_LOCKED))
+            Locked_Move_To_Lru(page, &s_activeList);
+    }
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+}
+
+/*
+ * Remove a mapping of a user page, freeing it with the last one.
+ * The caller has already pointed its PTE elsewhere.  A page left
+ * with one mapping becomes pageable again; shared memory pages stay
+ * pinned.
+ */
+void Drop_Page(void *paddr) {
+    struct Page *page = Get_Page((ulong_t) paddr);
+    int left = Atomic_Decrement(&page->refCount);
+
+    if(left == 0)
+        Free_Page(paddr);
+    else if(left == 1 && !(page->flags & (PAGE_SHM | PAGE_PAGEABLE)))
+        Requeue_Unshared_Page(paddr, page->vaddr);
+}
+
 
 /*
  * Free a page of physical memory.
@@ -448,6 +1594,7 @@ void *Alloc_Pageable_Page(pte_t * entry, ulong_t vaddr) {
 void Free_Page(void *pageAddr) {
     ulong_t addr = (ulong_t) pageAddr;
     struct Page *page;
+    bool iflag, locked;
 
     KASSERT0(addr < (g_numPages << 12),
              "Attempted to free an invalid physical page");
@@ -459,7 +1606,8 @@ void Free_Page(void *pageAddr) {
              "Couldn't find a struct Page * for the given pageAddr");
 
     /* useful to find use-after-free bugs */
-    memset(pageAddr, '\0', 4096);
+    if(debugZeroOnFree)
+        memset(pageAddr, '\0', 4096);
     // Print("freeing %p because of %lx\n", pageAddr, (ulong_t) __builtin_return_address(0));
 
     KASSERT0((page->flags & PAGE_ALLOCATED) != 0,
@@ -469,20 +1617,32 @@ void Free_Page(void *pageAddr) {
        Debug("Free %spage at %p (%d others)\n", 
        ( page->flags & PAGE_LOCKED ) ? "locked " : "", pageAddr, g_freePageCount);
      */
+    /* the page-out daemon locks its victims under the LRU lock */
+    iflag = Save_And_Disable_Interrupts();
+    Lock_Page_List(&s_activeList);
+
     /* Clear the allocation bit */
     page->flags &= ~(PAGE_ALLOCATED);
 
     /* When a page is locked, don't free it just let other thread know its not needed 
        by clearing PAGE_ALLOCATED */
-    if(page->flags & PAGE_LOCKED) {
+    locked = (page->flags & PAGE_LOCKED) != 0;
+    if(locked) {
         page->entry = 0;
         page->context = NULL;
     } else {
+        if(page->inPage_List == &s_activeList
+           || page->inPage_List == &s_inactiveList)
+            Locked_Unlink_Page(page);
+
         /* Clear the pageable bit */
         page->flags &= ~(PAGE_PAGEABLE);
-
-        /* page is no longer locked or allocated.  free it. */
-        Unlock_Page(page);
     }
 
+    Unlock_Page_List(&s_activeList);
+    Restore_Interrupt_State(iflag);
+
+    /* page is no longer locked or allocated.  free it. */
+    if(!locked)
+        Unlock_Page(page);
 }
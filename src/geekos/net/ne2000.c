@@ -59,8 +59,7 @@ static void NE2000_Interrupt_Handler(struct Interrupt_State *state) {
     Begin_IRQ(state);
     DEBUG_NE2K("Handling NE2000 interrupt\n");
 
-    // 2014 rc = Get_Net_Device_By_IRQ(state->intNum - FIRST_EXTERNAL_INT, &device);
-    rc = Get_Net_Device_By_IRQ(state->intNum, &device);
+    rc = Get_Net_Device_By_IRQ(state->intNum - FIRST_EXTERNAL_INT, &device);
     if(rc != 0) {
         Print("NE2000: Could not identify interrupt number %d (rc=%d)\n",
               state->intNum, rc);
@@ -12,6 +12,7 @@
 #include <geekos/screen.h>
 #include <geekos/kassert.h>
 #include <geekos/malloc.h>
+#include <geekos/slab.h>
 #include <geekos/int.h>
 #include <geekos/subsystem_locks.h>
 #include <geekos/net/ne2000.h>
@@ -30,6 +31,10 @@ static struct Net_Device_Receive_Packet_Queue s_receivePacketQueue;
 /* threads blocked awaiting a packet */
 static struct Thread_Queue s_receiveThreadQueue;
 
+/* received packets; allocated in interrupt context */
+static struct Object_Cache s_packetCache =
+OBJECT_CACHE_INITIALIZER("netpacket", sizeof(struct Net_Device_Packet), 0);
+
 /* Private Functions */
 static struct Net_Device *Allocate_Net_Device(void) {
     struct Net_Device *device = Malloc(sizeof(struct Net_Device));
@@ -73,7 +78,7 @@ static void Net_Device_Receive_Thread(ulong_t arg
 
             Eth_Dispatch(packet->device, nBuf);
 
-            Free(packet);
+            Free_Object(&s_packetCache, packet);
         } else {
             Wait(&s_receiveThreadQueue);
             Spin_Unlock_Irq_Restore(&netLock, iflag);
@@ -199,7 +204,7 @@ int Net_Device_Receive(struct Net_Device *device, ushort_t ringBufferPage) {
 
     device->getHeader(device, &hdr, ringBufferPage >> 8);
 
-    packet = Malloc(sizeof(struct Net_Device_Packet));
+    packet = Alloc_Object(&s_packetCache);
     if(packet == 0)
         goto fail;
 
@@ -10,8 +10,15 @@
 #include <geekos/net/netbuf.h>
 #include <geekos/errno.h>
 #include <geekos/malloc.h>
+#include <geekos/slab.h>
 #include <geekos/ktypes.h>
 
+/* Every packet builds a Net_Buf and a few Message_Buffers. */
+static struct Object_Cache s_netBufCache =
+OBJECT_CACHE_INITIALIZER("netbuf", sizeof(struct Net_Buf), 0);
+static struct Object_Cache s_messageBufferCache =
+OBJECT_CACHE_INITIALIZER("msgbuf", sizeof(struct Message_Buffer), 0);
+
 /* Private Functions */
 
 static struct Message_Buffer *Find_Buffer_At_Offset(struct Net_Buf *nBuf,
@@ -84,7 +91,7 @@ static int Split_Buffer(struct Net_Buf *nBuf, ulong_t split) {
     // unused prev = Get_Prev_In_Message_Buffer_List(curr);
 
     /* Allocate two new message buffers */
-    buf1 = Malloc(sizeof(struct Message_Buffer));
+    buf1 = Alloc_Object(&s_messageBufferCache);
     if(buf1 == 0)
         return ENOMEM;
 
@@ -92,7 +99,7 @@ static int Split_Buffer(struct Net_Buf *nBuf, ulong_t split) {
     nBuf->mallocCount++;
 #endif
 
-    buf2 = Malloc(sizeof(struct Message_Buffer));
+    buf2 = Alloc_Object(&s_messageBufferCache);
     if(buf2 == 0)
         return ENOMEM;
 
@@ -129,7 +136,7 @@ static int Split_Buffer(struct Net_Buf *nBuf, ulong_t split) {
 /* Public Functions */
 
 int Net_Buf_Create(struct Net_Buf **nBuf) {
-    struct Net_Buf *buffer = Malloc(sizeof(struct Net_Buf));
+    struct Net_Buf *buffer = Alloc_Object(&s_netBufCache);
     if(buffer == 0)
         return ENOMEM;
 
@@ -145,7 +152,7 @@ int Net_Buf_Create(struct Net_Buf **nBuf) {
 int Net_Buf_Destroy(struct Net_Buf *nBuf) {
 
     Net_Buf_Remove_All(nBuf);
-    Free(nBuf);
+    Free_Object(&s_netBufCache, nBuf);
 
     return 0;
 }
@@ -157,7 +164,7 @@ static int Create_Message_Buffer(struct Net_Buf *nBuf,
 
     struct Message_Buffer *mBuf;
 
-    mBuf = Malloc(sizeof(struct Message_Buffer));
+    mBuf = Alloc_Object(&s_messageBufferCache);
     if(mBuf == 0)
         return ENOMEM;
 
@@ -359,7 +366,7 @@ int Net_Buf_Remove_All(struct Net_Buf *nBuf) {
 #endif
         }
 
-        Free(curr);
+        Free_Object(&s_messageBufferCache, curr);
 
 #ifndef NDEBUG
         freeCount++;
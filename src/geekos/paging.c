@@ -32,6 +32,10 @@
 #include <geekos/errno.h>
 #include <geekos/projects.h>
 #include <geekos/smp.h>
+#include <geekos/blockdev.h>
+#include <geekos/zswap.h>
+#include <geekos/atomic.h>
+#include <geekos/synch.h>
 
 #include <libc/mmap.h>
 
@@ -52,14 +56,48 @@ int debugFaults = 0;
 #define Debug(args...) if (debugFaults) Print(args)
 
 
+/*
+ * The kernel page directory.  Physical memory is identity mapped,
+ * in 4 MB pages where the CPU supports them, and the kernel's
+ * mappings are global where it supports that, so reloading CR3 on
+ * an address space switch leaves them in the TLB.
+ */
+static pde_t *s_kernelPageDir;
+
+#define LARGE_PAGE_SIZE   (NUM_PAGE_TABLE_ENTRIES * PAGE_SIZE)
+
+#define CPUID_FEATURE_PSE 0x00000008    /* 4 MB pages (edx of leaf 1) */
+#define CPUID_FEATURE_PGE 0x00002000    /* global pages (edx of leaf 1) */
+#define CR4_PSE           0x00000010
+#define CR4_PGE           0x00000080
+
+/* the local and I/O APICs, in the 4 MB page at this address */
+#define APIC_REGION_START 0xFEC00000
+#define IO_APIC_ADDR      0xFEC00000
+#define LOCAL_APIC_ADDR   0xFEE00000
+
+/* CR4 bits set on every CPU before paging is enabled */
+static ulong_t s_cr4Bits;
+
+static ulong_t s_largePagesMapped, s_smallPagesMapped;
+
 /* const because we do not expect any caller to need to
    modify the kernel page directory */
 const pde_t *Kernel_Page_Dir(void) {
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A, "return kernel page directory");
-    return NULL;
+    return s_kernelPageDir;
 }
 
+static __inline__ ulong_t Get_CPU_Features(void) {
+    ulong_t eax, edx;
+    __asm__ __volatile__("cpuid":"=a"(eax), "=d"(edx):"a"(1):"ecx", "ebx");
+    return edx;
+}
 
+static __inline__ void Set_CR4_Bits(ulong_t bits) {
+    ulong_t cr4;
+    __asm__ __volatile__("mov %%cr4, %0":"=r"(cr4));
+    __asm__ __volatile__("mov %0, %%cr4"::"r"(cr4 | bits));
+}
 
 /*
  * Print diagnostic information for a page fault.
@@ -88,6 +126,429 @@ static void Print_Fault_Info(uint_t address, faultcode_t faultCode) {
         Print("in Supervisor Mode\n");
 }
 
+/*
+ * Swap-in readahead.  A fault on a page in the paging file also reads
+ * the following pages of the address space, as long as they are in
+ * the following slots of the paging file, up to s_readaheadWindow
+ * pages in all.  The window doubles while most pages read ahead get
+ * used before they are evicted and halves while most do not, between
+ * 1 and swapReadaheadMax.
+ */
+int swapReadaheadMax = 16;
+static int s_readaheadWindow = 4;
+static int s_readaheadUsed, s_readaheadWasted;
+
+#define READAHEAD_SAMPLE 32     /* outcomes between window adjustments */
+#define READAHEAD_LIMIT  32     /* largest window swapReadaheadMax may set */
+
+static ulong_t s_swapInFaults, s_swapInPages;
+
+/*
+ * Called by the page replacement code the first time it looks at a
+ * page that was read ahead.
+ */
+void Note_Readahead_Outcome(bool used) {
+    if(used)
+        ++s_readaheadUsed;
+    else
+        ++s_readaheadWasted;
+
+    if(s_readaheadUsed + s_readaheadWasted < READAHEAD_SAMPLE)
+        return;
+    if(s_readaheadUsed >= 3 * s_readaheadWasted)
+        s_readaheadWindow *= 2;
+    else if(3 * s_readaheadUsed < s_readaheadWasted)
+        s_readaheadWindow /= 2;
+    if(s_readaheadWindow > swapReadaheadMax)
+        s_readaheadWindow = swapReadaheadMax;
+    if(s_readaheadWindow < 1)
+        s_readaheadWindow = 1;
+    s_readaheadUsed = s_readaheadWasted = 0;
+}
+
+/*
+ * Find the page table entry for a user address, or null if there
+ * is no page table for it.
+ */
+pte_t *Find_User_PTE(struct User_Context *context, ulong_t vaddr) {
+    pde_t *pde = &context->pageDir[PAGE_DIRECTORY_INDEX(vaddr)];
+    pte_t *pageTable;
+
+    if(!pde->present)
+        return 0;
+    pageTable = (pte_t *) (pde->pageTableBaseAddr << 12);
+    return &pageTable[PAGE_TABLE_INDEX(vaddr)];
+}
+
+/*
+ * Every paged address space, so that the last mapping of a page
+ * shared copy-on-write can be found.  Fork maps a shared page at the
+ * same address in each process.
+ */
+static struct User_Context *s_pagedContexts;
+static Spin_Lock_t s_pagedContextLock;
+
+void Add_Paged_User_Context(struct User_Context *context) {
+    bool iflag = Spin_Lock_Irq_Save(&s_pagedContextLock);
+
+    context->nextPaged = s_pagedContexts;
+    s_pagedContexts = context;
+    Spin_Unlock_Irq_Restore(&s_pagedContextLock, iflag);
+}
+
+/*
+ * Called before the address space is torn down, so that it is no
+ * longer taken for the owner of the pages it drops.
+ */
+void Remove_Paged_User_Context(struct User_Context *context) {
+    struct User_Context **link;
+    bool iflag = Spin_Lock_Irq_Save(&s_pagedContextLock);
+
+    for(link = &s_pagedContexts; *link != 0; link = &(*link)->nextPaged)
+        if(*link == context) {
+            *link = context->nextPaged;
+            break;
+        }
+    context->nextPaged = 0;
+    Spin_Unlock_Irq_Restore(&s_pagedContextLock, iflag);
+}
+
+/*
+ * A page shared at vaddr is down to one mapping: find it and make
+ * it the page's owner, so the page can be paged out again.  If the
+ * mapping is on its way out too, the page is simply left pinned
+ * until it is freed.
+ */
+void Requeue_Unshared_Page(void *paddr, ulong_t vaddr) {
+    struct User_Context *context;
+    bool iflag = Spin_Lock_Irq_Save(&s_pagedContextLock);
+
+    for(context = s_pagedContexts; context != 0;
+        context = context->nextPaged) {
+        pte_t *entry = Find_User_PTE(context, vaddr);
+
+        if(entry != 0 && entry->present
+           && entry->pageBaseAddr == PAGE_ALIGNED_ADDR(paddr)) {
+            Adopt_Page(Get_Page((ulong_t) paddr), context, entry, vaddr);
+            break;
+        }
+    }
+    Spin_Unlock_Irq_Restore(&s_pagedContextLock, iflag);
+}
+
+/*
+ * Find the page table entry for a user address, creating an empty
+ * page table for it if needed.  Returns null if out of memory.
+ */
+pte_t *Find_Or_Create_User_PTE(struct User_Context * context,
+                               ulong_t vaddr) {
+    pde_t *pde = &context->pageDir[PAGE_DIRECTORY_INDEX(vaddr)];
+    pte_t *pageTable;
+
+    if(!pde->present) {
+        pageTable = Alloc_Page();
+        if(pageTable == 0)
+            return 0;
+        memset(pageTable, '\0', PAGE_SIZE);
+        pde->pageTableBaseAddr = PAGE_ALIGNED_ADDR(pageTable);
+        pde->flags = VM_USER | VM_WRITE;
+        pde->present = 1;
+    }
+    return Find_User_PTE(context, vaddr);
+}
+
+static bool Is_On_Disk(const pte_t * entry) {
+    return !entry->present && entry->kernelInfo == KINFO_PAGE_ON_DISK;
+}
+
+/*
+ * Bring back a page from the paging file, along with the
+ * neighbouring pages that were written next to it.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Page_In(struct User_Context *context, ulong_t vaddr,
+                   pte_t * entry) {
+    pte_t *entries[READAHEAD_LIMIT];
+    void *paddrs[READAHEAD_LIMIT];
+    int first = entry->pageBaseAddr;
+    int window = s_readaheadWindow, count, i, rc;
+    ulong_t tableEnd = (vaddr | ((PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES) - 1));
+
+    vaddr = Round_Down_To_Page(vaddr);
+    if(window > READAHEAD_LIMIT)
+        window = READAHEAD_LIMIT;
+
+    /* stop at the first neighbour that is resident or elsewhere on disk */
+    entries[0] = entry;
+    for(count = 1; count < window; count++) {
+        ulong_t next = vaddr + count * PAGE_SIZE;
+        if(next > tableEnd)
+            break;
+        entries[count] = entry + count;
+        if(!Is_On_Disk(entries[count])
+           || entries[count]->pageBaseAddr != (uint_t) (first + count))
+            break;
+    }
+
+    /* kept off the LRU until they hold their contents and are mapped */
+    for(i = 0; i < count; i++) {
+        paddrs[i] = Alloc_Unmapped_Page();
+        if(paddrs[i] == 0)
+            break;
+        Lock_Page(Get_Page((ulong_t) paddrs[i]));
+    }
+    if(i == 0)
+        return ENOMEM;
+    count = i;
+
+    rc = Read_Pages_From_Paging_File(paddrs, count, first);
+
+    for(i = 0; i < count; i++) {
+        struct Page *page = Get_Page((ulong_t) paddrs[i]);
+
+        Unlock_Page(page);
+        if(rc != 0) {
+            /* the PTEs still say where on disk the pages are */
+            Free_Page(paddrs[i]);
+            continue;
+        }
+        entries[i]->pageBaseAddr = PAGE_ALIGNED_ADDR(paddrs[i]);
+        entries[i]->kernelInfo = 0;
+        entries[i]->accessed = 0;
+        entries[i]->dirty = 0;
+        entries[i]->present = 1;
+        Free_Space_On_Paging_File(first + i);
+        if(i > 0)
+            page->flags |= PAGE_READAHEAD;
+        Claim_Page(page, entries[i], vaddr + i * PAGE_SIZE);
+    }
+    if(rc == 0) {
+        ++s_swapInFaults;
+        s_swapInPages += count;
+        Zswap_Note_Disk_Fault();
+    }
+    return rc;
+}
+
+/*
+ * Bring back a page from the compressed swap cache.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Page_In_Compressed(ulong_t vaddr, pte_t * entry) {
+    /* the copy may be written back to disk while we wait for memory */
+    int handle = entry->pageBaseAddr;
+    void *paddr;
+    int rc;
+
+    /* the PTE must keep saying where the copy is until it is loaded */
+    paddr = Alloc_Unmapped_Page();
+    if(paddr == 0)
+        return ENOMEM;
+
+    rc = Zswap_Load(entry, handle, paddr);
+    if(rc != 0) {
+        Free_Page(paddr);
+        return rc;
+    }
+    entry->pageBaseAddr = PAGE_ALIGNED_ADDR(paddr);
+    entry->kernelInfo = 0;
+    entry->accessed = 0;
+    entry->dirty = 0;
+    entry->present = 1;
+    Claim_Page(Get_Page((ulong_t) paddr), entry, Round_Down_To_Page(vaddr));
+    return 0;
+}
+
+/*
+ * Add a mapped region to a user context.  file, if not null, gains
+ * a reference held by the region.
+ * Returns 0 if successful, error code otherwise.
+ */
+int Add_Mapped_Region(struct User_Context *context, struct File *file,
+                      ulong_t startAddr, ulong_t length, int prot,
+                      int flags, ulong_t fileOffset, ulong_t fileLength) {
+    mappedRegion_t *region = Malloc(sizeof(*region));
+
+    if(region == 0)
+        return ENOMEM;
+    region->file = file;
+    region->startAddr = startAddr;
+    region->length = length;
+    region->prot = prot;
+    region->flags = flags;
+    region->fileOffset = fileOffset;
+    region->fileLength = fileLength;
+    if(file != 0)
+        Atomic_Increment(&file->refCount);
+
+    region->next = context->mappedRegions;
+    context->mappedRegions = region;
+    return 0;
+}
+
+/*
+ * Find the mapped region of a process containing a user address,
+ * or null if there is none.
+ */
+mappedRegion_t *Find_Mapped_Region(struct User_Context * context,
+                                   ulong_t userAddr) {
+    mappedRegion_t *region;
+
+    for(region = context->mappedRegions; region != 0; region = region->next)
+        if(userAddr >= region->startAddr
+           && userAddr - region->startAddr < region->length)
+            return region;
+    return 0;
+}
+
+/*
+ * Read len bytes at offset in a mapped file into buf.  The file is
+ * the process's own open file, so its position is left alone.
+ */
+static int Read_Region_File(struct File *file, ulong_t offset, char *buf,
+                            ulong_t len) {
+    while (len > 0) {
+        int n = Read_At(file, offset, buf, len);
+        if(n <= 0)
+            return n < 0 ? n : EIO;
+        offset += n;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Write len bytes from buf at offset in a mapped file.
+ */
+static int Write_Region_File(struct File *file, ulong_t offset, char *buf,
+                             ulong_t len) {
+    while (len > 0) {
+        int n = Write_At(file, offset, buf, len);
+        if(n <= 0)
+            return n < 0 ? n : EIO;
+        offset += n;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * First touch of a page in the mapped regions of a process: fill it
+ * from every region overlapping the page (executable segments need
+ * not be page aligned), reading their file-backed parts and leaving
+ * the rest zero.  The page is writable if any of those regions is.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Fill_Region_Page(struct User_Context *context, ulong_t vaddr,
+                            pte_t * entry) {
+    ulong_t linear = Round_Down_To_Page(vaddr);
+    ulong_t first = linear - USER_VM_START, last = first + PAGE_SIZE;
+    mappedRegion_t *region;
+    bool writable = false;
+    char *paddr;
+    int rc = 0;
+
+    /* kept off the LRU until it is filled and mapped */
+    paddr = Alloc_Unmapped_Page();
+    if(paddr == 0)
+        return ENOMEM;
+    memset(paddr, '\0', PAGE_SIZE);
+
+    for(region = context->mappedRegions; region != 0 && rc == 0;
+        region = region->next) {
+        ulong_t start = region->startAddr, end = start + region->fileLength;
+
+        if(start >= last || start + region->length <= first)
+            continue;
+        if(region->prot & PROT_WRITE)
+            writable = true;
+        if(region->file == 0)
+            continue;
+        if(start < first)
+            start = first;
+        if(end > last)
+            end = last;
+        if(start < end)
+            rc = Read_Region_File(region->file,
+                                  region->fileOffset + (start -
+                                                        region->startAddr),
+                                  paddr + (start - first), end - start);
+    }
+
+    if(rc != 0 || entry->present) {
+        /* error, or another thread got here first */
+        Free_Page(paddr);
+        return rc;
+    }
+    entry->pageBaseAddr = PAGE_ALIGNED_ADDR(paddr);
+    entry->flags = VM_USER | (writable ? VM_WRITE : 0);
+    entry->kernelInfo = 0;
+    entry->accessed = 0;
+    entry->dirty = 0;
+    entry->present = 1;
+    Claim_Page(Get_Page((ulong_t) paddr), entry, linear);
+    return 0;
+}
+
+/*
+ * Bring back a swapped-out page of the current process, wherever it
+ * is.  Returns 0 if the page is resident, error code otherwise.
+ */
+int Page_In_User_Page(struct User_Context *context, ulong_t vaddr) {
+    pte_t *entry = Find_User_PTE(context, vaddr);
+    int rc = 0;
+
+    KASSERT(context == CURRENT_THREAD->userContext);
+    while (rc == 0 && entry != 0 && !entry->present) {
+        if(Is_On_Disk(entry))
+            rc = Page_In(context, vaddr, entry);
+        else if(entry->kernelInfo == KINFO_PAGE_COMPRESSED) {
+            rc = Page_In_Compressed(vaddr, entry);
+            if(rc == ENOTFOUND)
+                rc = 0;         /* now on disk; go again */
+        } else
+            rc = EINVALID;
+    }
+    return entry == 0 ? EINVALID : rc;
+}
+
+/*
+ * Handle a write to a page shared copy-on-write since fork: copy it,
+ * unless every other mapping is already gone.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Break_COW(ulong_t vaddr, pte_t * entry) {
+    void *old = (void *)(entry->pageBaseAddr << 12), *copy;
+    struct Page *page = Get_Page((ulong_t) old), *copyPage;
+
+    vaddr = Round_Down_To_Page(vaddr);
+    if(page->refCount == 1) {
+        Claim_Page(page, entry, vaddr);
+    } else {
+        /* hold on to the original while copying it */
+        Atomic_Increment(&page->refCount);
+        /* the PTE does not refer to the copy yet; keep it off the LRU */
+        copy = Alloc_Unmapped_Page();
+        if(copy == 0) {
+            Drop_Page(old);
+            return ENOMEM;
+        }
+        copyPage = Get_Page((ulong_t) copy);
+        memcpy(copy, old, PAGE_SIZE);
+        entry->pageBaseAddr = PAGE_ALIGNED_ADDR(copy);
+        Claim_Page(copyPage, entry, vaddr);
+        Drop_Page(old);
+        Drop_Page(old);
+    }
+    entry->flags |= VM_WRITE;
+    entry->kernelInfo = 0;
+    /* XXX - should only flush the one page */
+    Flush_TLB();
+    return 0;
+}
+
 union type_pun_workaround {
     faultcode_t faultCode;
     ulong_t errorCode;
@@ -121,9 +582,69 @@ union type_pun_workaround {
     // faultCode = *((faultcode_t *) &(state->errorCode));
 
     /* rest of your handling code here */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_B, "handle page faults");
+    if(faultCode.protectionViolation && faultCode.writeFault
+       && CURRENT_THREAD->userContext != 0) {
+        pte_t *entry = Find_User_PTE(CURRENT_THREAD->userContext, address);
+
+        if(entry != 0 && entry->present
+           && entry->kernelInfo == KINFO_PAGE_COW) {
+            int rc;
+
+            Enable_Interrupts();
+            rc = Break_COW(address, entry);
+            Disable_Interrupts();
+            if(rc == 0)
+                return;
+            Print("Could not copy page %lx on write: error %d\n", address,
+                  rc);
+            goto error;
+        }
+    }
+    if(!faultCode.protectionViolation && CURRENT_THREAD->userContext != 0) {
+        struct User_Context *context = CURRENT_THREAD->userContext;
+        pte_t *entry = Find_User_PTE(context, address);
+
+        if(entry != 0 && Is_On_Disk(entry)) {
+            int rc;
 
-    TODO_P(PROJECT_MMAP, "handle mmap'd page faults");
+            /* reading the paging file blocks */
+            Enable_Interrupts();
+            rc = Page_In(context, address, entry);
+            Disable_Interrupts();
+            if(rc == 0)
+                return;
+            Print("Could not page in %lx: error %d\n", address, rc);
+            goto error;
+        }
+        if(entry != 0 && !entry->present
+           && entry->kernelInfo == KINFO_PAGE_COMPRESSED) {
+            int rc;
+
+            Enable_Interrupts();
+            rc = Page_In_Compressed(address, entry);
+            Disable_Interrupts();
+            /* ENOTFOUND: moved to the paging file meanwhile; fault again */
+            if(rc == 0 || rc == ENOTFOUND)
+                return;
+            Print("Could not page in %lx: error %d\n", address, rc);
+            goto error;
+        }
+        if((entry == 0 || (!entry->present && entry->kernelInfo == 0))
+           && address >= USER_VM_START
+           && Find_Mapped_Region(context, address - USER_VM_START)) {
+            int rc;
+
+            Enable_Interrupts();
+            entry = Find_Or_Create_User_PTE(context, address);
+            rc = entry ? Fill_Region_Page(context, address, entry) : ENOMEM;
+            Disable_Interrupts();
+            if(rc == 0)
+                return;
+            Print("Could not fill page %lx: error %d\n", address, rc);
+            goto error;
+        }
+    }
+    TODO_P(PROJECT_VIRTUAL_MEMORY_B, "handle page faults");
 
 
   error:
@@ -139,8 +660,50 @@ union type_pun_workaround {
     Exit(-1);
 }
 
+/*
+ * Map the 4 KB page at address to itself, creating its page table
+ * if needed.  Kernel mappings are global when CR4.PGE is in use.
+ */
 void Identity_Map_Page(pde_t * currentPageDir, unsigned int address,
                        int flags) {
+    pde_t *pde = &currentPageDir[PAGE_DIRECTORY_INDEX(address)];
+    pte_t *pageTable, *entry;
+
+    if(!pde->present) {
+        pageTable = Alloc_Page();
+        KASSERT0(pageTable != 0, "out of memory for kernel page tables");
+        memset(pageTable, '\0', PAGE_SIZE);
+        pde->pageTableBaseAddr = PAGE_ALIGNED_ADDR(pageTable);
+        pde->flags = VM_WRITE | (flags & VM_USER);
+        pde->present = 1;
+    }
+    KASSERT(!pde->largePages);
+
+    pageTable = (pte_t *) (pde->pageTableBaseAddr << 12);
+    entry = &pageTable[PAGE_TABLE_INDEX(address)];
+    entry->pageBaseAddr = PAGE_ALIGNED_ADDR(address);
+    entry->flags = flags;
+    entry->globalPage = (s_cr4Bits & CR4_PGE) && !(flags & VM_USER);
+    entry->present = 1;
+    ++s_smallPagesMapped;
+}
+
+/*
+ * Identity map the 4 MB page at address (which must be 4 MB
+ * aligned) with a single directory entry.  Needs CR4.PSE.
+ */
+static void Identity_Map_Large_Page(pde_t * currentPageDir,
+                                    unsigned int address, int flags) {
+    pde_t *pde = &currentPageDir[PAGE_DIRECTORY_INDEX(address)];
+
+    KASSERT((address & (LARGE_PAGE_SIZE - 1)) == 0);
+    KASSERT(!pde->present);
+    pde->pageTableBaseAddr = PAGE_ALIGNED_ADDR(address);
+    pde->flags = flags;
+    pde->largePages = 1;
+    pde->globalPage = (s_cr4Bits & CR4_PGE) && !(flags & VM_USER);
+    pde->present = 1;
+    ++s_largePagesMapped;
 }
 
 /* ----------------------------------------------------------------------
@@ -153,48 +716,197 @@ void Identity_Map_Page(pde_t * currentPageDir, unsigned int address,
  * for the kernel and physical memory.
  */
 void Init_VM(struct Boot_Info *bootInfo) {
+    extern unsigned int g_numPages;
+    ulong_t memEnd = g_numPages * PAGE_SIZE, features, addr;
+
+    features = Get_CPU_Features();
+    if(features & CPUID_FEATURE_PSE)
+        s_cr4Bits |= CR4_PSE;
+    if(features & CPUID_FEATURE_PGE)
+        s_cr4Bits |= CR4_PGE;
+    if(memEnd > USER_VM_START)
+        memEnd = USER_VM_START;
+
+    s_kernelPageDir = Alloc_Page();
+    KASSERT0(s_kernelPageDir != 0, "out of memory for kernel page directory");
+    memset(s_kernelPageDir, '\0', PAGE_SIZE);
+
     /*
-     * Hints:
-     * - Build kernel page directory and page tables
-     * - Call Enable_Paging() with the kernel page directory
-     * - Install an interrupt handler for interrupt 14,
-     *   page fault
-     * - Do not map a page at address 0; this will help trap
-     *   null pointer references
+     * Physical memory: small pages for the first 4 MB, so page 0
+     * stays unmapped and traps null pointers, then large pages
+     * wherever a whole 4 MB page is backed by memory.
      */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A,
-           "Build initial kernel page directory and page tables");
+    for(addr = PAGE_SIZE; addr < memEnd;) {
+        if((s_cr4Bits & CR4_PSE) && addr >= LARGE_PAGE_SIZE
+           && (addr & (LARGE_PAGE_SIZE - 1)) == 0
+           && memEnd - addr >= LARGE_PAGE_SIZE) {
+            Identity_Map_Large_Page(s_kernelPageDir, addr, VM_WRITE);
+            addr += LARGE_PAGE_SIZE;
+        } else {
+            Identity_Map_Page(s_kernelPageDir, addr, VM_WRITE);
+            addr += PAGE_SIZE;
+        }
+    }
+
+    /* memory-mapped APIC registers */
+    if(s_cr4Bits & CR4_PSE) {
+        Identity_Map_Large_Page(s_kernelPageDir, APIC_REGION_START,
+                                VM_WRITE | VM_NOCACHE);
+    } else {
+        Identity_Map_Page(s_kernelPageDir, IO_APIC_ADDR,
+                          VM_WRITE | VM_NOCACHE);
+        Identity_Map_Page(s_kernelPageDir, LOCAL_APIC_ADDR,
+                          VM_WRITE | VM_NOCACHE);
+    }
+
+    Install_Interrupt_Handler(14, Page_Fault_Handler);
+
+    if(s_cr4Bits != 0)
+        Set_CR4_Bits(s_cr4Bits);
+    Enable_Paging(s_kernelPageDir);
+
+    Print("Paging enabled: %lu 4 MB and %lu 4 KB kernel pages%s\n",
+          s_largePagesMapped, s_smallPagesMapped,
+          (s_cr4Bits & CR4_PGE) ? ", global" : "");
 }
 
+/*
+ * Turn on paging on a secondary CPU with the kernel page directory
+ * built by Init_VM(), if there is one.
+ */
 void Init_Secondary_VM() {
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A, "enable paging on secondary cores");
+    if(s_kernelPageDir == 0)
+        return;
+    if(s_cr4Bits != 0)
+        Set_CR4_Bits(s_cr4Bits);
+    Enable_Paging(s_kernelPageDir);
 }
 
+/*
+ * Identity map a device's memory-mapped registers, uncached, in the
+ * kernel page directory, so drivers can reach them with paging on.
+ * Nothing to do if paging is off.  The pages were not present
+ * before, so no CPU has stale TLB entries for them.
+ */
+void Map_Device_Memory(ulong_t paddr, ulong_t size) {
+    ulong_t addr;
+
+    if(s_kernelPageDir == 0)
+        return;
+    for(addr = paddr & ~(ulong_t) PAGE_MASK; addr < paddr + size;
+        addr += PAGE_SIZE) {
+        pde_t *pde = &s_kernelPageDir[PAGE_DIRECTORY_INDEX(addr)];
+
+        /* e.g. inside the APIC region */
+        if(pde->present && pde->largePages)
+            continue;
+        Identity_Map_Page(s_kernelPageDir, addr, VM_WRITE | VM_NOCACHE);
+    }
+}
+
+/*
+ * Paging file state.  One bit per page-sized slot, set while the
+ * slot holds a page.  s_nextSlot is where the next search starts, so
+ * consecutive page-outs get consecutive slots.
+ */
+static struct Paging_Device *s_pagingDevice;
+static ulong_t *s_slotBitmap;
+static int s_numSlots, s_freeSlots, s_nextSlot;
+
+#define SLOT_WORD(i)   ((i) / (8 * sizeof(ulong_t)))
+#define SLOT_BIT(i)    (1UL << ((i) % (8 * sizeof(ulong_t))))
+#define SLOT_USED(i)   (s_slotBitmap[SLOT_WORD(i)] & SLOT_BIT(i))
+
 /**
  * Initialize paging file data structures.
  * All filesystems should be mounted before this function
  * is called, to ensure that the paging file is available.
  */
 void Init_Paging(void) {
-    TODO_P(PROJECT_VIRTUAL_MEMORY_B,
-           "Initialize paging file data structures");
+    ulong_t bytes;
+
+    s_pagingDevice = Get_Paging_Device();
+    if(s_pagingDevice == 0) {
+        Print("No paging file; page-out disabled\n");
+        return;
+    }
+
+    s_numSlots = s_pagingDevice->numSectors / SECTORS_PER_PAGE;
+    bytes = (SLOT_WORD(s_numSlots) + 1) * sizeof(ulong_t);
+    s_slotBitmap = Malloc(bytes);
+    if(s_slotBitmap == 0) {
+        Print("No memory for paging file bitmap; page-out disabled\n");
+        s_numSlots = 0;
+        return;
+    }
+    memset(s_slotBitmap, '\0', bytes);
+    s_freeSlots = s_numSlots;
+
+    Init_Zswap();
+    Init_Pageout_Daemon();
 }
 
 /* guards your structure for tracking free space on the paging file. */
 static Spin_Lock_t s_free_space_spin_lock;
 
+/**
+ * Find a run of free page-sized chunks of disk on the paging file,
+ * so a batch of pages can be written with sequential I/O.
+ * @param pCount on entry, the number of chunks wanted; on return,
+ *   the number found (at least one, unless the file is full)
+ * @return index of the first chunk of the run, or -1 if the
+ *   paging file is full
+ */
+int Find_Space_Run_On_Paging_File(int *pCount) {
+    int i, start, best = -1, bestLen = 0, len, scanned;
+    bool iflag = Spin_Lock_Irq_Save(&s_free_space_spin_lock);
+
+    KASSERT(*pCount > 0);
+    if(s_freeSlots == 0) {
+        Spin_Unlock_Irq_Restore(&s_free_space_spin_lock, iflag);
+        *pCount = 0;
+        return -1;
+    }
+
+    /* first run of the wanted length from s_nextSlot on, else the longest */
+    i = s_nextSlot;
+    for(scanned = 0; scanned < s_numSlots && bestLen < *pCount;) {
+        if(SLOT_USED(i)) {
+            i = (i + 1) % s_numSlots;
+            scanned++;
+            continue;
+        }
+        start = i;
+        for(len = 0; len < *pCount && i < s_numSlots && !SLOT_USED(i);
+            len++, i++) ;
+        scanned += len;
+        if(len > bestLen) {
+            best = start;
+            bestLen = len;
+        }
+        if(i == s_numSlots)
+            i = 0;
+    }
+
+    for(i = best; i < best + bestLen; i++)
+        s_slotBitmap[SLOT_WORD(i)] |= SLOT_BIT(i);
+    s_freeSlots -= bestLen;
+    s_nextSlot = (best + bestLen) % s_numSlots;
+
+    Spin_Unlock_Irq_Restore(&s_free_space_spin_lock, iflag);
+    *pCount = bestLen;
+    return best;
+}
+
 /**
  * Find a free bit of disk on the paging file for this page.
  * @return index of free page sized chunk of disk space in
  *   the paging file, or -1 if the paging file is full
  */
 int Find_Space_On_Paging_File(void) {
-    unsigned int retval;
-    bool iflag = Spin_Lock_Irq_Save(&s_free_space_spin_lock);
-    TODO_P(PROJECT_VIRTUAL_MEMORY_B, "Find free page in paging file");
-    retval = EUNSUPPORTED;
-    Spin_Unlock_Irq_Restore(&s_free_space_spin_lock, iflag);
-    return retval;
+    int count = 1;
+
+    return Find_Space_Run_On_Paging_File(&count);
 }
 
 /**
@@ -203,10 +915,79 @@ int Find_Space_On_Paging_File(void) {
  */
 void Free_Space_On_Paging_File(int pagefileIndex) {
     bool iflag = Spin_Lock_Irq_Save(&s_free_space_spin_lock);
-    TODO_P(PROJECT_VIRTUAL_MEMORY_B, "Free page in paging file");
+    KASSERT(pagefileIndex >= 0 && pagefileIndex < s_numSlots);
+    KASSERT(SLOT_USED(pagefileIndex));
+    s_slotBitmap[SLOT_WORD(pagefileIndex)] &= ~SLOT_BIT(pagefileIndex);
+    s_freeSlots++;
     Spin_Unlock_Irq_Restore(&s_free_space_spin_lock, iflag);
 }
 
+/*
+ * Transfer pages to or from consecutive chunks of the paging file,
+ * BLOCK_MAX_SEGMENTS pages to a scatter-gather request.
+ */
+static int Paging_File_IO(enum Request_Type type, void **paddrs, int count,
+                          int pagefileIndex) {
+    struct Block_Device *dev = s_pagingDevice->dev;
+    struct Block_Segment segments[BLOCK_MAX_SEGMENTS];
+    int block, done, i, n, rc;
+
+    KASSERT(pagefileIndex >= 0 && pagefileIndex + count <= s_numSlots);
+    block = s_pagingDevice->startSector + pagefileIndex * SECTORS_PER_PAGE;
+    for(done = 0; done < count; done += n) {
+        n = count - done;
+        if(n > BLOCK_MAX_SEGMENTS)
+            n = BLOCK_MAX_SEGMENTS;
+        for(i = 0; i < n; i++) {
+            segments[i].buf = paddrs[done + i];
+            segments[i].numBlocks = SECTORS_PER_PAGE;
+        }
+        rc = type == BLOCK_WRITE
+            ? Block_Write_Vector(dev, block, segments, n)
+            : Block_Read_Vector(dev, block, segments, n);
+        if(rc != 0)
+            return rc;
+        block += n * SECTORS_PER_PAGE;
+    }
+    return 0;
+}
+
+/**
+ * Read a batch of pages from consecutive chunks of the paging file,
+ * starting at pagefileIndex.
+ * @param paddrs physical addresses of the (locked) pages
+ * @param count number of pages
+ * @return 0 if successful, error code otherwise
+ */
+int Read_Pages_From_Paging_File(void **paddrs, int count, int pagefileIndex) {
+    int i;
+
+    for(i = 0; i < count; i++) {
+        struct Page *page = Get_Page((ulong_t) paddrs[i]);
+        KASSERT(!(page->flags & PAGE_PAGEABLE));
+        KASSERT(page->flags & PAGE_LOCKED);
+    }
+    return Paging_File_IO(BLOCK_READ, paddrs, count, pagefileIndex);
+}
+
+/**
+ * Write a batch of pages to consecutive chunks of the paging file,
+ * starting at pagefileIndex.
+ * @param paddrs physical addresses of the (locked) pages
+ * @param count number of pages
+ * @return 0 if successful, error code otherwise
+ */
+int Write_Pages_To_Paging_File(void **paddrs, int count, int pagefileIndex) {
+    int i;
+
+    for(i = 0; i < count; i++) {
+        struct Page *page = Get_Page((ulong_t) paddrs[i]);
+        KASSERT(!(page->flags & PAGE_PAGEABLE));
+        KASSERT(page->flags & PAGE_LOCKED);
+    }
+    return Paging_File_IO(BLOCK_WRITE, paddrs, count, pagefileIndex);
+}
+
 /**
  * Write the contents of given page to the indicated block
  * of space in the paging file.
@@ -219,7 +1000,8 @@ void Write_To_Paging_File(void *paddr, ulong_t vaddr, int pagefileIndex) {
     struct Page *page = Get_Page((ulong_t) paddr);
     KASSERT(!(page->flags & PAGE_PAGEABLE));    /* Page must be pageable! */
     KASSERT(page->flags & PAGE_LOCKED); /* Page must be locked! */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_B, "Write page data to paging file");
+    if(Paging_File_IO(BLOCK_WRITE, &paddr, 1, pagefileIndex) != 0)
+        Print("Error writing page %lx to paging file\n", vaddr);
 }
 
 /**
@@ -234,27 +1016,292 @@ void Write_To_Paging_File(void *paddr, ulong_t vaddr, int pagefileIndex) {
 void Read_From_Paging_File(void *paddr, ulong_t vaddr, int pagefileIndex) {
     struct Page *page = Get_Page((ulong_t) paddr);
     KASSERT(!(page->flags & PAGE_PAGEABLE));    /* Page must be locked! */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_B, "Read page data from paging file");
+    if(Paging_File_IO(BLOCK_READ, &paddr, 1, pagefileIndex) != 0)
+        Print("Error reading page %lx from paging file\n", vaddr);
+}
+
+
+/* ----------------------------------------------------------------------
+ * Memory mapped files
+ *
+ * Mmap() only records a region; its pages are filled from the file
+ * by Fill_Region_Page() the first time they are touched.  Dirty
+ * pages of MAP_SHARED regions are written back to the file by
+ * Msync(), Munmap(), process exit and page-out, which drops them
+ * instead of swapping them; they are read back on the next fault.
+ * ---------------------------------------------------------------------- */
+
+static ulong_t s_mmapWritebacks;
+
+/*
+ * Does user address range [start, start + length) overlap any
+ * mapped region of a process?
+ */
+static bool Overlaps_Mapped_Region(struct User_Context *context,
+                                   ulong_t start, ulong_t length) {
+    mappedRegion_t *region;
+
+    for(region = context->mappedRegions; region != 0; region = region->next)
+        if(start < region->startAddr + region->length
+           && region->startAddr < start + length)
+            return true;
+    return false;
+}
+
+/*
+ * Does user address range [start, start + length) overlap the image,
+ * the space reserved for the heap, or any mapped region of a process?
+ */
+static bool Is_User_Range_Used(struct User_Context *context, ulong_t start,
+                               ulong_t length) {
+    if(start < context->size || start < context->heapLimit)
+        return true;
+    return Overlaps_Mapped_Region(context, start, length);
+}
+
+/*
+ * Find room for a mapping of length bytes, first fit upwards from
+ * USER_MMAP_START, or from the end of the image and heap reserve if
+ * that is higher.  Returns the user address, or 0 if there is none.
+ */
+ulong_t Find_Mmap_Space(struct User_Context *context, ulong_t length) {
+    ulong_t start = USER_MMAP_START;
+    mappedRegion_t *region;
+    bool moved = true;
+
+    if(start < Round_Up_To_Page(context->size))
+        start = Round_Up_To_Page(context->size);
+    if(start < Round_Up_To_Page(context->heapLimit))
+        start = Round_Up_To_Page(context->heapLimit);
+
+    while (moved) {
+        moved = false;
+        for(region = context->mappedRegions; region != 0;
+            region = region->next)
+            if(start < region->startAddr + region->length
+               && region->startAddr < start + length) {
+                start = Round_Up_To_Page(region->startAddr + region->length);
+                moved = true;
+            }
+        if(start + length > USER_VM_END - USER_VM_START
+           || start + length < start)
+            return 0;
+    }
+    return start;
+}
+
+/*
+ * Write a resident page of a MAP_SHARED region, held at paddr, back
+ * to its file, clearing its dirty bit first so writes made meanwhile
+ * are not lost.  The caller keeps the page from being evicted or
+ * freed: it is locked by the page-out daemon or pinned by
+ * Sync_Mapped_Region().
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Write_Region_Page(mappedRegion_t * region, pte_t * entry,
+                             ulong_t first, void *paddr) {
+    ulong_t end = first + PAGE_SIZE;
+    int rc;
+
+    KASSERT(Get_Page((ulong_t) paddr)->flags & PAGE_LOCKED);
+    entry->dirty = 0;
+    /* XXX - should flush the page on every CPU */
+    Flush_TLB();
+
+    if(end > region->startAddr + region->fileLength)
+        end = region->startAddr + region->fileLength;
+    if(first >= end)
+        return 0;               /* beyond the end of the file */
+    rc = Write_Region_File(region->file,
+                           region->fileOffset + (first - region->startAddr),
+                           paddr, end - first);
+    if(rc != 0)
+        entry->dirty = 1;
+    else
+        ++s_mmapWritebacks;
+    return rc;
+}
+
+/*
+ * Write every dirty resident page of a MAP_SHARED region back to
+ * its file.  Returns 0 if successful, error code otherwise.
+ */
+int Sync_Mapped_Region(struct User_Context *context, mappedRegion_t * region) {
+    ulong_t first;
+    int rc = 0, err;
+
+    if(region->file == 0 || !(region->flags & MAP_SHARED))
+        return 0;
+    for(first = region->startAddr; first < region->startAddr + region->length;
+        first += PAGE_SIZE) {
+        pte_t *entry = Find_User_PTE(context, USER_VM_START + first);
+        struct Page *page;
+
+        if(entry == 0 || !entry->present || !entry->dirty)
+            continue;
+        page = Get_Page(entry->pageBaseAddr << 12);
+        if(!Pin_Page(page))
+            continue;           /* being paged out, which writes it back */
+        err = Write_Region_Page(region, entry, first,
+                                (void *)(entry->pageBaseAddr << 12));
+        Unpin_Page(page);
+        if(rc == 0)
+            rc = err;
+    }
+    return rc;
 }
 
+/*
+ * Map length bytes of the file open as fd at user address ptr, or
+ * wherever there is room if ptr is 0 or unusable.
+ * Returns the user address of the mapping, or an error code (< 0).
+ */
+int Mmap_Impl(ulong_t ptr, ulong_t length, int prot, int flags, int fd) {
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    struct File *file;
+    ulong_t fileLength;
+    int rc;
+
+    if(context->pageDir == 0)
+        return EUNSUPPORTED;
+    if(length == 0 || (flags != MAP_SHARED && flags != MAP_PRIVATE)
+       || (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0)
+        return EINVALID;
+    if(fd < 0 || fd >= USER_MAX_FILES
+       || (file = context->file_descriptor_table[fd]) == 0)
+        return EINVALID;
+    if(!(file->mode & O_READ)
+       || ((flags & MAP_SHARED) && (prot & PROT_WRITE)
+           && !(file->mode & O_WRITE)))
+        return EACCESS;
 
-void *Mmap_Impl(void *ptr, unsigned int length, int prot, int flags,
-                int fd) {
-    TODO_P(PROJECT_MMAP, "Mmap setup mapping");
-    return NULL;
+    length = Round_Up_To_Page(length);
+    if(length == 0 || length > USER_VM_END - USER_VM_START)
+        return EINVALID;
+    if(ptr == 0 || ptr != Round_Down_To_Page(ptr)
+       || ptr + length > USER_VM_END - USER_VM_START
+       || Is_User_Range_Used(context, ptr, length))
+        ptr = Find_Mmap_Space(context, length);
+    if(ptr == 0)
+        return ENOMEM;
+
+    fileLength = file->endPos < length ? file->endPos : length;
+    rc = Add_Mapped_Region(context, file, ptr, length, prot, flags, 0,
+                           fileLength);
+    if(rc != 0)
+        return rc;
+    Debug("mmap fd %d at %lx, %lu bytes\n", fd, ptr, length);
+    return (int)ptr;
 }
 
+/*
+ * Is linear address vaddr in a MAP_SHARED file mapping of context,
+ * whose pages are written back rather than swapped?
+ */
 bool Is_Mmaped_Page(struct User_Context * context, ulong_t vaddr) {
-    TODO_P(PROJECT_MMAP,
-           "is this passed vaddr an mmap'd page in the passed user context");
-    return false;
+    mappedRegion_t *region;
+
+    if(vaddr < USER_VM_START)
+        return false;
+    region = Find_Mapped_Region(context, vaddr - USER_VM_START);
+    return region != 0 && region->file != 0 && (region->flags & MAP_SHARED);
+}
+
+/*
+ * Write the resident page at linear address vaddr of a MAP_SHARED
+ * file mapping, held in the locked frame paddr, back to the file.
+ * Returns 0 if successful, error code otherwise.
+ */
+int Write_Out_Mmaped_Page(struct User_Context *context, ulong_t vaddr,
+                          void *paddr) {
+    ulong_t first = Round_Down_To_Page(vaddr) - USER_VM_START;
+    mappedRegion_t *region;
+    pte_t *entry;
+
+    if(!Is_Mmaped_Page(context, vaddr))
+        return EINVALID;
+    region = Find_Mapped_Region(context, first);
+    entry = Find_User_PTE(context, Round_Down_To_Page(vaddr));
+    if(entry == 0 || !entry->present
+       || entry->pageBaseAddr != PAGE_ALIGNED_ADDR(paddr))
+        return EINVALID;
+    return Write_Region_Page(region, entry, first, paddr);
+}
+
+/*
+ * Write the dirty pages of the MAP_SHARED mapping containing user
+ * address ptr back to the file.
+ * Returns 0 if successful, error code otherwise.
+ */
+int Msync_Impl(ulong_t ptr) {
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    mappedRegion_t *region = Find_Mapped_Region(context, ptr);
+
+    if(region == 0)
+        return EINVALID;
+    return Sync_Mapped_Region(context, region);
 }
 
-void Write_Out_Mmaped_Page(struct User_Context *context, ulong_t vaddr) {
-    TODO_P(PROJECT_MMAP, "Mmap write back dirty mmap'd page");
+/*
+ * Release the pages at user addresses [first, end) of a process,
+ * resident or swapped out, except those still inside one of its
+ * mapped regions.
+ */
+void Unmap_User_Pages(struct User_Context *context, ulong_t first,
+                      ulong_t end) {
+    for(; first < end; first += PAGE_SIZE) {
+        pte_t *entry = Find_User_PTE(context, USER_VM_START + first);
+
+        if(entry == 0 || Overlaps_Mapped_Region(context, first, PAGE_SIZE))
+            continue;
+        if(entry->present)
+            Drop_Page((void *)(entry->pageBaseAddr << 12));
+        else if(entry->kernelInfo != 0)
+            Zswap_Free_PTE(entry);
+        memset(entry, '\0', sizeof(*entry));
+    }
+    Flush_TLB();
 }
 
+/*
+ * Remove the mapping starting at user address ptr: write back its
+ * dirty shared pages, then release every page it covers that no
+ * other region shares.  Regions are never split, so an address
+ * inside a mapping but not at its start is EINVALID, as is the heap.
+ * Returns 0 if successful, error code otherwise.
+ */
 int Munmap_Impl(ulong_t ptr) {
-    TODO_P(PROJECT_MMAP, "unmapp the pages");
-    return 0;
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    mappedRegion_t **pRegion, *region;
+    int rc;
+
+    if(context->pageDir == 0)
+        return EUNSUPPORTED;
+    if(ptr != Round_Down_To_Page(ptr))
+        return EINVALID;
+    for(pRegion = &context->mappedRegions; *pRegion != 0;
+        pRegion = &(*pRegion)->next)
+        if((*pRegion)->startAddr == ptr)
+            break;
+    region = *pRegion;
+    if(region == 0 || (region->flags & MAP_HEAP))
+        return EINVALID;
+
+    rc = Sync_Mapped_Region(context, region);
+    *pRegion = region->next;
+    Unmap_User_Pages(context, ptr, ptr + region->length);
+
+    if(region->file != 0)
+        Close(region->file);
+    Free(region);
+    return rc;
+}
+
+/*
+ * Print paging file, swap-in and mapped file statistics.
+ */
+void Dump_Paging_Stats(void) {
+    Print("paging file: %d of %d slots free; %lu swap-in faults, %lu pages read, readahead window %d; %lu mapped pages written back\n",
+          s_freeSlots, s_numSlots, s_swapInFaults, s_swapInPages,
+          s_readaheadWindow, s_mmapWritebacks);
 }
@@ -0,0 +1,262 @@
+/*
+ * PCI bus enumeration.
+ *
+ * Configuration mechanism #1: write the bus/slot/function/register
+ * address to CONFIG_ADDRESS (0xCF8), then access the double word at
+ * CONFIG_DATA (0xCFC).  The two steps are done under s_pciLock.
+ */
+
+#include <geekos/io.h>
+#include <geekos/lock.h>
+#include <geekos/int.h>
+#include <geekos/screen.h>
+#include <geekos/pci.h>
+
+#define PCI_CONFIG_ADDRESS  0xcf8
+#define PCI_CONFIG_DATA     0xcfc
+#define PCI_CONFIG_ENABLE   0x80000000
+
+#define PCI_MAX_SLOT        32
+#define PCI_MAX_FUNC        8
+
+#define PCI_HEADER_MULTI_FUNCTION 0x80
+#define PCI_HEADER_TYPE_MASK      0x7f
+#define PCI_HEADER_TYPE_BRIDGE    0x01
+
+#define PCI_BAR_IO          0x1
+#define PCI_BAR_TYPE_MASK   0x6
+#define PCI_BAR_TYPE_64     0x4
+
+static struct PCI_Device s_pciDevices[PCI_MAX_DEVICES];
+static int s_numPCIDevices;
+static Spin_Lock_t s_pciLock;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static ulong_t Config_Address(int bus, int slot, int func, int offset) {
+    return PCI_CONFIG_ENABLE | (bus << 16) | (slot << 11) | (func << 8) |
+        (offset & 0xfc);
+}
+
+static ulong_t Read_Config(int bus, int slot, int func, int offset) {
+    bool iflag = Spin_Lock_Irq_Save(&s_pciLock);
+    ulong_t value;
+
+    Out_DWord(PCI_CONFIG_ADDRESS, Config_Address(bus, slot, func, offset));
+    value = In_DWord(PCI_CONFIG_DATA);
+    Spin_Unlock_Irq_Restore(&s_pciLock, iflag);
+    return value;
+}
+
+static void Write_Config(int bus, int slot, int func, int offset,
+                         ulong_t value) {
+    bool iflag = Spin_Lock_Irq_Save(&s_pciLock);
+
+    Out_DWord(PCI_CONFIG_ADDRESS, Config_Address(bus, slot, func, offset));
+    Out_DWord(PCI_CONFIG_DATA, value);
+    Spin_Unlock_Irq_Restore(&s_pciLock, iflag);
+}
+
+/*
+ * Find the size of each BAR by writing all ones and reading back
+ * which address bits stick.  A 64-bit memory BAR uses the next BAR
+ * for its high half; that one is left empty.  Decoding is turned off
+ * meanwhile, so the device does not claim cycles at the all-ones
+ * address.
+ */
+static void Probe_BARs(struct PCI_Device *dev, int numBars) {
+    ushort_t command = PCI_Read_Config_Word(dev, PCI_COMMAND);
+    int i;
+
+    if(command & (PCI_COMMAND_IO | PCI_COMMAND_MEMORY))
+        PCI_Write_Config(dev, PCI_COMMAND,
+                         command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for(i = 0; i < numBars; i++) {
+        int offset = PCI_BAR0 + i * 4;
+        ulong_t orig = PCI_Read_Config(dev, offset), mask;
+
+        PCI_Write_Config(dev, offset, 0xffffffff);
+        mask = PCI_Read_Config(dev, offset);
+        PCI_Write_Config(dev, offset, orig);
+        if(mask == 0 || mask == 0xffffffff)
+            continue;
+
+        dev->barIsIO[i] = (orig & PCI_BAR_IO) != 0;
+        if(dev->barIsIO[i]) {
+            dev->bar[i] = orig & ~0x3;
+            dev->barSize[i] = (~(mask & ~0x3) & 0xffff) + 1;
+        } else {
+            dev->bar[i] = orig & ~0xf;
+            dev->barSize[i] = ~(mask & ~0xf) + 1;
+            if((orig & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64)
+                ++i;
+        }
+    }
+
+    if(command & (PCI_COMMAND_IO | PCI_COMMAND_MEMORY))
+        PCI_Write_Config(dev, PCI_COMMAND, command);
+}
+
+static void Scan_Bus(int bus);
+
+/*
+ * Record one function, and scan behind it if it is a bridge.
+ */
+static void Add_Function(int bus, int slot, int func, ulong_t id) {
+    struct PCI_Device *dev;
+    ulong_t classReg;
+    int headerType;
+
+    if(s_numPCIDevices == PCI_MAX_DEVICES) {
+        Print("pci: too many devices, ignoring %d:%d.%d\n", bus, slot,
+              func);
+        return;
+    }
+    dev = &s_pciDevices[s_numPCIDevices++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendorId = id & 0xffff;
+    dev->deviceId = id >> 16;
+
+    classReg = Read_Config(bus, slot, func, PCI_REVISION);
+    dev->revision = classReg & 0xff;
+    dev->progIf = (classReg >> 8) & 0xff;
+    dev->subclass = (classReg >> 16) & 0xff;
+    dev->classCode = classReg >> 24;
+    dev->irq = PCI_Read_Config_Byte(dev, PCI_INTERRUPT_LINE);
+    if(dev->irq == 0)
+        dev->irq = PCI_NO_IRQ;
+
+    headerType = PCI_Read_Config_Byte(dev, PCI_HEADER_TYPE) &
+        PCI_HEADER_TYPE_MASK;
+    if(headerType == PCI_HEADER_TYPE_BRIDGE) {
+        int secondary = PCI_Read_Config_Byte(dev, PCI_SECONDARY_BUS);
+
+        Probe_BARs(dev, 2);
+        if(dev->classCode == PCI_CLASS_BRIDGE
+           && dev->subclass == PCI_SUBCLASS_PCI_BRIDGE && secondary > bus)
+            Scan_Bus(secondary);
+    } else if(headerType == 0) {
+        Probe_BARs(dev, PCI_NUM_BARS);
+    }
+}
+
+static void Scan_Bus(int bus) {
+    int slot, func;
+
+    for(slot = 0; slot < PCI_MAX_SLOT; slot++) {
+        ulong_t id = Read_Config(bus, slot, 0, PCI_VENDOR_ID);
+        int numFuncs;
+
+        if((id & 0xffff) == 0xffff)
+            continue;
+        numFuncs = (Read_Config(bus, slot, 0, PCI_HEADER_TYPE) >> 16) &
+            PCI_HEADER_MULTI_FUNCTION ? PCI_MAX_FUNC : 1;
+
+        for(func = 0; func < numFuncs; func++) {
+            if(func > 0) {
+                id = Read_Config(bus, slot, func, PCI_VENDOR_ID);
+                if((id & 0xffff) == 0xffff)
+                    continue;
+            }
+            Add_Function(bus, slot, func, id);
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Read configuration space of a device; offset is rounded down to
+ * a multiple of the access size.
+ */
+ulong_t PCI_Read_Config(const struct PCI_Device *dev, int offset) {
+    return Read_Config(dev->bus, dev->slot, dev->func, offset);
+}
+
+ushort_t PCI_Read_Config_Word(const struct PCI_Device *dev, int offset) {
+    return PCI_Read_Config(dev, offset) >> ((offset & 2) * 8);
+}
+
+uchar_t PCI_Read_Config_Byte(const struct PCI_Device *dev, int offset) {
+    return PCI_Read_Config(dev, offset) >> ((offset & 3) * 8);
+}
+
+void PCI_Write_Config(const struct PCI_Device *dev, int offset,
+                      ulong_t value) {
+    Write_Config(dev->bus, dev->slot, dev->func, offset, value);
+}
+
+/*
+ * Find the index'th device (counting from 0) with the given IDs.
+ */
+struct PCI_Device *Find_PCI_Device(ushort_t vendorId, ushort_t deviceId,
+                                   int index) {
+    int i;
+
+    for(i = 0; i < s_numPCIDevices; i++)
+        if(s_pciDevices[i].vendorId == vendorId
+           && s_pciDevices[i].deviceId == deviceId && index-- == 0)
+            return &s_pciDevices[i];
+    return 0;
+}
+
+/*
+ * Find the index'th device (counting from 0) of the given class.
+ */
+struct PCI_Device *Find_PCI_Class(uchar_t classCode, uchar_t subclass,
+                                  int index) {
+    int i;
+
+    for(i = 0; i < s_numPCIDevices; i++)
+        if(s_pciDevices[i].classCode == classCode
+           && s_pciDevices[i].subclass == subclass && index-- == 0)
+            return &s_pciDevices[i];
+    return 0;
+}
+
+/*
+ * Turn on I/O and memory decoding, and bus mastering if asked for.
+ * The status register shares the double word; its bits are cleared
+ * by writing ones, so zeros are written to leave it alone.
+ */
+void PCI_Enable_Device(struct PCI_Device *dev, bool busMaster) {
+    ushort_t command = PCI_Read_Config_Word(dev, PCI_COMMAND);
+
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY;
+    if(busMaster)
+        command |= PCI_COMMAND_BUS_MASTER;
+    PCI_Write_Config(dev, PCI_COMMAND, command);
+}
+
+void Dump_PCI_Devices(void) {
+    int i, b;
+
+    for(i = 0; i < s_numPCIDevices; i++) {
+        struct PCI_Device *dev = &s_pciDevices[i];
+
+        Print("    %02x:%02x.%x %04x:%04x class %02x.%02x.%02x",
+              dev->bus, dev->slot, dev->func, dev->vendorId, dev->deviceId,
+              dev->classCode, dev->subclass, dev->progIf);
+        if(dev->irq != PCI_NO_IRQ)
+            Print(" irq %d", dev->irq);
+        for(b = 0; b < PCI_NUM_BARS; b++)
+            if(dev->barSize[b] != 0)
+                Print(" %s%x/%lx", dev->barIsIO[b] ? "io " : "",
+                      (unsigned)dev->bar[b], dev->barSize[b]);
+        Print("\n");
+    }
+}
+
+void Init_PCI(void) {
+    Print("Scanning PCI buses...\n");
+    Scan_Bus(0);
+    Print("pci: %d devices\n", s_numPCIDevices);
+    Dump_PCI_Devices();
+}
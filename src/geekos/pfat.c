@@ -123,35 +123,32 @@ static inline ulong_t advance_by_n_blocks(struct PFAT_Instance *instance,
 }
 
 /*
- * Read function for PFAT files.
+ * Read numBytesRequested bytes at position start of a PFAT file.
+ * Called with the PFAT_File's lock held; does not move the file
+ * position.
  */
-static int PFAT_Read(struct File *file, void *buf,
-                     ulong_t numBytesRequested) {
+static int PFAT_Read_Locked(struct File *file, ulong_t start, void *buf,
+                            ulong_t numBytesRequested) {
     struct PFAT_File *pfatFile = (struct PFAT_File *)file->fsData;
     struct PFAT_Instance *instance =
         (struct PFAT_Instance *)file->mountPoint->fsData;
-    ulong_t start, end;
+    ulong_t end;
     ulong_t startBlock, endBlock, curBlock;
     ulong_t i;
 
-    /* Only allow one thread at a time to read this file, updating position. */
-    Mutex_Lock(&pfatFile->lock);
-
-    start = file->filePos;
-    end = file->filePos + numBytesRequested;
+    end = start + numBytesRequested;
 
     if(pfatFile->entry->directory)
         return EINVALID;
 
     if(end > file->endPos) {
-        numBytesRequested = file->endPos - file->filePos;
+        numBytesRequested = file->endPos - start;
         end = file->endPos;
     }
     //Print("start:%d end:%d nb:%d  \n",start,end,numBytesRequested);
 
     /* Special case: can't handle reads longer than INT_MAX */
     if(numBytesRequested > INT_MAX) {
-        Mutex_Unlock(&pfatFile->lock);
         return EINVALID;
     }
 
@@ -159,16 +156,14 @@ static int PFAT_Read(struct File *file, void *buf,
        we may end up with a read starting just at the end of the file.  such
        is not invalid, it is just the end of the file. (ns) */
     if(start == file->endPos) {
-        Mutex_Unlock(&pfatFile->lock);
         return 0;
     }
 
     /* Make sure request represents a valid range within the file */
     if(start >= file->endPos || end > file->endPos || end < start) {
         Debug
-            ("Invalid read position: filePos=%lu, numBytesRequested=%lu, endPos=%lu\n",
-             file->filePos, numBytesRequested, file->endPos);
-        Mutex_Unlock(&pfatFile->lock);
+            ("Invalid read position: pos=%lu, numBytesRequested=%lu, endPos=%lu\n",
+             start, numBytesRequested, file->endPos);
         return EINVALID;
     }
 
@@ -204,7 +199,6 @@ static int PFAT_Read(struct File *file, void *buf,
             Print
                 ("Unexpected end of file in FAT at file block %lu of %lu\n",
                  i, endBlock);
-            Mutex_Unlock(&pfatFile->lock);
             return EIO;         /* probable filesystem corruption */
         }
 
@@ -212,7 +206,6 @@ static int PFAT_Read(struct File *file, void *buf,
                         pfatFile->fileDataCache);
         if(rc != 0) {
             Print("Unexpected block read error occurred\n");
-            Mutex_Unlock(&pfatFile->lock);
             return EIO;
         }
 
@@ -242,11 +235,6 @@ static int PFAT_Read(struct File *file, void *buf,
 
     }
 
-    //update position in file!
-    file->filePos += numBytesRequested;
-
-    Mutex_Unlock(&pfatFile->lock);
-
     KASSERT(numBytesRead == numBytesRequested);
     Debug("Read satisfied!\n");
 
@@ -254,19 +242,18 @@ static int PFAT_Read(struct File *file, void *buf,
 }
 
 /*
- * Write function for PFAT files.
+ * Write numBytes bytes at position start of a PFAT file.  Called
+ * with the PFAT_File's lock held; does not move the file position.
  */
-static int PFAT_Write(struct File *file, void *ptr, ulong_t numBytes) {
+static int PFAT_Write_Locked(struct File *file, ulong_t start, void *ptr,
+                             ulong_t numBytes) {
     char *buf = (char *)ptr;
     struct PFAT_File *pfatFile = (struct PFAT_File *)file->fsData;
     struct PFAT_Instance *instance =
         (struct PFAT_Instance *)file->mountPoint->fsData;
-    ulong_t start, end;
+    ulong_t end;
 
-    Mutex_Lock(&pfatFile->lock);
-
-    start = file->filePos;
-    end = file->filePos + numBytes;
+    end = start + numBytes;
 
     if(pfatFile->entry->directory)
         return EINVALID;
@@ -280,15 +267,16 @@ static int PFAT_Write(struct File *file, void *ptr, ulong_t numBytes) {
         return EINVALID;
     }
 
-    if(file->filePos % SECTOR_SIZE) {
+    if(start % SECTOR_SIZE) {
         /* only write at start of sector */
         return EINVALID;
     }
 
-    KASSERT(file->filePos <= file->endPos);
+    if(start > file->endPos)
+        return EINVALID;
     // allowed to write the last sector even if file is not full
-    if(file->filePos + numBytes > file->endPos) {
-        numBytes = file->endPos - file->filePos;
+    if(start + numBytes > file->endPos) {
+        numBytes = file->endPos - start;
     }
 
     /*
@@ -312,7 +300,6 @@ static int PFAT_Write(struct File *file, void *ptr, ulong_t numBytes) {
         /* Are we at a valid block? */
         if(curBlock == FAT_ENTRY_FREE || curBlock == FAT_ENTRY_EOF) {
             Print("Unexpected end of file in FAT at file block %lu\n", i);
-            Mutex_Unlock(&pfatFile->lock);
             return EIO;         /* probable filesystem corruption */
         }
 
@@ -323,7 +310,6 @@ static int PFAT_Write(struct File *file, void *ptr, ulong_t numBytes) {
         currOffset += SECTOR_SIZE;
 
         if(rc != 0) {
-            Mutex_Unlock(&pfatFile->lock);
             return rc;
         }
 
@@ -331,13 +317,64 @@ static int PFAT_Write(struct File *file, void *ptr, ulong_t numBytes) {
         curBlock = instance->fat[curBlock];
     }
 
-    //update position in file!
-    file->filePos += numBytes;
+    return numBytes;
+}
 
-    /* Done attempting to fetch the block */
+/*
+ * Read function for PFAT files.
+ */
+static int PFAT_Read(struct File *file, void *buf, ulong_t numBytes) {
+    struct PFAT_File *pfatFile = (struct PFAT_File *)file->fsData;
+    int rc;
+
+    /* Only allow one thread at a time to read this file, updating position. */
+    Mutex_Lock(&pfatFile->lock);
+    rc = PFAT_Read_Locked(file, file->filePos, buf, numBytes);
+    if(rc > 0)
+        file->filePos += rc;
     Mutex_Unlock(&pfatFile->lock);
+    return rc;
+}
 
-    return numBytes;
+/*
+ * Write function for PFAT files.
+ */
+static int PFAT_Write(struct File *file, void *buf, ulong_t numBytes) {
+    struct PFAT_File *pfatFile = (struct PFAT_File *)file->fsData;
+    int rc;
+
+    Mutex_Lock(&pfatFile->lock);
+    rc = PFAT_Write_Locked(file, file->filePos, buf, numBytes);
+    if(rc > 0)
+        file->filePos += rc;
+    Mutex_Unlock(&pfatFile->lock);
+    return rc;
+}
+
+/*
+ * Positional read and write for PFAT files, which leave the file
+ * position alone.
+ */
+static int PFAT_Read_At(struct File *file, ulong_t pos, void *buf,
+                        ulong_t numBytes) {
+    struct PFAT_File *pfatFile = (struct PFAT_File *)file->fsData;
+    int rc;
+
+    Mutex_Lock(&pfatFile->lock);
+    rc = PFAT_Read_Locked(file, pos, buf, numBytes);
+    Mutex_Unlock(&pfatFile->lock);
+    return rc;
+}
+
+static int PFAT_Write_At(struct File *file, ulong_t pos, void *buf,
+                         ulong_t numBytes) {
+    struct PFAT_File *pfatFile = (struct PFAT_File *)file->fsData;
+    int rc;
+
+    Mutex_Lock(&pfatFile->lock);
+    rc = PFAT_Write_Locked(file, pos, buf, numBytes);
+    Mutex_Unlock(&pfatFile->lock);
+    return rc;
 }
 
 /*
@@ -384,6 +421,8 @@ static const struct File_Ops s_pfatFileOps = {
     &PFAT_Seek,
     &PFAT_Close,
     0,                          /* Read_Entry */
+    &PFAT_Read_At,
+    &PFAT_Write_At,
 };
 
 static int PFAT_FStat_Dir(struct File *dir, struct VFS_File_Stat *stat) {
@@ -444,6 +483,8 @@ static struct File_Ops s_pfatDirOps = {
     0,                          /* Seek */
     &PFAT_Close_Dir,
     &PFAT_Read_Entry,
+    0,                          /* Read_At */
+    0,                          /* Write_At */
 };
 
 
@@ -803,7 +844,6 @@ static int PFAT_Mount(struct Mount_Point *mountPoint) {
     void *bootSect = 0;
     int rootDirSize;
     int rc;
-    int i;
 
     /* Allocate instance. */
     instance = (struct PFAT_Instance *)Malloc(sizeof(*instance));
@@ -857,12 +897,10 @@ static int PFAT_Mount(struct Mount_Point *mountPoint) {
         goto memfail;
 
     /* Read the FAT */
-    for(i = 0; i < fsinfo->fileAllocationLength; ++i) {
-        int blockNum = fsinfo->fileAllocationOffset + i;
-        char *p = ((char *)instance->fat) + (i * SECTOR_SIZE);
-        if((rc = Block_Read(mountPoint->dev, blockNum, p)) < 0)
-            goto fail;
-    }
+    if((rc = Block_Read_Range(mountPoint->dev, fsinfo->fileAllocationOffset,
+                              fsinfo->fileAllocationLength,
+                              instance->fat)) != 0)
+        goto fail;
     Debug("Read FAT successfully!\n");
 
     if(fsinfo->rootDirectoryCount > 0) {        /* nspring attempting to avoid stupidity of malloc(0) */
@@ -874,13 +912,11 @@ static int PFAT_Mount(struct Mount_Point *mountPoint) {
 
         /* Read the root directory */
         Debug("Root directory size = %d\n", rootDirSize);
-        for(i = 0; i < rootDirSize; i += SECTOR_SIZE) {
-            int blockNum = fsinfo->rootDirectoryOffset + i / SECTOR_SIZE;
-            if((rc =
-                Block_Read(mountPoint->dev, blockNum,
-                           (void *)((int)instance->rootDir + i))) < 0)
-                goto fail;
-        }
+        if((rc = Block_Read_Range(mountPoint->dev,
+                                  fsinfo->rootDirectoryOffset,
+                                  rootDirSize / SECTOR_SIZE,
+                                  instance->rootDir)) != 0)
+            goto fail;
         Debug("Read root directory successfully!\n");
     } else {
         Print("Warning: missing root directory in PFAT");
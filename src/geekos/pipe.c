@@ -16,12 +16,29 @@
 #include <geekos/errno.h>
 #include <geekos/projects.h>
 #include <geekos/int.h>
+#include <geekos/slab.h>
 
 
 const struct File_Ops Pipe_Read_Ops =
-    { NULL, Pipe_Read, NULL, NULL, Pipe_Close, NULL };
+    { NULL, Pipe_Read, NULL, NULL, Pipe_Close, NULL, NULL, NULL };
 const struct File_Ops Pipe_Write_Ops =
-    { NULL, NULL, Pipe_Write, NULL, Pipe_Close, NULL };
+    { NULL, NULL, Pipe_Write, NULL, Pipe_Close, NULL, NULL, NULL };
+
+/*
+ * Pipe objects.  The mutex and conditions are set up once by the
+ * constructor; a pipe is only freed after both ends closed, when
+ * they are unlocked with no waiters again.
+ */
+static void Construct_Pipe(void *obj) {
+    struct Pipe *pipe = (struct Pipe *)obj;
+
+    Mutex_Init(&pipe->mutex);
+    Cond_Init(&pipe->dataAvailable);
+    Cond_Init(&pipe->spaceAvailable);
+}
+
+static struct Object_Cache s_pipeCache =
+OBJECT_CACHE_INITIALIZER("pipe", sizeof(struct Pipe), Construct_Pipe);
 
 static ulong_t Min(ulong_t a, ulong_t b) {
     return a < b ? a : b;
@@ -40,13 +57,13 @@ int Pipe_Create(struct File **read_file, struct File **write_file) {
     *read_file = 0;
     *write_file = 0;
 
-    pipe = (struct Pipe *)Malloc(sizeof(struct Pipe));
+    pipe = (struct Pipe *)Alloc_Object(&s_pipeCache);
     if(pipe == 0)
         return ENOMEM;
 
     pipe->buffer = (char *)Malloc(PIPE_BUFFER_SIZE);
     if(pipe->buffer == 0) {
-        Free(pipe);
+        Free_Object(&s_pipeCache, pipe);
         return ENOMEM;
     }
 
@@ -56,22 +73,19 @@ int Pipe_Create(struct File **read_file, struct File **write_file) {
     pipe->count = 0;
     pipe->readers = 1;
     pipe->writers = 1;
-    Mutex_Init(&pipe->mutex);
-    Cond_Init(&pipe->dataAvailable);
-    Cond_Init(&pipe->spaceAvailable);
 
     readPipe = Allocate_File(&Pipe_Read_Ops, 0, 0, pipe, O_READ, 0);
     if(readPipe == 0) {
         Free(pipe->buffer);
-        Free(pipe);
+        Free_Object(&s_pipeCache, pipe);
         return ENOMEM;
     }
 
     writePipe = Allocate_File(&Pipe_Write_Ops, 0, 0, pipe, O_WRITE, 0);
     if(writePipe == 0) {
-        Free(readPipe);
+        Free_File(readPipe);
         Free(pipe->buffer);
-        Free(pipe);
+        Free_Object(&s_pipeCache, pipe);
         return ENOMEM;
     }
 
@@ -202,7 +216,7 @@ int Pipe_Close(struct File *f) {
 
     if(should_free) {
         Free(pipe->buffer);
-        Free(pipe);
+        Free_Object(&s_pipeCache, pipe);
     }
 
     return 0;
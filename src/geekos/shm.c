@@ -0,0 +1,278 @@
+/*
+ * Named shared memory segments.
+ *
+ * Segments live on a list protected by s_shmMutex.  The segment
+ * holds one reference on each of its pages; every process mapping
+ * it holds another, dropped by Shm_Detach() or Munmap_Impl(), or by
+ * Destroy_User_Context() at exit.  Removing a segment only drops the
+ * segment's own references, so processes still attached keep their
+ * pages until they detach.
+ *
+ * Pages of a segment are pinned (never paged out) and marked
+ * PAGE_SHM, which keeps fork() from making them copy-on-write.
+ */
+
+#include <geekos/errno.h>
+#include <geekos/kassert.h>
+#include <geekos/kthread.h>
+#include <geekos/malloc.h>
+#include <geekos/mem.h>
+#include <geekos/paging.h>
+#include <geekos/screen.h>
+#include <geekos/string.h>
+#include <geekos/synch.h>
+#include <geekos/atomic.h>
+#include <geekos/user.h>
+#include <geekos/shm.h>
+
+#include <libc/mmap.h>
+
+extern int Copy_User_String(ulong_t uaddr, ulong_t len, ulong_t maxLen,
+                            char **pStr);
+
+struct Shm_Segment {
+    char name[SHM_MAX_NAME_LEN + 1];
+    int numPages;
+    void **pages;
+    struct Shm_Segment *next;
+};
+
+static struct Shm_Segment *s_shmSegments;
+static struct Mutex s_shmMutex = MUTEX_INITIALIZER;
+
+static int s_shmCount, s_shmPages;
+static ulong_t s_shmAttaches;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Find a segment by name; called with s_shmMutex held.
+ */
+static struct Shm_Segment *Find_Segment(const char *name) {
+    struct Shm_Segment *seg;
+
+    for(seg = s_shmSegments; seg != 0; seg = seg->next)
+        if(strcmp(seg->name, name) == 0)
+            return seg;
+    return 0;
+}
+
+/*
+ * Drop the segment's references to its pages and free it.
+ */
+static void Free_Segment(struct Shm_Segment *seg) {
+    int i;
+
+    for(i = 0; i < seg->numPages; i++)
+        if(seg->pages[i] != 0)
+            Drop_Page(seg->pages[i]);
+    Free(seg->pages);
+    Free(seg);
+}
+
+/*
+ * Copy a segment name in from user space.
+ */
+static int Get_Segment_Name(struct Interrupt_State *state, char **pName) {
+    if(state->ecx == 0 || state->ecx > SHM_MAX_NAME_LEN)
+        return EINVALID;
+    return Copy_User_String(state->ebx, state->ecx, SHM_MAX_NAME_LEN, pName);
+}
+
+/*
+ * Map every page of seg into the current process.
+ * Returns the user address of the mapping, or error code (< 0).
+ */
+static int Attach_Segment(struct Shm_Segment *seg) {
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    ulong_t length = seg->numPages * PAGE_SIZE, addr;
+    int i, rc;
+
+    addr = Find_Mmap_Space(context, length);
+    if(addr == 0)
+        return ENOMEM;
+    rc = Add_Mapped_Region(context, 0, addr, length,
+                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_SHM, 0,
+                           0);
+    if(rc != 0)
+        return rc;
+
+    for(i = 0; i < seg->numPages; i++) {
+        ulong_t vaddr = USER_VM_START + addr + i * PAGE_SIZE;
+        pte_t *entry = Find_Or_Create_User_PTE(context, vaddr);
+
+        if(entry == 0) {
+            /* drops the pages mapped so far */
+            Munmap_Impl(addr);
+            return ENOMEM;
+        }
+        Atomic_Increment(&Get_Page((ulong_t) seg->pages[i])->refCount);
+        entry->pageBaseAddr = PAGE_ALIGNED_ADDR(seg->pages[i]);
+        entry->flags = VM_USER | VM_WRITE;
+        entry->kernelInfo = 0;
+        entry->accessed = 0;
+        entry->dirty = 0;
+        entry->present = 1;
+    }
+    ++s_shmAttaches;
+    return (int)addr;
+}
+
+/* ----------------------------------------------------------------------
+ * System calls
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Create a shared memory segment.
+ * Params:
+ *   state->ebx - user address of name of segment
+ *   state->ecx - length of segment name
+ *   state->edx - size of the segment in bytes
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+int Sys_Shm_Create(struct Interrupt_State *state) {
+    ulong_t size = state->edx;
+    struct Shm_Segment *seg;
+    char *name = 0;
+    int i, rc;
+
+    if(size == 0 || size > SHM_MAX_SIZE)
+        return EINVALID;
+    rc = Get_Segment_Name(state, &name);
+    if(rc != 0)
+        return rc;
+
+    seg = Malloc(sizeof(*seg));
+    if(seg == 0) {
+        Free(name);
+        return ENOMEM;
+    }
+    strcpy(seg->name, name);
+    Free(name);
+    seg->numPages = Round_Up_To_Page(size) / PAGE_SIZE;
+    seg->pages = Malloc(seg->numPages * sizeof(void *));
+    if(seg->pages == 0) {
+        Free(seg);
+        return ENOMEM;
+    }
+    memset(seg->pages, '\0', seg->numPages * sizeof(void *));
+
+    for(i = 0; i < seg->numPages; i++) {
+        void *paddr = Alloc_Page();
+        struct Page *page;
+
+        if(paddr == 0) {
+            Free_Segment(seg);
+            return ENOMEM;
+        }
+        memset(paddr, '\0', PAGE_SIZE);
+        page = Get_Page((ulong_t) paddr);
+        page->flags |= PAGE_SHM;
+        page->refCount = 1;
+        seg->pages[i] = paddr;
+    }
+
+    Mutex_Lock(&s_shmMutex);
+    if(Find_Segment(seg->name) != 0) {
+        Mutex_Unlock(&s_shmMutex);
+        Free_Segment(seg);
+        return EEXIST;
+    }
+    seg->next = s_shmSegments;
+    s_shmSegments = seg;
+    ++s_shmCount;
+    s_shmPages += seg->numPages;
+    Mutex_Unlock(&s_shmMutex);
+    return 0;
+}
+
+/*
+ * Map a shared memory segment into the current process.
+ * Params:
+ *   state->ebx - user address of name of segment
+ *   state->ecx - length of segment name
+ * Returns: the address of the segment, or error code (< 0)
+ */
+int Sys_Shm_Attach(struct Interrupt_State *state) {
+    struct Shm_Segment *seg;
+    char *name = 0;
+    int rc;
+
+    if(CURRENT_THREAD->userContext->pageDir == 0)
+        return EUNSUPPORTED;
+    rc = Get_Segment_Name(state, &name);
+    if(rc != 0)
+        return rc;
+
+    Mutex_Lock(&s_shmMutex);
+    seg = Find_Segment(name);
+    rc = seg != 0 ? Attach_Segment(seg) : ENOTFOUND;
+    Mutex_Unlock(&s_shmMutex);
+
+    Free(name);
+    return rc;
+}
+
+/*
+ * Unmap a shared memory segment from the current process.
+ * Params:
+ *   state->ebx - address the segment is attached at
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+int Sys_Shm_Detach(struct Interrupt_State *state) {
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    mappedRegion_t *region;
+
+    if(context->pageDir == 0)
+        return EUNSUPPORTED;
+    region = Find_Mapped_Region(context, state->ebx);
+    if(region == 0 || region->startAddr != state->ebx
+       || !(region->flags & MAP_SHM))
+        return EINVALID;
+    return Munmap_Impl(state->ebx);
+}
+
+/*
+ * Remove the name of a shared memory segment.  Its memory is freed
+ * once every process has detached it.
+ * Params:
+ *   state->ebx - user address of name of segment
+ *   state->ecx - length of segment name
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+int Sys_Shm_Remove(struct Interrupt_State *state) {
+    struct Shm_Segment **pSeg, *seg = 0;
+    char *name = 0;
+    int rc;
+
+    rc = Get_Segment_Name(state, &name);
+    if(rc != 0)
+        return rc;
+
+    Mutex_Lock(&s_shmMutex);
+    for(pSeg = &s_shmSegments; *pSeg != 0; pSeg = &(*pSeg)->next)
+        if(strcmp((*pSeg)->name, name) == 0) {
+            seg = *pSeg;
+            *pSeg = seg->next;
+            --s_shmCount;
+            s_shmPages -= seg->numPages;
+            break;
+        }
+    Mutex_Unlock(&s_shmMutex);
+
+    Free(name);
+    if(seg == 0)
+        return ENOTFOUND;
+    Free_Segment(seg);
+    return 0;
+}
+
+/*
+ * Print shared memory statistics.
+ */
+void Dump_Shm_Stats(void) {
+    Print("shm: %d segments, %d pages, %lu attaches\n", s_shmCount,
+          s_shmPages, s_shmAttaches);
+}
@@ -0,0 +1,329 @@
+/*
+ * Object caches (slab allocator) for fixed-size kernel objects.
+ *
+ * A slab is one page: a struct Slab header followed by equal-sized
+ * slots.  Each slot holds an object followed by one link word that
+ * chains the free objects of the slab, so a free object keeps the
+ * state its constructor (or last user) left in it.  Because slabs
+ * are page aligned, the slab owning an object is found by rounding
+ * the object's address down to a page.
+ *
+ * Each cache has one magazine per CPU holding up to
+ * OBJECT_MAGAZINE_SIZE free objects.  A magazine is only touched by
+ * its own CPU with interrupts disabled, so it needs no lock; the
+ * cache lock is only taken to move half a magazine to or from the
+ * slabs at once.
+ */
+
+#include <geekos/slab.h>
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/mem.h>
+#include <geekos/smp.h>
+#include <geekos/screen.h>
+#include <geekos/string.h>
+
+#define OBJECT_ALIGN 8
+
+/* keep at most this many empty slabs per cache; free the rest */
+#define OBJECT_CACHE_MAX_EMPTY 1
+
+#define OBJECT_MAGAZINE_SIZE 13
+
+/* sized to 64 bytes so a page holds magazines for 64 CPUs */
+struct Object_Magazine {
+    int count;
+    ulong_t hits;               /* allocs served without the cache lock */
+    ulong_t frees;              /* frees absorbed without the cache lock */
+    void *objs[OBJECT_MAGAZINE_SIZE];
+};
+
+struct Slab {
+    DEFINE_LINK(Slab_List, Slab);
+    struct Object_Cache *cache;
+    void *freeObjs;             /* chain of free objects in this slab */
+    int inUse;
+};
+
+IMPLEMENT_LIST(Slab_List, Slab);
+
+/* link word that follows each object in its slot */
+#define FREE_LINK(cache, obj) (*(void **)((char *)(obj) + (cache)->objSize))
+
+#define SLAB_HEADER_SIZE \
+    ((sizeof(struct Slab) + OBJECT_ALIGN - 1) & ~(OBJECT_ALIGN - 1))
+
+/* All caches that have been used, for Dump_Object_Cache_Stats(). */
+static struct Object_Cache *s_objectCacheList;
+static Spin_Lock_t s_objectCacheListLock;
+
+/* ----------------------------------------------------------------------
+ * Private functions; all called with interrupts disabled and the
+ * cache lock held.
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Unlink a slab from a cache list without the O(n) membership check
+ * of Locked_Remove_From_Slab_List.
+ */
+static void Unlink_Slab(struct Slab_List *list, struct Slab *slab) {
+    KASSERT(slab->inSlab_List == list);
+    if(slab->prevSlab_List != 0)
+        slab->prevSlab_List->nextSlab_List = slab->nextSlab_List;
+    else
+        list->head = slab->nextSlab_List;
+    if(slab->nextSlab_List != 0)
+        slab->nextSlab_List->prevSlab_List = slab->prevSlab_List;
+    else
+        list->tail = slab->prevSlab_List;
+    slab->inSlab_List = 0;
+}
+
+static void Move_Slab(struct Slab_List *from, struct Slab_List *to,
+                      struct Slab *slab) {
+    Unlink_Slab(from, slab);
+    Locked_Unchecked_Add_To_Back_Of_Slab_List(to, slab);
+}
+
+/*
+ * First use of a cache: size its slabs, give it per-CPU magazines
+ * and add it to the list of caches.
+ */
+static void Setup_Object_Cache(struct Object_Cache *cache) {
+    extern int CPU_Count;
+    ulong_t size;
+
+    size = (cache->objSize + OBJECT_ALIGN - 1) & ~(OBJECT_ALIGN - 1);
+    cache->objSize = size;
+    cache->slotSize = size + OBJECT_ALIGN;
+    cache->objsPerSlab = (PAGE_SIZE - SLAB_HEADER_SIZE) / cache->slotSize;
+    KASSERT0(cache->objsPerSlab > 0, "object too large for a slab");
+
+    if(CPU_Count > 0) {
+        cache->magazines = Alloc_Page_Atomic();
+        if(cache->magazines) {
+            cache->numMagazines =
+                PAGE_SIZE / sizeof(struct Object_Magazine);
+            if(cache->numMagazines > CPU_Count)
+                cache->numMagazines = CPU_Count;
+        }
+    }
+
+    Spin_Lock(&s_objectCacheListLock);
+    cache->nextCache = s_objectCacheList;
+    s_objectCacheList = cache;
+    Spin_Unlock(&s_objectCacheListLock);
+
+    cache->initialized = true;
+}
+
+/*
+ * Carve a new page into objects.  Returns null if out of memory.
+ */
+static struct Slab *Grow_Object_Cache(struct Object_Cache *cache) {
+    struct Slab *slab;
+    char *obj;
+    int i;
+
+    slab = Alloc_Page_Atomic();
+    if(slab == 0)
+        return 0;
+
+    slab->cache = cache;
+    slab->inUse = 0;
+    slab->freeObjs = 0;
+    obj = (char *)slab + SLAB_HEADER_SIZE;
+    for(i = 0; i < cache->objsPerSlab; i++, obj += cache->slotSize) {
+        if(cache->ctor)
+            cache->ctor(obj);
+        FREE_LINK(cache, obj) = slab->freeObjs;
+        slab->freeObjs = obj;
+    }
+
+    Locked_Unchecked_Add_To_Back_Of_Slab_List(&cache->emptySlabs, slab);
+    cache->numEmptySlabs++;
+    cache->slabsCreated++;
+    return slab;
+}
+
+/*
+ * Take one object from the slabs.
+ */
+static void *Take_Object(struct Object_Cache *cache) {
+    struct Slab *slab;
+    void *obj;
+
+    slab = Get_Front_Of_Slab_List(&cache->partialSlabs);
+    if(slab == 0) {
+        slab = Get_Front_Of_Slab_List(&cache->emptySlabs);
+        if(slab == 0)
+            slab = Grow_Object_Cache(cache);
+        if(slab == 0)
+            return 0;
+        Move_Slab(&cache->emptySlabs, &cache->partialSlabs, slab);
+        cache->numEmptySlabs--;
+    }
+
+    obj = slab->freeObjs;
+    KASSERT(obj);
+    slab->freeObjs = FREE_LINK(cache, obj);
+    if(++slab->inUse == cache->objsPerSlab)
+        Move_Slab(&cache->partialSlabs, &cache->fullSlabs, slab);
+
+    cache->inUse++;
+    cache->allocs++;
+    return obj;
+}
+
+/*
+ * Return one object to its slab, releasing surplus empty slabs.
+ */
+static void Return_Object(struct Object_Cache *cache, void *obj) {
+    struct Slab *slab = (struct Slab *)Round_Down_To_Page((ulong_t) obj);
+
+    KASSERT0(slab->cache == cache, "object freed to the wrong cache");
+    KASSERT(slab->inUse > 0);
+
+    FREE_LINK(cache, obj) = slab->freeObjs;
+    slab->freeObjs = obj;
+    if(slab->inUse-- == cache->objsPerSlab)
+        Move_Slab(&cache->fullSlabs, &cache->partialSlabs, slab);
+    if(slab->inUse == 0) {
+        Move_Slab(&cache->partialSlabs, &cache->emptySlabs, slab);
+        if(++cache->numEmptySlabs > OBJECT_CACHE_MAX_EMPTY) {
+            Unlink_Slab(&cache->emptySlabs, slab);
+            cache->numEmptySlabs--;
+            cache->slabsDestroyed++;
+            Free_Page(slab);
+        }
+    }
+    cache->inUse--;
+    cache->frees++;
+}
+
+/*
+ * Get the current CPU's magazine, or null if the cache has none for it.
+ */
+static struct Object_Magazine *Get_Magazine(struct Object_Cache *cache) {
+    int id;
+
+    if(cache->numMagazines == 0)
+        return 0;
+    id = Get_CPU_ID();
+    if(id < 0 || id >= cache->numMagazines)
+        return 0;
+    return &cache->magazines[id];
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Allocate an object from given cache.
+ * Returns null if there is not enough memory.
+ */
+void *Alloc_Object(struct Object_Cache *cache) {
+    struct Object_Magazine *mag;
+    void *obj = 0;
+    bool iflag = Save_And_Disable_Interrupts();
+
+    if(cache->initialized) {
+        mag = Get_Magazine(cache);
+        if(mag && mag->count > 0) {
+            obj = mag->objs[--mag->count];
+            mag->hits++;
+            Restore_Interrupt_State(iflag);
+            return obj;
+        }
+    }
+
+    Spin_Lock(&cache->lock);
+    if(!cache->initialized)
+        Setup_Object_Cache(cache);
+    mag = Get_Magazine(cache);
+
+    /* refill half a magazine while we hold the lock */
+    if(mag) {
+        while(mag->count < OBJECT_MAGAZINE_SIZE / 2) {
+            void *extra = Take_Object(cache);
+            if(extra == 0)
+                break;
+            mag->objs[mag->count++] = extra;
+        }
+        if(mag->count > 0)
+            obj = mag->objs[--mag->count];
+    } else {
+        obj = Take_Object(cache);
+    }
+    Spin_Unlock(&cache->lock);
+    Restore_Interrupt_State(iflag);
+
+    return obj;
+}
+
+/*
+ * Return an object to the cache it was allocated from.
+ */
+void Free_Object(struct Object_Cache *cache, void *obj) {
+    struct Object_Magazine *mag;
+    bool iflag;
+
+    if(obj == 0)
+        return;
+
+    KASSERT(cache->initialized);
+    iflag = Save_And_Disable_Interrupts();
+
+    mag = Get_Magazine(cache);
+    if(mag && mag->count < OBJECT_MAGAZINE_SIZE) {
+        mag->objs[mag->count++] = obj;
+        mag->frees++;
+        Restore_Interrupt_State(iflag);
+        return;
+    }
+
+    Spin_Lock(&cache->lock);
+    if(mag) {
+        /* magazine full: send its older half back to the slabs */
+        int i, n = OBJECT_MAGAZINE_SIZE / 2;
+        for(i = 0; i < n; i++)
+            Return_Object(cache, mag->objs[i]);
+        memmove(&mag->objs[0], &mag->objs[n],
+                (mag->count - n) * sizeof(void *));
+        mag->count -= n;
+        mag->objs[mag->count++] = obj;
+        mag->frees++;
+    } else {
+        Return_Object(cache, obj);
+    }
+    Spin_Unlock(&cache->lock);
+    Restore_Interrupt_State(iflag);
+}
+
+/*
+ * Print statistics for every object cache in use.
+ */
+void Dump_Object_Cache_Stats(void) {
+    struct Object_Cache *cache;
+    bool iflag = Spin_Lock_Irq_Save(&s_objectCacheListLock);
+
+    for(cache = s_objectCacheList; cache != 0; cache = cache->nextCache) {
+        ulong_t hits = 0, frees = 0;
+        int i, cached = 0;
+
+        for(i = 0; i < cache->numMagazines; i++) {
+            hits += cache->magazines[i].hits;
+            frees += cache->magazines[i].frees;
+            cached += cache->magazines[i].count;
+        }
+        Print
+            ("%s: %lu bytes, %d/slab, %lu slabs, %d in use, %d in magazines, %lu slab allocs, %lu magazine hits, %lu slab frees, %lu magazine frees\n",
+             cache->name, cache->objSize, cache->objsPerSlab,
+             cache->slabsCreated - cache->slabsDestroyed,
+             cache->inUse - cached, cached, cache->allocs, hits,
+             cache->frees, frees);
+    }
+
+    Spin_Unlock_Irq_Restore(&s_objectCacheListLock, iflag);
+}
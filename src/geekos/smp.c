@@ -385,7 +385,7 @@ int Init_Local_APIC(int cpu) {
 
     if(!cpu) {
         // make timer a one shot
-        APIC_Write(APIC_LVTT, 32);
+        APIC_Write(APIC_LVTT, FIRST_EXTERNAL_INT);
 
         APIC_Write(APIC_TDCR, 0x03);
 
@@ -425,7 +425,7 @@ int Init_Local_APIC(int cpu) {
     APIC_Write(APIC_TICR, apicInitialCount < 16 ? 16 : apicInitialCount);
 
     // finally re-enable timer in periodic mode
-    APIC_Write(APIC_LVTT, 32 | TMR_PERIODIC);
+    APIC_Write(APIC_LVTT, FIRST_EXTERNAL_INT | TMR_PERIODIC);
 
     // setting divide value register again not needed by the manuals
     // although I have found buggy hardware that required it
@@ -704,14 +704,26 @@ void Spin_Unlock_Irq_Restore(Spin_Lock_t *lock, bool iflag) {
     Restore_Interrupt_State(iflag);
 }
 
+/* IOAPIC redirection entry, low word */
+#define IOAPIC_LEVEL_TRIGGERED	(1 << 15)
+#define IOAPIC_ACTIVE_LOW	(1 << 13)
+
 // map pic interrupt to be delivered through IOAPIC
 //    xxxx - for now send them all to cpu0
-void Map_IO_APIC_IRQ(int irq, void *handler) {
-    // low seven bits are the irq# to pass to cpu
-    IOAPIC_Write(0x10 + 2 * irq, 0x00000000 | irq);
+//    irqs go to vectors FIRST_EXTERNAL_INT and up, clear of the exceptions
+//    level: the line is a PCI INTx line, which is level-triggered and
+//    active-low; ISA lines are edge-triggered and active-high
+void Map_IO_APIC_IRQ(int irq, void *handler, int level) {
+    int vector = FIRST_EXTERNAL_INT + irq;
+    int mode = level ? IOAPIC_LEVEL_TRIGGERED | IOAPIC_ACTIVE_LOW : 0;
+
+    KASSERT(irq >= 0 && irq < NUM_EXTERNAL_INTS);
+
+    // low eight bits are the vector to pass to cpu
+    IOAPIC_Write(0x10 + 2 * irq, mode | vector);
     IOAPIC_Write(0x10 + 2 * irq + 1, 0x00000000);
 
-    Install_Interrupt_Handler(irq, handler);
+    Install_Interrupt_Handler(vector, handler);
 }
 
 /*
@@ -34,9 +34,14 @@
 #include <geekos/mem.h>
 #include <geekos/smp.h>
 #include <geekos/atomic.h>
-
-/* Defined in userseg.c; no separate header */
-extern struct User_Context *Create_User_Context(ulong_t size);
+#include <geekos/slab.h>
+#include <geekos/paging.h>
+#include <geekos/zswap.h>
+#include <geekos/shm.h>
+#include <geekos/ide.h>
+#include <geekos/virtio_blk.h>
+#include <geekos/ahci.h>
+#include <geekos/blockdev.h>
 
 extern Spin_Lock_t kthreadLock;
 extern Spin_Lock_t printLock;  /* From screen.c - console output synchronization */
@@ -841,6 +846,37 @@ static int Sys_Format(struct Interrupt_State *state) {
     return rc;
 }
 
+/*
+ * Choose the I/O scheduler of a block device
+ * Params:
+ *   state->ebx - address of user string containing block device name
+ *   state->ecx - length of block device name string
+ *   state->edx - address of user string containing scheduler name
+ *   state->esi - length of scheduler name string
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_Set_IO_Scheduler(struct Interrupt_State *state) {
+    int rc = 0;
+    char *devname = 0, *schedname = 0;
+
+    if((rc =
+        Copy_User_String(state->ebx, state->ecx, BLOCKDEV_MAX_NAME_LEN,
+                         &devname)) != 0 ||
+       (rc =
+        Copy_User_String(state->edx, state->esi, BLOCKDEV_MAX_NAME_LEN,
+                         &schedname)) != 0)
+        goto done;
+
+    rc = Set_Block_Scheduler(devname, schedname);
+
+  done:
+    if(devname != 0)
+        Free(devname);
+    if(schedname != 0)
+        Free(schedname);
+    return rc;
+}
+
 /*
  * Read a block from a device
  * Params:
@@ -957,28 +993,21 @@ static int Sys_Pipe(struct Interrupt_State *state) {
 
 
 static int Sys_Fork(struct Interrupt_State *state) {
-    int i;
+    int i, rc;
     struct User_Context *parentCtx = CURRENT_THREAD->userContext;
     struct User_Context *childCtx;
     struct Kernel_Thread *childThread;
 
     DONE_P(PROJECT_FORK, "Fork system call");
 
-    /* 1. Allocate a new User_Context and copy all of parent's memory */
-    childCtx = Create_User_Context(parentCtx->size);
-    if(childCtx == 0)
-        return ENOMEM;
-    memcpy(childCtx->memory, parentCtx->memory, parentCtx->size);
+    /* 1. Duplicate the parent's memory (userseg.c copies it;
+     *    uservm.c shares its pages copy-on-write) */
+    rc = Clone_User_Context(parentCtx, &childCtx);
+    if(rc != 0)
+        return rc;
     strncpy(childCtx->name, parentCtx->name, MAX_PROC_NAME_SZB);
     childCtx->name[MAX_PROC_NAME_SZB - 1] = '\0';
 
-    /* Re-initialize LDT descriptors to point at the child's memory block
-     * (Create_User_Context already did this for the fresh block, so the
-     * selectors are already correct; we just need to preserve entry/arg addrs) */
-    childCtx->entryAddr      = parentCtx->entryAddr;
-    childCtx->argBlockAddr   = parentCtx->argBlockAddr;
-    childCtx->stackPointerAddr = parentCtx->stackPointerAddr;
-
     /* 2. Copy file descriptor table; bump refCount for each inherited file */
     for(i = 0; i < USER_MAX_FILES; i++) {
         struct File *f = parentCtx->file_descriptor_table[i];
@@ -1011,10 +1040,7 @@ static int Sys_Fork(struct Interrupt_State *state) {
 static int Sys_Execl(struct Interrupt_State *state) {
     int rc, i;
     char *program = 0, *command = 0;
-    void *exeFileData = 0;
-    ulong_t exeFileLength;
     struct User_Context *newCtx = 0;
-    struct Exe_Format exeFormat;
 
     DONE_P(PROJECT_FORK, "Execl system call");
 
@@ -1025,14 +1051,9 @@ static int Sys_Execl(struct Interrupt_State *state) {
         goto fail;
 
     /* 2. Load the new executable */
-    if((rc = Read_Fully(program, &exeFileData, &exeFileLength)) != 0 ||
-       (rc = Parse_ELF_Executable(exeFileData, exeFileLength, &exeFormat)) != 0 ||
-       (rc = Load_User_Program(exeFileData, exeFileLength,
-                               &exeFormat, command, &newCtx)) != 0)
+    if((rc = Load_User_Program_File(program, command, &newCtx)) != 0)
         goto fail;
 
-    Free(exeFileData); exeFileData = 0;
-
     /* 3. Inherit file descriptors: copy table and bump refCounts */
     {
         struct User_Context *oldCtx = CURRENT_THREAD->userContext;
@@ -1071,7 +1092,6 @@ static int Sys_Execl(struct Interrupt_State *state) {
     return 0;
 
 fail:
-    if(exeFileData) Free(exeFileData);
     if(newCtx)      Destroy_User_Context(newCtx);
     if(program)     Free(program);
     if(command)     Free(command);
@@ -1087,6 +1107,15 @@ fail:
 static int Sys_Diagnostic(struct Interrupt_State *state) {
     (void)state;                /* warning appeasement */
     Dump_Blockdev_Stats();
+    Dump_IDE_Stats();
+    Dump_Virtio_Blk_Stats();
+    Dump_AHCI_Stats();
+    Dump_Page_Cache_Stats();
+    Dump_Paging_Stats();
+    Dump_Zswap_Stats();
+    Dump_Shm_Stats();
+    Dump_Object_Cache_Stats();
+    Dump_Heap_Stats();
     return 0;
 }
 
@@ -1160,16 +1189,31 @@ static int Sys_Clone(struct Interrupt_State *state) {
     return EUNSUPPORTED;
 }
 
+/*
+ * Map a file into the address space of the current process.
+ * Params:
+ *   state->ebx - requested user address (0: anywhere)
+ *   state->ecx - length of the mapping in bytes
+ *   state->edx - protection (PROT_READ, PROT_WRITE, PROT_EXEC)
+ *   state->esi - MAP_SHARED or MAP_PRIVATE
+ *   state->edi - file descriptor of the file to map
+ * Returns: address of the mapping, or error code (< 0) on error
+ */
 static int Sys_Mmap(struct Interrupt_State *state) {
-    TODO_P(PROJECT_MMAP, "Mmap system call");
-    return EUNSUPPORTED;
+    return Mmap_Impl(state->ebx, state->ecx, state->edx, state->esi,
+                     state->edi);
 }
 
+/*
+ * Remove a mapping, writing back its modified MAP_SHARED pages.
+ * Mappings are removed whole: there is no length, and an address
+ * other than the start of a mapping is EINVALID.
+ * Params:
+ *   state->ebx - address the mapping starts at
+ * Returns: 0 if successful, error code (< 0) on error
+ */
 static int Sys_Munmap(struct Interrupt_State *state) {
-    extern int Munmap_Impl(void *);
-
-    TODO_P(PROJECT_MMAP, "Munmap system call");
-    return EUNSUPPORTED;
+    return Munmap_Impl(state->ebx);
 }
 
 /*
@@ -1184,10 +1228,29 @@ static int Sys_Alarm(struct Interrupt_State *state) {
     return EUNSUPPORTED;
 }
 
+/*
+ * Grow or shrink the heap of the current process.
+ * Params:
+ *   state->ebx - number of bytes to move the break by (may be negative)
+ * Returns: the old break, or error code (< 0) on error
+ */
 static int Sys_Sbrk(struct Interrupt_State *state) {
-    TODO_P(PROJECT_MALLOC,
-           "underlying system call that allows malloc to work");
-    return EUNSUPPORTED;
+    ulong_t oldBreak;
+    int rc;
+
+    rc = Resize_User_Heap(CURRENT_THREAD->userContext, (int)state->ebx,
+                          &oldBreak);
+    return rc == 0 ? (int)oldBreak : rc;
+}
+
+/*
+ * Write the modified pages of a MAP_SHARED mapping back to its file.
+ * Params:
+ *   state->ebx - an address inside the mapping
+ * Returns: 0 if successful, error code (< 0) on error
+ */
+static int Sys_Msync(struct Interrupt_State *state) {
+    return Msync_Impl(state->ebx);
 }
 
 /*
@@ -1282,7 +1345,15 @@ const Syscall g_syscallTable[] = {
     Sys_Rename,
     Sys_Link,
     Sys_SymLink,
-    Sys_Sbrk
+    Sys_Sbrk,
+    Sys_Msync,
+    /* shared memory */
+    Sys_Shm_Create,
+    Sys_Shm_Attach,
+    Sys_Shm_Detach,
+    Sys_Shm_Remove,
+    /* block layer */
+    Sys_Set_IO_Scheduler
 };
 
 /*
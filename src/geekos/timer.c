@@ -18,6 +18,7 @@
 #include <geekos/io.h>
 #include <geekos/int.h>
 #include <geekos/irq.h>
+#include <geekos/idt.h>
 #include <geekos/kthread.h>
 #include <geekos/timer.h>
 #include <geekos/smp.h>
@@ -241,8 +242,8 @@ void Init_Timer(void) {
     /* Install an interrupt handler for the timer IRQ */
     // Install_IRQ(TIMER_IRQ, &Timer_Interrupt_Handler);
 
-    // apic timer interrupt
-    Install_IRQ(32, &Timer_Interrupt_Handler);
+    // apic timer interrupt (its vector is set in smp.c, not routed by the IOAPIC)
+    Install_Interrupt_Handler(FIRST_EXTERNAL_INT, &Timer_Interrupt_Handler);
 
     Init_Timer_Interrupt();
 }
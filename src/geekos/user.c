@@ -91,37 +91,17 @@ void Detach_User_Context(struct Kernel_Thread *kthread) {
  */
 int Spawn(const char *program, const char *command,
           struct Kernel_Thread **pThread, bool background) {
-    int rc = 0, rc2 = 0, rc3 = 0;
-    char *exeFileData = 0;
-    ulong_t exeFileLength;
+    int rc = 0;
     struct User_Context *userContext = 0;
     struct Kernel_Thread *process = 0;
-    struct Exe_Format exeFormat;
 
     /*
-     * Load the executable file data, parse ELF headers,
-     * and load code and data segments into user memory.
+     * Load the executable: parse ELF headers, and load (or, in the
+     * paging model, map) code and data segments into user memory.
      */
-
-    if((rc =
-        Read_Fully(program, (void **)&exeFileData, &exeFileLength)) != 0
-       || (rc2 =
-           Parse_ELF_Executable(exeFileData, exeFileLength,
-                                &exeFormat)) != 0 ||
-       (rc3 =
-        Load_User_Program(exeFileData, exeFileLength, &exeFormat, command,
-                          &userContext)) != 0) {
-        rc |= rc2 | rc3;        /* since all are zero, this sets rc to whichever one is nonzero.
-                                   breakpoint here if you need to know which one failed. */
+    rc = Load_User_Program_File(program, command, &userContext);
+    if(rc != 0)
         goto fail;
-    }
-
-    /*
-     * User program has been loaded, so we can free the
-     * executable file data now.
-     */
-    Free(exeFileData);
-    exeFileData = 0;
 
     strncpy(userContext->name, program, MAX_PROC_NAME_SZB);
     userContext->name[MAX_PROC_NAME_SZB - 1] = '\0';
@@ -138,8 +118,6 @@ int Spawn(const char *program, const char *command,
     return rc;
 
   fail:
-    if(exeFileData != 0)
-        Free(exeFileData);
     if(userContext != 0)
         Destroy_User_Context(userContext);
 
@@ -26,6 +26,8 @@
 #include <geekos/argblock.h>
 #include <geekos/user.h>
 #include <geekos/smp.h>
+#include <geekos/errno.h>
+#include <geekos/vfs.h>
 
 /* ----------------------------------------------------------------------
  * Variables
@@ -33,6 +35,15 @@
 
 #define DEFAULT_USER_STACK_SIZE 8192
 
+/*
+ * room left between the image and the stack for the Sbrk() heap.
+ * libc's Malloc() grows its pool in 64 KB steps (MALLOC_POOL_INCR)
+ * and each new pool carries a header, so a single step would not
+ * fit; leave room for a few.  Every process pays for it when
+ * spawned, so keep it modest.
+ */
+#define USER_HEAP_RESERVE (256 * 1024)
+
 
 int userDebug = 0;
 
@@ -117,6 +128,64 @@ extern struct User_Context *Create_User_Context(ulong_t size) {
     return 0;
 }
 
+/*
+ * Create a copy of a user context's memory for fork.
+ * Returns 0 if successful, or an error code (< 0) if unsuccessful.
+ */
+int Clone_User_Context(struct User_Context *parent,
+                       struct User_Context **pChild) {
+    struct User_Context *child = Create_User_Context(parent->size);
+
+    if(child == 0)
+        return ENOMEM;
+    /*
+     * [0, heapBreak) is the image and everything Sbrk() has handed
+     * out; the reserve above the break is kept zeroed by
+     * Resize_User_Heap(), as the new copy already is.
+     */
+    KASSERT(parent->heapStart <= parent->heapBreak
+            && parent->heapBreak <= parent->heapLimit
+            && parent->heapLimit <= parent->size);
+    memcpy(child->memory, parent->memory, parent->heapBreak);
+    memcpy(child->memory + parent->heapLimit,
+           parent->memory + parent->heapLimit,
+           parent->size - parent->heapLimit);
+
+    /* Create_User_Context already pointed the LDT at the copy */
+    child->entryAddr = parent->entryAddr;
+    child->argBlockAddr = parent->argBlockAddr;
+    child->stackPointerAddr = parent->stackPointerAddr;
+    child->heapStart = parent->heapStart;
+    child->heapBreak = parent->heapBreak;
+    child->heapLimit = parent->heapLimit;
+
+    *pChild = child;
+    return 0;
+}
+
+/*
+ * Move the heap break by increment bytes, within the room reserved
+ * for the heap when the program was loaded, so the image is never
+ * reallocated or copied.
+ * Returns 0 and the old break in *pOldBreak if successful,
+ * error code otherwise.
+ */
+int Resize_User_Heap(struct User_Context *context, int increment,
+                     ulong_t * pOldBreak) {
+    ulong_t oldBreak = context->heapBreak, newBreak = oldBreak + increment;
+
+    if(increment < 0 ? (newBreak < context->heapStart || newBreak > oldBreak)
+       : (newBreak > context->heapLimit || newBreak < oldBreak))
+        return ENOMEM;
+
+    /* the reserve starts out zeroed; keep what is given back that way */
+    if(newBreak < oldBreak)
+        memset(context->memory + newBreak, '\0', oldBreak - newBreak);
+    context->heapBreak = newBreak;
+    *pOldBreak = oldBreak;
+    return 0;
+}
+
 bool Validate_User_Memory(struct User_Context * userContext,
                           ulong_t userAddr, ulong_t bufSize,
                           int for_writing) {
@@ -197,7 +266,8 @@ int Load_User_Program(char *exeFileData, ulong_t exeFileLength
      * Now we can determine the size of the memory block needed
      * to run the process.
      */
-    size = Round_Up_To_Page(maxva) + DEFAULT_USER_STACK_SIZE;
+    size = Round_Up_To_Page(maxva) + USER_HEAP_RESERVE +
+        DEFAULT_USER_STACK_SIZE;
     argBlockAddr = size;
     size += argBlockSize;
 
@@ -229,11 +299,40 @@ int Load_User_Program(char *exeFileData, ulong_t exeFileLength
     userContext->argBlockAddr = argBlockAddr;
     userContext->stackPointerAddr = argBlockAddr;
 
+    /* heap between the image and the stack */
+    userContext->heapStart = Round_Up_To_Page(maxva);
+    userContext->heapBreak = userContext->heapStart;
+    userContext->heapLimit = userContext->heapStart + USER_HEAP_RESERVE;
+
 
     *pUserContext = userContext;
     return 0;
 }
 
+/*
+ * Load the named executable into a new user context: read the whole
+ * file, parse its ELF headers and copy its segments in.
+ * Returns 0 if successful, or an error code (< 0) if unsuccessful.
+ */
+int Load_User_Program_File(const char *program, const char *command,
+                           struct User_Context **pUserContext) {
+    char *exeFileData = 0;
+    ulong_t exeFileLength;
+    struct Exe_Format exeFormat;
+    int rc;
+
+    if((rc = Read_Fully(program, (void **)&exeFileData,
+                        &exeFileLength)) == 0
+       && (rc = Parse_ELF_Executable(exeFileData, exeFileLength,
+                                     &exeFormat)) == 0)
+        rc = Load_User_Program(exeFileData, exeFileLength, &exeFormat,
+                               command, pUserContext);
+
+    if(exeFileData != 0)
+        Free(exeFileData);
+    return rc;
+}
+
 /*
  * Copy data from user memory into a kernel buffer.
  * Params:
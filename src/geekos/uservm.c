@@ -28,6 +28,13 @@
 #include <geekos/smp.h>
 #include <geekos/synch.h>
 #include <geekos/errno.h>
+#include <geekos/gdt.h>
+#include <geekos/segment.h>
+#include <geekos/zswap.h>
+#include <geekos/elf.h>
+#include <geekos/atomic.h>
+
+#include <libc/mmap.h>
 
 
 extern Spin_Lock_t kthreadLock;
@@ -35,11 +42,118 @@ extern Spin_Lock_t kthreadLock;
 int userDebug = 0;
 #define Debug(args...) if (userDebug) Print("uservm: " args)
 
+/* stack pages are zero filled on first touch, so this costs nothing until used */
+#define DEFAULT_USER_STACK_SIZE (64 * 1024)
+
 /* ----------------------------------------------------------------------
  * Private functions
  * ---------------------------------------------------------------------- */
 
-// TODO: Add private functions
+/*
+ * Allocate a User_Context for a paged address space, with a page
+ * directory that shares the kernel mappings of template.
+ */
+static struct User_Context *Create_Paged_User_Context(const pde_t *
+                                                      template) {
+    struct User_Context *context;
+    int index;
+
+    context = (struct User_Context *)Malloc(sizeof(*context));
+    if(context == 0)
+        return 0;
+    memset(context, 0, sizeof(struct User_Context));
+
+    context->pageDir = Alloc_Page();
+    if(context->pageDir == 0)
+        goto fail;
+    memset(context->pageDir, '\0', PAGE_SIZE);
+    memcpy(context->pageDir, template,
+           PAGE_DIRECTORY_INDEX(USER_VM_START) * sizeof(pde_t));
+    /* and the APIC mappings above user space */
+    memcpy(&context->pageDir[PAGE_DIRECTORY_INDEX(USER_VM_END)],
+           &template[PAGE_DIRECTORY_INDEX(USER_VM_END)],
+           (NUM_PAGE_DIR_ENTRIES - PAGE_DIRECTORY_INDEX(USER_VM_END)) *
+           sizeof(pde_t));
+
+    /* user segments cover the user half of the address space */
+    context->ldtDescriptor = Allocate_Segment_Descriptor();
+    if(context->ldtDescriptor == 0)
+        goto fail;
+    Init_LDT_Descriptor(context->ldtDescriptor, context->ldt,
+                        NUM_USER_LDT_ENTRIES);
+    index = Get_Descriptor_Index(context->ldtDescriptor);
+    context->ldtSelector = Selector(KERNEL_PRIVILEGE, true, index);
+    Init_Code_Segment_Descriptor(&context->ldt[0], USER_VM_START,
+                                 (USER_VM_END - USER_VM_START) / PAGE_SIZE,
+                                 USER_PRIVILEGE);
+    Init_Data_Segment_Descriptor(&context->ldt[1], USER_VM_START,
+                                 (USER_VM_END - USER_VM_START) / PAGE_SIZE,
+                                 USER_PRIVILEGE);
+    context->csSelector = Selector(USER_PRIVILEGE, false, 0);
+    context->dsSelector = Selector(USER_PRIVILEGE, false, 1);
+
+    Add_Paged_User_Context(context);
+    return context;
+
+  fail:
+    if(context->pageDir != 0)
+        Free_Page(context->pageDir);
+    Free(context);
+    return 0;
+}
+
+/*
+ * Give the child of a fork a page table mapping the same pages as
+ * the parent's table for directory entry index.  Writable pages are
+ * made read-only in both and marked KINFO_PAGE_COW; the first write
+ * to one copies it.  Swapped-out pages are brought back first, so
+ * that the child can share them too.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Clone_Page_Table(struct User_Context *parent,
+                            struct User_Context *child, uint_t index) {
+    pte_t *from = (pte_t *) (parent->pageDir[index].pageTableBaseAddr << 12);
+    pte_t *to;
+    int i, rc;
+
+    to = Alloc_Page();
+    if(to == 0)
+        return ENOMEM;
+    memset(to, '\0', PAGE_SIZE);
+    child->pageDir[index] = parent->pageDir[index];
+    child->pageDir[index].pageTableBaseAddr = PAGE_ALIGNED_ADDR(to);
+
+    for(i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+        ulong_t vaddr = ((ulong_t) index << 22) | ((ulong_t) i << 12);
+        pte_t *entry = &from[i];
+        struct Page *page;
+
+        for(;;) {
+            if(!entry->present) {
+                if(entry->kernelInfo == 0)
+                    break;      /* not mapped */
+                rc = Page_In_User_Page(parent, vaddr);
+                if(rc != 0)
+                    return rc;
+            }
+            page = Get_Page(entry->pageBaseAddr << 12);
+            if(Share_Page(page))
+                break;
+            /* being paged out; look again once it is gone */
+            Yield();
+        }
+        if(!entry->present)
+            continue;
+
+        /* shared memory segments stay shared and writable */
+        if((entry->flags & VM_WRITE) && !(page->flags & PAGE_SHM)) {
+            entry->flags &= ~VM_WRITE;
+            entry->kernelInfo = KINFO_PAGE_COW;
+        }
+        to[i] = *entry;
+    }
+    return 0;
+}
 
 
 /* ----------------------------------------------------------------------
@@ -51,21 +165,286 @@ int userDebug = 0;
  * and other resources allocated within it.
  */
 void Destroy_User_Context(struct User_Context *context) {
-    /*
-     * Hints:
-     * - Free all pages, page tables, and page directory for
-     *   the process (interrupts must be disabled while you do this,
-     *   otherwise those pages could be stolen by other processes)
-     * - Free semaphores, files, and other resources used
-     *   by the process
-     */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A,
-           "Destroy User_Context data structure after process exits");
+    uint_t i, j;
+
+    KASSERT(context->refCount == 0);
+
+    /* the other mappings of the pages we drop take them over */
+    Remove_Paged_User_Context(context);
+
+    while (context->mappedRegions != 0) {
+        mappedRegion_t *region = context->mappedRegions;
+
+        context->mappedRegions = region->next;
+        if(region->file != 0 && (region->flags & MAP_SHARED))
+            Sync_Mapped_Region(context, region);
+        if(region->file != 0)
+            Close(region->file);
+        Free(region);
+    }
+
+    /* pages may be shared copy-on-write: drop our reference to each */
+    for(i = PAGE_DIRECTORY_INDEX(USER_VM_START);
+        i < PAGE_DIRECTORY_INDEX(USER_VM_END); i++) {
+        pte_t *pageTable;
+
+        if(!context->pageDir[i].present)
+            continue;
+        pageTable = (pte_t *) (context->pageDir[i].pageTableBaseAddr << 12);
+        for(j = 0; j < NUM_PAGE_TABLE_ENTRIES; j++) {
+            pte_t *entry = &pageTable[j];
+
+            if(entry->present)
+                Drop_Page((void *)(entry->pageBaseAddr << 12));
+            else if(entry->kernelInfo != 0)
+                Zswap_Free_PTE(entry);
+        }
+        Free_Page(pageTable);
+    }
+
+    Free_Page(context->pageDir);
+    Free_Segment_Descriptor(context->ldtDescriptor);
+    Free(context);
+}
+
+/*
+ * Move the heap break by increment bytes.  The address space up to
+ * heapLimit is reserved for the heap, so growing only extends its
+ * region; pages are committed as they are first touched.  Shrinking
+ * releases the whole pages above the new break.
+ * Returns 0 and the old break in *pOldBreak if successful,
+ * error code otherwise.
+ */
+int Resize_User_Heap(struct User_Context *context, int increment,
+                     ulong_t * pOldBreak) {
+    ulong_t oldBreak = context->heapBreak, newBreak = oldBreak + increment;
+    ulong_t oldEnd, newEnd;
+    mappedRegion_t *region;
+
+    if(increment < 0 ? (newBreak < context->heapStart || newBreak > oldBreak)
+       : (newBreak > context->heapLimit || newBreak < oldBreak))
+        return ENOMEM;
+    for(region = context->mappedRegions; region != 0; region = region->next)
+        if(region->flags & MAP_HEAP)
+            break;
+    if(region == 0)
+        return ENOMEM;
+
+    oldEnd = region->startAddr + region->length;
+    newEnd = Round_Up_To_Page(newBreak);
+    region->length = newEnd - region->startAddr;
+    if(newEnd < oldEnd)
+        Unmap_User_Pages(context, newEnd, oldEnd);
+
+    context->heapBreak = newBreak;
+    *pOldBreak = oldBreak;
+    return 0;
+}
+
+/*
+ * Create the address space of a child process for fork.  The child
+ * gets its own page tables, but shares all of the parent's pages
+ * copy-on-write, so the cost is proportional to the size of the page
+ * tables rather than of the image.
+ * Returns 0 if successful, or an error code (< 0) if unsuccessful.
+ */
+int Clone_User_Context(struct User_Context *parent,
+                       struct User_Context **pChild) {
+    struct User_Context *child;
+    mappedRegion_t *region;
+    uint_t i;
+    int rc = 0;
+
+    child = Create_Paged_User_Context(parent->pageDir);
+    if(child == 0)
+        return ENOMEM;
+    child->size = parent->size;
+    child->entryAddr = parent->entryAddr;
+    child->argBlockAddr = parent->argBlockAddr;
+    child->stackPointerAddr = parent->stackPointerAddr;
+    child->heapStart = parent->heapStart;
+    child->heapBreak = parent->heapBreak;
+    child->heapLimit = parent->heapLimit;
+
+    for(region = parent->mappedRegions; region != 0 && rc == 0;
+        region = region->next)
+        rc = Add_Mapped_Region(child, region->file, region->startAddr,
+                               region->length, region->prot,
+                               region->flags, region->fileOffset,
+                               region->fileLength);
+
+    for(i = PAGE_DIRECTORY_INDEX(USER_VM_START);
+        i < PAGE_DIRECTORY_INDEX(USER_VM_END) && rc == 0; i++)
+        if(parent->pageDir[i].present)
+            rc = Clone_Page_Table(parent, child, i);
+
+    /* the parent's writable pages are now read-only */
+    Flush_TLB();
+
+    if(rc != 0) {
+        Destroy_User_Context(child);
+        return rc;
+    }
+    *pChild = child;
+    return 0;
+}
+
+/*
+ * Put the argument block for command at user address argBlockAddr
+ * of a new context.  The block is formatted in a kernel buffer and
+ * copied to freshly allocated pages, since the context is not the
+ * current address space.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Map_Argument_Block(struct User_Context *context,
+                              const char *command, unsigned numArgs,
+                              ulong_t argBlockAddr, ulong_t argBlockSize) {
+    char *argBlock = Malloc(argBlockSize);
+    ulong_t offset;
+
+    if(argBlock == 0)
+        return ENOMEM;
+    Format_Argument_Block(argBlock, numArgs, argBlockAddr, command);
+
+    for(offset = 0; offset < argBlockSize; offset += PAGE_SIZE) {
+        ulong_t linear = USER_VM_START + argBlockAddr + offset;
+        ulong_t len = argBlockSize - offset;
+        pte_t *entry = Find_Or_Create_User_PTE(context, linear);
+        char *paddr = entry ? Alloc_Pageable_Page(entry, linear) : 0;
+
+        if(paddr == 0) {
+            Free(argBlock);
+            return ENOMEM;
+        }
+        if(len > PAGE_SIZE)
+            len = PAGE_SIZE;
+        memset(paddr + len, '\0', PAGE_SIZE - len);
+        memcpy(paddr, argBlock + offset, len);
+        entry->pageBaseAddr = PAGE_ALIGNED_ADDR(paddr);
+        entry->flags = VM_USER | VM_WRITE;
+        entry->present = 1;
+    }
+
+    Free(argBlock);
+    return 0;
 }
 
 /*
- * Load a user executable into memory by creating a User_Context
- * data structure.
+ * Give a new context with its image regions in place the rest of
+ * its address space: the argument block at the top of user memory,
+ * the stack just below it and an empty heap after the image, which
+ * ends at maxva.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Finish_User_Context(struct User_Context *context,
+                               const char *command, ulong_t maxva,
+                               ulong_t entryAddr) {
+    ulong_t argBlockSize, argBlockAddr;
+    unsigned numArgs;
+    int rc;
+
+    Get_Argument_Block_Size(command, &numArgs, &argBlockSize);
+    argBlockAddr =
+        Round_Down_To_Page(USER_VM_END - USER_VM_START - argBlockSize);
+    if(Round_Up_To_Page(maxva) + DEFAULT_USER_STACK_SIZE > argBlockAddr)
+        return ENOEXEC;
+    rc = Add_Mapped_Region(context, 0,
+                           argBlockAddr - DEFAULT_USER_STACK_SIZE,
+                           USER_VM_END - USER_VM_START -
+                           (argBlockAddr - DEFAULT_USER_STACK_SIZE),
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE, 0, 0);
+    if(rc == 0)
+        rc = Map_Argument_Block(context, command, numArgs, argBlockAddr,
+                                argBlockSize);
+    if(rc != 0)
+        return rc;
+
+    /* Resize_User_Heap() grows the heap */
+    context->heapStart = Round_Up_To_Page(maxva);
+    context->heapBreak = context->heapStart;
+    context->heapLimit = context->heapStart < USER_MMAP_START ?
+        USER_MMAP_START : context->heapStart;
+    rc = Add_Mapped_Region(context, 0, context->heapStart, 0,
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_HEAP, 0,
+                           0);
+    if(rc != 0)
+        return rc;
+
+    context->size = Round_Up_To_Page(maxva);
+    context->entryAddr = entryAddr;
+    context->argBlockAddr = argBlockAddr;
+    context->stackPointerAddr = argBlockAddr;
+    return 0;
+}
+
+/*
+ * Copy the file part of each segment of an executable image into
+ * new pages of context, which is not the current address space.
+ * Pages holding only .bss are left to be zero filled on demand.
+ * Like Fill_Region_Page(), a page gathers everything any segment
+ * puts in it before it is mapped and becomes pageable.
+ * Returns 0 if successful, error code otherwise.
+ */
+static int Copy_Image_Pages(struct User_Context *context,
+                            const char *exeFileData,
+                            const struct Exe_Format *exeFormat,
+                            ulong_t maxva) {
+    ulong_t first;
+    int i;
+
+    for(first = 0; first < maxva; first += PAGE_SIZE) {
+        ulong_t last = first + PAGE_SIZE, linear = USER_VM_START + first;
+        bool writable = false;
+        char *paddr = 0;
+        pte_t *entry;
+
+        for(i = 0; i < exeFormat->numSegments; ++i) {
+            const struct Exe_Segment *segment = &exeFormat->segmentList[i];
+            ulong_t start = segment->startAddress;
+            ulong_t end = start + segment->lengthInFile;
+
+            if(segment->sizeInMemory == 0 || start >= last
+               || start + segment->sizeInMemory <= first)
+                continue;
+            if(segment->protFlags & VM_WRITE)
+                writable = true;
+            if(start < first)
+                start = first;
+            if(end > last)
+                end = last;
+            if(start >= end)
+                continue;
+            if(paddr == 0) {
+                paddr = Alloc_Unmapped_Page();
+                if(paddr == 0)
+                    return ENOMEM;
+                memset(paddr, '\0', PAGE_SIZE);
+            }
+            memcpy(paddr + (start - first),
+                   exeFileData + segment->offsetInFile +
+                   (start - segment->startAddress), end - start);
+        }
+        if(paddr == 0)
+            continue;
+
+        entry = Find_Or_Create_User_PTE(context, linear);
+        if(entry == 0) {
+            Free_Page(paddr);
+            return ENOMEM;
+        }
+        entry->pageBaseAddr = PAGE_ALIGNED_ADDR(paddr);
+        entry->flags = VM_USER | (writable ? VM_WRITE : 0);
+        entry->present = 1;
+        Adopt_Page(Get_Page((ulong_t) paddr), context, entry, linear);
+    }
+    return 0;
+}
+
+/*
+ * Load a user executable, already read into memory, into a new
+ * paged user context.  Each segment becomes an anonymous region
+ * whose file part is copied in now; the rest of it, the stack and
+ * the heap are zero filled on demand.
  * Params:
  * exeFileData - a buffer containing the executable to load
  * exeFileLength - number of bytes in exeFileData
@@ -84,19 +463,166 @@ void Destroy_User_Context(struct User_Context *context) {
 int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
                       struct Exe_Format *exeFormat, const char *command,
                       struct User_Context **pUserContext) {
-    /*
-     * Hints:
-     * - This will be similar to the same function in userseg.c
-     * - Determine space requirements for code, data, argument block,
-     *   and stack
-     * - Allocate pages for above, map them into user address
-     *   space (allocating page directory and page tables as needed)
-     * - Fill in initial stack pointer, argument block address,
-     *   and code entry point fields in User_Context
-     */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A,
-           "Load user program into address space");
+    struct User_Context *context;
+    ulong_t maxva = 0;
+    int i, rc;
+
+    context = Create_Paged_User_Context(Get_PDBR());
+    if(context == 0)
+        return ENOMEM;
+
+    for(i = 0; i < exeFormat->numSegments; ++i) {
+        struct Exe_Segment *segment = &exeFormat->segmentList[i];
+        ulong_t topva = segment->startAddress + segment->sizeInMemory;
+
+        if(segment->sizeInMemory == 0)
+            continue;
+        if(topva < segment->startAddress
+           || topva > USER_VM_END - USER_VM_START
+           || segment->lengthInFile > segment->sizeInMemory
+           || segment->offsetInFile + segment->lengthInFile > exeFileLength) {
+            rc = ENOEXEC;
+            goto fail;
+        }
+        rc = Add_Mapped_Region(context, 0, segment->startAddress,
+                               segment->sizeInMemory,
+                               PROT_READ | PROT_EXEC |
+                               ((segment->protFlags & VM_WRITE) ?
+                                PROT_WRITE : 0), MAP_PRIVATE, 0, 0);
+        if(rc != 0)
+            goto fail;
+        if(topva > maxva)
+            maxva = topva;
+    }
+
+    rc = Copy_Image_Pages(context, exeFileData, exeFormat, maxva);
+    if(rc == 0)
+        rc = Finish_User_Context(context, command, maxva,
+                                 exeFormat->entryAddr);
+    if(rc != 0)
+        goto fail;
+
+    *pUserContext = context;
+    return 0;
+
+  fail:
+    Destroy_User_Context(context);
+    return rc;
+}
+
+/*
+ * Load the named executable into a new paged user context.
+ * Only the ELF headers are read now.  Each segment becomes a mapped
+ * region of the executable file, so its pages are read on first
+ * touch, and the part of it not in the file (.bss) is zero filled
+ * on demand, as is the stack.  Only the argument block, at the top
+ * of user memory, is allocated up front.
+ * Returns 0 if successful, or an error code (< 0) if unsuccessful.
+ */
+int Load_User_Program_File(const char *program, const char *command,
+                           struct User_Context **pUserContext) {
+    struct User_Context *context = 0;
+    struct File *file = 0;
+    struct VFS_File_Stat stat;
+    struct Exe_Format exeFormat;
+    char *headers = 0;
+    ulong_t headerLength, maxva = 0;
+    int i, rc;
+
+    if((rc = Stat(program, &stat)) < 0
+       || (rc = Open(program, O_READ, &file)) < 0)
+        goto fail;
+
+    /* program headers follow the ELF header in the first page */
+    headerLength = stat.size < PAGE_SIZE ? stat.size : PAGE_SIZE;
+    headers = Malloc(headerLength);
+    if(headers == 0) {
+        rc = ENOMEM;
+        goto fail;
+    }
+    for(i = 0; i < (int)headerLength; i += rc)
+        if((rc = Read(file, headers + i, headerLength - i)) <= 0) {
+            rc = rc < 0 ? rc : ENOEXEC;
+            goto fail;
+        }
+    if((rc = Parse_ELF_Executable(headers, headerLength, &exeFormat)) != 0)
+        goto fail;
+    Free(headers);
+    headers = 0;
+
+    context = Create_Paged_User_Context(Get_PDBR());
+    if(context == 0) {
+        rc = ENOMEM;
+        goto fail;
+    }
+
+    for(i = 0; i < exeFormat.numSegments; ++i) {
+        struct Exe_Segment *segment = &exeFormat.segmentList[i];
+        ulong_t topva = segment->startAddress + segment->sizeInMemory;
+
+        if(segment->sizeInMemory == 0)
+            continue;
+        if(topva < segment->startAddress
+           || topva > USER_VM_END - USER_VM_START
+           || segment->offsetInFile + segment->lengthInFile >
+           (ulong_t) stat.size) {
+            rc = ENOEXEC;
+            goto fail;
+        }
+        rc = Add_Mapped_Region(context, file, segment->startAddress,
+                               segment->sizeInMemory,
+                               PROT_READ | PROT_EXEC |
+                               ((segment->protFlags & VM_WRITE) ?
+                                PROT_WRITE : 0), MAP_PRIVATE,
+                               segment->offsetInFile,
+                               segment->lengthInFile);
+        if(rc != 0)
+            goto fail;
+        if(topva > maxva)
+            maxva = topva;
+    }
+
+    rc = Finish_User_Context(context, command, maxva, exeFormat.entryAddr);
+    if(rc != 0)
+        goto fail;
+
+    /* the regions hold their own references to the file */
+    Close(file);
+    *pUserContext = context;
     return 0;
+
+  fail:
+    if(headers != 0)
+        Free(headers);
+    if(context != 0)
+        Destroy_User_Context(context);
+    if(file != 0)
+        Close(file);
+    return rc;
+}
+
+/*
+ * Is [userAddr, userAddr + numBytes) of the current process covered
+ * by mapped regions that allow prot?  The kernel can then touch it
+ * at USER_VM_START + userAddr: pages that are not resident are
+ * faulted in, and copy-on-write pages copied (CR0.WP makes kernel
+ * writes fault too), just as for the process's own accesses.
+ */
+static bool Validate_User_Range(ulong_t userAddr, ulong_t numBytes,
+                                int prot) {
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    ulong_t end = userAddr + numBytes;
+    mappedRegion_t *region;
+
+    if(context == 0 || end < userAddr || end > USER_VM_END - USER_VM_START)
+        return false;
+    while (userAddr < end) {
+        region = Find_Mapped_Region(context, userAddr);
+        if(region == 0 || (region->prot & prot) != prot)
+            return false;
+        userAddr = region->startAddr + region->length;
+    }
+    return true;
 }
 
 /*
@@ -105,25 +631,10 @@ int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
  */
 bool Copy_From_User(void *destInKernel, ulong_t srcInUser,
                     ulong_t numBytes) {
-    /*
-     * Hints:
-     * - Make sure that user page is part of a valid region
-     *   of memory
-     * - Remember that you need to add 0x80000000 to user addresses
-     *   to convert them to kernel addresses, because of how the
-     *   user code and data segments are defined
-     * - User pages may need to be paged in from disk before being accessed.
-     * - Before you touch (read or write) any data in a user
-     *   page, **disable the PAGE_PAGEABLE bit**.
-     *
-     * Be very careful with race conditions in reading a page from disk.
-     * Kernel code must always assume that if the struct Page for
-     * a page of memory has the PAGE_PAGEABLE bit set,
-     * IT CAN BE STOLEN AT ANY TIME.  The only exception is if
-     * interrupts are disabled; because no other process can run,
-     * the page is guaranteed not to be stolen.
-     */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A, "Copy user data to kernel buffer");
+    if(!Validate_User_Range(srcInUser, numBytes, PROT_READ))
+        return false;
+    memcpy(destInKernel, (void *)(USER_VM_START + srcInUser), numBytes);
+    return true;
 }
 
 /*
@@ -132,13 +643,10 @@ bool Copy_From_User(void *destInKernel, ulong_t srcInUser,
  */
 bool Copy_To_User(ulong_t destInUser, const void *srcInKernel,
                   ulong_t numBytes) {
-    /*
-     * Hints:
-     * - Same as for Copy_From_User()
-     * - Also, make sure the memory is mapped into the user
-     *   address space with write permission enabled
-     */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A, "Copy kernel data to user buffer");
+    if(!Validate_User_Range(destInUser, numBytes, PROT_WRITE))
+        return false;
+    memcpy((void *)(USER_VM_START + destInUser), srcInKernel, numBytes);
+    return true;
 }
 
 
@@ -146,11 +654,12 @@ bool Copy_To_User(ulong_t destInUser, const void *srcInKernel,
  * Switch to user address space.
  */
 void Switch_To_Address_Space(struct User_Context *userContext) {
-    /*
-     * - If you are still using an LDT to define your user code and data
-     *   segments, switch to the process's LDT
-     * - 
-     */
-    TODO_P(PROJECT_VIRTUAL_MEMORY_A,
-           "Switch_To_Address_Space() using paging");
+    ushort_t ldtSelector = userContext->ldtSelector;
+
+    __asm__ __volatile__("lldt %0"::"a"(ldtSelector)
+        );
+
+    /* kernel mappings are global, so this only flushes user entries */
+    if(Get_PDBR() != userContext->pageDir)
+        Set_PDBR(userContext->pageDir);
 }
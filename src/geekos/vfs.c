@@ -24,6 +24,7 @@
 #include <geekos/vfs.h>
 #include <geekos/projects.h>
 #include <geekos/atomic.h>
+#include <geekos/slab.h>
 
 /*
  * Notes:
@@ -69,6 +70,10 @@ static struct Filesystem_List s_filesystemList;
 /* Registered paging device. */
 static struct Paging_Device *s_pagingDevice;
 
+/* Open file objects. */
+static struct Object_Cache s_fileCache =
+OBJECT_CACHE_INITIALIZER("file", sizeof(struct File), 0);
+
 #define MAX_PREFIX_LEN 16
 
 /*
@@ -436,7 +441,7 @@ int Close(struct File *file) {
 
     rc = file->ops->Close(file);
     if(rc == 0)
-        Free(file);
+        Free_File(file);
     return rc;
 }
 
@@ -507,7 +512,7 @@ struct File *Allocate_File(const struct File_Ops *ops, int filePos,
                            struct Mount_Point *mountPoint) {
     struct File *file;
 
-    file = (struct File *)Malloc(sizeof(struct File));
+    file = (struct File *)Alloc_Object(&s_fileCache);
     if(file != 0) {
         file->ops = ops;
         file->filePos = filePos;
@@ -516,10 +521,19 @@ struct File *Allocate_File(const struct File_Ops *ops, int filePos,
         file->mode = mode;
         file->mountPoint = mountPoint;
         file->refCount = 1;
+        Mutex_Init(&file->posLock);
     }
     return file;
 }
 
+/*
+ * Release a File object created by Allocate_File() without closing it.
+ * Close() calls this once the filesystem has closed the file.
+ */
+void Free_File(struct File *file) {
+    Free_Object(&s_fileCache, file);
+}
+
 /*
  * Get metadata for given file.
  * Params:
@@ -580,6 +594,64 @@ int Seek(struct File *file, ulong_t len) {
         return file->ops->Seek(file, len);
 }
 
+/*
+ * Read bytes at a given position of a file, leaving its current
+ * position alone.  Filesystems without a Read_At operation get a
+ * seek, read and seek back, under the file's posLock so positional
+ * users of the file do not see each other's position; a plain Read()
+ * of the same file at the same time may still see it moved.
+ * Params:
+ *   file - the File object
+ *   pos - position to read at
+ *   buf - kernel buffer where data should be read
+ *   len - number of bytes to read
+ * Returns: number of bytes read, or error code (< 0) if read fails
+ */
+int Read_At(struct File *file, ulong_t pos, void *buf, ulong_t len) {
+    ulong_t oldPos;
+    int rc;
+
+    if(file->ops->Read_At != 0)
+        return file->ops->Read_At(file, pos, buf, len);
+    if(file->ops->Read == 0 || file->ops->Seek == 0)
+        return EUNSUPPORTED;
+
+    Mutex_Lock(&file->posLock);
+    oldPos = file->filePos;
+    rc = Seek(file, pos);
+    if(rc == 0) {
+        rc = Read(file, buf, len);
+        Seek(file, oldPos);
+    }
+    Mutex_Unlock(&file->posLock);
+    return rc;
+}
+
+/*
+ * Write bytes at a given position of a file, leaving its current
+ * position alone; see Read_At().
+ * Returns: number of bytes written, or error code (< 0) if write fails
+ */
+int Write_At(struct File *file, ulong_t pos, void *buf, ulong_t len) {
+    ulong_t oldPos;
+    int rc;
+
+    if(file->ops->Write_At != 0)
+        return file->ops->Write_At(file, pos, buf, len);
+    if(file->ops->Write == 0 || file->ops->Seek == 0)
+        return EUNSUPPORTED;
+
+    Mutex_Lock(&file->posLock);
+    oldPos = file->filePos;
+    rc = Seek(file, pos);
+    if(rc == 0) {
+        rc = Write(file, buf, len);
+        Seek(file, oldPos);
+    }
+    Mutex_Unlock(&file->posLock);
+    return rc;
+}
+
 /*
  * Completely read named file into a buffer.
  * Params:
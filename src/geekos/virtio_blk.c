@@ -0,0 +1,547 @@
+/*
+ * Virtio block device driver (legacy virtio-pci interface).
+ *
+ * The device has one virtqueue.  A request is a descriptor chain:
+ * a header the device reads (type and sector), one descriptor per
+ * page of the data buffer, and a status byte the device writes.
+ * The request thread adds chains to the available ring as long as
+ * descriptors are free; the interrupt handler walks the used ring
+ * and completes the requests the device has finished.
+ *
+ * The queue memory, headers and status bytes are kernel memory,
+ * which is identity mapped, so their addresses are also the physical
+ * addresses the device uses.
+ */
+
+#include <geekos/ktypes.h>
+#include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/malloc.h>
+#include <geekos/mem.h>
+#include <geekos/string.h>
+#include <geekos/io.h>
+#include <geekos/int.h>
+#include <geekos/irq.h>
+#include <geekos/idt.h>
+#include <geekos/lock.h>
+#include <geekos/screen.h>
+#include <geekos/kthread.h>
+#include <geekos/blockdev.h>
+#include <geekos/pci.h>
+#include <geekos/virtio_blk.h>
+
+#define VIRTIO_VENDOR_ID            0x1af4
+#define VIRTIO_BLK_DEVICE_ID        0x1001      /* transitional */
+
+#define VIRTIO_MAX_DEVICES          4
+#define VIRTIO_BATCH                16      /* requests taken at a time */
+
+/* Legacy registers, offsets from BAR 0 */
+#define VIRTIO_DEVICE_FEATURES      0x00
+#define VIRTIO_GUEST_FEATURES       0x04
+#define VIRTIO_QUEUE_ADDRESS        0x08        /* page frame number */
+#define VIRTIO_QUEUE_SIZE           0x0c
+#define VIRTIO_QUEUE_SELECT         0x0e
+#define VIRTIO_QUEUE_NOTIFY         0x10
+#define VIRTIO_DEVICE_STATUS        0x12
+#define VIRTIO_ISR_STATUS           0x13
+#define VIRTIO_BLK_CAPACITY         0x14        /* 64 bits, in sectors */
+
+/* Device status bits */
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+
+#define VIRTIO_ISR_QUEUE            0x01
+
+/* Descriptor flags */
+#define VRING_DESC_F_NEXT           1
+#define VRING_DESC_F_WRITE          2       /* device writes the buffer */
+
+/* Used ring flag: the device does not need to be notified */
+#define VRING_USED_F_NO_NOTIFY      1
+
+/* Request types and status */
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_S_OK             0
+
+/* Legacy queues are aligned to a page between avail and used rings */
+#define VIRTIO_QUEUE_ALIGN          PAGE_SIZE
+
+struct Vring_Desc {
+    ulong_t addr, addrHigh;
+    ulong_t len;
+    ushort_t flags;
+    ushort_t next;
+};
+
+struct Vring_Avail {
+    ushort_t flags;
+    ushort_t idx;
+    ushort_t ring[];
+};
+
+struct Vring_Used_Elem {
+    ulong_t id;
+    ulong_t len;
+};
+
+struct Vring_Used {
+    ushort_t flags;
+    ushort_t idx;
+    struct Vring_Used_Elem ring[];
+};
+
+struct Virtio_Blk_Header {
+    ulong_t type;
+    ulong_t reserved;
+    ulong_t sector, sectorHigh;
+};
+
+/*
+ * What the driver keeps for each chain in flight, indexed by the
+ * chain's head descriptor.
+ */
+struct Virtio_Blk_Slot {
+    struct Block_Request *request;
+    struct Virtio_Blk_Header header;
+    volatile uchar_t status;
+};
+
+struct Virtio_Blk {
+    struct PCI_Device *pci;
+    ushort_t ioBase;
+    int capacity;               /* in sectors */
+    int queueSize;
+
+    Spin_Lock_t lock;           /* protects the queue and slots */
+    struct Vring_Desc *desc;
+    struct Vring_Avail *avail;
+    volatile struct Vring_Used *used;
+    struct Virtio_Blk_Slot *slots;
+    int freeHead;               /* free descriptors, chained by next */
+    int numFree;
+    ushort_t lastUsed;          /* used ring entries consumed */
+    struct Thread_Queue spaceWaitQueue;         /* submit waits for descriptors */
+    bool unnotified;            /* chains added since the last notify */
+
+    struct Block_Queue queue;
+
+    /* statistics */
+    ulong_t submitted, completed, errors;
+    ulong_t inFlight, maxInFlight;
+};
+
+static struct Virtio_Blk s_virtioBlk[VIRTIO_MAX_DEVICES];
+static int s_numVirtioBlk;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Legacy queue layout: descriptors, then the avail ring, then the
+ * used ring on the next VIRTIO_QUEUE_ALIGN boundary.
+ */
+static ulong_t Vring_Used_Offset(int queueSize) {
+    return Round_Up_To_Page(sizeof(struct Vring_Desc) * queueSize +
+                            sizeof(ushort_t) * (3 + queueSize));
+}
+
+static ulong_t Vring_Size(int queueSize) {
+    return Vring_Used_Offset(queueSize) +
+        Round_Up_To_Page(sizeof(ushort_t) * 3 +
+                         sizeof(struct Vring_Used_Elem) * queueSize);
+}
+
+/*
+ * Take n descriptors off the free list, linked in a chain; returns
+ * the head.  Called with vblk->lock held.
+ */
+static int Alloc_Desc_Chain(struct Virtio_Blk *vblk, int n) {
+    int head = vblk->freeHead, i, d = head;
+
+    KASSERT(n > 0 && n <= vblk->numFree);
+    for(i = 1; i < n; i++)
+        d = vblk->desc[d].next;
+    vblk->freeHead = vblk->desc[d].next;
+    vblk->numFree -= n;
+    return head;
+}
+
+/*
+ * Return the chain starting at head to the free list.
+ * Called with vblk->lock held.
+ */
+static void Free_Desc_Chain(struct Virtio_Blk *vblk, int head) {
+    int d = head, n = 1;
+
+    while (vblk->desc[d].flags & VRING_DESC_F_NEXT) {
+        d = vblk->desc[d].next;
+        ++n;
+    }
+    vblk->desc[d].next = vblk->freeHead;
+    vblk->freeHead = head;
+    vblk->numFree += n;
+}
+
+/*
+ * Number of data descriptors needed: one per page each memory
+ * segment of the request touches.
+ */
+static int Count_Data_Segments(const struct Block_Request *request) {
+    int i, n = 0;
+
+    for(i = 0; i < Get_Num_Request_Segments(request); i++) {
+        struct Block_Segment seg = Get_Request_Segment(request, i);
+        ulong_t addr = (ulong_t) seg.buf;
+
+        n += (Round_Up_To_Page(addr + seg.numBlocks * SECTOR_SIZE) -
+              (addr & ~(ulong_t) PAGE_MASK)) / PAGE_SIZE;
+    }
+    return n;
+}
+
+/*
+ * Tell the device about the chains added since the last call, unless
+ * it has asked not to be told.  Called with vblk->lock held.
+ */
+static void Notify_Device(struct Virtio_Blk *vblk) {
+    if(!vblk->unnotified)
+        return;
+    vblk->unnotified = false;
+    /*
+     * The avail->idx store must be visible to the device before we
+     * read its used->flags, or we can miss a change to NO_NOTIFY;
+     * x86 lets a load pass an earlier store, so a full fence.
+     */
+    __asm__ __volatile__("mfence":::"memory");
+    if(!(vblk->used->flags & VRING_USED_F_NO_NOTIFY))
+        Out_Word(vblk->ioBase + VIRTIO_QUEUE_NOTIFY, 0);
+}
+
+/*
+ * Build the chain for request and make it available to the device;
+ * the device is told later by Notify_Device().
+ * Called with vblk->lock held and enough descriptors free.
+ */
+static void Submit_Request(struct Virtio_Blk *vblk,
+                           struct Block_Request *request, int numData) {
+    int head = Alloc_Desc_Chain(vblk, numData + 2), d = head, i;
+    struct Virtio_Blk_Slot *slot = &vblk->slots[head];
+
+    slot->request = request;
+    slot->status = 0xff;
+    slot->header.type = request->type == BLOCK_READ
+        ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+    slot->header.reserved = 0;
+    slot->header.sector = request->blockNum;
+    slot->header.sectorHigh = 0;
+
+    vblk->desc[d].addr = (ulong_t) & slot->header;
+    vblk->desc[d].addrHigh = 0;
+    vblk->desc[d].len = sizeof(slot->header);
+    vblk->desc[d].flags = VRING_DESC_F_NEXT;
+    d = vblk->desc[d].next;
+
+    /* one descriptor per page of each segment */
+    for(i = 0; i < Get_Num_Request_Segments(request); i++) {
+        struct Block_Segment seg = Get_Request_Segment(request, i);
+        ulong_t addr = (ulong_t) seg.buf;
+        ulong_t bytes = seg.numBlocks * SECTOR_SIZE;
+
+        while (bytes > 0) {
+            ulong_t chunk = PAGE_SIZE - (addr & PAGE_MASK);
+
+            if(chunk > bytes)
+                chunk = bytes;
+            vblk->desc[d].addr = addr;
+            vblk->desc[d].addrHigh = 0;
+            vblk->desc[d].len = chunk;
+            vblk->desc[d].flags = VRING_DESC_F_NEXT |
+                (request->type == BLOCK_READ ? VRING_DESC_F_WRITE : 0);
+            d = vblk->desc[d].next;
+            addr += chunk;
+            bytes -= chunk;
+        }
+    }
+
+    vblk->desc[d].addr = (ulong_t) & slot->status;
+    vblk->desc[d].addrHigh = 0;
+    vblk->desc[d].len = 1;
+    vblk->desc[d].flags = VRING_DESC_F_WRITE;
+
+    vblk->avail->ring[vblk->avail->idx % vblk->queueSize] = head;
+    /* the device must see the ring entry before the new index */
+    __asm__ __volatile__("":::"memory");
+    vblk->avail->idx++;
+    vblk->unnotified = true;
+
+    ++vblk->submitted;
+    if(++vblk->inFlight > vblk->maxInFlight)
+        vblk->maxInFlight = vblk->inFlight;
+}
+
+/*
+ * Complete every request the device has returned.
+ * Called with vblk->lock held.
+ */
+static bool Reap_Completions(struct Virtio_Blk *vblk) {
+    bool any = false;
+
+    while (vblk->lastUsed != vblk->used->idx) {
+        const volatile struct Vring_Used_Elem *elem =
+            &vblk->used->ring[vblk->lastUsed % vblk->queueSize];
+        struct Virtio_Blk_Slot *slot = &vblk->slots[elem->id];
+        struct Block_Request *request = slot->request;
+        bool ok = slot->status == VIRTIO_BLK_S_OK;
+
+        Free_Desc_Chain(vblk, elem->id);
+        slot->request = 0;
+        ++vblk->lastUsed;
+        ++vblk->completed;
+        --vblk->inFlight;
+        if(!ok)
+            ++vblk->errors;
+        Notify_Request_Completion(request, ok ? COMPLETED : ERROR,
+                                  ok ? 0 : EIO);
+        any = true;
+    }
+    return any;
+}
+
+/*
+ * PCI interrupt lines are shared, so the line may have been raised
+ * by another device, or by another virtio-blk device on it.
+ */
+static void Virtio_Blk_Interrupt_Handler(struct Interrupt_State *state) {
+    int i;
+
+    for(i = 0; i < s_numVirtioBlk; i++) {
+        struct Virtio_Blk *vblk = &s_virtioBlk[i];
+
+        /* reading the ISR acknowledges the interrupt */
+        if(vblk->pci->irq != state->intNum - FIRST_EXTERNAL_INT
+           || !(In_Byte(vblk->ioBase + VIRTIO_ISR_STATUS) &
+                VIRTIO_ISR_QUEUE))
+            continue;
+        Spin_Lock(&vblk->lock);
+        if(Reap_Completions(vblk))
+            Wake_Up(&vblk->spaceWaitQueue);
+        Spin_Unlock(&vblk->lock);
+    }
+}
+
+/*
+ * Check a request against the device; false if it cannot be done.
+ */
+static bool Valid_Request(struct Virtio_Blk *vblk,
+                          struct Block_Request *request, int numData) {
+    return request->blockNum >= 0 && request->numBlocks > 0
+        && request->numBlocks <= vblk->capacity - request->blockNum
+        && numData + 2 <= vblk->queueSize;
+}
+
+/*
+ * Take the queued requests in batches and put each batch on the
+ * ring before notifying the device once.
+ */
+static void Virtio_Blk_Request_Thread(ulong_t arg) {
+    struct Virtio_Blk *vblk = (struct Virtio_Blk *)arg;
+    struct Block_Request *batch[VIRTIO_BATCH];
+
+    for(;;) {
+        int n = Dequeue_Requests(&vblk->queue, batch, VIRTIO_BATCH), i;
+        bool iflag = Spin_Lock_Irq_Save(&vblk->lock);
+
+        for(i = 0; i < n; i++) {
+            struct Block_Request *request = batch[i];
+            int numData = Count_Data_Segments(request);
+
+            if(!Valid_Request(vblk, request, numData)) {
+                Notify_Request_Completion(request, ERROR, EINVALID);
+                continue;
+            }
+            if(vblk->numFree < numData + 2) {
+                /* queue full: let the device at what we have added */
+                Notify_Device(vblk);
+                Wait_Until(&vblk->spaceWaitQueue, &vblk->lock,
+                           vblk->numFree >= numData + 2);
+            }
+            Submit_Request(vblk, request, numData);
+        }
+        Notify_Device(vblk);
+        Spin_Unlock_Irq_Restore(&vblk->lock, iflag);
+    }
+}
+
+static int Virtio_Blk_Open(struct Block_Device *dev) {
+    KASSERT(!dev->inUse);
+    return 0;
+}
+
+static int Virtio_Blk_Close(struct Block_Device *dev) {
+    KASSERT(dev->inUse);
+    return 0;
+}
+
+static int Virtio_Blk_Get_Num_Blocks(struct Block_Device *dev) {
+    return ((struct Virtio_Blk *)dev->driverData)->capacity;
+}
+
+static struct Block_Device_Ops s_virtioBlkDeviceOps = {
+    Virtio_Blk_Open,
+    Virtio_Blk_Close,
+    Virtio_Blk_Get_Num_Blocks,
+};
+
+/*
+ * Reset the device, negotiate (no) features, and set up queue 0.
+ */
+/*
+ * Reset the device, so it lets go of the rings, and free them.
+ */
+static void Release_Device(struct Virtio_Blk *vblk) {
+    Out_Byte(vblk->ioBase + VIRTIO_DEVICE_STATUS, 0);
+    if(vblk->desc != 0)
+        Free_Contiguous_Pages(vblk->desc);
+    if(vblk->slots != 0)
+        Free(vblk->slots);
+    vblk->desc = 0;
+    vblk->slots = 0;
+}
+
+static int Setup_Device(struct Virtio_Blk *vblk) {
+    ulong_t capLow, capHigh, size;
+    char *queue;
+    int i;
+
+    Out_Byte(vblk->ioBase + VIRTIO_DEVICE_STATUS, 0);
+    Out_Byte(vblk->ioBase + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    Out_Byte(vblk->ioBase + VIRTIO_DEVICE_STATUS,
+             VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    Out_DWord(vblk->ioBase + VIRTIO_GUEST_FEATURES, 0);
+
+    capLow = In_DWord(vblk->ioBase + VIRTIO_BLK_CAPACITY);
+    capHigh = In_DWord(vblk->ioBase + VIRTIO_BLK_CAPACITY + 4);
+    vblk->capacity = capHigh != 0 || capLow > 0x7fffffff
+        ? 0x7fffffff : (int)capLow;
+
+    Out_Word(vblk->ioBase + VIRTIO_QUEUE_SELECT, 0);
+    vblk->queueSize = In_Word(vblk->ioBase + VIRTIO_QUEUE_SIZE);
+    if(vblk->queueSize == 0)
+        return ENODEV;
+
+    size = Vring_Size(vblk->queueSize);
+    queue = Alloc_Contiguous_Pages(size / PAGE_SIZE);
+    vblk->slots = Malloc(vblk->queueSize * sizeof(struct Virtio_Blk_Slot));
+    if(queue == 0 || vblk->slots == 0) {
+        if(queue != 0)
+            Free_Contiguous_Pages(queue);
+        if(vblk->slots != 0)
+            Free(vblk->slots);
+        vblk->slots = 0;
+        return ENOMEM;
+    }
+    memset(queue, '\0', size);
+    memset(vblk->slots, '\0',
+           vblk->queueSize * sizeof(struct Virtio_Blk_Slot));
+
+    vblk->desc = (struct Vring_Desc *)queue;
+    vblk->avail = (struct Vring_Avail *)(queue +
+                                         vblk->queueSize *
+                                         sizeof(struct Vring_Desc));
+    vblk->used = (struct Vring_Used *)(queue +
+                                       Vring_Used_Offset(vblk->queueSize));
+    for(i = 0; i < vblk->queueSize; i++)
+        vblk->desc[i].next = (i + 1) % vblk->queueSize;
+    vblk->freeHead = 0;
+    vblk->numFree = vblk->queueSize;
+
+    /*
+     * Requests must still fit: a descriptor per page touched, and each
+     * segment may touch two pages more than its size needs.
+     */
+    if(vblk->queueSize > 3 + 2 * BLOCK_MAX_SEGMENTS)
+        vblk->queue.maxBlocks =
+            (vblk->queueSize - 2 - 2 * BLOCK_MAX_SEGMENTS) *
+            (PAGE_SIZE / SECTOR_SIZE);
+
+    Out_DWord(vblk->ioBase + VIRTIO_QUEUE_ADDRESS,
+              (ulong_t) queue / VIRTIO_QUEUE_ALIGN);
+    Out_Byte(vblk->ioBase + VIRTIO_DEVICE_STATUS,
+             VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+             VIRTIO_STATUS_DRIVER_OK);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+void Dump_Virtio_Blk_Stats(void) {
+    int i;
+
+    for(i = 0; i < s_numVirtioBlk; i++) {
+        struct Virtio_Blk *vblk = &s_virtioBlk[i];
+
+        Print("vd%c: %lu submitted, %lu completed, %lu errors, "
+              "max %lu in flight\n", 'a' + i, vblk->submitted,
+              vblk->completed, vblk->errors, vblk->maxInFlight);
+    }
+}
+
+void Init_Virtio_Blk(void) {
+    struct PCI_Device *pci;
+    int index;
+
+    for(index = 0; s_numVirtioBlk < VIRTIO_MAX_DEVICES
+        && (pci = Find_PCI_Device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID,
+                                  index)) != 0; index++) {
+        struct Virtio_Blk *vblk = &s_virtioBlk[s_numVirtioBlk];
+        char devname[BLOCKDEV_MAX_NAME_LEN];
+        int rc;
+
+        if(!pci->barIsIO[0] || pci->irq == PCI_NO_IRQ) {
+            Print("virtio-blk: device without io BAR or irq ignored\n");
+            continue;
+        }
+        memset(vblk, '\0', sizeof(*vblk));
+        vblk->pci = pci;
+        vblk->ioBase = pci->bar[0];
+        Init_Block_Queue(&vblk->queue);
+        PCI_Enable_Device(pci, true);
+
+        rc = Setup_Device(vblk);
+        if(rc != 0) {
+            Print("virtio-blk: setup failed (%d)\n", rc);
+            Out_Byte(vblk->ioBase + VIRTIO_DEVICE_STATUS,
+                     VIRTIO_STATUS_FAILED);
+            continue;
+        }
+
+        snprintf(devname, sizeof(devname), "vd%c", 'a' + s_numVirtioBlk);
+        rc = Register_Block_Device(devname, &s_virtioBlkDeviceOps, 0, vblk,
+                                   &vblk->queue);
+        if(rc != 0) {
+            Print("  Error: could not create block device for %s\n",
+                  devname);
+            Release_Device(vblk);
+            continue;
+        }
+        Print("    %s: %d sectors, queue %d, irq %d\n", devname,
+              vblk->capacity, vblk->queueSize, pci->irq);
+
+        /*
+         * Only devices that made it this far are counted, so the
+         * interrupt handler never looks at a released one.
+         */
+        ++s_numVirtioBlk;
+        Install_Shared_IRQ(pci->irq, &Virtio_Blk_Interrupt_Handler);
+        Enable_IRQ(pci->irq);
+        Start_Kernel_Thread(Virtio_Blk_Request_Thread, (ulong_t) vblk,
+                            PRIORITY_NORMAL, true, "{VirtioBlk}");
+    }
+}
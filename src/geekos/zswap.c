@@ -0,0 +1,299 @@
+/*
+ * Compressed in-memory swap cache.
+ *
+ * Each compressed page is a Malloc()ed buffer described by an entry
+ * in a fixed table; the index of the entry is the handle kept in the
+ * page table entry of the evicted page.  Entries in use are kept on
+ * a list in the order they were stored, so the oldest copies are the
+ * first written to the paging file when the pool fills up.
+ *
+ * Everything is protected by one mutex, held across compression,
+ * decompression and writeback.  Nothing here allocates pages through
+ * the page reclaim path, so page-out may call in without deadlock.
+ */
+
+#include <geekos/zswap.h>
+#include <geekos/lz.h>
+#include <geekos/mem.h>
+#include <geekos/malloc.h>
+#include <geekos/synch.h>
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/string.h>
+#include <geekos/errno.h>
+
+/* only keep pages that compress to at most this size */
+#define ZSWAP_MAX_LENGTH (PAGE_SIZE * 3 / 4)
+
+/* table entries per page of pool, i.e. the best average ratio allowed for */
+#define ZSWAP_ENTRIES_PER_PAGE 4
+
+struct Zswap_Entry;
+DEFINE_LIST(Zswap_Entry_List, Zswap_Entry);
+
+struct Zswap_Entry {
+    DEFINE_LINK(Zswap_Entry_List, Zswap_Entry);
+    pte_t *pte;                 /* entry of the evicted page; null if free */
+    void *data;
+    ulong_t length;
+};
+
+IMPLEMENT_LIST(Zswap_Entry_List, Zswap_Entry);
+
+int zswapPercent = 20;
+
+static bool s_enabled;
+static struct Mutex s_zswapMutex;
+static struct Zswap_Entry *s_entries;
+static int s_numEntries;
+static struct Zswap_Entry_List s_storedList;    /* oldest first */
+static struct Zswap_Entry_List s_freeEntryList;
+static ulong_t s_poolLimit, s_poolBytes;
+static int s_storedPages;
+
+static void *s_workMem;         /* LZ_Compress hash table */
+static void *s_compressBuf;     /* compressor output */
+static void *s_bouncePage;      /* decompressed copy being written back */
+
+/* statistics */
+static ulong_t s_stores, s_incompressible, s_poolFull, s_writebacks;
+static ulong_t s_hits, s_diskFaults;
+
+/*
+ * Unlink an entry from the list it is on, without the O(n)
+ * membership check of Remove_From_Zswap_Entry_List.
+ */
+static void Unlink_Entry(struct Zswap_Entry *e) {
+    struct Zswap_Entry_List *list = e->inZswap_Entry_List;
+
+    KASSERT(list != 0);
+    if(e->prevZswap_Entry_List != 0)
+        e->prevZswap_Entry_List->nextZswap_Entry_List =
+            e->nextZswap_Entry_List;
+    else
+        list->head = e->nextZswap_Entry_List;
+    if(e->nextZswap_Entry_List != 0)
+        e->nextZswap_Entry_List->prevZswap_Entry_List =
+            e->prevZswap_Entry_List;
+    else
+        list->tail = e->prevZswap_Entry_List;
+    e->inZswap_Entry_List = 0;
+}
+
+/*
+ * Drop a compressed copy.  Caller holds s_zswapMutex.
+ */
+static void Release_Entry(struct Zswap_Entry *e) {
+    KASSERT(e->pte != 0);
+    Unlink_Entry(e);
+    Free(e->data);
+    s_poolBytes -= e->length;
+    --s_storedPages;
+    e->pte = 0;
+    e->data = 0;
+    Add_To_Back_Of_Zswap_Entry_List(&s_freeEntryList, e);
+}
+
+/*
+ * Move the oldest compressed copy to the paging file.
+ * Caller holds s_zswapMutex.  Returns false if that is not possible.
+ */
+static bool Write_Back_Oldest(void) {
+    struct Zswap_Entry *e = Get_Front_Of_Zswap_Entry_List(&s_storedList);
+    int slot;
+
+    if(e == 0)
+        return false;
+    slot = Find_Space_On_Paging_File();
+    if(slot < 0)
+        return false;
+    if(LZ_Decompress(e->data, e->length, s_bouncePage, PAGE_SIZE) !=
+       PAGE_SIZE
+       || Write_Pages_To_Paging_File(&s_bouncePage, 1, slot) != 0) {
+        Free_Space_On_Paging_File(slot);
+        return false;
+    }
+
+    e->pte->pageBaseAddr = slot;
+    e->pte->kernelInfo = KINFO_PAGE_ON_DISK;
+    Release_Entry(e);
+    ++s_writebacks;
+    return true;
+}
+
+/*
+ * Set up the pool.  Called by Init_Paging(), since full pools are
+ * written back to the paging file.
+ */
+void Init_Zswap(void) {
+    extern uint_t g_numPages;
+    int i;
+
+    if(zswapPercent <= 0)
+        return;
+
+    s_poolLimit = g_numPages / 100 * zswapPercent * PAGE_SIZE;
+    s_numEntries = s_poolLimit / PAGE_SIZE * ZSWAP_ENTRIES_PER_PAGE;
+    if(s_numEntries == 0)
+        return;
+
+    s_entries = Malloc(s_numEntries * sizeof(struct Zswap_Entry));
+    s_workMem = Malloc(LZ_WORK_SIZE);
+    s_compressBuf = Malloc(ZSWAP_MAX_LENGTH);
+    s_bouncePage = Alloc_Page();
+    if(s_entries == 0 || s_workMem == 0 || s_compressBuf == 0
+       || s_bouncePage == 0) {
+        Print("No memory for compressed swap cache\n");
+        Free(s_entries);
+        Free(s_workMem);
+        Free(s_compressBuf);
+        if(s_bouncePage != 0)
+            Free_Page(s_bouncePage);
+        return;
+    }
+    /* the paging file code only writes locked pages */
+    Lock_Page(Get_Page((ulong_t) s_bouncePage));
+
+    memset(s_entries, '\0', s_numEntries * sizeof(struct Zswap_Entry));
+    for(i = 0; i < s_numEntries; i++)
+        Add_To_Back_Of_Zswap_Entry_List(&s_freeEntryList, &s_entries[i]);
+    Mutex_Init(&s_zswapMutex);
+    s_enabled = true;
+
+    Print("Compressed swap cache: up to %lu KB\n", s_poolLimit / 1024);
+}
+
+/*
+ * Compress a page being evicted into the pool, writing older copies
+ * to the paging file if there is no room.  entry is the page table
+ * entry that will refer to the copy.
+ * Returns the handle of the copy, or -1 if the page does not compress
+ * well enough or cannot be stored.
+ */
+int Zswap_Store(void *paddr, pte_t * entry) {
+    struct Zswap_Entry *e;
+    void *data;
+    int len;
+
+    if(!s_enabled)
+        return -1;
+
+    Mutex_Lock(&s_zswapMutex);
+
+    len = LZ_Compress(paddr, PAGE_SIZE, s_compressBuf, ZSWAP_MAX_LENGTH,
+                      s_workMem);
+    if(len == 0) {
+        ++s_incompressible;
+        Mutex_Unlock(&s_zswapMutex);
+        return -1;
+    }
+
+    while (s_poolBytes + len > s_poolLimit
+           || Is_Zswap_Entry_List_Empty(&s_freeEntryList))
+        if(!Write_Back_Oldest())
+            goto full;
+    data = Malloc(len);
+    if(data == 0)
+        goto full;
+
+    memcpy(data, s_compressBuf, len);
+    e = Remove_From_Front_Of_Zswap_Entry_List(&s_freeEntryList);
+    e->pte = entry;
+    e->data = data;
+    e->length = len;
+    Add_To_Back_Of_Zswap_Entry_List(&s_storedList, e);
+    s_poolBytes += len;
+    ++s_storedPages;
+    ++s_stores;
+
+    Mutex_Unlock(&s_zswapMutex);
+    return e - s_entries;
+
+  full:
+    ++s_poolFull;
+    Mutex_Unlock(&s_zswapMutex);
+    return -1;
+}
+
+/*
+ * Decompress copy handle, which entry referred to when the fault was
+ * taken, into paddr and drop it from the pool.  Returns 0 if
+ * successful, ENOTFOUND if the copy was written back to the paging
+ * file meanwhile (the caller should retry the fault), or EIO if it
+ * is corrupt.
+ */
+int Zswap_Load(pte_t * entry, int handle, void *paddr) {
+    struct Zswap_Entry *e;
+    int rc = 0;
+
+    Mutex_Lock(&s_zswapMutex);
+    if(entry->present || entry->kernelInfo != KINFO_PAGE_COMPRESSED
+       || entry->pageBaseAddr != (uint_t) handle) {
+        Mutex_Unlock(&s_zswapMutex);
+        return ENOTFOUND;
+    }
+
+    KASSERT(handle >= 0 && handle < s_numEntries);
+    e = &s_entries[handle];
+    KASSERT(e->pte == entry);
+    if(LZ_Decompress(e->data, e->length, paddr, PAGE_SIZE) != PAGE_SIZE)
+        rc = EIO;
+    Release_Entry(e);
+    entry->kernelInfo = 0;
+    ++s_hits;
+
+    Mutex_Unlock(&s_zswapMutex);
+    return rc;
+}
+
+/*
+ * Drop a compressed copy that is no longer needed.
+ */
+void Zswap_Free(int handle) {
+    KASSERT(handle >= 0 && handle < s_numEntries);
+    Mutex_Lock(&s_zswapMutex);
+    Release_Entry(&s_entries[handle]);
+    Mutex_Unlock(&s_zswapMutex);
+}
+
+/*
+ * Free the swapped-out copy that a non-present page table entry
+ * refers to, in the pool or (if it was written back meanwhile) in
+ * the paging file.
+ */
+void Zswap_Free_PTE(pte_t * entry) {
+    if(s_enabled)
+        Mutex_Lock(&s_zswapMutex);
+    if(entry->kernelInfo == KINFO_PAGE_COMPRESSED) {
+        KASSERT(entry->pageBaseAddr < (uint_t) s_numEntries);
+        Release_Entry(&s_entries[entry->pageBaseAddr]);
+    } else if(entry->kernelInfo == KINFO_PAGE_ON_DISK) {
+        Free_Space_On_Paging_File(entry->pageBaseAddr);
+    }
+    entry->kernelInfo = 0;
+    if(s_enabled)
+        Mutex_Unlock(&s_zswapMutex);
+}
+
+/*
+ * Count a fault that had to read the paging file, for the hit rate.
+ */
+void Zswap_Note_Disk_Fault(void) {
+    ++s_diskFaults;
+}
+
+void Dump_Zswap_Stats(void) {
+    ulong_t ratio, faults = s_hits + s_diskFaults;
+
+    if(!s_enabled)
+        return;
+    /* uncompressed / compressed, in hundredths */
+    ratio = s_poolBytes >= 16 ? s_storedPages * (PAGE_SIZE / 16) * 100
+        / (s_poolBytes / 16) : 0;
+    Print
+        ("zswap: %d pages in %lu of %lu KB (ratio %lu.%02lu), %lu stored, %lu incompressible, %lu pool full, %lu written back\n",
+         s_storedPages, s_poolBytes / 1024, s_poolLimit / 1024, ratio / 100,
+         ratio % 100, s_stores, s_incompressible, s_poolFull, s_writebacks);
+    Print("zswap: %lu hits, %lu paging file reads (%lu%% hit rate)\n",
+          s_hits, s_diskFaults, faults ? s_hits * 100 / faults : 0);
+}
@@ -1,16 +1,37 @@
 #include <conio.h>
 #include <stddef.h>
 #include <malloc.h>
+#include <bget.h>
 #include <geekos/syscall.h>
 #include <geekos/projects.h>
 
 DEF_SYSCALL(Sbrk, SYS_SBRK, void *, (int arg0),, SYSCALL_REGS_1)
-void *Malloc(unsigned long n __attribute__ ((unused))) {
-    Print("Malloc not implemented in user mode\n");
-    return 0;
-    TODO_P(PROJECT_MALLOC, "Malloc");
+
+/* heap memory is added to the Malloc() pool in at least this much */
+#define MALLOC_POOL_INCR (64 * 1024)
+
+/* bget's bookkeeping for a new pool and the buffer in it */
+#define MALLOC_POOL_OVERHEAD 64
+
+void *Malloc(unsigned long n) {
+    void *p = bget(n);
+
+    if(p == 0) {
+        long incr = MALLOC_POOL_INCR;
+        void *pool;
+
+        while (incr < (long)n + MALLOC_POOL_OVERHEAD)
+            incr += MALLOC_POOL_INCR;
+        pool = Sbrk(incr);
+        if((int)pool < 0)
+            return 0;
+        bpool(pool, incr);
+        p = bget(n);
+    }
+    return p;
 }
 
 void Free(void *p) {
-    TODO_P(PROJECT_MALLOC, "free!");
+    if(p != 0)
+        brel(p);
 }
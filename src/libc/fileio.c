@@ -123,6 +123,13 @@ DEF_SYSCALL(Diagnostic, SYS_DIAGNOSTIC, int, (void),, SYSCALL_REGS_0)
                 unsigned int *arg2 = block_size;
                 unsigned int *arg3 = blocks_on_disk;
                 , SYSCALL_REGS_4)
+    DEF_SYSCALL(Set_IO_Scheduler, SYS_SET_IO_SCHEDULER, int,
+                (const char *devname, const char *scheduler),
+                const char *arg0 = devname;
+                size_t arg1 = strlen(devname);
+                const char *arg2 = scheduler;
+                size_t arg3 = strlen(scheduler);
+                , SYSCALL_REGS_4)
 
 DEF_SYSCALL(SetAcl, SYS_SET_ACL, int,
                 (const char *file, int uid, int permissions),
@@ -153,6 +160,9 @@ DEF_SYSCALL(Mmap, SYS_MMAP, int,
 DEF_SYSCALL(Munmap, SYS_MUNMAP, int, (const void *addr),
             const void *arg0 = addr;
             , SYSCALL_REGS_1)
+DEF_SYSCALL(Msync, SYS_MSYNC, int, (const void *addr),
+            const void *arg0 = addr;
+            , SYSCALL_REGS_1)
 
 static bool Copy_String(char *dst, const char *src, size_t len) {
     if(strnlen(src, len) == len)
@@ -0,0 +1,24 @@
+/*
+ * Named shared memory segments.
+ */
+
+#include <geekos/syscall.h>
+#include <string.h>
+#include <shm.h>
+
+DEF_SYSCALL(Shm_Create, SYS_SHM_CREATE, int,
+            (const char *name, unsigned int size), const char *arg0 = name;
+            size_t arg1 = strlen(name);
+            unsigned int arg2 = size;
+            , SYSCALL_REGS_3)
+DEF_SYSCALL(Shm_Attach, SYS_SHM_ATTACH, void *, (const char *name),
+            const char *arg0 = name;
+            size_t arg1 = strlen(name);
+            , SYSCALL_REGS_2)
+DEF_SYSCALL(Shm_Detach, SYS_SHM_DETACH, int, (void *addr),
+            void *arg0 = addr;
+            , SYSCALL_REGS_1)
+DEF_SYSCALL(Shm_Remove, SYS_SHM_REMOVE, int, (const char *name),
+            const char *arg0 = name;
+            size_t arg1 = strlen(name);
+            , SYSCALL_REGS_2)
@@ -163,6 +163,22 @@ int Block_Read(struct Block_Device *dev __attribute__ ((unused)),
 
 }
 
+int Block_Write_Range(struct Block_Device *dev __attribute__ ((unused)),
+                      int block_index, int num_blocks, void *block_data) {
+    assert(block_data);
+    lseek(device_fd, block_index * SECTOR_SIZE, SEEK_SET);
+    assert(write(device_fd, block_data, num_blocks * SECTOR_SIZE) > 0);
+    return 0;
+}
+
+int Block_Read_Range(struct Block_Device *dev __attribute__ ((unused)),
+                     int block_index, int num_blocks, void *block_data) {
+    assert(block_data);
+    lseek(device_fd, block_index * SECTOR_SIZE, SEEK_SET);
+    assert(read(device_fd, block_data, num_blocks * SECTOR_SIZE) > 0);
+    return 0;
+}
+
 void assertion_failed_endless_loop(void) {
     abort();
 }
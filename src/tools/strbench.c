@@ -0,0 +1,256 @@
+/*
+ * Host microbenchmark for the block memory operations.
+ *
+ * Compares the rep-string memcpy/memmove/memset/memcmp of
+ * <geekos/repstring.h> with the word and byte loops they replaced,
+ * over a range of sizes and alignments, after checking that both
+ * give the same results.
+ *
+ * Build without auto-vectorization or loop-to-libcall conversion, as
+ * the kernel is built, or the old loops are measured as SSE code or
+ * as calls to the host C library:
+ *   gcc -O2 -fno-tree-vectorize -fno-tree-loop-distribute-patterns \
+ *       -I../include strbench.c -o strbench
+ *
+ * Usage: strbench [iterations-scale]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <geekos/repstring.h>
+
+#define BUF_SIZE (256 * 1024)
+
+/* ----------------------------------------------------------------------
+ * The previous implementations
+ * ---------------------------------------------------------------------- */
+
+static void *Old_Memset(void *s, int c, size_t n) {
+    if((((unsigned long)s) & 0x3) == 0 && ((unsigned long)n & 0x3) == 0) {
+        unsigned int *pi;
+        n /= 4;
+        c |= c << 8;
+        c |= c << 16;
+        for(pi = s; n > 0; n--, pi++)
+            *pi = c;
+    } else {
+        unsigned char *p = (unsigned char *)s;
+        while (n > 0) {
+            *p++ = (unsigned char)c;
+            --n;
+        }
+    }
+    return s;
+}
+
+static void *Old_Memcpy(void *dst, const void *src, size_t n) {
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+
+    if((((unsigned long)d | (unsigned long)s | n) & 0x3) == 0) {
+        unsigned int *di = (unsigned int *)dst;
+        const unsigned int *si = (const unsigned int *)src;
+        n /= 4;
+        while (n > 0) {
+            *di++ = *si++;
+            --n;
+        }
+    } else {
+        while (n > 0) {
+            *d++ = *s++;
+            --n;
+        }
+    }
+    return dst;
+}
+
+static void *Old_Memmove(void *dest1, const void *source1, size_t length) {
+    char *dest = dest1;
+    const char *source = source1;
+    if(source < dest)
+        for(source += length, dest += length; length; --length)
+            *--dest = *--source;
+    else if(source != dest) {
+        for(; length; --length)
+            *dest++ = *source++;
+    }
+    return dest1;
+}
+
+static int Old_Memcmp(const void *s1_, const void *s2_, size_t n) {
+    const signed char *s1 = s1_, *s2 = s2_;
+
+    while (n > 0) {
+        int cmp = *s1 - *s2;
+        if(cmp != 0)
+            return cmp;
+        ++s1;
+        ++s2;
+        --n;
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Harness
+ * ---------------------------------------------------------------------- */
+
+static unsigned char *s_src, *s_dst, *s_ref;
+static volatile int s_sink;
+
+static double Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Fill_Pattern(unsigned char *buf, size_t n, unsigned seed) {
+    size_t i;
+    for(i = 0; i < n; i++)
+        buf[i] = (unsigned char)(i * 131 + seed);
+}
+
+static int Sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+/*
+ * Check the new operations against the old ones for every size up
+ * to 300 bytes and every alignment of source and destination.
+ */
+static int Check(void) {
+    size_t n, sa, da;
+    int errors = 0;
+
+    for(n = 0; n <= 300; n++)
+        for(sa = 0; sa < 4; sa++)
+            for(da = 0; da < 4; da++) {
+                Fill_Pattern(s_src, 512, 7);
+                Fill_Pattern(s_dst, 512, 9);
+                memcpy(s_ref, s_dst, 512);
+                Old_Memcpy(s_ref + da, s_src + sa, n);
+                Copy_Forward(s_dst + da, s_src + sa, n);
+                errors += memcmp(s_dst, s_ref, 512) != 0;
+
+                Fill_Pattern(s_dst, 512, 9);
+                memcpy(s_ref, s_dst, 512);
+                Old_Memset(s_ref + da, 0xa5, n);
+                Fill_Bytes(s_dst + da, 0xa5, n);
+                errors += memcmp(s_dst, s_ref, 512) != 0;
+
+                /* overlapping moves in both directions */
+                Fill_Pattern(s_dst, 512, 3);
+                memcpy(s_ref, s_dst, 512);
+                Old_Memmove(s_ref + 8 + da, s_ref + 12 + sa, n);
+                Copy_Forward(s_dst + 8 + da, s_dst + 12 + sa, n);
+                errors += memcmp(s_dst, s_ref, 512) != 0;
+                Fill_Pattern(s_dst, 512, 3);
+                memcpy(s_ref, s_dst, 512);
+                Old_Memmove(s_ref + 12 + da, s_ref + 8 + sa, n);
+                Copy_Backward(s_dst + 12 + da, s_dst + 8 + sa, n);
+                errors += memcmp(s_dst, s_ref, 512) != 0;
+
+                Fill_Pattern(s_dst, 512, 7);
+                if(n > 0)
+                    s_dst[da + n - 1] ^= 0x80;
+                errors += Sign(Compare_Bytes(s_dst + da, s_src + sa, n))
+                    != Sign(memcmp(s_dst + da, s_src + sa, n));
+            }
+    return errors;
+}
+
+typedef void (*Bench_Func) (size_t n, size_t align);
+
+static void Bench_Old_Memcpy(size_t n, size_t align) {
+    Old_Memcpy(s_dst + align, s_src, n);
+}
+static void Bench_New_Memcpy(size_t n, size_t align) {
+    Copy_Forward(s_dst + align, s_src, n);
+}
+static void Bench_Old_Memmove(size_t n, size_t align) {
+    Old_Memmove(s_src + 64 + align, s_src, n);
+}
+static void Bench_New_Memmove(size_t n, size_t align) {
+    Copy_Backward(s_src + 64 + align, s_src, n);
+}
+static void Bench_Old_Memset(size_t n, size_t align) {
+    Old_Memset(s_dst + align, 0, n);
+}
+static void Bench_New_Memset(size_t n, size_t align) {
+    Fill_Bytes(s_dst + align, 0, n);
+}
+static void Bench_Old_Memcmp(size_t n, size_t align) {
+    s_sink += Old_Memcmp(s_dst + align, s_ref + align, n);
+}
+static void Bench_New_Memcmp(size_t n, size_t align) {
+    s_sink += Compare_Bytes(s_dst + align, s_ref + align, n);
+}
+
+/* seconds per call */
+static double Time_Func(Bench_Func func, size_t n, size_t align, long iters) {
+    double start;
+    long i;
+
+    func(n, align);
+    start = Now();
+    for(i = 0; i < iters; i++) {
+        func(n, align);
+        /* keep the compiler from hoisting or merging calls */
+        __asm__ __volatile__("":::"memory");
+    }
+    return (Now() - start) / iters;
+}
+
+int main(int argc, char **argv) {
+    static const size_t sizes[] = { 8, 64, 256, 4096, 65536 };
+    static const struct {
+        const char *name;
+        Bench_Func oldFunc, newFunc;
+    } ops[] = {
+        {"memcpy", Bench_Old_Memcpy, Bench_New_Memcpy},
+        {"memmove", Bench_Old_Memmove, Bench_New_Memmove},
+        {"memset", Bench_Old_Memset, Bench_New_Memset},
+        {"memcmp", Bench_Old_Memcmp, Bench_New_Memcmp},
+    };
+    double scale = argc > 1 ? atof(argv[1]) : 1.0;
+    unsigned o, s, align;
+    int errors;
+
+    s_src = malloc(BUF_SIZE);
+    s_dst = malloc(BUF_SIZE);
+    s_ref = malloc(BUF_SIZE);
+    if(s_src == 0 || s_dst == 0 || s_ref == 0)
+        return 1;
+
+    errors = Check();
+    printf("correctness: %s (%d mismatches); enhanced rep movsb: %s\n",
+           errors ? "FAILED" : "ok", errors,
+           Has_Fast_Rep_Movsb()? "yes" : "no");
+
+    printf("%-8s %6s %5s %12s %12s %8s\n", "op", "bytes", "align",
+           "old MB/s", "new MB/s", "speedup");
+    for(o = 0; o < sizeof(ops) / sizeof(ops[0]); o++)
+        for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            /* equal buffers, so memcmp runs to the end */
+            Fill_Pattern(s_src, BUF_SIZE, 1);
+            Fill_Pattern(s_dst, BUF_SIZE, 1);
+            Fill_Pattern(s_ref, BUF_SIZE, 1);
+            for(align = 0; align < 2; align++) {
+                size_t n = sizes[s];
+                long iters = (long)(scale * 2e8 / (n + 32));
+                double tOld, tNew;
+
+                if(iters < 1)
+                    iters = 1;
+                tOld = Time_Func(ops[o].oldFunc, n, align, iters);
+                tNew = Time_Func(ops[o].newFunc, n, align, iters);
+                printf("%-8s %6lu %5u %12.0f %12.0f %7.2fx\n", ops[o].name,
+                       (unsigned long)n, align, n / tOld / 1e6,
+                       n / tNew / 1e6, tOld / tNew);
+            }
+        }
+    return errors != 0;
+}
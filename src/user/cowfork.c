@@ -0,0 +1,90 @@
+/*
+ * cowfork - Check that Fork() gives the child a private copy of
+ * memory
+ *
+ * Usage: cowfork
+ * Fills a global array and a Malloc() buffer, forks, and has the
+ * child check the contents and then overwrite them.  The parent
+ * waits for the child and checks that its own copy is unchanged.
+ * Under the paging model the pages are shared copy-on-write until
+ * the child's writes, so this also checks that a write fault gives
+ * the writer, and only the writer, a new page.
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <string.h>
+#include <malloc.h>
+
+#define PAGE_SIZE 4096
+#define NUM_PAGES 8
+#define WORDS (NUM_PAGES * PAGE_SIZE / sizeof(int))
+
+static int s_data[WORDS];
+
+static int Expected(int word, int gen) {
+    return (gen << 24) | word;
+}
+
+static void Fill(int *buf, int gen) {
+    int word;
+
+    for(word = 0; word < (int)WORDS; word++)
+        buf[word] = Expected(word, gen);
+}
+
+/* Returns the number of words that differ from generation gen */
+static int Check(const char *who, const char *what, const int *buf,
+                 int gen) {
+    int word, bad = 0;
+
+    for(word = 0; word < (int)WORDS; word++)
+        if(buf[word] != Expected(word, gen) && bad++ == 0)
+            Print("cowfork: %s %s word %d is %x, expected %x\n", who, what,
+                  word, buf[word], Expected(word, gen));
+    return bad;
+}
+
+int main(void) {
+    int *heap, pid, rc, bad;
+
+    heap = Malloc(WORDS * sizeof(int));
+    if(heap == 0) {
+        Print("cowfork: could not allocate %d pages\n", NUM_PAGES);
+        return 1;
+    }
+    Fill(s_data, 1);
+    Fill(heap, 1);
+
+    pid = Fork();
+    if(pid < 0) {
+        Print("cowfork: Fork failed (%d)\n", pid);
+        return 1;
+    }
+    if(pid == 0) {
+        bad = Check("child", "data", s_data, 1) + Check("child", "heap", heap,
+                                                         1);
+        Fill(s_data, 2);
+        Fill(heap, 2);
+        bad += Check("child", "data", s_data, 2) + Check("child", "heap",
+                                                         heap, 2);
+        Exit(bad == 0 ? 0 : 1);
+    }
+
+    rc = Wait(pid);
+    bad = Check("parent", "data", s_data, 1) + Check("parent", "heap", heap,
+                                                     1);
+    /* the parent's own writes must work after the child is gone */
+    Fill(s_data, 3);
+    Fill(heap, 3);
+    bad += Check("parent", "data", s_data, 3) + Check("parent", "heap", heap,
+                                                      3);
+
+    if(rc != 0 || bad != 0) {
+        Print("cowfork: FAILED (child exit %d, %d bad words in parent)\n",
+              rc, bad);
+        return 1;
+    }
+    Print("cowfork: ok\n");
+    return 0;
+}
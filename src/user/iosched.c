@@ -0,0 +1,26 @@
+/*
+ * iosched - Choose the I/O scheduler of a block device
+ *
+ * Usage: iosched <device> <clook|deadline|fifo>
+ * The device's queue statistics are shown by Diagnostic().
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <fileio.h>
+
+int main(int argc, char **argv) {
+    int rc;
+
+    if(argc != 3) {
+        Print("usage: iosched <device> <clook|deadline|fifo>\n");
+        return 1;
+    }
+
+    rc = Set_IO_Scheduler(argv[1], argv[2]);
+    if(rc != 0)
+        Print("Could not set scheduler of %s to %s: %s\n", argv[1],
+              argv[2], Get_Error_String(rc));
+
+    return !(rc == 0);
+}
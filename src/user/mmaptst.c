@@ -0,0 +1,155 @@
+/*
+ * mmaptst - Check that file mappings see and update the file
+ *
+ * Usage: mmaptst [file]
+ * Maps the file (/c/mapfile.bin by default, whose length must be a
+ * multiple of 512 bytes, at most MAX_LENGTH) MAP_SHARED and checks
+ * it against Read(), writes a pattern through the mapping, and
+ * checks that Msync() and Munmap() put it in the file.  Then maps
+ * it MAP_PRIVATE and checks that writes there do not reach the
+ * file.  The file's contents are restored at the end.
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <fileio.h>
+#include <string.h>
+#include <mmap.h>
+#include <geekos/errno.h>
+
+#define MAX_LENGTH (64 * 1024)
+
+static unsigned char s_saved[MAX_LENGTH];
+static unsigned char s_buf[MAX_LENGTH];
+
+static unsigned char Pattern(int i, int gen) {
+    return (unsigned char)(i * 7 + gen);
+}
+
+/* Read the whole file into s_buf */
+static int Read_File(int fd, int length) {
+    int rc = Seek(fd, 0);
+
+    if(rc == 0)
+        rc = Read(fd, s_buf, length);
+    return rc == length ? 0 : (rc < 0 ? rc : EIO);
+}
+
+/* Returns the index of the first mismatch, or -1 */
+static int Compare(const unsigned char *a, const unsigned char *b,
+                   int length) {
+    int i;
+
+    for(i = 0; i < length; i++)
+        if(a[i] != b[i])
+            return i;
+    return -1;
+}
+
+static int Fail(const char *what, int rc) {
+    Print("mmaptst: %s failed (%d)\n", what, rc);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "/c/mapfile.bin";
+    struct VFS_File_Stat stat;
+    unsigned char *map;
+    int fd, length, rc, i, bad = 0;
+
+    fd = Open(path, O_READ | O_WRITE);
+    if(fd < 0)
+        return Fail("Open", fd);
+    rc = FStat(fd, &stat);
+    if(rc < 0)
+        return Fail("FStat", rc);
+    length = stat.size;
+    if(length <= 0 || length > MAX_LENGTH || length % 512 != 0) {
+        Print("mmaptst: %s is %d bytes; want a multiple of 512 up to %d\n",
+              path, length, MAX_LENGTH);
+        return 1;
+    }
+    rc = Read_File(fd, length);
+    if(rc < 0)
+        return Fail("Read", rc);
+    memcpy(s_saved, s_buf, length);
+
+    map = Mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd);
+    if((int)map == EUNSUPPORTED) {
+        Print("mmaptst: Mmap is not supported by this memory model\n");
+        return 0;
+    }
+    if((int)map < 0)
+        return Fail("Mmap(MAP_SHARED)", (int)map);
+
+    /* the mapping shows the file */
+    if((i = Compare(map, s_saved, length)) >= 0) {
+        Print("mmaptst: mapping differs from file at byte %d\n", i);
+        bad++;
+    }
+
+    /* writes through the mapping reach the file */
+    for(i = 0; i < length; i++)
+        map[i] = Pattern(i, 1);
+    rc = Msync(map);
+    if(rc < 0)
+        return Fail("Msync", rc);
+    rc = Read_File(fd, length);
+    if(rc < 0)
+        return Fail("Read after Msync", rc);
+    for(i = 0; i < length && s_buf[i] == Pattern(i, 1); i++) ;
+    if(i < length) {
+        Print("mmaptst: file after Msync differs at byte %d\n", i);
+        bad++;
+    }
+
+    /* and Munmap writes back what Msync has not */
+    for(i = 0; i < length; i += 512)
+        map[i] = Pattern(i, 2);
+    rc = Munmap(map);
+    if(rc < 0)
+        return Fail("Munmap", rc);
+    rc = Read_File(fd, length);
+    if(rc < 0)
+        return Fail("Read after Munmap", rc);
+    for(i = 0; i < length
+        && s_buf[i] == Pattern(i, i % 512 == 0 ? 2 : 1); i++) ;
+    if(i < length) {
+        Print("mmaptst: file after Munmap differs at byte %d\n", i);
+        bad++;
+    }
+
+    /* a private mapping's writes stay private */
+    map = Mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd);
+    if((int)map < 0)
+        return Fail("Mmap(MAP_PRIVATE)", (int)map);
+    for(i = 0; i < length; i++)
+        map[i] = Pattern(i, 3);
+    rc = Munmap(map);
+    if(rc < 0)
+        return Fail("Munmap(MAP_PRIVATE)", rc);
+    rc = Read_File(fd, length);
+    if(rc < 0)
+        return Fail("Read after private Munmap", rc);
+    for(i = 0; i < length
+        && s_buf[i] == Pattern(i, i % 512 == 0 ? 2 : 1); i++) ;
+    if(i < length) {
+        Print("mmaptst: private write reached the file at byte %d\n", i);
+        bad++;
+    }
+
+    /* put the file back as it was */
+    rc = Seek(fd, 0);
+    if(rc == 0)
+        rc = Write(fd, s_saved, length);
+    if(rc != length)
+        Print("mmaptst: could not restore %s (%d)\n", path, rc);
+    Close(fd);
+
+    if(bad > 0) {
+        Print("mmaptst: FAILED (%d checks)\n", bad);
+        return 1;
+    }
+    Print("mmaptst: ok\n");
+    return 0;
+}
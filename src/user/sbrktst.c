@@ -0,0 +1,90 @@
+/*
+ * sbrktst - Check that the Sbrk() heap grows and shrinks
+ *
+ * Usage: sbrktst
+ * Grows the heap, writes and reads back the new memory, shrinks it
+ * and grows it again, checking that the break moves as asked and
+ * that memory given back comes back zeroed.  Also checks that the
+ * break cannot move below the start of the heap, and that Malloc()
+ * can grow its pool by more than one step at once.
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <string.h>
+#include <malloc.h>
+
+#define PAGE_SIZE 4096
+#define GROW (4 * PAGE_SIZE)
+#define BIG_MALLOC (100 * 1024)
+
+static int Fail(const char *what, int rc) {
+    Print("sbrktst: %s failed (%d)\n", what, rc);
+    return 1;
+}
+
+int main(void) {
+    char *start, *old, *big;
+    int i, bad = 0;
+
+    start = Sbrk(0);
+    if((int)start < 0)
+        return Fail("Sbrk(0)", (int)start);
+
+    old = Sbrk(GROW);
+    if((int)old < 0)
+        return Fail("Sbrk(grow)", (int)old);
+    if(old != start || Sbrk(0) != start + GROW) {
+        Print("sbrktst: break moved from %x to %x, expected %x\n",
+              (int)start, (int)Sbrk(0), (int)(start + GROW));
+        bad++;
+    }
+    for(i = 0; i < GROW; i++)
+        start[i] = (char)i;
+    for(i = 0; i < GROW && start[i] == (char)i; i++) ;
+    if(i < GROW) {
+        Print("sbrktst: heap byte %d did not read back\n", i);
+        bad++;
+    }
+
+    /* give it back, then take it again: it must come back zeroed */
+    if((int)Sbrk(-GROW) < 0 || Sbrk(0) != start)
+        return Fail("Sbrk(shrink)", (int)Sbrk(0));
+    if((int)Sbrk(GROW) < 0)
+        return Fail("Sbrk(regrow)", (int)Sbrk(0));
+    for(i = 0; i < GROW && start[i] == 0; i++) ;
+    if(i < GROW) {
+        Print("sbrktst: regrown heap byte %d is not zero\n", i);
+        bad++;
+    }
+
+    /* the break cannot go below where the heap starts */
+    if((int)Sbrk(-(GROW + PAGE_SIZE)) >= 0) {
+        Print("sbrktst: break moved below the start of the heap\n");
+        bad++;
+    }
+    if((int)Sbrk(-GROW) < 0 || Sbrk(0) != start)
+        return Fail("Sbrk(shrink)", (int)Sbrk(0));
+
+    /* more than one MALLOC_POOL_INCR in a single Malloc() */
+    big = Malloc(BIG_MALLOC);
+    if(big == 0) {
+        Print("sbrktst: Malloc(%d) failed\n", BIG_MALLOC);
+        bad++;
+    } else {
+        memset(big, 0x5a, BIG_MALLOC);
+        for(i = 0; i < BIG_MALLOC && big[i] == 0x5a; i++) ;
+        if(i < BIG_MALLOC) {
+            Print("sbrktst: Malloc'ed byte %d did not read back\n", i);
+            bad++;
+        }
+        Free(big);
+    }
+
+    if(bad > 0) {
+        Print("sbrktst: FAILED (%d checks)\n", bad);
+        return 1;
+    }
+    Print("sbrktst: ok\n");
+    return 0;
+}
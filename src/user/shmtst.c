@@ -0,0 +1,123 @@
+/*
+ * shmtst - Check that named shared memory is shared
+ *
+ * Usage: shmtst
+ * Creates a segment, attaches it and fills it, then forks.  The
+ * child checks the contents through the mapping it inherited and
+ * through a second attachment of its own, and writes a new pattern;
+ * the parent checks that it sees the child's writes.  Also checks
+ * that a name cannot be created twice and is gone once removed.
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <string.h>
+#include <shm.h>
+#include <geekos/errno.h>
+
+#define SEGMENT_NAME "shmtst"
+#define SEGMENT_SIZE (3 * 4096 + 100)
+
+static unsigned char Pattern(int i, int gen) {
+    return (unsigned char)(i * 13 + gen);
+}
+
+static void Fill(unsigned char *seg, int gen) {
+    int i;
+
+    for(i = 0; i < SEGMENT_SIZE; i++)
+        seg[i] = Pattern(i, gen);
+}
+
+/* Returns 0 if seg holds generation gen */
+static int Check(const char *who, const unsigned char *seg, int gen) {
+    int i;
+
+    for(i = 0; i < SEGMENT_SIZE; i++)
+        if(seg[i] != Pattern(i, gen)) {
+            Print("shmtst: %s byte %d is %d, expected %d\n", who, i, seg[i],
+                  Pattern(i, gen));
+            return 1;
+        }
+    return 0;
+}
+
+static int Fail(const char *what, int rc) {
+    Print("shmtst: %s failed (%d)\n", what, rc);
+    Shm_Remove(SEGMENT_NAME);
+    return 1;
+}
+
+int main(void) {
+    unsigned char *seg, *again;
+    int pid, rc, bad = 0;
+
+    rc = Shm_Create(SEGMENT_NAME, SEGMENT_SIZE);
+    if(rc == EEXIST) {
+        /* left behind by an earlier run */
+        Shm_Remove(SEGMENT_NAME);
+        rc = Shm_Create(SEGMENT_NAME, SEGMENT_SIZE);
+    }
+    if(rc < 0)
+        return Fail("Shm_Create", rc);
+    rc = Shm_Create(SEGMENT_NAME, SEGMENT_SIZE);
+    if(rc != EEXIST) {
+        Print("shmtst: second Shm_Create returned %d, expected %d\n", rc,
+              EEXIST);
+        bad++;
+    }
+
+    seg = Shm_Attach(SEGMENT_NAME);
+    if((int)seg == EUNSUPPORTED) {
+        Print("shmtst: Shm_Attach is not supported by this memory model\n");
+        Shm_Remove(SEGMENT_NAME);
+        return 0;
+    }
+    if((int)seg < 0)
+        return Fail("Shm_Attach", (int)seg);
+    Fill(seg, 1);
+
+    pid = Fork();
+    if(pid < 0)
+        return Fail("Fork", pid);
+    if(pid == 0) {
+        rc = Check("child", seg, 1);
+        again = Shm_Attach(SEGMENT_NAME);
+        if((int)again < 0) {
+            Print("shmtst: child Shm_Attach failed (%d)\n", (int)again);
+            Exit(1);
+        }
+        rc += Check("child's second attachment", again, 1);
+        Fill(seg, 2);
+        rc += Check("child's second attachment", again, 2);
+        Shm_Detach(again);
+        Exit(rc);
+    }
+
+    rc = Wait(pid);
+    if(rc != 0) {
+        Print("shmtst: child exited with %d\n", rc);
+        bad++;
+    }
+    bad += Check("parent", seg, 2);
+
+    rc = Shm_Detach(seg);
+    if(rc < 0)
+        return Fail("Shm_Detach", rc);
+    rc = Shm_Remove(SEGMENT_NAME);
+    if(rc < 0)
+        return Fail("Shm_Remove", rc);
+    again = Shm_Attach(SEGMENT_NAME);
+    if((int)again != ENOTFOUND) {
+        Print("shmtst: Shm_Attach after Shm_Remove returned %d\n",
+              (int)again);
+        bad++;
+    }
+
+    if(bad > 0) {
+        Print("shmtst: FAILED (%d checks)\n", bad);
+        return 1;
+    }
+    Print("shmtst: ok\n");
+    return 0;
+}
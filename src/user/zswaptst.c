@@ -0,0 +1,89 @@
+/*
+ * zswaptst - Check that pages evicted to the compressed swap cache
+ * come back intact
+ *
+ * Usage: zswaptst [kilobytes]
+ * Fills a buffer larger than physical memory (32 MB by default)
+ * with a compressible pattern, so the page-out daemon moves most of
+ * it into the compressed swap cache, then faults every page back and
+ * checks it.  The cache's statistics are shown by Diagnostic().
+ *
+ * Under the segmentation model the heap is a small fixed reserve
+ * and nothing is paged; without an explicit size the test then
+ * shrinks the buffer to what the heap can hold and only checks the
+ * pattern.
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <fileio.h>
+#include <string.h>
+#include <malloc.h>
+
+#define PAGE_SIZE 4096
+#define MIN_KBYTES 16
+#define WORDS_PER_PAGE (PAGE_SIZE / sizeof(int))
+
+/* mostly repeated words, so each page compresses well */
+static int Expected(int page, int word) {
+    return (word % 64) == 0 ? page : 0x5a5a0000 | (word % 64);
+}
+
+int main(int argc, char **argv) {
+    int kbytes = 32 * 1024, numPages, page, word, bad = 0;
+    int *buf;
+
+    if(argc > 2) {
+        Print("usage: zswaptst [kilobytes]\n");
+        return 1;
+    }
+    if(argc == 2) {
+        kbytes = atoi(argv[1]);
+        if(kbytes < PAGE_SIZE / 1024) {
+            Print("zswaptst: bad size %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    buf = Malloc((unsigned long)kbytes * 1024);
+    if(buf == 0 && argc == 1) {
+        /* no paging: fit the heap, and only check the pattern */
+        while (buf == 0 && kbytes > MIN_KBYTES) {
+            kbytes /= 2;
+            buf = Malloc((unsigned long)kbytes * 1024);
+        }
+        if(buf != 0)
+            Print("zswaptst: heap is limited, using %d KB; nothing will be paged\n",
+                  kbytes);
+    }
+    if(buf == 0) {
+        Print("zswaptst: could not allocate %d KB\n", kbytes);
+        return 1;
+    }
+    numPages = kbytes / (PAGE_SIZE / 1024);
+
+    for(page = 0; page < numPages; page++)
+        for(word = 0; word < (int)WORDS_PER_PAGE; word++)
+            buf[page * WORDS_PER_PAGE + word] = Expected(page, word);
+
+    /* the early pages have been evicted by now; fault them all back */
+    for(page = 0; page < numPages; page++) {
+        for(word = 0; word < (int)WORDS_PER_PAGE; word++)
+            if(buf[page * WORDS_PER_PAGE + word] != Expected(page, word))
+                break;
+        if(word < (int)WORDS_PER_PAGE) {
+            if(bad++ < 10)
+                Print("zswaptst: page %d word %d is %x, expected %x\n",
+                      page, word, buf[page * WORDS_PER_PAGE + word],
+                      Expected(page, word));
+        }
+    }
+
+    Diagnostic();
+    if(bad > 0) {
+        Print("zswaptst: %d of %d pages corrupt\n", bad, numPages);
+        return 1;
+    }
+    Print("zswaptst: %d pages ok\n", numPages);
+    return 0;
+}